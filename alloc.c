@@ -0,0 +1,149 @@
+#include <string.h>
+#include "alloc.h"
+
+_Thread_local AllocationCounters G_ALLOCATION_COUNTERS;
+
+struct RegionChunk
+{
+    RegionChunk *next;
+    size_t size;
+    size_t used;
+    //Payload follows the header, kept 16 byte aligned by the rounding in regionAllocate
+    _Alignas(16) unsigned char data[];
+};
+
+static size_t regionRound(size_t size)
+{
+    return (size + 15) & ~(size_t)15;
+}
+
+static void *regionAllocate(Allocator *allocator, size_t size)
+{
+    Region *region = (Region*)allocator;
+    size = regionRound(size);
+    //Chunks after current are empty ones kept by a reset, or partly used ones adopted from another region
+    RegionChunk *chunk = region->current;
+    while(chunk && chunk->used + size > chunk->size)
+        chunk = chunk->next;
+    if(!chunk)
+    {
+        size_t chunkSize = region->nextChunkSize;
+        if(region->nextChunkSize < REGION_LARGEST_CHUNK_SIZE)
+            region->nextChunkSize *= 2;
+        if(size > chunkSize) chunkSize = size;
+        chunk = countedMalloc(sizeof(RegionChunk) + chunkSize);
+        chunk->size = chunkSize;
+        chunk->used = 0;
+        if(region->current)
+        {
+            chunk->next = region->current->next;
+            region->current->next = chunk;
+        }
+        else
+        {
+            chunk->next = region->first;
+            region->first = chunk;
+        }
+        region->usage.newChunks++;
+        region->usage.chunkBytes += chunkSize;
+    }
+    region->current = chunk;
+    void *result = chunk->data + chunk->used;
+    chunk->used += size;
+    region->usage.allocations++;
+    region->usage.bytes += size;
+    return result;
+}
+
+static void *regionReallocate(Allocator *allocator, void *memory, size_t oldSize, size_t size)
+{
+    Region *region = (Region*)allocator;
+    RegionChunk *chunk = region->current;
+    //The newest block can grow or shrink where it is, which is the common case of a vector being filled
+    if(memory && chunk && (unsigned char*)memory + regionRound(oldSize) == chunk->data + chunk->used)
+    {
+        size_t start = (size_t)((unsigned char*)memory - chunk->data);
+        if(start + regionRound(size) <= chunk->size)
+        {
+            chunk->used = start + regionRound(size);
+            if(size > oldSize)
+                region->usage.bytes += regionRound(size) - regionRound(oldSize);
+            return memory;
+        }
+    }
+    void *result = regionAllocate(allocator, size);
+    if(memory)
+        memcpy(result, memory, oldSize < size ? oldSize : size);
+    return result;
+}
+
+void regionInit(Region *region, const char *name)
+{
+    memset(region, 0, sizeof(Region));
+    region->allocator.allocate = regionAllocate;
+    region->allocator.reallocate = regionReallocate;
+    region->name = name;
+    region->nextChunkSize = REGION_FIRST_CHUNK_SIZE;
+}
+
+void regionReset(Region *region)
+{
+    size_t retained = 0;
+    RegionChunk **link = &region->first;
+    while(*link)
+    {
+        RegionChunk *chunk = *link;
+        if(retained + chunk->size <= REGION_RETAINED_BYTES)
+        {
+            retained += chunk->size;
+            chunk->used = 0;
+            link = &chunk->next;
+        }
+        else
+        {
+            *link = chunk->next;
+            free(chunk);
+        }
+    }
+    region->current = region->first;
+    memset(&region->usage, 0, sizeof(RegionUsage));
+    region->usage.chunkBytes = retained;
+}
+
+void regionDestroy(Region *region)
+{
+    RegionChunk *chunk = region->first;
+    while(chunk)
+    {
+        RegionChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    regionInit(region, region->name);
+}
+
+void regionAdopt(Region *region, Region *from)
+{
+    if(!from->first) return;
+    RegionChunk *last = from->first;
+    while(last->next)
+        last = last->next;
+    //After current, so the free space left in the adopted chunks still gets used
+    if(region->current)
+    {
+        last->next = region->current->next;
+        region->current->next = from->first;
+    }
+    else
+    {
+        last->next = region->first;
+        region->first = from->first;
+    }
+    region->usage.allocations += from->usage.allocations;
+    region->usage.bytes += from->usage.bytes;
+    region->usage.newChunks += from->usage.newChunks;
+    region->usage.chunkBytes += from->usage.chunkBytes;
+    from->first = NULL;
+    from->current = NULL;
+    memset(&from->usage, 0, sizeof(RegionUsage));
+}
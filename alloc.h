@@ -0,0 +1,126 @@
+#ifndef CCOMPILER_ALLOC_H
+#define CCOMPILER_ALLOC_H
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+//Heap allocations made by the current thread, for -ftime-report. Compiler sources allocate through the counted
+//functions below so they are included, free is the same as ever.
+typedef struct
+{
+    unsigned long long count;
+    unsigned long long bytes;
+} AllocationCounters;
+
+extern _Thread_local AllocationCounters G_ALLOCATION_COUNTERS;
+
+static inline void *countedMalloc(size_t size)
+{
+    G_ALLOCATION_COUNTERS.count++;
+    G_ALLOCATION_COUNTERS.bytes += size;
+    return malloc(size);
+}
+
+static inline void *countedCalloc(size_t count, size_t size)
+{
+    G_ALLOCATION_COUNTERS.count++;
+    G_ALLOCATION_COUNTERS.bytes += count * size;
+    return calloc(count, size);
+}
+
+//A realloc counts as a new allocation of the new size
+static inline void *countedRealloc(void *memory, size_t size)
+{
+    G_ALLOCATION_COUNTERS.count++;
+    G_ALLOCATION_COUNTERS.bytes += size;
+    return realloc(memory, size);
+}
+
+/*
+Where containers and compilation phases get their memory from. Code that takes an Allocator treats NULL as the heap,
+so zero initialized containers keep working. A Region is the other implementation: it carves allocations out of
+large chunks and gives all of them back at once.
+*/
+typedef struct Allocator Allocator;
+struct Allocator
+{
+    void *(*allocate)(Allocator *allocator, size_t size);
+    //memory is NULL or a block of oldSize bytes from this allocator
+    void *(*reallocate)(Allocator *allocator, void *memory, size_t oldSize, size_t size);
+    //NULL when single blocks cannot be given back, their memory then lives until the allocator is reset
+    void (*release)(Allocator *allocator, void *memory);
+};
+
+static inline void *allocatorAllocate(Allocator *allocator, size_t size)
+{
+    return allocator ? allocator->allocate(allocator, size) : countedMalloc(size);
+}
+
+static inline void *allocatorAllocateZeroed(Allocator *allocator, size_t size)
+{
+    if(!allocator) return countedCalloc(1, size);
+    void *memory = allocator->allocate(allocator, size);
+    memset(memory, 0, size);
+    return memory;
+}
+
+static inline void *allocatorReallocate(Allocator *allocator, void *memory, size_t oldSize, size_t size)
+{
+    return allocator ? allocator->reallocate(allocator, memory, oldSize, size) : countedRealloc(memory, size);
+}
+
+static inline void allocatorRelease(Allocator *allocator, void *memory)
+{
+    if(!allocator)
+        free(memory);
+    else if(allocator->release)
+        allocator->release(allocator, memory);
+}
+
+//True when releasing single blocks would do nothing, so callers can skip walking their structures to do it
+static inline bool allocatorReleasesAtOnce(Allocator *allocator)
+{
+    return allocator && !allocator->release;
+}
+
+//Chunks start small so short lived regions stay cheap, and double up to the largest size
+#define REGION_FIRST_CHUNK_SIZE (4 * 1024)
+#define REGION_LARGEST_CHUNK_SIZE (256 * 1024)
+//Chunks a reset keeps for the next use of the region, the rest go back to the heap
+#define REGION_RETAINED_BYTES (16 * 1024 * 1024)
+
+typedef struct RegionChunk RegionChunk;
+
+//Since the last reset, except chunkBytes
+typedef struct
+{
+    unsigned long long allocations;
+    unsigned long long bytes;
+    //Chunks taken from the heap, none when the region made do with what earlier uses left it
+    unsigned long long newChunks;
+    //Held by the region right now
+    unsigned long long chunkBytes;
+} RegionUsage;
+
+//Bump allocator for memory that dies all at once, such as everything one compilation builds. Not thread safe.
+typedef struct
+{
+    //First, so a Region converts to the Allocator handed to containers
+    Allocator allocator;
+    const char *name;
+    //Chunks in the order they are filled. Those before current are done with until the next reset.
+    RegionChunk *first;
+    RegionChunk *current;
+    size_t nextChunkSize;
+    RegionUsage usage;
+} Region;
+
+extern void regionInit(Region *region, const char *name);
+//Makes every allocation invalid and keeps the chunks for reuse, up to REGION_RETAINED_BYTES
+extern void regionReset(Region *region);
+extern void regionDestroy(Region *region);
+//Moves the chunks and usage of from into region, leaving from empty. Lets threads fill regions of their own that
+//one owner frees together later.
+extern void regionAdopt(Region *region, Region *from);
+
+#endif //CCOMPILER_ALLOC_H
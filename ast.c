@@ -2,11 +2,17 @@
 #include <string.h>
 #include <stdlib.h>
 #include "ast.h"
+#include "vec.h"
+#include "alloc.h"
+
+smallListDeclare(AstNode*, AstNodeStack, 32);
+smallListDefine(AstNode*, AstNodeStack);
 
 static AstOperatorType operatorTypeFromStr(const char *str, int strLength)
 {
     if (!strncmp(str, "*", strLength)) return ASTOPTYPE_MULTIPLY;
     if (!strncmp(str, "/", strLength)) return ASTOPTYPE_DIVIDE;
+    if (!strncmp(str, "%", strLength)) return ASTOPTYPE_MODULO;
     if (!strncmp(str, "+", strLength)) return ASTOPTYPE_ADD;
     if (!strncmp(str, "-", strLength)) return ASTOPTYPE_SUBTRACT;
     if (!strncmp(str, ".", strLength)) return ASTOPTYPE_DOT;
@@ -24,6 +30,7 @@ static int operatorPrecedence(AstOperatorType type)
             return 4;
         case ASTOPTYPE_MULTIPLY:
         case ASTOPTYPE_DIVIDE:
+        case ASTOPTYPE_MODULO:
             return 3;
         case ASTOPTYPE_DOT:
         case ASTOPTYPE_CALL:
@@ -105,6 +112,8 @@ void ast_node_pretty_print(AstNode *head)
         puts("*");
     if (head->operator == ASTOPTYPE_DIVIDE)
         puts("/");
+    if (head->operator == ASTOPTYPE_MODULO)
+        puts("%");
     if (head->operator == ASTOPTYPE_DOT)
         puts("dot");
     if (head->operator == ASTOPTYPE_COMMA)
@@ -142,14 +151,37 @@ void ast_node_pretty_print(AstNode *head)
     }
 }
 
-void ast_node_free_tree(AstNode *head)
+//Nodes created by this thread, for -ftime-report
+static _Thread_local unsigned long long ast_nodes_created;
+
+static AstNode *ast_node_create(Allocator *allocator)
+{
+    ast_nodes_created++;
+    return allocatorAllocateZeroed(allocator, sizeof(AstNode));
+}
+
+unsigned long long ast_node_count(void)
 {
-    if (!head)return;
-    if(head->left)
-        ast_node_free_tree(head->left);
-    if(head->right)
-        ast_node_free_tree(head->right);
-    free(head);
+    return ast_nodes_created;
+}
+
+//Long operator chains build trees as deep as they are long, so the walk uses a stack of its own, not recursion
+void ast_node_free_tree(Allocator *allocator, AstNode *head)
+{
+    if (!head || allocatorReleasesAtOnce(allocator))return;
+    AstNodeStack stack;
+    smallListInitAstNodeStack(&stack, allocator);
+    smallListPushAstNodeStack(&stack, head);
+    while (stack.length)
+    {
+        AstNode *node = smallListPopAstNodeStack(&stack);
+        if (node->left)
+            smallListPushAstNodeStack(&stack, node->left);
+        if (node->right)
+            smallListPushAstNodeStack(&stack, node->right);
+        allocatorRelease(allocator, node);
+    }
+    smallListFreeAstNodeStack(&stack);
 }
 
 static bool ast_check_subtree(TokenVector *tv, int tvOffset)
@@ -166,7 +198,8 @@ static bool ast_check_subtree(TokenVector *tv, int tvOffset)
     return false;
 }
 
-static bool ast_check_token(TokenVector *tv, int *tvOffset, AstNode **rootNode, AstNode **tree)
+static bool ast_check_token(Allocator *allocator, TokenVector *tv, int *tvOffset, AstNode **rootNode, AstNode **tree,
+                            FILE *log, Preprocessor *pp)
 {
     Token *firstToken = &tv->tokens[*tvOffset];
     if (!strncmp(firstToken->tokenStr, "(", firstToken->tokenStrLength))
@@ -174,11 +207,11 @@ static bool ast_check_token(TokenVector *tv, int *tvOffset, AstNode **rootNode,
         int closingParenIndex = find_closing_paren(tv, *tvOffset);
         if (closingParenIndex == -1)
         {
-            puts("Invalid expression. Could not find the closing paren.");
+            preprocessorReport(pp, log, firstToken, "Invalid expression. Could not find the closing paren.");
             *tree = *rootNode;
             return false;
         }
-        bool result = ast(tv, (*tvOffset) + 1, rootNode);
+        bool result = ast(allocator, tv, (*tvOffset) + 1, rootNode, log, pp);
         if (!result)
         {
             *tree = *rootNode;
@@ -190,9 +223,9 @@ static bool ast_check_token(TokenVector *tv, int *tvOffset, AstNode **rootNode,
     }
     if (!strncmp(firstToken->tokenStr, "&", firstToken->tokenStrLength))
     {
-        *rootNode = (AstNode *) calloc(1, sizeof(AstNode));
+        *rootNode = ast_node_create(allocator);
         (*rootNode)->operator = ASTOPTYPE_REFERENCE;
-        (*rootNode)->left = calloc(1, sizeof(AstNode));
+        (*rootNode)->left = ast_node_create(allocator);
         (*rootNode)->left->tokenValue = &tv->tokens[(*tvOffset) + 1];
         *tree = *rootNode;
         *tvOffset += 1;
@@ -203,16 +236,16 @@ static bool ast_check_token(TokenVector *tv, int *tvOffset, AstNode **rootNode,
     {
         *tvOffset += 1;
         AstNode *subTree = NULL;
-        bool result = ast_check_token(tv, tvOffset, &subTree, tree);
+        bool result = ast_check_token(allocator, tv, tvOffset, &subTree, tree, log, pp);
         if (!result) return result;
 
-        *rootNode = (AstNode *) calloc(1, sizeof(AstNode));
+        *rootNode = ast_node_create(allocator);
         (*rootNode)->operator = ASTOPTYPE_DEREFERENCE;
         *tree = *rootNode;
 
         if (!subTree)
         {
-            (*rootNode)->left = calloc(1, sizeof(AstNode));
+            (*rootNode)->left = ast_node_create(allocator);
             (*rootNode)->left->tokenValue = &tv->tokens[*tvOffset];
         } else
         {
@@ -229,14 +262,14 @@ static bool ast_check_token(TokenVector *tv, int *tvOffset, AstNode **rootNode,
             int funcCallEndIndex = find_closing_paren(tv, (*tvOffset) + 1);
             if (funcCallEndIndex == -1)
             {
-                puts("Could not parse function call.");
+                preprocessorReport(pp, log, firstToken, "Could not parse function call.");
                 *tree = *rootNode;
                 return false;
             }
             AstNode *funcParamsTree = NULL;
             if (funcCallEndIndex > (*tvOffset) + 2)
             {
-                bool result = ast(tv, (*tvOffset) + 2, &funcParamsTree);
+                bool result = ast(allocator, tv, (*tvOffset) + 2, &funcParamsTree, log, pp);
                 if (!result)
                 {
                     *tree = *rootNode;
@@ -245,12 +278,12 @@ static bool ast_check_token(TokenVector *tv, int *tvOffset, AstNode **rootNode,
             }
             if (funcParamsTree && funcParamsTree->operator != ASTOPTYPE_COMMA)
             {
-                AstNode *commaNode = calloc(1, sizeof(AstNode));
+                AstNode *commaNode = ast_node_create(allocator);
                 commaNode->operator = ASTOPTYPE_COMMA;
                 commaNode->left = funcParamsTree;
                 funcParamsTree = commaNode;
             }
-            AstNode *funcCallNode = calloc(1, sizeof(AstNode));
+            AstNode *funcCallNode = ast_node_create(allocator);
             funcCallNode->operator = ASTOPTYPE_CALL;
             funcCallNode->tokenValue = firstToken;
             funcCallNode->left = funcParamsTree;
@@ -263,18 +296,18 @@ static bool ast_check_token(TokenVector *tv, int *tvOffset, AstNode **rootNode,
     return true;
 }
 
-bool ast(TokenVector *tv, int tvOffset, AstNode **tree)
+bool ast(Allocator *allocator, TokenVector *tv, int tvOffset, AstNode **tree, FILE *log, Preprocessor *pp)
 {
     AstNode *rootNode = NULL;
     Token *firstToken = &tv->tokens[tvOffset];
     bool result = false;
 
-    result = ast_check_token(tv, &tvOffset, &rootNode, tree);
+    result = ast_check_token(allocator, tv, &tvOffset, &rootNode, tree, log, pp);
     if (!result) return result;
 
     if (rootNode == NULL)
     {
-        rootNode = calloc(1, sizeof(AstNode));
+        rootNode = ast_node_create(allocator);
         rootNode->tokenValue = firstToken;
     } else
         rootNode->isSubtree = true;
@@ -283,7 +316,7 @@ bool ast(TokenVector *tv, int tvOffset, AstNode **tree)
     {
         if (tvOffset + 1 >= tv->length)
         {
-            puts("Unexpected end of expression.");
+            preprocessorReport(pp, log, &tv->tokens[tvOffset], "Unexpected end of expression.");
             *tree = rootNode;
             return false;
         }
@@ -295,11 +328,12 @@ bool ast(TokenVector *tv, int tvOffset, AstNode **tree)
             *tree = rootNode;
             return true;
         }
+        Token *operatorToken = currentToken;
         AstOperatorType currentTokenOpType = operatorTypeFromStr(currentToken->tokenStr, currentToken->tokenStrLength);
         tvOffset += 1;
         if (tvOffset + 1 >= tv->length)
         {
-            puts("Unexpected end of expression.");
+            preprocessorReport(pp, log, operatorToken, "Unexpected end of expression.");
             *tree = rootNode;
             return false;
         }
@@ -308,37 +342,38 @@ bool ast(TokenVector *tv, int tvOffset, AstNode **tree)
         AstNode *subTree = NULL;
         if (ast_check_subtree(tv, tvOffset))
         {
-            result = ast_check_token(tv, &tvOffset, &subTree, tree);
+            result = ast_check_token(allocator, tv, &tvOffset, &subTree, tree, log, pp);
             if (!result) return result;
         }
 
         if (currentTokenOpType == ASTOPTYPE_INVALID)
         {
-            puts("Operator type was invalid.");
+            preprocessorReport(pp, log, operatorToken, "Operator type was invalid.");
             *tree = rootNode;
             return false;
         }
-        AstNode *nextNode = calloc(1, sizeof(AstNode));
+        AstNode *nextNode = ast_node_create(allocator);
         nextNode->operator = currentTokenOpType;
-        if (!strncmp(currentToken->tokenStr, "&", currentToken->tokenStrLength))
+        //Operands like *(p + i) were parsed as a subtree already
+        if (!subTree && !strncmp(currentToken->tokenStr, "&", currentToken->tokenStrLength))
         {
-            subTree = calloc(1, sizeof(AstNode));
+            subTree = ast_node_create(allocator);
             subTree->operator = ASTOPTYPE_REFERENCE;
-            subTree->left = calloc(1, sizeof(AstNode));
+            subTree->left = ast_node_create(allocator);
             subTree->left->tokenValue = &tv->tokens[tvOffset + 1];
             tvOffset++;
         }
-        if (!strncmp(currentToken->tokenStr, "*", currentToken->tokenStrLength))
+        if (!subTree && !strncmp(currentToken->tokenStr, "*", currentToken->tokenStrLength))
         {
-            subTree = calloc(1, sizeof(AstNode));
+            subTree = ast_node_create(allocator);
             subTree->operator = ASTOPTYPE_DEREFERENCE;
-            subTree->left = calloc(1, sizeof(AstNode));
+            subTree->left = ast_node_create(allocator);
             subTree->left->tokenValue = &tv->tokens[tvOffset + 1];
             tvOffset++;
         }
         if (subTree == NULL)
         {
-            nextNode->right = calloc(1, sizeof(AstNode));
+            nextNode->right = ast_node_create(allocator);
             nextNode->right->tokenValue = currentToken;
         } else
         {
@@ -360,7 +395,8 @@ bool ast(TokenVector *tv, int tvOffset, AstNode **tree)
         if (replacingNode == NULL)
         {
             //This shouldn't happen with a well-formed expression
-            free(nextNode);
+            preprocessorReport(pp, log, operatorToken, "Malformed expression.");
+            allocatorRelease(allocator, nextNode);
             *tree = rootNode;
             return false;
         }
@@ -1,12 +1,15 @@
 #ifndef CCOMPILER_AST_H
 #define CCOMPILER_AST_H
+#include <stdio.h>
 #include "tokenize.h"
+#include "preprocess.h"
 
 typedef enum
 {
     ASTOPTYPE_INVALID,
     ASTOPTYPE_MULTIPLY,
     ASTOPTYPE_DIVIDE,
+    ASTOPTYPE_MODULO,
     ASTOPTYPE_ADD,
     ASTOPTYPE_SUBTRACT,
     ASTOPTYPE_DOT,
@@ -25,10 +28,22 @@ struct AstNode
     Token *tokenValue;
     AstOperatorType operator;
     bool isSubtree;
+    //Sethi-Ullman labels, filled in by codegen before it compiles the tree. registerNeed is how many registers
+    //evaluating the subtree takes without spilling, heldRegisters how many its value occupies until it is used.
+    int registerNeed;
+    int heldRegisters;
+    int valueWidth;
+    bool hasSideEffects;
+    //Evaluate the right operand first, because it needs more registers
+    bool rightFirst;
 };
 
-extern void ast_node_free_tree(AstNode *head);
-extern bool ast(TokenVector *tv, int tvOffset, AstNode **tree);
+//Nodes come from allocator, NULL for the heap. Freeing a tree from a region does nothing, the region owns it.
+extern void ast_node_free_tree(Allocator *allocator, AstNode *head);
+//Number of nodes the calling thread has created so far
+extern unsigned long long ast_node_count(void);
+//Syntax errors go to log, located through pp, the preprocessor that produced tv, when it is not NULL
+extern bool ast(Allocator *allocator, TokenVector *tv, int tvOffset, AstNode **tree, FILE *log, Preprocessor *pp);
 extern void ast_node_pretty_print(AstNode *head);
 extern void ast_tree_to_list(AstNode *ast, AstNode **head, AstNode **tail);
 
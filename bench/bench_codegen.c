@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "bytes.h"
+
+/*
+Generated code quality benchmark. Every corpus file is compiled with -fcodegen-stats and the image is run in the
+simulator. The numbers are compared against the baseline file and any metric that grew by more than the threshold
+fails the run. Smaller numbers are always better.
+*/
+
+#define BENCH_METRIC_COUNT 4
+#define BENCH_MAX_NAME 128
+
+static const char *G_METRIC_NAMES[BENCH_METRIC_COUNT] = {"instructions", "frame", "spills", "cycles"};
+
+typedef struct
+{
+    char name[BENCH_MAX_NAME];
+    unsigned long long metrics[BENCH_METRIC_COUNT];
+    bool found;
+} BenchResult;
+
+static const char *baseName(const char *path)
+{
+    const char *name = path;
+    for(const char *c = path; *c; c++)
+    {
+        if(*c == '/' || *c == '\\') name = c + 1;
+    }
+    return name;
+}
+
+static bool measure(const char *compiler, const char *source, SimConfig *config, BenchResult *result)
+{
+    const char *name = baseName(source);
+    snprintf(result->name, BENCH_MAX_NAME, "%s", name);
+    char imagePath[BENCH_MAX_NAME + 16];
+    char statsPath[BENCH_MAX_NAME + 16];
+    snprintf(imagePath, sizeof(imagePath), "bench_%s.out", name);
+    snprintf(statsPath, sizeof(statsPath), "bench_%s.stats", name);
+
+    size_t commandLength = strlen(compiler) + strlen(source) + sizeof(imagePath) + sizeof(statsPath) + 64;
+    char *command = malloc(commandLength);
+    snprintf(command, commandLength, "\"%s\" -fcodegen-stats \"%s\" -o \"%s\" \"%s\"", compiler, statsPath, imagePath, source);
+    int status = system(command);
+    free(command);
+    if(status != 0)
+    {
+        printf("%s: compilation failed\n", name);
+        return false;
+    }
+
+    FILE *statsFile = fopen(statsPath, "r");
+    if(!statsFile)
+    {
+        printf("%s: no codegen stats written\n", name);
+        return false;
+    }
+    char line[512];
+    bool haveTotal = false;
+    while(fgets(line, sizeof(line), statsFile))
+    {
+        if(sscanf(line, "total instructions %llu frame %llu spills %llu",
+                  &result->metrics[0], &result->metrics[1], &result->metrics[2]) == 3)
+            haveTotal = true;
+    }
+    fclose(statsFile);
+    if(!haveTotal)
+    {
+        printf("%s: codegen stats are incomplete\n", name);
+        return false;
+    }
+
+    size_t imageSize;
+    unsigned char *image = readFile(imagePath, &imageSize, NULL);
+    if(!image)
+    {
+        printf("%s: failed to read %s\n", name, imagePath);
+        return false;
+    }
+    Simulator sim;
+    bool ran = simLoad(&sim, image, imageSize, "main", config) && simRun(&sim);
+    free(image);
+    result->metrics[3] = sim.stats.cycles;
+    simDispose(&sim);
+    if(!ran)
+        printf("%s: simulation failed\n", name);
+    return ran;
+}
+
+static BenchResult *loadBaseline(const char *path, int *count)
+{
+    *count = 0;
+    FILE *file = fopen(path, "r");
+    if(!file) return NULL;
+    int capacity = 16;
+    BenchResult *results = malloc(sizeof(BenchResult) * capacity);
+    char line[512];
+    while(fgets(line, sizeof(line), file))
+    {
+        if(line[0] == '#' || line[0] == '\n') continue;
+        BenchResult entry = {0};
+        if(sscanf(line, "%127s %llu %llu %llu %llu", entry.name, &entry.metrics[0], &entry.metrics[1],
+                  &entry.metrics[2], &entry.metrics[3]) != 5)
+        {
+            printf("Ignoring malformed baseline line: %s", line);
+            continue;
+        }
+        if(*count == capacity)
+        {
+            capacity *= 2;
+            results = realloc(results, sizeof(BenchResult) * capacity);
+        }
+        results[(*count)++] = entry;
+    }
+    fclose(file);
+    return results;
+}
+
+static bool writeBaseline(const char *path, BenchResult *results, int count)
+{
+    FILE *file = fopen(path, "w");
+    if(!file) return false;
+    fprintf(file, "# name instructions frame spills cycles\n");
+    for(int i = 0; i < count; i++)
+    {
+        fprintf(file, "%s %llu %llu %llu %llu\n", results[i].name, results[i].metrics[0], results[i].metrics[1],
+                results[i].metrics[2], results[i].metrics[3]);
+    }
+    return fclose(file) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *compiler = "ccompiler";
+    const char *baselinePath = "baseline.txt";
+    double threshold = 1.0;
+    bool update = false;
+    SimConfig config;
+    simConfigDefault(&config);
+
+    int sourceCount = 0;
+    const char **sources = malloc(sizeof(char*) * (argc + 1));
+    for(int i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "-compiler") && i + 1 < argc)
+            compiler = argv[++i];
+        else if(!strcmp(argv[i], "-baseline") && i + 1 < argc)
+            baselinePath = argv[++i];
+        else if(!strcmp(argv[i], "-threshold") && i + 1 < argc)
+            threshold = strtod(argv[++i], NULL);
+        else if(!strcmp(argv[i], "-cost") && i + 1 < argc)
+        {
+            if(!simConfigParseCosts(&config, argv[++i])) return 1;
+        }
+        else if(!strcmp(argv[i], "-update"))
+            update = true;
+        else if(argv[i][0] == '-')
+        {
+            printf("Unknown option '%s'\n", argv[i]);
+            puts("Usage: bench_codegen [-compiler path] [-baseline path] [-threshold percent] [-cost mnemonic=cycles,...] "
+                 "[-update] sources...");
+            return 1;
+        }
+        else
+            sources[sourceCount++] = argv[i];
+    }
+
+    int baselineCount;
+    BenchResult *baseline = loadBaseline(baselinePath, &baselineCount);
+    BenchResult *results = calloc(sourceCount + 1, sizeof(BenchResult));
+    bool failed = false;
+    int regressions = 0;
+
+    printf("%-16s %-12s %12s %12s %9s\n", "snippet", "metric", "baseline", "current", "change");
+    for(int s = 0; s < sourceCount; s++)
+    {
+        BenchResult *result = &results[s];
+        if(!measure(compiler, sources[s], &config, result))
+        {
+            failed = true;
+            continue;
+        }
+        BenchResult *previous = NULL;
+        for(int b = 0; b < baselineCount; b++)
+        {
+            if(!strcmp(baseline[b].name, result->name)) previous = &baseline[b];
+        }
+        for(int m = 0; m < BENCH_METRIC_COUNT; m++)
+        {
+            unsigned long long current = result->metrics[m];
+            if(!previous)
+            {
+                printf("%-16s %-12s %12s %12llu %9s\n", result->name, G_METRIC_NAMES[m], "-", current, "new");
+                continue;
+            }
+            unsigned long long before = previous->metrics[m];
+            double change = before ? ((double)current - (double)before) * 100.0 / (double)before : (current ? 100.0 : 0.0);
+            bool regressed = current > before && (!before || change > threshold);
+            printf("%-16s %-12s %12llu %12llu %+8.1f%%%s\n", result->name, G_METRIC_NAMES[m], before, current, change,
+                   regressed ? "  REGRESSION" : "");
+            if(regressed) regressions++;
+        }
+    }
+
+    if(update && !failed)
+    {
+        if(!writeBaseline(baselinePath, results, sourceCount))
+        {
+            printf("Failed to write baseline '%s'\n", baselinePath);
+            failed = true;
+        }
+        else
+            printf("Baseline written to %s\n", baselinePath);
+    }
+    else if(regressions)
+    {
+        printf("%d metric(s) regressed by more than %.1f%%\n", regressions, threshold);
+        failed = true;
+    }
+
+    free(results);
+    free(baseline);
+    free(sources);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,31 @@
+int get(int *p)
+{
+    return *p;
+}
+
+void set(int *p, int value)
+{
+    *p = value;
+}
+
+long wide(int *p)
+{
+    return *p;
+}
+
+int bump(int *p, int step)
+{
+    set(p, get(p) + step);
+    return get(p);
+}
+
+int main()
+{
+    int x = 3;
+    int y = 40;
+    set(&x, get(&y) + 1);
+    bump(&y, x);
+    long total = wide(&x) + wide(&y);
+    total = total + bump(&x, 7) - bump(&y, 0 - 2);
+    return total;
+}
@@ -0,0 +1,17 @@
+int mix(int a, int b, int c)
+{
+    int d = a + b - c;
+    int e = d + a + 7;
+    int f = e - b + d;
+    int g = f + f - e;
+    int h = g + d - a + b;
+    return h + e - g + c + 300;
+}
+
+int main()
+{
+    int x = mix(1, 2, 3);
+    int y = mix(x, x - 1, 4);
+    int z = mix(y, x, y + x);
+    return z - x + y;
+}
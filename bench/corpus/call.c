@@ -0,0 +1,27 @@
+int one()
+{
+    return 1;
+}
+
+int inc(int a)
+{
+    return a + one();
+}
+
+int add3(int a, int b, int c)
+{
+    return a + b + c;
+}
+
+int nest(int a, int b)
+{
+    return add3(inc(a), inc(b), add3(a, b, one()));
+}
+
+int main()
+{
+    int total = nest(1, 2);
+    total = total + nest(total, inc(total));
+    total = total + add3(nest(3, 4), inc(5), one());
+    return total;
+}
@@ -0,0 +1,39 @@
+int sum(int *p, int n)
+{
+    int s = 0;
+    for(int i = 0; n - i; i = i + 1)
+        s = *(p + i * 2) + s;
+    return s;
+}
+
+int fill(int *p, int n, int stride, int value)
+{
+    int i = 0;
+    while(n - i)
+    {
+        *(p + i * stride) = value + i * 3;
+        i = i + 1;
+    }
+    return i;
+}
+
+int countdown(int n)
+{
+    int c = 0;
+    do
+    {
+        c = c + n % 7;
+        n = n - 1;
+    } while(n);
+    return c;
+}
+
+int main()
+{
+    int data = 0;
+    int *base = &data;
+    base = base - 4000;
+    fill(base, 40, 2, 5);
+    int total = sum(base, 40);
+    return total + countdown(20);
+}
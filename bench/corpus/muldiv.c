@@ -0,0 +1,22 @@
+int scale(int x, int y)
+{
+    return x * 10 + y * 3 - x / 7 + y % 16;
+}
+
+unsigned int digits(unsigned int x)
+{
+    return x / 10 + x % 10 + x / 1000;
+}
+
+long mix(long x, long y)
+{
+    return x * y + x / y - x % 3;
+}
+
+int main()
+{
+    int a = scale(123, 45);
+    unsigned int b = digits(4321);
+    long c = mix(100000, 37);
+    return a + b + c / 100;
+}
@@ -0,0 +1,15 @@
+int twice(int x)
+{
+    return x + x;
+}
+
+int main()
+{
+    int a = 3;
+    int b = 4;
+    int *p = &a;
+    int *q = &b;
+    int r = *p + twice(*q);
+    r = *q + (*p + twice(r));
+    return r - (*p - twice(*q + *p));
+}
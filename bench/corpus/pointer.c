@@ -0,0 +1,31 @@
+void store(int *target, int value)
+{
+    *target = value;
+}
+
+int load(int *source)
+{
+    return *source;
+}
+
+int swapSum(int *a, int *b)
+{
+    int t = *a;
+    *a = *b;
+    *b = t;
+    return *a + *b;
+}
+
+int main()
+{
+    int x = 10;
+    int y = 20;
+    int *p = &x;
+    int **pp = &p;
+    store(p, 11);
+    store(&y, load(&x) + 1);
+    int s = swapSum(&x, &y);
+    int *q = *pp;
+    *q = *q + s;
+    return x - y;
+}
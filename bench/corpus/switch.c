@@ -0,0 +1,56 @@
+int step(int state, int input)
+{
+    switch(state)
+    {
+        case 0: return input + 1;
+        case 1: return state + input;
+        case 2: return 5;
+        case 3:
+        case 4: return state * 2;
+        case 5: return 7;
+        case 6: return 0;
+        case 7: return 9;
+        case 8: return input;
+        case 9: return 3;
+        default: return 0;
+    }
+}
+
+int cost(int opcode)
+{
+    int cycles = 1;
+    switch(opcode)
+    {
+        case 0x10: cycles = 2; break;
+        case 0x24: cycles = 3; break;
+        case 0x31: break;
+        case 0x100: cycles = 4; break;
+        case 0x250: cycles = 6; break;
+        case 0x1000: cycles = 8; break;
+        case -3: cycles = 0; break;
+        default: cycles = cycles + 10;
+    }
+    return cycles;
+}
+
+int sign(long value)
+{
+    switch(value)
+    {
+        case 0: return 0;
+        case 1: return 1;
+    }
+    return 2;
+}
+
+int main()
+{
+    int state = step(0, 1);
+    state = step(state, 1);
+    state = step(state, 0);
+    state = step(state, 4);
+    state = step(state, 0);
+    state = step(state, 2);
+    int total = state + cost(0x24) + cost(0x250) + cost(0 - 3) + cost(0x1001);
+    return total + sign(1) + sign(70000);
+}
@@ -0,0 +1,32 @@
+static const unsigned int crc[16] = {
+    0x0000, 0x1081, 0x2102, 0x3183, 0x4204, 0x5285, 0x6306, 0x7387,
+    0x8408, 0x9489, 0xA50A, 0xB58B, 0xC60C, 0xD68D, 0xE70E, 0xF78F
+};
+
+static const long powers[] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+
+unsigned int checksum(int *bytes, int count)
+{
+    unsigned int value = 0xFFFF;
+    for(int i = 0; i - count; i = i + 1)
+    {
+        unsigned int index = (value + *(bytes + i)) % 16;
+        value = value / 16 + *(crc + index);
+    }
+    return value;
+}
+
+long scale(int digits)
+{
+    return *(powers + digits * 2);
+}
+
+int main()
+{
+    int data = 0;
+    int *bytes = &data;
+    bytes = bytes - 8000;
+    for(int i = 0; i - 32; i = i + 1)
+        *(bytes + i) = i * 7;
+    return checksum(bytes, 32) + scale(5);
+}
@@ -0,0 +1,23 @@
+long addLong(long a, long b)
+{
+    return a + b;
+}
+
+long long accumulate(long long a, long long b, long long c)
+{
+    long long s = a + b;
+    s = s - c;
+    return s + a;
+}
+
+int main()
+{
+    long a = 70000;
+    long b = addLong(a, 123456);
+    long long big = 5000000000;
+    long long c = accumulate(big, b, a);
+    unsigned long d = b - a;
+    long long e = c - big + d;
+    int low = e;
+    return low;
+}
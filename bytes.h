@@ -0,0 +1,80 @@
+#ifndef CCOMPILER_BYTES_H
+#define CCOMPILER_BYTES_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+//Little endian fields of the binary images, objects, precompiled headers and server messages
+
+static inline uint32_t get16(const unsigned char *src)
+{
+    return (uint32_t)src[0] | (uint32_t)src[1] << 8;
+}
+
+static inline uint32_t get32(const unsigned char *src)
+{
+    return get16(src) | get16(src + 2) << 16;
+}
+
+static inline uint64_t get64(const unsigned char *src)
+{
+    return (uint64_t)get32(src) | (uint64_t)get32(src + 4) << 32;
+}
+
+static inline void put16(unsigned char *dst, uint32_t value)
+{
+    dst[0] = (unsigned char)value;
+    dst[1] = (unsigned char)(value >> 8);
+}
+
+static inline void put32(unsigned char *dst, uint32_t value)
+{
+    put16(dst, value);
+    put16(dst + 2, value >> 16);
+}
+
+static inline void put64(unsigned char *dst, uint64_t value)
+{
+    put32(dst, (uint32_t)value);
+    put32(dst + 4, (uint32_t)(value >> 32));
+}
+
+//Sections of these files start 8 byte aligned
+static inline uint64_t align8(uint64_t value)
+{
+    return (value + 7) & ~(uint64_t)7;
+}
+
+//Whether bytes from offset lie within a file of fileSize bytes, without overflowing on hostile offsets
+static inline bool sectionFits(size_t fileSize, uint32_t offset, uint64_t bytes)
+{
+    return offset <= fileSize && bytes <= fileSize - offset;
+}
+
+//The whole file in a heap block, NULL if it cannot be read. Failures are reported to log unless it is NULL.
+static inline unsigned char *readFile(const char *path, size_t *size, FILE *log)
+{
+    FILE *file = fopen(path, "rb");
+    if(!file)
+    {
+        if(log) fprintf(log, "Failed to open '%s'\n", path);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    unsigned char *buffer = malloc(length > 0 ? (size_t)length : 1);
+    if(length < 0 || fread(buffer, 1, (size_t)length, file) != (size_t)length)
+    {
+        if(log) fprintf(log, "Failed to read '%s'\n", path);
+        free(buffer);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+    *size = (size_t)length;
+    return buffer;
+}
+
+#endif //CCOMPILER_BYTES_H
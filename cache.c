@@ -0,0 +1,310 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "cache.h"
+#include "alloc.h"
+
+//Entry file names are the 32 hex digits of the key
+#define CACHE_KEY_DIGITS 32
+#define CACHE_PATH_MAX 4096
+//Temporary files left behind by a crashed writer are removed after this many seconds
+#define CACHE_STALE_TEMPORARY_SECONDS 3600
+
+//Makes temporary file names unique between the threads of one process
+static atomic_ullong G_TEMPORARY_COUNTER;
+
+static uint64_t rotl64(uint64_t value, int shift)
+{
+    return (value << shift) | (value >> (64 - shift));
+}
+
+static uint64_t load64(const unsigned char *bytes)
+{
+    uint64_t value = 0;
+    for(int i = 7; i >= 0; i--)
+        value = value << 8 | bytes[i];
+    return value;
+}
+
+static uint64_t fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+//MurmurHash3 x64 128 with both lanes seeded, so hashes can be chained
+static CacheKey hash128(const void *data, size_t length, CacheKey seed)
+{
+    const unsigned char *bytes = data;
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    uint64_t h1 = seed.low;
+    uint64_t h2 = seed.high;
+
+    size_t blocks = length / 16;
+    for(size_t i = 0; i < blocks; i++)
+    {
+        uint64_t k1 = load64(bytes + i * 16);
+        uint64_t k2 = load64(bytes + i * 16 + 8);
+        k1 *= c1;
+        k1 = rotl64(k1, 31);
+        k1 *= c2;
+        h1 ^= k1;
+        h1 = rotl64(h1, 27);
+        h1 += h2;
+        h1 = h1 * 5 + 0x52dce729;
+        k2 *= c2;
+        k2 = rotl64(k2, 33);
+        k2 *= c1;
+        h2 ^= k2;
+        h2 = rotl64(h2, 31);
+        h2 += h1;
+        h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    const unsigned char *tail = bytes + blocks * 16;
+    size_t rest = length & 15;
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+    for(size_t i = rest; i > 8; i--)
+        k2 ^= (uint64_t)tail[i - 1] << ((i - 9) * 8);
+    for(size_t i = rest < 8 ? rest : 8; i > 0; i--)
+        k1 ^= (uint64_t)tail[i - 1] << ((i - 1) * 8);
+    if(rest > 8)
+    {
+        k2 *= c2;
+        k2 = rotl64(k2, 33);
+        k2 *= c1;
+        h2 ^= k2;
+    }
+    if(rest)
+    {
+        k1 *= c1;
+        k1 = rotl64(k1, 31);
+        k1 *= c2;
+        h1 ^= k1;
+    }
+
+    h1 ^= length;
+    h2 ^= length;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+    return (CacheKey){h1, h2};
+}
+
+bool cacheOpen(CompilationCache *cache, const char *directory, unsigned long long maxBytes, const char *compilerPath,
+               FILE *log)
+{
+    memset(cache, 0, sizeof(CompilationCache));
+    if(mkdir(directory, 0777) != 0 && errno != EEXIST)
+    {
+        fprintf(log, "Failed to create cache directory '%s'\n", directory);
+        return false;
+    }
+    struct stat info;
+    if(stat(directory, &info) != 0 || !S_ISDIR(info.st_mode))
+    {
+        fprintf(log, "Cache path '%s' is not a directory\n", directory);
+        return false;
+    }
+    cache->directory = countedMalloc(strlen(directory) + 1);
+    strcpy(cache->directory, directory);
+    cache->maxBytes = maxBytes ? maxBytes : CACHE_DEFAULT_MAX_BYTES;
+
+    //A rebuilt compiler invalidates the cache even if nobody bumped the version
+    CacheKey identity = hash128(CCOMPILER_VERSION, strlen(CCOMPILER_VERSION), (CacheKey){0, 0});
+    if(compilerPath && stat(compilerPath, &info) == 0)
+    {
+        uint64_t build[2] = {(uint64_t)info.st_size, (uint64_t)info.st_mtime};
+        identity = hash128(build, sizeof(build), identity);
+    }
+    cache->compilerIdentity = identity;
+    atomic_init(&cache->hits, 0);
+    atomic_init(&cache->misses, 0);
+    atomic_init(&cache->stores, 0);
+    return true;
+}
+
+void cacheClose(CompilationCache *cache)
+{
+    free(cache->directory);
+    cache->directory = NULL;
+}
+
+CacheKey cacheComputeKey(CompilationCache *cache, const char *source, size_t sourceLength, const char *options)
+{
+    CacheKey key = hash128(options, strlen(options), cache->compilerIdentity);
+    return hash128(source, sourceLength, key);
+}
+
+CacheKey cacheExtendKey(CacheKey key, const void *data, size_t length)
+{
+    return hash128(data, length, key);
+}
+
+static void entryPath(CompilationCache *cache, CacheKey key, char *path)
+{
+    snprintf(path, CACHE_PATH_MAX, "%s/%016llx%016llx", cache->directory,
+             (unsigned long long)key.high, (unsigned long long)key.low);
+}
+
+static bool copyFile(const char *sourcePath, const char *destinationPath)
+{
+    FILE *source = fopen(sourcePath, "rb");
+    if(!source) return false;
+    FILE *destination = fopen(destinationPath, "wb");
+    if(!destination)
+    {
+        fclose(source);
+        return false;
+    }
+    char buffer[64 * 1024];
+    size_t length;
+    bool result = true;
+    while((length = fread(buffer, 1, sizeof(buffer), source)) > 0)
+    {
+        if(fwrite(buffer, 1, length, destination) != length)
+        {
+            result = false;
+            break;
+        }
+    }
+    if(ferror(source)) result = false;
+    fclose(source);
+    if(fclose(destination) != 0) result = false;
+    return result;
+}
+
+bool cacheFetch(CompilationCache *cache, CacheKey key, const char *outputPath)
+{
+    char path[CACHE_PATH_MAX];
+    entryPath(cache, key, path);
+    if(!copyFile(path, outputPath))
+    {
+        atomic_fetch_add(&cache->misses, 1);
+        return false;
+    }
+    //The modification time doubles as the last use for eviction
+    utime(path, NULL);
+    atomic_fetch_add(&cache->hits, 1);
+    return true;
+}
+
+bool cacheStore(CompilationCache *cache, CacheKey key, const char *outputPath)
+{
+    char path[CACHE_PATH_MAX];
+    char temporaryPath[CACHE_PATH_MAX];
+    entryPath(cache, key, path);
+    snprintf(temporaryPath, CACHE_PATH_MAX, "%s/tmp-%ld-%llu", cache->directory, (long)getpid(),
+             atomic_fetch_add(&G_TEMPORARY_COUNTER, 1));
+    //Readers only ever see complete entries because rename replaces the name atomically
+    if(!copyFile(outputPath, temporaryPath) || rename(temporaryPath, path) != 0)
+    {
+        remove(temporaryPath);
+        return false;
+    }
+    atomic_fetch_add(&cache->stores, 1);
+    return true;
+}
+
+typedef struct
+{
+    char name[CACHE_KEY_DIGITS + 1];
+    unsigned long long size;
+    time_t lastUse;
+} CacheEntry;
+
+static int compareLastUse(const void *a, const void *b)
+{
+    const CacheEntry *left = a;
+    const CacheEntry *right = b;
+    if(left->lastUse != right->lastUse) return left->lastUse < right->lastUse ? -1 : 1;
+    return strcmp(left->name, right->name);
+}
+
+static bool isEntryName(const char *name)
+{
+    if(strlen(name) != CACHE_KEY_DIGITS) return false;
+    for(int i = 0; i < CACHE_KEY_DIGITS; i++)
+    {
+        if(!strchr("0123456789abcdef", name[i])) return false;
+    }
+    return true;
+}
+
+void cacheTrim(CompilationCache *cache)
+{
+    DIR *directory = opendir(cache->directory);
+    if(!directory) return;
+    int count = 0;
+    int capacity = 64;
+    CacheEntry *entries = countedMalloc(sizeof(CacheEntry) * capacity);
+    unsigned long long total = 0;
+    time_t now = time(NULL);
+    char path[CACHE_PATH_MAX];
+    struct dirent *dirent;
+    while((dirent = readdir(directory)))
+    {
+        struct stat info;
+        snprintf(path, CACHE_PATH_MAX, "%s/%s", cache->directory, dirent->d_name);
+        if(!strncmp(dirent->d_name, "tmp-", 4))
+        {
+            if(stat(path, &info) == 0 && now - info.st_mtime > CACHE_STALE_TEMPORARY_SECONDS)
+                remove(path);
+            continue;
+        }
+        if(!isEntryName(dirent->d_name) || stat(path, &info) != 0 || !S_ISREG(info.st_mode)) continue;
+        if(count == capacity)
+        {
+            capacity *= 2;
+            entries = countedRealloc(entries, sizeof(CacheEntry) * capacity);
+        }
+        strcpy(entries[count].name, dirent->d_name);
+        entries[count].size = (unsigned long long)info.st_size;
+        entries[count].lastUse = info.st_mtime;
+        total += entries[count].size;
+        count++;
+    }
+    closedir(directory);
+
+    //Trimming to 90% leaves headroom so the next few stores do not each trigger an eviction pass
+    if(total > cache->maxBytes)
+    {
+        unsigned long long target = cache->maxBytes / 10 * 9;
+        qsort(entries, count, sizeof(CacheEntry), compareLastUse);
+        for(int i = 0; i < count && total > target; i++)
+        {
+            snprintf(path, CACHE_PATH_MAX, "%s/%s", cache->directory, entries[i].name);
+            if(remove(path) != 0) continue;
+            total -= entries[i].size;
+            cache->evictions++;
+        }
+    }
+    cache->sizeBytes = total;
+    free(entries);
+}
+
+void cachePrintStats(CompilationCache *cache, FILE *file)
+{
+    unsigned long long hits = atomic_load(&cache->hits);
+    unsigned long long misses = atomic_load(&cache->misses);
+    unsigned long long lookups = hits + misses;
+    fprintf(file, "cache: %llu hits, %llu misses (%.1f%% hit rate), %llu stored, %llu evicted, %llu of %llu bytes\n",
+            hits, misses, lookups ? hits * 100.0 / lookups : 0.0, atomic_load(&cache->stores), cache->evictions,
+            cache->sizeBytes, cache->maxBytes);
+}
@@ -0,0 +1,52 @@
+#ifndef CCOMPILER_CACHE_H
+#define CCOMPILER_CACHE_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+//Part of every cache key. Bump when the same input and options can produce different output.
+#define CCOMPILER_VERSION "0.4.0"
+#define CACHE_DEFAULT_MAX_BYTES (256ULL * 1024 * 1024)
+
+typedef struct
+{
+    uint64_t low;
+    uint64_t high;
+} CacheKey;
+
+/*
+Content addressed store of compiler outputs. An entry is named by the hash of the source text, the options that
+affect the output, the compiler version and the identity of the compiler executable. Entries are written to a
+temporary file and renamed into place, so concurrent compilers never see a partial entry. The modification time of an
+entry is its last use, cacheTrim evicts the least recently used entries once the directory outgrows maxBytes.
+*/
+typedef struct
+{
+    char *directory;
+    unsigned long long maxBytes;
+    CacheKey compilerIdentity;
+    atomic_ullong hits;
+    atomic_ullong misses;
+    atomic_ullong stores;
+    unsigned long long evictions;
+    unsigned long long sizeBytes;
+} CompilationCache;
+
+//Creates the directory if needed. compilerPath is used to tell compiler builds apart and may be NULL.
+//Problems with the directory are reported to log.
+extern bool cacheOpen(CompilationCache *cache, const char *directory, unsigned long long maxBytes,
+                      const char *compilerPath, FILE *log);
+extern void cacheClose(CompilationCache *cache);
+extern CacheKey cacheComputeKey(CompilationCache *cache, const char *source, size_t sourceLength, const char *options);
+//Mixes more input into a key, such as the headers a source file includes
+extern CacheKey cacheExtendKey(CacheKey key, const void *data, size_t length);
+//Copies the entry to outputPath and marks it used. Returns false on a miss.
+extern bool cacheFetch(CompilationCache *cache, CacheKey key, const char *outputPath);
+//Adds the file at outputPath as the entry for key
+extern bool cacheStore(CompilationCache *cache, CacheKey key, const char *outputPath);
+//Evicts least recently used entries until the cache fits in maxBytes
+extern void cacheTrim(CompilationCache *cache);
+extern void cachePrintStats(CompilationCache *cache, FILE *file);
+
+#endif //CCOMPILER_CACHE_H
@@ -0,0 +1,113 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "server.h"
+#include "bytes.h"
+
+/*
+Thin client of the compile server. Forwards its command line and working directory, prints what the server wrote
+and exits with the status of the compilation.
+    ccclient [-socket PATH] [-shutdown] compiler arguments...
+*/
+
+static bool writeString(int descriptor, const char *str)
+{
+    unsigned char header[4];
+    put32(header, (uint32_t)strlen(str));
+    return serverWriteFully(descriptor, header, 4) && serverWriteFully(descriptor, str, strlen(str));
+}
+
+int main(int argc, char **argv)
+{
+    char socketPath[SERVER_SOCKET_PATH_MAX];
+    serverDefaultSocketPath(socketPath, sizeof(socketPath));
+    ServerRequestKind kind = SERVER_REQUEST_COMPILE;
+    int first = 1;
+    while(first < argc)
+    {
+        if(!strcmp(argv[first], "-socket") && first + 1 < argc)
+        {
+            snprintf(socketPath, sizeof(socketPath), "%s", argv[first + 1]);
+            first += 2;
+        }
+        else if(!strcmp(argv[first], "-shutdown"))
+        {
+            kind = SERVER_REQUEST_SHUTDOWN;
+            first++;
+        }
+        else
+            break;
+    }
+    int argumentCount = argc - first;
+    if(argumentCount > SERVER_MAX_ARGUMENTS)
+    {
+        puts("Too many arguments for the compile server.");
+        return 1;
+    }
+    for(int i = first; i < argc; i++)
+    {
+        if(strlen(argv[i]) > SERVER_MAX_STRING)
+        {
+            puts("Argument too long for the compile server.");
+            return 1;
+        }
+    }
+    char workingDirectory[PATH_MAX];
+    if(!getcwd(workingDirectory, sizeof(workingDirectory)))
+    {
+        puts("Failed to get the working directory.");
+        return 1;
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", socketPath);
+    int descriptor = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(descriptor < 0 || connect(descriptor, (struct sockaddr*)&address, sizeof(address)) != 0)
+    {
+        printf("No compile server is listening on '%s'\n", socketPath);
+        if(descriptor >= 0) close(descriptor);
+        return 1;
+    }
+
+    unsigned char header[16];
+    memcpy(header, SERVER_REQUEST_MAGIC, 4);
+    put32(header + 4, SERVER_PROTOCOL_VERSION);
+    put32(header + 8, kind);
+    put32(header + 12, (uint32_t)argumentCount);
+    bool sent = serverWriteFully(descriptor, header, sizeof(header)) && writeString(descriptor, workingDirectory);
+    for(int i = first; i < argc && sent; i++)
+        sent = writeString(descriptor, argv[i]);
+
+    unsigned char response[12];
+    if(!sent || !serverReadFully(descriptor, response, sizeof(response)) || memcmp(response, SERVER_RESPONSE_MAGIC, 4))
+    {
+        puts("Lost the connection to the compile server.");
+        close(descriptor);
+        return 1;
+    }
+    int status = (int)get32(response + 4);
+    uint32_t remaining = get32(response + 8);
+    char buffer[4096];
+    while(remaining)
+    {
+        size_t length = remaining < sizeof(buffer) ? remaining : sizeof(buffer);
+        if(!serverReadFully(descriptor, buffer, length))
+        {
+            puts("Lost the connection to the compile server.");
+            status = 1;
+            break;
+        }
+        fwrite(buffer, 1, length, stdout);
+        remaining -= (uint32_t)length;
+    }
+    close(descriptor);
+    return status;
+}
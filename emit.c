@@ -0,0 +1,661 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emit.h"
+#include "bytes.h"
+#include "alloc.h"
+
+#define OUTPUT_WRITER_DEFAULT_CAPACITY (1024 * 1024)
+
+const char *G_INSTRUCTION_MNEMONICS[] = {
+        "add",
+        "sub",
+        "subi",
+        "adc",
+        "addi",
+        "mov",
+        "movi",
+        "lhi",
+        "ori",
+        "push",
+        "ldr",
+        "sbc",
+        "str",
+        "pop",
+        "call",
+        "ret",
+        "jmp",
+        "bnz",
+        "shl",
+        "shr",
+        "sar",
+        "jmpt",
+        ".word",
+        "",
+        ".address",
+};
+
+const char *isaRegisterName(int registerNumber)
+{
+    static const char *names[] = {"r0", "r1", "r2", "r3", "r4", "bp", "r6", "r7", "sp", "r9", "r10", "r11", "r12",
+                                  "r13", "r14", "r15"};
+    if(registerNumber < 0 || registerNumber > 15) return "r?";
+    return names[registerNumber];
+}
+
+int instructionWordCount(Instruction *instruction)
+{
+    switch(instruction->type)
+    {
+        case IT_LABEL:
+            return 0;
+        case IT_CALL:
+        case IT_JMP:
+        case IT_BNZ:
+        case IT_ADDRESS:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+void outputWriterInit(OutputWriter *writer, FILE *file, size_t capacity)
+{
+    if(!capacity) capacity = OUTPUT_WRITER_DEFAULT_CAPACITY;
+    writer->file = file;
+    writer->buffer = countedMalloc(capacity);
+    writer->length = 0;
+    writer->capacity = capacity;
+    writer->failed = writer->buffer == NULL;
+}
+
+bool outputWriterFlush(OutputWriter *writer)
+{
+    if(writer->length && !writer->failed)
+    {
+        if(fwrite(writer->buffer, 1, writer->length, writer->file) != writer->length)
+            writer->failed = true;
+    }
+    writer->length = 0;
+    return !writer->failed;
+}
+
+void outputWriterPutChars(OutputWriter *writer, const char *chars, size_t length)
+{
+    if(writer->failed) return;
+    if(writer->length + length > writer->capacity)
+    {
+        outputWriterFlush(writer);
+        //Anything bigger than the whole buffer goes straight through
+        if(length > writer->capacity)
+        {
+            if(fwrite(chars, 1, length, writer->file) != length)
+                writer->failed = true;
+            return;
+        }
+    }
+    memcpy(writer->buffer + writer->length, chars, length);
+    writer->length += length;
+}
+
+void outputWriterPutString(OutputWriter *writer, const char *str)
+{
+    outputWriterPutChars(writer, str, strlen(str));
+}
+
+void outputWriterPutInt(OutputWriter *writer, long long value)
+{
+    char digits[24];
+    int length = 0;
+    unsigned long long magnitude = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+    do
+    {
+        digits[sizeof(digits) - 1 - length++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while(magnitude);
+    if(value < 0)
+        digits[sizeof(digits) - 1 - length++] = '-';
+    outputWriterPutChars(writer, digits + sizeof(digits) - length, length);
+}
+
+bool outputWriterClose(OutputWriter *writer)
+{
+    bool result = outputWriterFlush(writer);
+    free(writer->buffer);
+    writer->buffer = NULL;
+    return result;
+}
+
+static void putLabelName(OutputWriter *writer, LabelInstruction *label)
+{
+    if(label->symbol)
+    {
+        outputWriterPutChars(writer, label->symbol->tokenStr, label->symbol->tokenStrLength);
+        return;
+    }
+    outputWriterPutChars(writer, ".L", 2);
+    outputWriterPutInt(writer, label->labelId);
+}
+
+bool emitAssembly(InstructionPtrList *instructions, DataSection *data, FILE *file)
+{
+    OutputWriter writer;
+    outputWriterInit(&writer, file, 0);
+    for(int i = 0; i < instructions->length; i++)
+    {
+        Instruction *instruction = instructions->data[i];
+        if(instruction->type == IT_LABEL)
+        {
+            putLabelName(&writer, (LabelInstruction*)instruction);
+            outputWriterPutChars(&writer, ":\n", 2);
+            continue;
+        }
+        if(instruction->type == IT_ADDRESS)
+        {
+            //Written out as the two instructions it stands for
+            long long address = (data ? data->address : 0) + ((AddressInstruction*)instruction)->iValue;
+            outputWriterPutString(&writer, "    lhi ");
+            outputWriterPutInt(&writer, (address >> 8) & 0xFF);
+            outputWriterPutString(&writer, "\n    ori ");
+            outputWriterPutInt(&writer, address & 0xFF);
+            outputWriterPutChars(&writer, "\n", 1);
+            continue;
+        }
+        outputWriterPutChars(&writer, "    ", 4);
+        outputWriterPutString(&writer, G_INSTRUCTION_MNEMONICS[instruction->type]);
+        switch(instruction->type)
+        {
+            case IT_SUBI:
+            case IT_ADDI:
+            case IT_MOVI:
+            case IT_LHI:
+            case IT_ORI:
+                outputWriterPutChars(&writer, " ", 1);
+                outputWriterPutInt(&writer, ((struct InstructionImm*)instruction)->iValue);
+                break;
+            case IT_PUSH:
+                outputWriterPutChars(&writer, " ", 1);
+                outputWriterPutString(&writer, isaRegisterName(((PushInstruction*)instruction)->srcReg));
+                break;
+            case IT_POP:
+                outputWriterPutChars(&writer, " ", 1);
+                outputWriterPutString(&writer, isaRegisterName(((PopInstruction*)instruction)->dstReg));
+                break;
+            case IT_LDR:
+            {
+                LdrInstruction *ldr = (LdrInstruction*)instruction;
+                outputWriterPutChars(&writer, " ", 1);
+                outputWriterPutString(&writer, isaRegisterName(ldr->dstReg));
+                outputWriterPutChars(&writer, ", [", 3);
+                outputWriterPutString(&writer, isaRegisterName(ldr->srcReg));
+                outputWriterPutChars(&writer, "]", 1);
+                break;
+            }
+            case IT_STR:
+            {
+                StrInstruction *str = (StrInstruction*)instruction;
+                outputWriterPutChars(&writer, " [", 2);
+                outputWriterPutString(&writer, isaRegisterName(str->dstReg));
+                outputWriterPutChars(&writer, "], ", 3);
+                outputWriterPutString(&writer, isaRegisterName(str->srcReg));
+                break;
+            }
+            case IT_CALL:
+            case IT_JMP:
+            case IT_WORD:
+                outputWriterPutChars(&writer, " ", 1);
+                putLabelName(&writer, (LabelInstruction*)instruction);
+                break;
+            case IT_JMPT:
+                outputWriterPutChars(&writer, " ", 1);
+                outputWriterPutString(&writer, isaRegisterName(((JmptInstruction*)instruction)->srcReg));
+                break;
+            case IT_BNZ:
+                outputWriterPutChars(&writer, " ", 1);
+                outputWriterPutString(&writer, isaRegisterName(((BnzInstruction*)instruction)->srcReg));
+                outputWriterPutChars(&writer, ", ", 2);
+                putLabelName(&writer, (LabelInstruction*)instruction);
+                break;
+            case IT_RET:
+                break;
+            case IT_SHL:
+            case IT_SHR:
+            case IT_SAR:
+            {
+                ShiftInstruction *shift = (ShiftInstruction*)instruction;
+                outputWriterPutChars(&writer, " ", 1);
+                outputWriterPutString(&writer, isaRegisterName(shift->dstReg));
+                outputWriterPutChars(&writer, ", ", 2);
+                outputWriterPutInt(&writer, shift->srcReg);
+                break;
+            }
+            default:
+            {
+                struct InstructionRegReg *regReg = (struct InstructionRegReg*)instruction;
+                outputWriterPutChars(&writer, " ", 1);
+                outputWriterPutString(&writer, isaRegisterName(regReg->dstReg));
+                outputWriterPutChars(&writer, ", ", 2);
+                outputWriterPutString(&writer, isaRegisterName(regReg->srcReg));
+                break;
+            }
+        }
+        outputWriterPutChars(&writer, "\n", 1);
+    }
+    //Static data follows the code, one word per line
+    if(data && data->length)
+    {
+        outputWriterPutString(&writer, ".data ");
+        outputWriterPutInt(&writer, data->address);
+        outputWriterPutChars(&writer, ":\n", 2);
+        for(uint32_t i = 0; i < data->length; i++)
+        {
+            outputWriterPutChars(&writer, "    .word ", 10);
+            outputWriterPutInt(&writer, data->words[i]);
+            outputWriterPutChars(&writer, "\n", 1);
+        }
+    }
+    return outputWriterClose(&writer);
+}
+
+//Function symbols by name, open addressing with linear probing
+typedef struct
+{
+    Token **names;
+    uint32_t *addresses;
+    //Position of the symbol in the symbol table of an object
+    uint32_t *indices;
+    unsigned int mask;
+} SymbolTable;
+
+static unsigned int symbolHash(const char *str, int length)
+{
+    unsigned int hash = 2166136261u;
+    for(int i = 0; i < length; i++)
+        hash = (hash ^ (unsigned char)str[i]) * 16777619u;
+    return hash;
+}
+
+static int symbolSlot(SymbolTable *table, Token *name)
+{
+    unsigned int index = symbolHash(name->tokenStr, name->tokenStrLength) & table->mask;
+    while(table->names[index])
+    {
+        Token *existing = table->names[index];
+        if(existing->tokenStrLength == name->tokenStrLength &&
+           !memcmp(existing->tokenStr, name->tokenStr, name->tokenStrLength))
+            break;
+        index = (index + 1) & table->mask;
+    }
+    return (int)index;
+}
+
+//Addresses of the labels and functions of a unit, counted from its first instruction
+typedef struct
+{
+    uint32_t *labelAddresses;
+    SymbolTable symbols;
+    //Functions the unit defines, in the order they come
+    Token **defined;
+    int definedCount;
+    uint32_t codeWords;
+} CodeLayout;
+
+static void codeLayoutInit(CodeLayout *layout, InstructionPtrList *instructions)
+{
+    //Room for every symbol an instruction names, so objects can add the functions they call
+    int symbolReferences = 0;
+    int maxLabel = -1;
+    layout->codeWords = 0;
+    for(int i = 0; i < instructions->length; i++)
+    {
+        Instruction *instruction = instructions->data[i];
+        if(instruction->type == IT_LABEL || instruction->type == IT_CALL || instruction->type == IT_JMP ||
+           instruction->type == IT_BNZ)
+        {
+            LabelInstruction *label = (LabelInstruction*)instruction;
+            if(label->symbol) symbolReferences++;
+            if(label->labelId > maxLabel) maxLabel = label->labelId;
+        }
+        layout->codeWords += instructionWordCount(instruction);
+    }
+    layout->labelAddresses = countedMalloc(sizeof(uint32_t) * (maxLabel + 2));
+    unsigned int symbolCapacity = 16;
+    while(symbolCapacity < (unsigned int)symbolReferences * 2) symbolCapacity *= 2;
+    layout->symbols.names = countedCalloc(symbolCapacity, sizeof(Token*));
+    layout->symbols.addresses = countedCalloc(symbolCapacity, sizeof(uint32_t));
+    layout->symbols.indices = countedCalloc(symbolCapacity, sizeof(uint32_t));
+    layout->symbols.mask = symbolCapacity - 1;
+    layout->defined = countedMalloc(sizeof(Token*) * (symbolReferences + 1));
+    layout->definedCount = 0;
+
+    uint32_t address = 0;
+    for(int i = 0; i < instructions->length; i++)
+    {
+        Instruction *instruction = instructions->data[i];
+        if(instruction->type == IT_LABEL)
+        {
+            LabelInstruction *label = (LabelInstruction*)instruction;
+            if(label->labelId >= 0)
+                layout->labelAddresses[label->labelId] = address;
+            if(label->symbol)
+            {
+                int slot = symbolSlot(&layout->symbols, label->symbol);
+                layout->symbols.names[slot] = label->symbol;
+                layout->symbols.addresses[slot] = address;
+                layout->symbols.indices[slot] = (uint32_t)layout->definedCount;
+                layout->defined[layout->definedCount++] = label->symbol;
+            }
+        }
+        address += instructionWordCount(instruction);
+    }
+}
+
+static void codeLayoutFree(CodeLayout *layout)
+{
+    free(layout->defined);
+    free(layout->symbols.indices);
+    free(layout->symbols.addresses);
+    free(layout->symbols.names);
+    free(layout->labelAddresses);
+}
+
+//A word of an object's code the linker adjusts
+typedef struct
+{
+    uint32_t offset;
+    RelocationKind kind;
+    Token *symbol;
+} PendingRelocation;
+
+typedef struct
+{
+    PendingRelocation *data;
+    int length;
+    int capacity;
+} RelocationList;
+
+static void noteRelocation(RelocationList *relocations, uint32_t offset, RelocationKind kind, Token *symbol)
+{
+    if(relocations->length == relocations->capacity)
+    {
+        relocations->capacity = relocations->capacity * 2 + 64;
+        relocations->data = countedRealloc(relocations->data, sizeof(PendingRelocation) * relocations->capacity);
+    }
+    relocations->data[relocations->length++] = (PendingRelocation){offset, kind, symbol};
+}
+
+/*
+Encodes the instructions into code, with data addresses counted from dataAddress. When relocations is not NULL
+every word that depends on where the code and data end up is noted in it, and calls are left for the linker to
+fill in. Otherwise calls of functions the unit does not define are reported to log.
+*/
+static bool encodeCode(InstructionPtrList *instructions, CodeLayout *layout, uint32_t dataAddress,
+                       unsigned char *code, RelocationList *relocations, FILE *log)
+{
+    bool result = true;
+    uint32_t address = 0;
+    for(int i = 0; i < instructions->length && result; i++)
+    {
+        Instruction *instruction = instructions->data[i];
+        uint32_t opcode = (uint32_t)instruction->type << 8;
+        switch(instruction->type)
+        {
+            case IT_LABEL:
+                continue;
+            case IT_SUBI:
+            case IT_ADDI:
+            case IT_MOVI:
+            case IT_LHI:
+            case IT_ORI:
+            {
+                long long iValue = ((struct InstructionImm*)instruction)->iValue;
+                if(iValue < 0 || iValue > ISA_IMMEDIATE_MAX)
+                {
+                    fprintf(log, "Immediate %lld out of range for %s\n", iValue,
+                            G_INSTRUCTION_MNEMONICS[instruction->type]);
+                    result = false;
+                    continue;
+                }
+                put16(code + address * 2, opcode | (uint32_t)iValue);
+                break;
+            }
+            case IT_CALL:
+            case IT_JMP:
+            case IT_BNZ:
+            {
+                LabelInstruction *branch = (LabelInstruction*)instruction;
+                uint32_t target = 0;
+                if(branch->symbol && relocations)
+                {
+                    noteRelocation(relocations, address + 1, RELOCATION_SYMBOL, branch->symbol);
+                }
+                else if(branch->symbol)
+                {
+                    int slot = symbolSlot(&layout->symbols, branch->symbol);
+                    if(!layout->symbols.names[slot])
+                    {
+                        fprintf(log, "Undefined function '%.*s'\n", branch->symbol->tokenStrLength,
+                                branch->symbol->tokenStr);
+                        result = false;
+                        continue;
+                    }
+                    target = layout->symbols.addresses[slot];
+                }
+                else
+                {
+                    target = layout->labelAddresses[branch->labelId];
+                    if(relocations)
+                        noteRelocation(relocations, address + 1, RELOCATION_CODE, NULL);
+                }
+                put16(code + address * 2, opcode | (uint32_t)(branch->srcReg & 0xF));
+                put16(code + address * 2 + 2, target);
+                break;
+            }
+            case IT_WORD:
+                put16(code + address * 2, layout->labelAddresses[((WordInstruction*)instruction)->labelId]);
+                if(relocations)
+                    noteRelocation(relocations, address, RELOCATION_CODE, NULL);
+                break;
+            case IT_ADDRESS:
+            {
+                uint32_t target = dataAddress + (uint32_t)((AddressInstruction*)instruction)->iValue;
+                put16(code + address * 2, (uint32_t)IT_LHI << 8 | (target >> 8 & 0xFF));
+                put16(code + address * 2 + 2, (uint32_t)IT_ORI << 8 | (target & 0xFF));
+                if(relocations)
+                    noteRelocation(relocations, address, RELOCATION_DATA, NULL);
+                break;
+            }
+            case IT_RET:
+                put16(code + address * 2, opcode);
+                break;
+            default:
+            {
+                struct InstructionRegReg *regReg = (struct InstructionRegReg*)instruction;
+                put16(code + address * 2, opcode | (uint32_t)(regReg->dstReg & 0xF) << 4 | (uint32_t)(regReg->srcReg & 0xF));
+                break;
+            }
+        }
+        address += instructionWordCount(instruction);
+    }
+    return result;
+}
+
+//Writes the profile ranges after the strings at stringCursor, with counter addresses counted from dataAddress
+static void putProfileRanges(unsigned char *entries, ProfileCounterRange *profileRanges, int profileRangeCount,
+                             uint32_t dataAddress, unsigned char *strings, uint32_t *stringCursor)
+{
+    for(int i = 0; i < profileRangeCount; i++)
+    {
+        ProfileCounterRange *range = &profileRanges[i];
+        unsigned char *entry = entries + i * sizeof(BinaryProfileRange);
+        put32(entry, *stringCursor);
+        put32(entry + 4, range->name->tokenStrLength);
+        put32(entry + 8, range->checksum);
+        put32(entry + 12, dataAddress + range->counterOffset);
+        put32(entry + 16, range->counterCount);
+        memcpy(strings + *stringCursor, range->name->tokenStr, range->name->tokenStrLength);
+        *stringCursor += range->name->tokenStrLength;
+    }
+}
+
+bool emitBinary(InstructionPtrList *instructions, DataSection *data, ProfileCounterRange *profileRanges,
+                int profileRangeCount, FILE *file, FILE *log)
+{
+    CodeLayout layout;
+    codeLayoutInit(&layout, instructions);
+    uint32_t stringBytes = 0;
+    for(int i = 0; i < layout.definedCount; i++)
+        stringBytes += layout.defined[i]->tokenStrLength;
+    for(int i = 0; i < profileRangeCount; i++)
+        stringBytes += profileRanges[i].name->tokenStrLength;
+
+    uint32_t symbolCount = (uint32_t)layout.definedCount;
+    uint32_t codeWords = layout.codeWords;
+    uint32_t codeOffset = align8(sizeof(BinaryHeader));
+    uint32_t symbolOffset = align8(codeOffset + codeWords * 2);
+    uint32_t profileRangeOffset = symbolOffset + symbolCount * (uint32_t)sizeof(BinarySymbol);
+    uint32_t stringOffset = profileRangeOffset + profileRangeCount * (uint32_t)sizeof(BinaryProfileRange);
+    uint32_t dataOffset = align8(stringOffset + stringBytes);
+    uint32_t dataWords = data ? data->length : 0;
+    uint32_t dataAddress = data ? data->address : 0;
+    uint32_t imageSize = align8(dataOffset + dataWords * 2);
+    unsigned char *image = countedCalloc(imageSize, 1);
+
+    memcpy(image, BINARY_MAGIC, 4);
+    put32(image + 4, BINARY_VERSION);
+    put32(image + 8, codeOffset);
+    put32(image + 12, codeWords);
+    put32(image + 16, symbolOffset);
+    put32(image + 20, symbolCount);
+    put32(image + 24, stringOffset);
+    put32(image + 28, stringBytes);
+    put32(image + 32, profileRangeOffset);
+    put32(image + 36, (uint32_t)profileRangeCount);
+    put32(image + 40, dataOffset);
+    put32(image + 44, dataAddress);
+    put32(image + 48, dataWords);
+
+    bool result = encodeCode(instructions, &layout, dataAddress, image + codeOffset, NULL, log);
+
+    uint32_t stringCursor = 0;
+    for(uint32_t i = 0; i < symbolCount; i++)
+    {
+        Token *name = layout.defined[i];
+        unsigned char *symbol = image + symbolOffset + i * sizeof(BinarySymbol);
+        put32(symbol, stringCursor);
+        put32(symbol + 4, name->tokenStrLength);
+        put32(symbol + 8, layout.symbols.addresses[symbolSlot(&layout.symbols, name)]);
+        memcpy(image + stringOffset + stringCursor, name->tokenStr, name->tokenStrLength);
+        stringCursor += name->tokenStrLength;
+    }
+    putProfileRanges(image + profileRangeOffset, profileRanges, profileRangeCount, dataAddress,
+                     image + stringOffset, &stringCursor);
+    for(uint32_t i = 0; i < dataWords; i++)
+        put16(image + dataOffset + i * 2, data->words[i]);
+
+    //The whole image goes out in a single write
+    if(result && fwrite(image, 1, imageSize, file) != imageSize)
+        result = false;
+
+    free(image);
+    codeLayoutFree(&layout);
+    return result;
+}
+
+bool emitObject(InstructionPtrList *instructions, DataSection *data, ProfileCounterRange *profileRanges,
+                int profileRangeCount, bool (*isShared)(const Token *symbol), FILE *file, FILE *log)
+{
+    CodeLayout layout;
+    codeLayoutInit(&layout, instructions);
+    uint32_t codeWords = layout.codeWords;
+    unsigned char *code = countedCalloc(codeWords ? codeWords * 2 : 1, 1);
+    RelocationList relocations = {0};
+    bool result = encodeCode(instructions, &layout, 0, code, &relocations, log);
+
+    //The functions the unit calls without defining them follow the ones it defines
+    Token **symbols = countedMalloc(sizeof(Token*) * (layout.definedCount + relocations.length + 1));
+    memcpy(symbols, layout.defined, sizeof(Token*) * layout.definedCount);
+    uint32_t symbolCount = (uint32_t)layout.definedCount;
+    uint32_t stringBytes = 0;
+    for(int i = 0; i < relocations.length; i++)
+    {
+        Token *name = relocations.data[i].symbol;
+        if(!name) continue;
+        int slot = symbolSlot(&layout.symbols, name);
+        if(layout.symbols.names[slot]) continue;
+        layout.symbols.names[slot] = name;
+        layout.symbols.indices[slot] = symbolCount;
+        symbols[symbolCount++] = name;
+    }
+    for(uint32_t i = 0; i < symbolCount; i++)
+        stringBytes += symbols[i]->tokenStrLength;
+    for(int i = 0; i < profileRangeCount; i++)
+        stringBytes += profileRanges[i].name->tokenStrLength;
+
+    uint32_t dataWords = data ? data->length : 0;
+    uint32_t relocationCount = (uint32_t)relocations.length;
+    uint32_t codeOffset = align8(sizeof(ObjectHeader));
+    uint32_t dataOffset = align8(codeOffset + codeWords * 2);
+    uint32_t symbolOffset = align8(dataOffset + dataWords * 2);
+    uint32_t relocationOffset = symbolOffset + symbolCount * (uint32_t)sizeof(ObjectSymbol);
+    uint32_t profileRangeOffset = relocationOffset + relocationCount * (uint32_t)sizeof(ObjectRelocation);
+    uint32_t stringOffset = profileRangeOffset + profileRangeCount * (uint32_t)sizeof(BinaryProfileRange);
+    uint32_t objectSize = align8(stringOffset + stringBytes);
+    unsigned char *object = countedCalloc(objectSize, 1);
+
+    memcpy(object, OBJECT_MAGIC, 4);
+    put32(object + 4, OBJECT_VERSION);
+    put32(object + 8, codeOffset);
+    put32(object + 12, codeWords);
+    put32(object + 16, dataOffset);
+    put32(object + 20, dataWords);
+    put32(object + 24, symbolOffset);
+    put32(object + 28, symbolCount);
+    put32(object + 32, relocationOffset);
+    put32(object + 36, relocationCount);
+    put32(object + 40, profileRangeOffset);
+    put32(object + 44, (uint32_t)profileRangeCount);
+    put32(object + 48, stringOffset);
+    put32(object + 52, stringBytes);
+
+    memcpy(object + codeOffset, code, codeWords * 2);
+    for(uint32_t i = 0; i < dataWords; i++)
+        put16(object + dataOffset + i * 2, data->words[i]);
+    uint32_t stringCursor = 0;
+    for(uint32_t i = 0; i < symbolCount; i++)
+    {
+        Token *name = symbols[i];
+        unsigned char *symbol = object + symbolOffset + i * sizeof(ObjectSymbol);
+        bool defined = i < (uint32_t)layout.definedCount;
+        uint32_t flags = defined ? OBJECT_SYMBOL_DEFINED : 0;
+        if(defined && isShared && isShared(name))
+            flags |= OBJECT_SYMBOL_SHARED;
+        put32(symbol, stringCursor);
+        put32(symbol + 4, name->tokenStrLength);
+        put32(symbol + 8, flags);
+        put32(symbol + 12, defined ? layout.symbols.addresses[symbolSlot(&layout.symbols, name)] : 0);
+        memcpy(object + stringOffset + stringCursor, name->tokenStr, name->tokenStrLength);
+        stringCursor += name->tokenStrLength;
+    }
+    for(uint32_t i = 0; i < relocationCount; i++)
+    {
+        PendingRelocation *relocation = &relocations.data[i];
+        unsigned char *entry = object + relocationOffset + i * sizeof(ObjectRelocation);
+        put32(entry, relocation->offset);
+        put32(entry + 4, relocation->kind);
+        if(relocation->symbol)
+            put32(entry + 8, layout.symbols.indices[symbolSlot(&layout.symbols, relocation->symbol)]);
+    }
+    putProfileRanges(object + profileRangeOffset, profileRanges, profileRangeCount, 0, object + stringOffset,
+                     &stringCursor);
+
+    if(result && fwrite(object, 1, objectSize, file) != objectSize)
+        result = false;
+
+    free(object);
+    free(symbols);
+    free(relocations.data);
+    free(code);
+    codeLayoutFree(&layout);
+    return result;
+}
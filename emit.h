@@ -0,0 +1,187 @@
+#ifndef CCOMPILER_EMIT_H
+#define CCOMPILER_EMIT_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "isa.h"
+
+//Accumulates output in one large buffer and hands it to stdio in big chunks.
+typedef struct
+{
+    FILE *file;
+    char *buffer;
+    size_t length;
+    size_t capacity;
+    bool failed;
+} OutputWriter;
+
+extern void outputWriterInit(OutputWriter *writer, FILE *file, size_t capacity);
+extern void outputWriterPutChars(OutputWriter *writer, const char *chars, size_t length);
+extern void outputWriterPutString(OutputWriter *writer, const char *str);
+extern void outputWriterPutInt(OutputWriter *writer, long long value);
+extern bool outputWriterFlush(OutputWriter *writer);
+//Flushes and releases the buffer. Returns false if any write failed.
+extern bool outputWriterClose(OutputWriter *writer);
+
+/*
+Binary program image. All fields are little endian and every section starts 8 byte aligned, so a loader can mmap
+the file and index the code and symbol tables in place.
+    BinaryHeader
+    uint16_t code[codeWords]
+    BinarySymbol symbols[symbolCount]
+    BinaryProfileRange profileRanges[profileRangeCount]
+    char strings[stringBytes]
+    uint16_t data[dataWords]
+Images of programs built without -fprofile-generate have no profile ranges. The data section holds the tables a
+program defines at file scope and is copied to data memory at dataAddress before the program starts. Loaders go by
+the offsets in the header: cclink puts the data right after the code, so both keep their place when it relinks.
+*/
+#define BINARY_MAGIC "CCBN"
+#define BINARY_VERSION 3
+//Data address of the static data, clear of the null pointer. Profile counters follow the tables.
+#define BINARY_DATA_ADDRESS 0x100
+//End of the static data, which leaves the stack the upper half of data memory
+#define BINARY_DATA_LIMIT 0x8000
+
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t codeOffset;
+    uint32_t codeWords;
+    uint32_t symbolOffset;
+    uint32_t symbolCount;
+    uint32_t stringOffset;
+    uint32_t stringBytes;
+    uint32_t profileRangeOffset;
+    uint32_t profileRangeCount;
+    uint32_t dataOffset;
+    uint32_t dataAddress;
+    uint32_t dataWords;
+    uint32_t reserved;
+} BinaryHeader;
+
+typedef struct
+{
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    //Word address of the function entry in the code section
+    uint32_t address;
+    uint32_t reserved;
+} BinarySymbol;
+
+//Block counters of a function, see profile.h. The name is in the string section like those of the symbols.
+typedef struct
+{
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t checksum;
+    //Data address of the counter of block 0, the others follow two words apart
+    uint32_t counterAddress;
+    uint32_t counterCount;
+    uint32_t reserved;
+} BinaryProfileRange;
+
+//What emitBinary writes as a BinaryProfileRange
+typedef struct
+{
+    Token *name;
+    uint32_t checksum;
+    //Offset of the counter of block 0 in the data section
+    uint32_t counterOffset;
+    uint32_t counterCount;
+} ProfileCounterRange;
+
+/*
+Relocatable object, written with -c and combined with others into a program image by cclink, see link.h. The same
+conventions as the image apply.
+    ObjectHeader
+    uint16_t code[codeWords]
+    uint16_t data[dataWords]
+    ObjectSymbol symbols[symbolCount]
+    ObjectRelocation relocations[relocationCount]
+    BinaryProfileRange profileRanges[profileRangeCount]
+    char strings[stringBytes]
+Code addresses in the code count from the object's first word and data addresses from the first word of its data,
+as do the counterAddress fields of the profile ranges. The relocations say which words the linker has to adjust once
+it has placed the sections.
+*/
+#define OBJECT_MAGIC "CCOB"
+#define OBJECT_VERSION 1
+
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t codeOffset;
+    uint32_t codeWords;
+    uint32_t dataOffset;
+    uint32_t dataWords;
+    uint32_t symbolOffset;
+    uint32_t symbolCount;
+    uint32_t relocationOffset;
+    uint32_t relocationCount;
+    uint32_t profileRangeOffset;
+    uint32_t profileRangeCount;
+    uint32_t stringOffset;
+    uint32_t stringBytes;
+} ObjectHeader;
+
+//Set for the functions the object defines, the others are called by it and defined elsewhere
+#define OBJECT_SYMBOL_DEFINED 1
+//Runtime routines every object that calls them carries a copy of. The linker keeps the first and drops the rest.
+#define OBJECT_SYMBOL_SHARED 2
+
+typedef struct
+{
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t flags;
+    //Word address of the function entry in the object's code, 0 for undefined symbols
+    uint32_t address;
+} ObjectSymbol;
+
+typedef enum
+{
+    //The word holds a code address counted from the object's first word
+    RELOCATION_CODE,
+    //The word is the address of the function named by symbol
+    RELOCATION_SYMBOL,
+    //The word and the next are the LHI and ORI loading a data address counted from the object's first data word
+    RELOCATION_DATA
+} RelocationKind;
+
+typedef struct
+{
+    //Word in the object's code
+    uint32_t offset;
+    uint32_t kind;
+    //Index into the symbols for RELOCATION_SYMBOL
+    uint32_t symbol;
+    uint32_t reserved;
+} ObjectRelocation;
+
+//Words of static data and the address they are loaded at
+typedef struct
+{
+    uint16_t *words;
+    uint32_t length;
+    uint32_t capacity;
+    uint32_t address;
+} DataSection;
+
+extern const char *G_INSTRUCTION_MNEMONICS[];
+extern const char *isaRegisterName(int registerNumber);
+extern int instructionWordCount(Instruction *instruction);
+
+//data may be NULL, as may profileRanges when profileRangeCount is 0
+extern bool emitAssembly(InstructionPtrList *instructions, DataSection *data, FILE *file);
+//Unresolved calls and out of range immediates are reported to log
+extern bool emitBinary(InstructionPtrList *instructions, DataSection *data, ProfileCounterRange *profileRanges,
+                       int profileRangeCount, FILE *file, FILE *log);
+//Writes a relocatable object instead of an image. Calls of functions the unit does not define are left to the
+//linker. Defined symbols isShared returns true for are marked OBJECT_SYMBOL_SHARED.
+extern bool emitObject(InstructionPtrList *instructions, DataSection *data, ProfileCounterRange *profileRanges,
+                       int profileRangeCount, bool (*isShared)(const Token *symbol), FILE *file, FILE *log);
+
+#endif //CCOMPILER_EMIT_H
@@ -0,0 +1,168 @@
+#include <stdlib.h>
+#include <string.h>
+#include "frame.h"
+#include "alloc.h"
+
+listDefine(FrameSlot, FrameSlotList);
+
+typedef struct
+{
+    int width;
+    //Last position at which the region is occupied
+    int busyUntil;
+    int accessCount;
+    int bpRelativeAddress;
+} FrameRegion;
+
+//Min-heap of region indices ordered by busyUntil, one per shareable width
+typedef struct
+{
+    int *items;
+    int length;
+} RegionHeap;
+
+static void heapPush(RegionHeap *heap, FrameRegion *regions, int region)
+{
+    int i = heap->length++;
+    heap->items[i] = region;
+    while(i > 0)
+    {
+        int parent = (i - 1) / 2;
+        if(regions[heap->items[parent]].busyUntil <= regions[heap->items[i]].busyUntil) break;
+        int swap = heap->items[parent];
+        heap->items[parent] = heap->items[i];
+        heap->items[i] = swap;
+        i = parent;
+    }
+}
+
+static int heapPop(RegionHeap *heap, FrameRegion *regions)
+{
+    int top = heap->items[0];
+    heap->items[0] = heap->items[--heap->length];
+    int i = 0;
+    while(true)
+    {
+        int smallest = i;
+        int left = i * 2 + 1;
+        int right = left + 1;
+        if(left < heap->length && regions[heap->items[left]].busyUntil < regions[heap->items[smallest]].busyUntil)
+            smallest = left;
+        if(right < heap->length && regions[heap->items[right]].busyUntil < regions[heap->items[smallest]].busyUntil)
+            smallest = right;
+        if(smallest == i) break;
+        int swap = heap->items[smallest];
+        heap->items[smallest] = heap->items[i];
+        heap->items[i] = swap;
+        i = smallest;
+    }
+    return top;
+}
+
+void frameLayoutInit(FrameLayout *layout)
+{
+    layout->slots = listInitFrameSlotList(NULL, 16);
+    layout->frameSize = 0;
+    layout->regionCount = 0;
+}
+
+void frameLayoutDispose(FrameLayout *layout)
+{
+    listFreeFrameSlotList(&layout->slots);
+}
+
+int frameLayoutAddSlot(FrameLayout *layout, int width, int start, int end, int accessCount)
+{
+    FrameSlot slot = {0};
+    slot.width = width;
+    slot.start = start;
+    slot.end = end;
+    slot.accessCount = accessCount;
+    slot.region = -1;
+    listPushFrameSlotList(&layout->slots, slot);
+    return layout->slots.length - 1;
+}
+
+//Sort keys carry their index so qsort needs no shared state
+typedef struct
+{
+    int key;
+    int index;
+} SortEntry;
+
+static int compareSortEntry(const void *a, const void *b)
+{
+    const SortEntry *left = a;
+    const SortEntry *right = b;
+    if(left->key != right->key) return left->key < right->key ? -1 : 1;
+    return left->index - right->index;
+}
+
+/*
+Greedy interval colouring per width: slots are visited by start position and take over the region of the same width
+that became free earliest, if it is free by then. This uses the minimum number of regions for each width.
+*/
+void frameLayoutAssign(FrameLayout *layout)
+{
+    int slotCount = layout->slots.length;
+    FrameSlot *slots = layout->slots.data;
+    layout->frameSize = 0;
+    layout->regionCount = 0;
+    if(!slotCount) return;
+
+    SortEntry *order = countedMalloc(sizeof(SortEntry) * slotCount);
+    for(int i = 0; i < slotCount; i++)
+        order[i] = (SortEntry){slots[i].start, i};
+    qsort(order, slotCount, sizeof(SortEntry), compareSortEntry);
+
+    FrameRegion *regions = countedMalloc(sizeof(FrameRegion) * slotCount);
+    RegionHeap heaps[FRAME_MAX_SHARED_WIDTH + 1];
+    for(int w = 0; w <= FRAME_MAX_SHARED_WIDTH; w++)
+    {
+        heaps[w].items = countedMalloc(sizeof(int) * slotCount);
+        heaps[w].length = 0;
+    }
+
+    int regionCount = 0;
+    for(int i = 0; i < slotCount; i++)
+    {
+        FrameSlot *slot = &slots[order[i].index];
+        int region = -1;
+        bool shareable = slot->width <= FRAME_MAX_SHARED_WIDTH;
+        RegionHeap *heap = shareable ? &heaps[slot->width] : NULL;
+        if(heap && heap->length && regions[heap->items[0]].busyUntil < slot->start)
+            region = heapPop(heap, regions);
+        if(region < 0)
+        {
+            region = regionCount++;
+            regions[region].width = slot->width;
+            regions[region].accessCount = 0;
+        }
+        regions[region].busyUntil = slot->end;
+        regions[region].accessCount += slot->accessCount;
+        slot->region = region;
+        if(heap)
+            heapPush(heap, regions, region);
+    }
+
+    //Most accessed regions go nearest bp so their offsets stay within a single immediate
+    SortEntry *regionOrder = countedMalloc(sizeof(SortEntry) * regionCount);
+    for(int r = 0; r < regionCount; r++)
+        regionOrder[r] = (SortEntry){-regions[r].accessCount, r};
+    qsort(regionOrder, regionCount, sizeof(SortEntry), compareSortEntry);
+    for(int r = 0; r < regionCount; r++)
+    {
+        FrameRegion *region = &regions[regionOrder[r].index];
+        region->bpRelativeAddress = layout->frameSize + 1;
+        layout->frameSize += region->width;
+    }
+    for(int i = 0; i < slotCount; i++)
+        slots[i].bpRelativeAddress = regions[slots[i].region].bpRelativeAddress;
+    layout->regionCount = regionCount;
+
+    for(int w = 0; w <= FRAME_MAX_SHARED_WIDTH; w++)
+        free(heaps[w].items);
+    free(regionOrder);
+    free(regions);
+    free(order);
+}
@@ -0,0 +1,38 @@
+#ifndef CCOMPILER_FRAME_H
+#define CCOMPILER_FRAME_H
+#include <stdbool.h>
+#include "vec.h"
+
+//Widest value that can share a frame region with others, wider slots always get a region of their own
+#define FRAME_MAX_SHARED_WIDTH 4
+
+/*
+A value that needs a home in the stack frame for the positions [start, end] of the linearized function.
+Slots of the same width whose lifetimes do not overlap are packed into the same region of the frame.
+*/
+typedef struct
+{
+    int width;
+    int start;
+    int end;
+    int accessCount;
+    int region;
+    //Assigned by frameLayoutAssign, same meaning as AstNodeValue.bpRelativeAddress
+    int bpRelativeAddress;
+} FrameSlot;
+listDeclare(FrameSlot, FrameSlotList);
+
+typedef struct
+{
+    FrameSlotList slots;
+    //Words between bp and sp once the prologue ran
+    int frameSize;
+    int regionCount;
+} FrameLayout;
+
+extern void frameLayoutInit(FrameLayout *layout);
+extern void frameLayoutDispose(FrameLayout *layout);
+extern int frameLayoutAddSlot(FrameLayout *layout, int width, int start, int end, int accessCount);
+extern void frameLayoutAssign(FrameLayout *layout);
+
+#endif //CCOMPILER_FRAME_H
@@ -0,0 +1,1042 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ir.h"
+#include "alloc.h"
+
+//Zeroed memory that lives as long as the function
+static void *irAllocate(IrFunction *fn, size_t size)
+{
+    return allocatorAllocateZeroed(fn->allocator, size);
+}
+
+IrFunction *irFunctionCreate(Allocator *allocator, Token *name, int paramCount)
+{
+    IrFunction *fn = allocatorAllocateZeroed(allocator, sizeof(IrFunction));
+    fn->allocator = allocator;
+    fn->name = name;
+    fn->paramCount = paramCount;
+    fn->returnWidth = 1;
+    fn->returnSigned = true;
+    if(paramCount)
+        fn->paramWidths = irAllocate(fn, sizeof(int) * paramCount);
+    fn->entry = irBlockCreate(fn);
+    irSealBlock(fn->entry);
+    fn->currentBlock = fn->entry;
+    return fn;
+}
+
+IrBlock *irBlockCreate(IrFunction *fn)
+{
+    IrBlock *block = irAllocate(fn, sizeof(IrBlock));
+    block->id = fn->blockCount++;
+    block->function = fn;
+    block->rpoIndex = -1;
+    if(fn->lastBlock)
+        fn->lastBlock->next = block;
+    else
+        fn->entry = block;
+    fn->lastBlock = block;
+    return block;
+}
+
+void irMoveBlockToEnd(IrFunction *fn, IrBlock *block)
+{
+    if(fn->lastBlock == block) return;
+    IrBlock *previous = fn->entry;
+    while(previous->next != block)
+        previous = previous->next;
+    previous->next = block->next;
+    block->next = NULL;
+    fn->lastBlock->next = block;
+    fn->lastBlock = block;
+}
+
+void irSetBlock(IrFunction *fn, IrBlock *block)
+{
+    fn->currentBlock = block;
+    fn->insertionPoint = NULL;
+}
+
+void irSetInsertionPoint(IrFunction *fn, IrInstr *instr)
+{
+    fn->insertionPoint = instr;
+}
+
+int irFrameSlotCreate(IrFunction *fn, int width)
+{
+    if(fn->slotCount == fn->slotCapacity)
+    {
+        int newCapacity = fn->slotCapacity * 2 + 4;
+        int *newSlots = irAllocate(fn, sizeof(int) * newCapacity);
+        if(fn->slotCount)
+            memcpy(newSlots, fn->slotWidths, sizeof(int) * fn->slotCount);
+        fn->slotWidths = newSlots;
+        fn->slotCapacity = newCapacity;
+    }
+    fn->slotWidths[fn->slotCount] = width;
+    return fn->slotCount++;
+}
+
+bool irBlockTerminated(IrBlock *block)
+{
+    if(!block->last) return false;
+    IrOpcode op = block->last->opcode;
+    return op == IROP_JMP || op == IROP_BRANCH || op == IROP_SWITCH || op == IROP_RET;
+}
+
+int irBlockSuccessors(IrBlock *block, IrBlock ***successors)
+{
+    if(!block->last) return 0;
+    *successors = block->last->targets;
+    return block->last->targetCount;
+}
+
+static void blockAddPred(IrBlock *block, IrBlock *pred)
+{
+    IrFunction *fn = block->function;
+    if(block->predCount == block->predCapacity)
+    {
+        int newCapacity = block->predCapacity * 2 + 2;
+        IrBlock **newPreds = irAllocate(fn, sizeof(IrBlock*) * newCapacity);
+        if(block->predCount)
+            memcpy(newPreds, block->preds, sizeof(IrBlock*) * block->predCount);
+        block->preds = newPreds;
+        block->predCapacity = newCapacity;
+    }
+    block->preds[block->predCount++] = pred;
+}
+
+void irInstrAddOperand(IrFunction *fn, IrInstr *instr, IrInstr *operand)
+{
+    if(instr->operandCount == instr->operandCapacity)
+    {
+        int newCapacity = instr->operandCapacity * 2 + 2;
+        IrInstr **newOperands = irAllocate(fn, sizeof(IrInstr*) * newCapacity);
+        if(instr->operandCount)
+            memcpy(newOperands, instr->operands, sizeof(IrInstr*) * instr->operandCount);
+        instr->operands = newOperands;
+        instr->operandCapacity = newCapacity;
+    }
+    instr->operands[instr->operandCount++] = operand;
+}
+
+static IrInstr *instrCreate(IrFunction *fn, IrOpcode opcode, int width, bool isSigned)
+{
+    IrInstr *instr = irAllocate(fn, sizeof(IrInstr));
+    instr->opcode = opcode;
+    instr->width = width;
+    instr->isSigned = isSigned;
+    instr->variable = -1;
+    if(width > 0)
+        instr->vreg = ++fn->vregCount;
+    return instr;
+}
+
+static void instrSetTargetCount(IrFunction *fn, IrInstr *instr, int count)
+{
+    instr->targets = irAllocate(fn, sizeof(IrBlock*) * count);
+    instr->targetCount = count;
+}
+
+static void blockAppend(IrBlock *block, IrInstr *instr)
+{
+    instr->block = block;
+    instr->prev = block->last;
+    instr->next = NULL;
+    if(block->last)
+        block->last->next = instr;
+    else
+        block->first = instr;
+    block->last = instr;
+}
+
+//Phis are kept grouped at the start of the block
+static void blockPrependPhi(IrBlock *block, IrInstr *phi)
+{
+    IrInstr *after = NULL;
+    for(IrInstr *instr = block->first; instr && instr->opcode == IROP_PHI; instr = instr->next)
+        after = instr;
+    phi->block = block;
+    phi->prev = after;
+    phi->next = after ? after->next : block->first;
+    if(phi->next)
+        phi->next->prev = phi;
+    else
+        block->last = phi;
+    if(after)
+        after->next = phi;
+    else
+        block->first = phi;
+}
+
+void irInstrRemove(IrInstr *instr)
+{
+    IrBlock *block = instr->block;
+    if(instr->prev)
+        instr->prev->next = instr->next;
+    else
+        block->first = instr->next;
+    if(instr->next)
+        instr->next->prev = instr->prev;
+    else
+        block->last = instr->prev;
+    instr->prev = NULL;
+    instr->next = NULL;
+}
+
+bool irInstrHasSideEffects(IrInstr *instr)
+{
+    switch(instr->opcode)
+    {
+        case IROP_STORE:
+        case IROP_CALL:
+        case IROP_COUNTER:
+        case IROP_JMP:
+        case IROP_BRANCH:
+        case IROP_SWITCH:
+        case IROP_RET:
+            return true;
+        default:
+            return false;
+    }
+}
+
+//Appends to the current block. Code emitted after a terminator is unreachable and goes to a fresh block so the
+//caller never has to check.
+static IrInstr *emit(IrFunction *fn, IrInstr *instr)
+{
+    if(fn->insertionPoint)
+    {
+        irInstrInsertBefore(instr, fn->insertionPoint);
+        return instr;
+    }
+    if(irBlockTerminated(fn->currentBlock))
+    {
+        IrBlock *dead = irBlockCreate(fn);
+        irSealBlock(dead);
+        fn->currentBlock = dead;
+    }
+    blockAppend(fn->currentBlock, instr);
+    return instr;
+}
+
+void irInstrInsertBefore(IrInstr *instr, IrInstr *before)
+{
+    instr->block = before->block;
+    instr->prev = before->prev;
+    instr->next = before;
+    if(before->prev)
+        before->prev->next = instr;
+    else
+        before->block->first = instr;
+    before->prev = instr;
+}
+
+IrInstr *irBuildConst(IrFunction *fn, long long value, int width, bool isSigned)
+{
+    IrInstr *instr = instrCreate(fn, IROP_CONST, width, isSigned);
+    instr->constant = value;
+    return emit(fn, instr);
+}
+
+IrInstr *irBuildParam(IrFunction *fn, int index, int width, bool isSigned)
+{
+    IrInstr *instr = instrCreate(fn, IROP_PARAM, width, isSigned);
+    instr->constant = index;
+    fn->paramWidths[index] = width;
+    return emit(fn, instr);
+}
+
+IrInstr *irBuildCopy(IrFunction *fn, IrInstr *value)
+{
+    IrInstr *instr = instrCreate(fn, IROP_COPY, value->width, value->isSigned);
+    irInstrAddOperand(fn, instr, value);
+    return emit(fn, instr);
+}
+
+IrInstr *irBuildBinary(IrFunction *fn, IrOpcode opcode, IrInstr *left, IrInstr *right)
+{
+    IrInstr *instr = instrCreate(fn, opcode, left->width, left->isSigned && right->isSigned);
+    irInstrAddOperand(fn, instr, left);
+    irInstrAddOperand(fn, instr, right);
+    return emit(fn, instr);
+}
+
+IrInstr *irBuildShift(IrFunction *fn, IrOpcode opcode, IrInstr *value, int count)
+{
+    IrInstr *instr = instrCreate(fn, opcode, value->width, value->isSigned);
+    instr->constant = count;
+    irInstrAddOperand(fn, instr, value);
+    return emit(fn, instr);
+}
+
+IrInstr *irBuildMultiplyHigh(IrFunction *fn, IrInstr *value, long long multiplier, bool isSigned)
+{
+    IrInstr *instr = instrCreate(fn, IROP_MULHI, 1, isSigned);
+    instr->constant = multiplier;
+    irInstrAddOperand(fn, instr, value);
+    return emit(fn, instr);
+}
+
+IrInstr *irBuildCast(IrFunction *fn, IrInstr *value, int width, bool isSigned)
+{
+    if(value->width == width)
+    {
+        if(value->isSigned == isSigned) return value;
+        IrInstr *copy = irBuildCopy(fn, value);
+        copy->isSigned = isSigned;
+        return copy;
+    }
+    IrOpcode opcode = IROP_TRUNC;
+    if(width > value->width)
+        opcode = value->isSigned ? IROP_SEXT : IROP_ZEXT;
+    IrInstr *instr = instrCreate(fn, opcode, width, isSigned);
+    irInstrAddOperand(fn, instr, value);
+    return emit(fn, instr);
+}
+
+IrInstr *irBuildFrameAddr(IrFunction *fn, int slot)
+{
+    IrInstr *instr = instrCreate(fn, IROP_FRAMEADDR, 1, false);
+    instr->constant = slot;
+    return emit(fn, instr);
+}
+
+IrInstr *irBuildDataAddr(IrFunction *fn, int offset)
+{
+    IrInstr *instr = instrCreate(fn, IROP_DATAADDR, 1, false);
+    instr->constant = offset;
+    return emit(fn, instr);
+}
+
+IrInstr *irBuildLoad(IrFunction *fn, IrInstr *address, int width, bool isSigned)
+{
+    IrInstr *instr = instrCreate(fn, IROP_LOAD, width, isSigned);
+    irInstrAddOperand(fn, instr, address);
+    return emit(fn, instr);
+}
+
+void irBuildStore(IrFunction *fn, IrInstr *address, IrInstr *value)
+{
+    IrInstr *instr = instrCreate(fn, IROP_STORE, 0, false);
+    irInstrAddOperand(fn, instr, address);
+    irInstrAddOperand(fn, instr, value);
+    emit(fn, instr);
+}
+
+IrInstr *irBuildCall(IrFunction *fn, Token *symbol, IrInstr **args, int argCount, int width, bool isSigned)
+{
+    IrInstr *instr = instrCreate(fn, IROP_CALL, width, isSigned);
+    instr->symbol = symbol;
+    for(int i = 0; i < argCount; i++)
+        irInstrAddOperand(fn, instr, args[i]);
+    return emit(fn, instr);
+}
+
+void irBuildJump(IrFunction *fn, IrBlock *target)
+{
+    IrInstr *instr = instrCreate(fn, IROP_JMP, 0, false);
+    instrSetTargetCount(fn, instr, 1);
+    instr->targets[0] = target;
+    emit(fn, instr);
+    blockAddPred(target, instr->block);
+}
+
+void irBuildBranch(IrFunction *fn, IrInstr *condition, IrBlock *trueTarget, IrBlock *falseTarget)
+{
+    IrInstr *instr = instrCreate(fn, IROP_BRANCH, 0, false);
+    irInstrAddOperand(fn, instr, condition);
+    instrSetTargetCount(fn, instr, 2);
+    instr->targets[0] = trueTarget;
+    instr->targets[1] = falseTarget;
+    emit(fn, instr);
+    blockAddPred(trueTarget, instr->block);
+    blockAddPred(falseTarget, instr->block);
+}
+
+void irBuildSwitch(IrFunction *fn, IrInstr *value, IrBlock *defaultTarget, long long *caseValues,
+                   IrBlock **caseTargets, int caseCount)
+{
+    IrInstr *instr = instrCreate(fn, IROP_SWITCH, 0, false);
+    irInstrAddOperand(fn, instr, value);
+    instr->caseValues = irAllocate(fn, sizeof(long long) * (caseCount + 1));
+    instr->caseTargets = irAllocate(fn, sizeof(int) * (caseCount + 1));
+    instr->caseCount = caseCount;
+    //Each block is a successor once however many cases lead to it, so it has a single edge from the switch
+    int *targetIndices = countedMalloc(sizeof(int) * fn->blockCount);
+    memset(targetIndices, -1, sizeof(int) * fn->blockCount);
+    IrBlock **targets = countedMalloc(sizeof(IrBlock*) * (caseCount + 1));
+    int targetCount = 0;
+    targetIndices[defaultTarget->id] = targetCount;
+    targets[targetCount++] = defaultTarget;
+    for(int i = 0; i < caseCount; i++)
+    {
+        IrBlock *target = caseTargets[i];
+        if(targetIndices[target->id] < 0)
+        {
+            targetIndices[target->id] = targetCount;
+            targets[targetCount++] = target;
+        }
+        instr->caseValues[i] = caseValues[i];
+        instr->caseTargets[i] = targetIndices[target->id];
+    }
+    if(targetCount == 1)
+    {
+        //Every case leads to the default
+        irBuildJump(fn, defaultTarget);
+    }
+    else
+    {
+        instrSetTargetCount(fn, instr, targetCount);
+        memcpy(instr->targets, targets, sizeof(IrBlock*) * targetCount);
+        emit(fn, instr);
+        for(int i = 0; i < targetCount; i++)
+            blockAddPred(targets[i], instr->block);
+    }
+    free(targets);
+    free(targetIndices);
+}
+
+void irBuildReturn(IrFunction *fn, IrInstr *value)
+{
+    IrInstr *instr = instrCreate(fn, IROP_RET, 0, false);
+    if(value)
+        irInstrAddOperand(fn, instr, value);
+    emit(fn, instr);
+}
+
+IrInstr *irBuildPhi(IrBlock *block, int width, bool isSigned)
+{
+    IrInstr *phi = instrCreate(block->function, IROP_PHI, width, isSigned);
+    blockPrependPhi(block, phi);
+    return phi;
+}
+
+void irWriteVariable(IrBlock *block, int variable, IrInstr *value)
+{
+    if(variable >= block->currentDefsCapacity)
+    {
+        int newCapacity = block->currentDefsCapacity * 2 + 8;
+        if(newCapacity <= variable) newCapacity = variable + 8;
+        IrInstr **newDefs = irAllocate(block->function, sizeof(IrInstr*) * newCapacity);
+        if(block->currentDefsCapacity)
+            memcpy(newDefs, block->currentDefs, sizeof(IrInstr*) * block->currentDefsCapacity);
+        block->currentDefs = newDefs;
+        block->currentDefsCapacity = newCapacity;
+    }
+    block->currentDefs[variable] = value;
+}
+
+static IrInstr *phiCreate(IrBlock *block, int variable, int width, bool isSigned)
+{
+    IrInstr *phi = irBuildPhi(block, width, isSigned);
+    phi->variable = variable;
+    return phi;
+}
+
+//A phi whose operands are all the same value (or the phi itself) is turned into a copy of that value.
+//Users keep pointing at the phi; copy propagation later rewires them.
+static IrInstr *tryRemoveTrivialPhi(IrInstr *phi)
+{
+    IrInstr *same = NULL;
+    for(int i = 0; i < phi->operandCount; i++)
+    {
+        IrInstr *operand = phi->operands[i];
+        if(operand == same || operand == phi) continue;
+        if(same) return phi;
+        same = operand;
+    }
+    if(!same)
+    {
+        //Variable was never written on any path, read it as zero
+        IrFunction *fn = phi->block->function;
+        IrInstr *zero = instrCreate(fn, IROP_CONST, phi->width, phi->isSigned);
+        zero->block = fn->entry;
+        zero->next = fn->entry->first;
+        if(fn->entry->first)
+            fn->entry->first->prev = zero;
+        else
+            fn->entry->last = zero;
+        fn->entry->first = zero;
+        same = zero;
+    }
+    phi->opcode = IROP_COPY;
+    phi->operandCount = 0;
+    irInstrAddOperand(phi->block->function, phi, same);
+    //Copies must come after the remaining phis of the block
+    IrBlock *block = phi->block;
+    irInstrRemove(phi);
+    IrInstr *after = NULL;
+    for(IrInstr *instr = block->first; instr && instr->opcode == IROP_PHI; instr = instr->next)
+        after = instr;
+    phi->block = block;
+    phi->prev = after;
+    phi->next = after ? after->next : block->first;
+    if(phi->next)
+        phi->next->prev = phi;
+    else
+        block->last = phi;
+    if(after)
+        after->next = phi;
+    else
+        block->first = phi;
+    return phi;
+}
+
+static IrInstr *addPhiOperands(IrInstr *phi)
+{
+    IrBlock *block = phi->block;
+    for(int i = 0; i < block->predCount; i++)
+    {
+        IrInstr *value = irReadVariable(block->preds[i], phi->variable, phi->width, phi->isSigned);
+        irInstrAddOperand(block->function, phi, value);
+    }
+    return tryRemoveTrivialPhi(phi);
+}
+
+IrInstr *irReadVariable(IrBlock *block, int variable, int width, bool isSigned)
+{
+    if(variable < block->currentDefsCapacity && block->currentDefs[variable])
+        return block->currentDefs[variable];
+
+    IrInstr *value;
+    if(!block->sealed)
+    {
+        //Operands are filled in by irSealBlock once every predecessor is known
+        value = phiCreate(block, variable, width, isSigned);
+    }
+    else if(block->predCount == 1)
+    {
+        value = irReadVariable(block->preds[0], variable, width, isSigned);
+    }
+    else if(block->predCount == 0)
+    {
+        IrFunction *fn = block->function;
+        IrInstr *zero = instrCreate(fn, IROP_CONST, width, isSigned);
+        zero->block = block;
+        zero->next = block->first;
+        if(block->first)
+            block->first->prev = zero;
+        else
+            block->last = zero;
+        block->first = zero;
+        value = zero;
+    }
+    else
+    {
+        //Write the phi first to break cycles through loops
+        IrInstr *phi = phiCreate(block, variable, width, isSigned);
+        irWriteVariable(block, variable, phi);
+        value = addPhiOperands(phi);
+    }
+    irWriteVariable(block, variable, value);
+    return value;
+}
+
+void irSealBlock(IrBlock *block)
+{
+    if(block->sealed) return;
+    block->sealed = true;
+    for(IrInstr *instr = block->first; instr; )
+    {
+        IrInstr *next = instr->next;
+        if(instr->opcode == IROP_PHI && instr->operandCount == 0 && instr->variable >= 0)
+            addPhiOperands(instr);
+        instr = next;
+    }
+}
+
+//FNV-1a step over one word of v
+static uint32_t checksumAdd(uint32_t hash, uint32_t v)
+{
+    for(int i = 0; i < 4; i++, v >>= 8)
+        hash = (hash ^ (v & 0xff)) * 16777619u;
+    return hash;
+}
+
+uint32_t irChecksum(IrFunction *fn)
+{
+    uint32_t hash = checksumAdd(2166136261u, fn->blockCount);
+    for(IrBlock *block = fn->entry; block; block = block->next)
+    {
+        hash = checksumAdd(hash, block->id);
+        for(IrInstr *instr = block->first; instr; instr = instr->next)
+        {
+            hash = checksumAdd(hash, instr->opcode);
+            for(int t = 0; t < instr->targetCount; t++)
+                hash = checksumAdd(hash, instr->targets[t]->id);
+        }
+    }
+    return hash;
+}
+
+void irAddBlockCounters(IrFunction *fn, int offset)
+{
+    for(IrBlock *block = fn->entry; block; block = block->next)
+    {
+        IrInstr *counter = instrCreate(fn, IROP_COUNTER, 0, false);
+        counter->constant = offset + 2 * block->id;
+        if(irBlockTerminated(block))
+            irInstrInsertBefore(counter, block->last);
+        else
+            blockAppend(block, counter);
+    }
+}
+
+static void postOrderVisit(IrBlock *block, IrBlock **order, int *count, bool *visited)
+{
+    visited[block->id] = true;
+    IrBlock **successors;
+    int successorCount = irBlockSuccessors(block, &successors);
+    for(int i = 0; i < successorCount; i++)
+    {
+        if(!visited[successors[i]->id])
+            postOrderVisit(successors[i], order, count, visited);
+    }
+    order[(*count)++] = block;
+}
+
+static IrBlock *intersect(IrBlock *a, IrBlock *b)
+{
+    while(a != b)
+    {
+        while(a->rpoIndex > b->rpoIndex) a = a->idom;
+        while(b->rpoIndex > a->rpoIndex) b = b->idom;
+    }
+    return a;
+}
+
+//Cooper, Harvey and Kennedy's iterative dominator algorithm. Unreachable blocks keep rpoIndex -1 and no idom.
+void irComputeDominators(IrFunction *fn)
+{
+    bool *visited = countedCalloc(fn->blockCount, sizeof(bool));
+    IrBlock **postOrder = countedMalloc(sizeof(IrBlock*) * fn->blockCount);
+    int count = 0;
+    for(IrBlock *block = fn->entry; block; block = block->next)
+    {
+        block->rpoIndex = -1;
+        block->idom = NULL;
+    }
+    postOrderVisit(fn->entry, postOrder, &count, visited);
+    for(int i = 0; i < count; i++)
+        postOrder[i]->rpoIndex = count - 1 - i;
+
+    fn->entry->idom = fn->entry;
+    bool changed = true;
+    while(changed)
+    {
+        changed = false;
+        for(int i = count - 2; i >= 0; i--)
+        {
+            IrBlock *block = postOrder[i];
+            IrBlock *newIdom = NULL;
+            for(int p = 0; p < block->predCount; p++)
+            {
+                IrBlock *pred = block->preds[p];
+                if(pred->rpoIndex < 0 || !pred->idom) continue;
+                newIdom = newIdom ? intersect(pred, newIdom) : pred;
+            }
+            if(newIdom != block->idom)
+            {
+                block->idom = newIdom;
+                changed = true;
+            }
+        }
+    }
+    free(postOrder);
+    free(visited);
+}
+
+bool irDominates(IrBlock *a, IrBlock *b)
+{
+    if(b->rpoIndex < 0) return false;
+    while(b != a)
+    {
+        if(b->idom == b) return false;
+        b = b->idom;
+    }
+    return true;
+}
+
+//Lays block out directly ahead of before, which must not be the entry
+static void moveBlockBefore(IrFunction *fn, IrBlock *block, IrBlock *before)
+{
+    IrBlock *previous = NULL;
+    IrBlock *beforePrevious = NULL;
+    for(IrBlock *current = fn->entry; current; current = current->next)
+    {
+        if(current->next == block) previous = current;
+        if(current->next == before) beforePrevious = current;
+    }
+    if(!previous || !beforePrevious || beforePrevious == block) return;
+    previous->next = block->next;
+    if(fn->lastBlock == block)
+        fn->lastBlock = previous;
+    beforePrevious->next = block;
+    block->next = before;
+}
+
+//How often the edge from block to target ran: what block passed on to neither the successors only it leads to nor
+//a successor reached twice, and no more than target ran
+static unsigned long long edgeProfileCount(IrBlock *block, IrBlock *target)
+{
+    unsigned long long count = block->profileCount;
+    IrInstr *terminator = block->last;
+    for(int t = 0; t < terminator->targetCount; t++)
+    {
+        IrBlock *other = terminator->targets[t];
+        if(other == target || other->predCount != 1) continue;
+        count = count > other->profileCount ? count - other->profileCount : 0;
+    }
+    return count < target->profileCount ? count : target->profileCount;
+}
+
+//Puts a block that jumps to the target of the terminator of block at index targetIndex on that edge. The new block
+//goes at the end of the layout.
+static IrBlock *splitEdge(IrFunction *fn, IrBlock *block, int targetIndex)
+{
+    IrInstr *terminator = block->last;
+    IrBlock *target = terminator->targets[targetIndex];
+    IrBlock *split = irBlockCreate(fn);
+    split->sealed = true;
+    split->profileCount = edgeProfileCount(block, target);
+    IrInstr *jump = instrCreate(fn, IROP_JMP, 0, false);
+    instrSetTargetCount(fn, jump, 1);
+    jump->targets[0] = target;
+    blockAppend(split, jump);
+    blockAddPred(split, block);
+    terminator->targets[targetIndex] = split;
+    for(int p = 0; p < target->predCount; p++)
+    {
+        if(target->preds[p] == block)
+        {
+            target->preds[p] = split;
+            break;
+        }
+    }
+    return split;
+}
+
+IrBlock *irSplitEdge(IrFunction *fn, IrBlock *block, IrBlock *target)
+{
+    IrInstr *terminator = block->last;
+    for(int t = 0; t < terminator->targetCount; t++)
+    {
+        if(terminator->targets[t] != target) continue;
+        IrBlock *split = splitEdge(fn, block, t);
+        if(target != fn->entry)
+            moveBlockBefore(fn, split, target);
+        return split;
+    }
+    return NULL;
+}
+
+/*
+Inserts an empty block on every edge from a block with several successors to a block with several predecessors,
+so the backend has somewhere to put phi copies that only run on that edge. Blocks on forward edges go at the end of
+the layout, where they cost a jump only on the edge they split. Blocks on backward edges, which close loops, go just
+ahead of the loop's first block, so the copies fall through into it and the branch that repeats the loop stays
+the only one per iteration.
+*/
+void irSplitCriticalEdges(IrFunction *fn)
+{
+    IrBlock *originalLast = fn->lastBlock;
+    int *layoutIndices = countedMalloc(sizeof(int) * fn->blockCount);
+    int layoutIndex = 0;
+    for(IrBlock *block = fn->entry; block; block = block->next)
+        layoutIndices[block->id] = layoutIndex++;
+    int originalBlockCount = fn->blockCount;
+    for(IrBlock *block = fn->entry; block; block = block->next)
+    {
+        IrInstr *terminator = block->last;
+        if(block->id < originalBlockCount && terminator && terminator->targetCount > 1)
+        {
+            for(int t = 0; t < terminator->targetCount; t++)
+            {
+                IrBlock *target = terminator->targets[t];
+                if(target->predCount < 2) continue;
+                IrBlock *split = splitEdge(fn, block, t);
+                if(layoutIndices[target->id] <= layoutIndices[block->id] && target != fn->entry)
+                    moveBlockBefore(fn, split, target);
+            }
+        }
+        if(block == originalLast) break;
+    }
+    free(layoutIndices);
+}
+
+//Moves the blocks created since last, the old last block of fn, to just after block
+static void moveNewBlocksAfter(IrFunction *fn, IrBlock *last, IrBlock *block)
+{
+    if(block == last || !last->next) return;
+    IrBlock *first = last->next;
+    IrBlock *newLast = fn->lastBlock;
+    last->next = NULL;
+    fn->lastBlock = last;
+    newLast->next = block->next;
+    block->next = first;
+}
+
+bool irInlineCall(IrFunction *fn, IrInstr *call, IrFunction *callee)
+{
+    if(callee == fn || call->operandCount != callee->paramCount || call->width != callee->returnWidth) return false;
+    IrBlock *block = call->block;
+    IrBlock *oldLast = fn->lastBlock;
+    IrInstr **values = countedCalloc(callee->vregCount + 1, sizeof(IrInstr*));
+    IrBlock **blocks = countedCalloc(callee->blockCount, sizeof(IrBlock*));
+    int slotBase = fn->slotCount;
+    for(int i = 0; i < callee->slotCount; i++)
+        irFrameSlotCreate(fn, callee->slotWidths[i]);
+
+    //First every instruction, then their operands, which may refer to values further down
+    irSetInsertionPoint(fn, call);
+    for(IrBlock *calleeBlock = callee->entry; calleeBlock; calleeBlock = calleeBlock->next)
+    {
+        IrBlock *clone = irBlockCreate(fn);
+        clone->sealed = true;
+        blocks[calleeBlock->id] = clone;
+        if(fn->hasProfile)
+        {
+            //The callee's counts cover every call of it, this call gets its share of them
+            unsigned long long calleeEntry = callee->hasProfile ? callee->entry->profileCount : 0;
+            clone->profileCount = calleeEntry
+                ? (unsigned long long)((long double)calleeBlock->profileCount * block->profileCount / calleeEntry)
+                : block->profileCount;
+        }
+        for(IrInstr *instr = calleeBlock->first; instr; instr = instr->next)
+        {
+            if(instr->opcode == IROP_PARAM)
+            {
+                //Arguments take the place of the parameters, so constants keep folding through the body
+                IrInstr *argument = call->operands[instr->constant];
+                values[instr->vreg] = irBuildCast(fn, argument, instr->width, instr->isSigned);
+                continue;
+            }
+            IrInstr *copy = instrCreate(fn, instr->opcode, instr->width, instr->isSigned);
+            copy->constant = instr->constant;
+            if(instr->opcode == IROP_FRAMEADDR)
+                copy->constant += slotBase;
+            copy->symbol = instr->symbol;
+            blockAppend(clone, copy);
+            if(instr->vreg)
+                values[instr->vreg] = copy;
+        }
+    }
+    irSetInsertionPoint(fn, NULL);
+    IrBlock *continuation = irBlockCreate(fn);
+    continuation->sealed = true;
+    continuation->profileCount = block->profileCount;
+
+    //Values of the returns, in the order they become predecessors of the continuation
+    IrInstr **returns = countedMalloc(sizeof(IrInstr*) * callee->blockCount);
+    int returnCount = 0;
+    for(IrBlock *calleeBlock = callee->entry; calleeBlock; calleeBlock = calleeBlock->next)
+    {
+        IrBlock *clone = blocks[calleeBlock->id];
+        for(int i = 0; i < calleeBlock->predCount; i++)
+            blockAddPred(clone, blocks[calleeBlock->preds[i]->id]);
+        IrInstr *copy = clone->first;
+        for(IrInstr *instr = calleeBlock->first; instr; instr = instr->next)
+        {
+            if(instr->opcode == IROP_PARAM) continue;
+            for(int i = 0; i < instr->operandCount; i++)
+                irInstrAddOperand(fn, copy, values[instr->operands[i]->vreg]);
+            if(instr->targetCount)
+            {
+                instrSetTargetCount(fn, copy, instr->targetCount);
+                for(int t = 0; t < instr->targetCount; t++)
+                    copy->targets[t] = blocks[instr->targets[t]->id];
+            }
+            if(instr->caseCount)
+            {
+                copy->caseValues = irAllocate(fn, sizeof(long long) * instr->caseCount);
+                copy->caseTargets = irAllocate(fn, sizeof(int) * instr->caseCount);
+                memcpy(copy->caseValues, instr->caseValues, sizeof(long long) * instr->caseCount);
+                memcpy(copy->caseTargets, instr->caseTargets, sizeof(int) * instr->caseCount);
+                copy->caseCount = instr->caseCount;
+            }
+            if(instr->opcode == IROP_RET)
+            {
+                //Returns jump to the code after the call, their values meet in a phi there
+                IrInstr *value = copy->operandCount ? copy->operands[0] : NULL;
+                if(!value && call->vreg)
+                {
+                    irSetInsertionPoint(fn, copy);
+                    value = irBuildConst(fn, 0, call->width, call->isSigned);
+                    irSetInsertionPoint(fn, NULL);
+                }
+                returns[returnCount++] = value;
+                copy->opcode = IROP_JMP;
+                copy->operandCount = 0;
+                instrSetTargetCount(fn, copy, 1);
+                copy->targets[0] = continuation;
+                blockAddPred(continuation, clone);
+            }
+            copy = copy->next;
+        }
+    }
+
+    //The rest of the calling block moves to the continuation, which inherits its successors
+    continuation->first = call->next;
+    continuation->last = call->next ? block->last : NULL;
+    for(IrInstr *instr = call->next; instr; instr = instr->next)
+        instr->block = continuation;
+    if(call->next)
+        call->next->prev = NULL;
+    block->last = call;
+    call->next = NULL;
+    IrBlock **successors;
+    int successorCount = irBlockSuccessors(continuation, &successors);
+    for(int s = 0; s < successorCount; s++)
+    {
+        for(int i = 0; i < successors[s]->predCount; i++)
+        {
+            if(successors[s]->preds[i] == block)
+                successors[s]->preds[i] = continuation;
+        }
+    }
+    irInstrRemove(call);
+    IrInstr *jump = instrCreate(fn, IROP_JMP, 0, false);
+    instrSetTargetCount(fn, jump, 1);
+    jump->targets[0] = blocks[callee->entry->id];
+    blockAppend(block, jump);
+    blockAddPred(jump->targets[0], block);
+
+    if(call->vreg)
+    {
+        //The call instruction becomes the result, so its users need no rewriting
+        call->symbol = NULL;
+        call->operandCount = 0;
+        if(returnCount == 1)
+        {
+            call->opcode = IROP_COPY;
+            irInstrAddOperand(fn, call, returns[0]);
+        }
+        else if(returnCount)
+        {
+            call->opcode = IROP_PHI;
+            for(int i = 0; i < returnCount; i++)
+                irInstrAddOperand(fn, call, returns[i]);
+        }
+        else
+        {
+            //The callee never returns, so the value is never used
+            call->opcode = IROP_CONST;
+            call->constant = 0;
+        }
+        blockPrependPhi(continuation, call);
+    }
+    moveNewBlocksAfter(fn, oldLast, block);
+    free(returns);
+    free(blocks);
+    free(values);
+    return true;
+}
+
+int irSignedDigits(unsigned long long value, int bits, int *shifts, int *signs)
+{
+    int count = 0;
+    for(int bit = 0; value && bit < bits; bit++, value >>= 1)
+    {
+        if(!(value & 1)) continue;
+        //Ending in binary 11 takes -1 and carries into the next digit
+        int sign = (value & 3) == 3 ? -1 : 1;
+        value = sign > 0 ? value - 1 : value + 1;
+        shifts[count] = bit;
+        signs[count++] = sign;
+    }
+    return count;
+}
+
+const char *irOpcodeName(IrOpcode opcode)
+{
+    switch(opcode)
+    {
+        case IROP_CONST: return "const";
+        case IROP_PARAM: return "param";
+        case IROP_COPY: return "copy";
+        case IROP_PHI: return "phi";
+        case IROP_ADD: return "add";
+        case IROP_SUB: return "sub";
+        case IROP_MUL: return "mul";
+        case IROP_DIV: return "div";
+        case IROP_MOD: return "mod";
+        case IROP_MULHI: return "mulhi";
+        case IROP_SHL: return "shl";
+        case IROP_SHR: return "shr";
+        case IROP_SAR: return "sar";
+        case IROP_SEXT: return "sext";
+        case IROP_ZEXT: return "zext";
+        case IROP_TRUNC: return "trunc";
+        case IROP_FRAMEADDR: return "frameaddr";
+        case IROP_DATAADDR: return "dataaddr";
+        case IROP_LOAD: return "load";
+        case IROP_STORE: return "store";
+        case IROP_CALL: return "call";
+        case IROP_COUNTER: return "counter";
+        case IROP_JMP: return "jmp";
+        case IROP_BRANCH: return "br";
+        case IROP_SWITCH: return "switch";
+        case IROP_RET: return "ret";
+        default: return "?";
+    }
+}
+
+void irDumpFunction(IrFunction *fn, FILE *stream)
+{
+    fprintf(stream, "function %.*s(", fn->name ? fn->name->tokenStrLength : 1, fn->name ? fn->name->tokenStr : "?");
+    for(int i = 0; i < fn->paramCount; i++)
+        fprintf(stream, "%si%d", i ? ", " : "", fn->paramWidths[i] * 16);
+    fprintf(stream, ") -> i%d\n", fn->returnWidth * 16);
+    for(int i = 0; i < fn->slotCount; i++)
+        fprintf(stream, "  slot%d: %d words\n", i, fn->slotWidths[i]);
+
+    for(IrBlock *block = fn->entry; block; block = block->next)
+    {
+        fprintf(stream, "b%d:", block->id);
+        if(block->predCount)
+        {
+            fputs("  ; preds", stream);
+            for(int i = 0; i < block->predCount; i++)
+                fprintf(stream, " b%d", block->preds[i]->id);
+        }
+        fputc('\n', stream);
+        for(IrInstr *instr = block->first; instr; instr = instr->next)
+        {
+            fputs("    ", stream);
+            if(instr->vreg)
+                fprintf(stream, "v%d = ", instr->vreg);
+            fputs(irOpcodeName(instr->opcode), stream);
+            if(instr->width)
+                fprintf(stream, ".%c%d", instr->isSigned ? 'i' : 'u', instr->width * 16);
+            if(instr->opcode == IROP_CONST || instr->opcode == IROP_PARAM || instr->opcode == IROP_DATAADDR ||
+               instr->opcode == IROP_COUNTER)
+                fprintf(stream, " %lld", instr->constant);
+            if(instr->opcode == IROP_FRAMEADDR)
+                fprintf(stream, " slot%lld", instr->constant);
+            if(instr->opcode == IROP_SHL || instr->opcode == IROP_SHR || instr->opcode == IROP_SAR ||
+               instr->opcode == IROP_MULHI)
+                fprintf(stream, " %lld,", instr->constant);
+            if(instr->opcode == IROP_CALL && instr->symbol)
+                fprintf(stream, " %.*s", instr->symbol->tokenStrLength, instr->symbol->tokenStr);
+            for(int i = 0; i < instr->operandCount; i++)
+            {
+                fprintf(stream, "%s v%d", i ? "," : "", instr->operands[i]->vreg);
+                if(instr->opcode == IROP_PHI && i < block->predCount)
+                    fprintf(stream, "(b%d)", block->preds[i]->id);
+            }
+            if(instr->opcode == IROP_JMP)
+                fprintf(stream, " b%d", instr->targets[0]->id);
+            if(instr->opcode == IROP_BRANCH)
+                fprintf(stream, ", b%d, b%d", instr->targets[0]->id, instr->targets[1]->id);
+            if(instr->opcode == IROP_SWITCH)
+            {
+                fprintf(stream, ", default b%d", instr->targets[0]->id);
+                for(int i = 0; i < instr->caseCount; i++)
+                    fprintf(stream, ", %lld b%d", instr->caseValues[i], instr->targets[instr->caseTargets[i]]->id);
+            }
+            fputc('\n', stream);
+        }
+    }
+}
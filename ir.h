@@ -0,0 +1,234 @@
+#ifndef CCOMPILER_IR_H
+#define CCOMPILER_IR_H
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "tokenize.h"
+#include "alloc.h"
+
+//Default budget of irInlineCalls, in target instructions
+#define IR_INLINE_DEFAULT_BUDGET 16
+
+/*
+Mid-level SSA representation that sits between the AstNode trees and the final Instruction list.
+Every value is produced by exactly one IrInstr and is identified by its virtual register number (vreg).
+Widths are counted in machine words, the same unit CodeVariable and AstNodeValue use.
+All memory belonging to a function (blocks, instructions, operand arrays) comes from the function's allocator, a
+region that releases it in one go together with the rest of the unit.
+*/
+
+typedef enum
+{
+    IROP_CONST,
+    IROP_PARAM,
+    IROP_COPY,
+    IROP_PHI,
+    IROP_ADD,
+    IROP_SUB,
+    //Signedness of the result selects signed or unsigned division. The arithmetic lowering pass removes all three.
+    IROP_MUL,
+    IROP_DIV,
+    IROP_MOD,
+    //High word of the two word product of a one word operand and the unsigned 16 bit constant
+    IROP_MULHI,
+    //Logical left, logical right and arithmetic right shift of the operand by constant bits
+    IROP_SHL,
+    IROP_SHR,
+    IROP_SAR,
+    IROP_SEXT,
+    IROP_ZEXT,
+    IROP_TRUNC,
+    IROP_FRAMEADDR,
+    //Address of the word at offset constant in the static data of the unit, which the linker may move
+    IROP_DATAADDR,
+    IROP_LOAD,
+    IROP_STORE,
+    IROP_CALL,
+    //Adds one to the block counter at data offset constant in a program built with -fprofile-generate
+    IROP_COUNTER,
+    IROP_JMP,
+    IROP_BRANCH,
+    //Multi-way branch on the operand read as an unsigned number of its width, see irBuildSwitch
+    IROP_SWITCH,
+    IROP_RET
+} IrOpcode;
+
+typedef struct IrInstr IrInstr;
+typedef struct IrBlock IrBlock;
+typedef struct IrFunction IrFunction;
+
+struct IrInstr
+{
+    IrOpcode opcode;
+    //Zero for instructions that do not produce a value
+    int vreg;
+    int width;
+    bool isSigned;
+    //Literal for IROP_CONST, parameter index for IROP_PARAM, slot index for IROP_FRAMEADDR, bit count for shifts,
+    //multiplier for IROP_MULHI, data offset for IROP_DATAADDR and IROP_COUNTER
+    long long constant;
+    IrInstr **operands;
+    int operandCount;
+    int operandCapacity;
+    //Successors of a terminator: the target of IROP_JMP, the true and false targets of IROP_BRANCH and every distinct
+    //target of IROP_SWITCH once, its default first
+    IrBlock **targets;
+    int targetCount;
+    //Cases of an IROP_SWITCH in ascending order, each with the index into targets it jumps to
+    long long *caseValues;
+    int *caseTargets;
+    int caseCount;
+    //Callee of an IROP_CALL
+    Token *symbol;
+    IrBlock *block;
+    IrInstr *prev;
+    IrInstr *next;
+    //Source variable of a phi created during SSA construction, -1 otherwise
+    int variable;
+    //Scratch fields for passes and the backend
+    int position;
+    bool mark;
+};
+
+struct IrBlock
+{
+    int id;
+    IrFunction *function;
+    IrInstr *first;
+    IrInstr *last;
+    IrBlock **preds;
+    int predCount;
+    int predCapacity;
+    IrBlock *next;
+
+    //SSA construction state, see irReadVariable
+    IrInstr **currentDefs;
+    int currentDefsCapacity;
+    bool sealed;
+
+    //Filled by irComputeDominators
+    IrBlock *idom;
+    int rpoIndex;
+
+    //Times the block ran in the profile the function is compiled with, if it has one. Blocks made by the passes
+    //get an estimate from the blocks around them.
+    unsigned long long profileCount;
+
+    //Scratch fields for the backend
+    int startPosition;
+    int endPosition;
+};
+
+struct IrFunction
+{
+    //Nothing is released on its own, so this must be a region. Passes that run on another thread switch it to a
+    //region of that thread.
+    Allocator *allocator;
+    Token *name;
+    int returnWidth;
+    bool returnSigned;
+    int paramCount;
+    int *paramWidths;
+    IrBlock *entry;
+    IrBlock *lastBlock;
+    IrBlock *currentBlock;
+    //When set the builders insert in front of it instead of appending to currentBlock
+    IrInstr *insertionPoint;
+    int blockCount;
+    int vregCount;
+    //Word widths of the address-taken locals that must live in the frame
+    int *slotWidths;
+    int slotCount;
+    int slotCapacity;
+    //Set when the profileCount of the blocks came from a profile
+    bool hasProfile;
+    IrFunction *next;
+};
+
+extern IrFunction *irFunctionCreate(Allocator *allocator, Token *name, int paramCount);
+extern IrBlock *irBlockCreate(IrFunction *fn);
+extern void irSetBlock(IrFunction *fn, IrBlock *block);
+//Moves block to the end of the layout, for blocks created before the code that comes ahead of them
+extern void irMoveBlockToEnd(IrFunction *fn, IrBlock *block);
+//Builds in front of instr until the next irSetBlock or irSetInsertionPoint(fn, NULL), so passes can expand an
+//instruction into several
+extern void irSetInsertionPoint(IrFunction *fn, IrInstr *instr);
+extern int irFrameSlotCreate(IrFunction *fn, int width);
+extern bool irBlockTerminated(IrBlock *block);
+//Points successors at the targets of the block's terminator and returns how many there are
+extern int irBlockSuccessors(IrBlock *block, IrBlock ***successors);
+extern void irInstrRemove(IrInstr *instr);
+extern void irInstrAddOperand(IrFunction *fn, IrInstr *instr, IrInstr *operand);
+//Links instr, which must not be in a block, in front of before
+extern void irInstrInsertBefore(IrInstr *instr, IrInstr *before);
+extern bool irInstrHasSideEffects(IrInstr *instr);
+
+extern IrInstr *irBuildConst(IrFunction *fn, long long value, int width, bool isSigned);
+extern IrInstr *irBuildParam(IrFunction *fn, int index, int width, bool isSigned);
+extern IrInstr *irBuildCopy(IrFunction *fn, IrInstr *value);
+extern IrInstr *irBuildBinary(IrFunction *fn, IrOpcode opcode, IrInstr *left, IrInstr *right);
+extern IrInstr *irBuildShift(IrFunction *fn, IrOpcode opcode, IrInstr *value, int count);
+//isSigned says how value is read, rather than value's own type, which copy propagation may have looked through
+extern IrInstr *irBuildMultiplyHigh(IrFunction *fn, IrInstr *value, long long multiplier, bool isSigned);
+extern IrInstr *irBuildCast(IrFunction *fn, IrInstr *value, int width, bool isSigned);
+extern IrInstr *irBuildFrameAddr(IrFunction *fn, int slot);
+extern IrInstr *irBuildDataAddr(IrFunction *fn, int offset);
+extern IrInstr *irBuildLoad(IrFunction *fn, IrInstr *address, int width, bool isSigned);
+extern void irBuildStore(IrFunction *fn, IrInstr *address, IrInstr *value);
+extern IrInstr *irBuildCall(IrFunction *fn, Token *symbol, IrInstr **args, int argCount, int width, bool isSigned);
+extern void irBuildJump(IrFunction *fn, IrBlock *target);
+extern void irBuildBranch(IrFunction *fn, IrInstr *condition, IrBlock *trueTarget, IrBlock *falseTarget);
+//Jumps to caseTargets[i] where value, read as an unsigned number of its width, equals caseValues[i], and to
+//defaultTarget for any other value. caseValues must be distinct and ascending.
+extern void irBuildSwitch(IrFunction *fn, IrInstr *value, IrBlock *defaultTarget, long long *caseValues,
+                          IrBlock **caseTargets, int caseCount);
+extern void irBuildReturn(IrFunction *fn, IrInstr *value);
+//Adds a phi without operands to block, the caller adds one for each predecessor in order
+extern IrInstr *irBuildPhi(IrBlock *block, int width, bool isSigned);
+
+//SSA construction for source variables, following Braun et al. "Simple and Efficient Construction of SSA Form".
+//A block must be sealed once all of its predecessors are known.
+extern void irWriteVariable(IrBlock *block, int variable, IrInstr *value);
+extern IrInstr *irReadVariable(IrBlock *block, int variable, int width, bool isSigned);
+extern void irSealBlock(IrBlock *block);
+
+//Hash of the blocks, their instructions and the edges between them, which a profile of fn is checked against
+extern uint32_t irChecksum(IrFunction *fn);
+//Ends every block with an IROP_COUNTER, the one of the block with id i at data offset offset + 2 * i
+extern void irAddBlockCounters(IrFunction *fn, int offset);
+
+extern void irComputeDominators(IrFunction *fn);
+extern bool irDominates(IrBlock *a, IrBlock *b);
+extern void irSplitCriticalEdges(IrFunction *fn);
+//Puts an empty block, laid out just ahead of target, on the edge from block to target and returns it
+extern IrBlock *irSplitEdge(IrFunction *fn, IrBlock *block, IrBlock *target);
+//Replaces call, a call of callee, with a copy of callee's body whose parameters are the arguments and whose returns
+//jump to the rest of the calling block. callee is left as it was. Returns false if the call does not match callee's
+//signature or callee is fn itself.
+extern bool irInlineCall(IrFunction *fn, IrInstr *call, IrFunction *callee);
+
+extern bool irEliminateDeadCode(IrFunction *fn);
+extern bool irPropagateCopies(IrFunction *fn);
+extern bool irNumberValues(IrFunction *fn);
+//Expands multiplication, division and modulo into shifts and adds where an operand is constant and into calls to
+//the runtime helpers otherwise
+extern bool irLowerArithmetic(IrFunction *fn);
+//Moves loop invariant code into loop preheaders and turns products of induction variables into variables that
+//advance by an addition per iteration
+extern bool irOptimizeLoops(IrFunction *fn);
+//Inlines calls between the functions of a unit, callees before their callers, wherever the callee's estimated
+//size in target instructions exceeds what the call itself costs by at most budget. Negative budgets inline nothing.
+extern void irInlineCalls(IrFunction *functions, int budget);
+//Runs the pass pipeline. When dumpStream is not NULL the function is printed before and after each pass.
+extern void irOptimize(IrFunction *fn, FILE *dumpStream);
+
+//Writes the non-zero digits of the non-adjacent form of value, truncated to bits, from the lowest up: value is the
+//sum of signs[i] << shifts[i] modulo 2^bits. 15 becomes 16 - 1 rather than 8 + 4 + 2 + 1. Returns the digit count,
+//at most bits / 2 + 1.
+extern int irSignedDigits(unsigned long long value, int bits, int *shifts, int *signs);
+
+extern const char *irOpcodeName(IrOpcode opcode);
+extern void irDumpFunction(IrFunction *fn, FILE *stream);
+
+#endif //CCOMPILER_IR_H
@@ -0,0 +1,1468 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "ir.h"
+#include "runtime.h"
+#include "vec.h"
+#include "alloc.h"
+
+static IrInstr *resolveCopy(IrInstr *value)
+{
+    while(value->opcode == IROP_COPY && value->operands[0] != value)
+        value = value->operands[0];
+    return value;
+}
+
+//Turns instr into a copy of value in place, so every user of instr keeps a valid operand.
+static void replaceWithCopy(IrFunction *fn, IrInstr *instr, IrInstr *value)
+{
+    instr->opcode = IROP_COPY;
+    instr->operandCount = 0;
+    irInstrAddOperand(fn, instr, value);
+}
+
+static void replaceWithConst(IrInstr *instr, long long value)
+{
+    instr->opcode = IROP_CONST;
+    instr->operandCount = 0;
+    instr->constant = value;
+}
+
+//Truncates value to width words and re-extends it according to signedness, so equal values compare equal
+static long long normalizeConstant(long long value, int width, bool isSigned)
+{
+    if(width >= 4) return value;
+    int bits = width * 16;
+    unsigned long long mask = (1ULL << bits) - 1;
+    unsigned long long result = (unsigned long long)value & mask;
+    if(isSigned && (result >> (bits - 1)) & 1)
+        result |= ~mask;
+    return (long long)result;
+}
+
+bool irPropagateCopies(IrFunction *fn)
+{
+    bool changed = false;
+    bool phiChanged = true;
+    while(phiChanged)
+    {
+        phiChanged = false;
+        for(IrBlock *block = fn->entry; block; block = block->next)
+        {
+            for(IrInstr *instr = block->first; instr; instr = instr->next)
+            {
+                if(instr->opcode == IROP_COPY) continue;
+                for(int i = 0; i < instr->operandCount; i++)
+                {
+                    IrInstr *resolved = resolveCopy(instr->operands[i]);
+                    if(resolved != instr->operands[i])
+                    {
+                        instr->operands[i] = resolved;
+                        changed = true;
+                    }
+                }
+                if(instr->opcode != IROP_PHI) continue;
+
+                //Phis that ended up merging a single value collapse into a copy of it
+                IrInstr *same = NULL;
+                bool trivial = true;
+                for(int i = 0; i < instr->operandCount; i++)
+                {
+                    IrInstr *operand = instr->operands[i];
+                    if(operand == instr || operand == same) continue;
+                    if(same)
+                    {
+                        trivial = false;
+                        break;
+                    }
+                    same = operand;
+                }
+                if(trivial && same)
+                {
+                    replaceWithCopy(fn, instr, same);
+                    phiChanged = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+    return changed;
+}
+
+static void removePredecessor(IrBlock *block, IrBlock *pred)
+{
+    int index = -1;
+    for(int i = 0; i < block->predCount; i++)
+    {
+        if(block->preds[i] == pred)
+        {
+            index = i;
+            break;
+        }
+    }
+    if(index < 0) return;
+    for(int i = index; i < block->predCount - 1; i++)
+        block->preds[i] = block->preds[i + 1];
+    block->predCount--;
+    //Copies left by SSA construction can still sit ahead of the phis
+    for(IrInstr *instr = block->first; instr; instr = instr->next)
+    {
+        if(instr->opcode != IROP_PHI || index >= instr->operandCount) continue;
+        for(int i = index; i < instr->operandCount - 1; i++)
+            instr->operands[i] = instr->operands[i + 1];
+        instr->operandCount--;
+    }
+}
+
+static void markReachable(IrBlock *block, bool *reachable)
+{
+    //Explicit stack, generated code can chain thousands of blocks
+    IrBlock **stack = countedMalloc(sizeof(IrBlock*) * (block->function->blockCount + 1));
+    int stackLength = 0;
+    stack[stackLength++] = block;
+    reachable[block->id] = true;
+    while(stackLength)
+    {
+        IrBlock *current = stack[--stackLength];
+        IrBlock **successors;
+        int successorCount = irBlockSuccessors(current, &successors);
+        for(int i = 0; i < successorCount; i++)
+        {
+            if(reachable[successors[i]->id]) continue;
+            reachable[successors[i]->id] = true;
+            stack[stackLength++] = successors[i];
+        }
+    }
+    free(stack);
+}
+
+bool irEliminateDeadCode(IrFunction *fn)
+{
+    bool changed = false;
+
+    //Branches and switches on a known value become jumps
+    for(IrBlock *block = fn->entry; block; block = block->next)
+    {
+        IrInstr *terminator = block->last;
+        if(!terminator || (terminator->opcode != IROP_BRANCH && terminator->opcode != IROP_SWITCH)) continue;
+        IrInstr *condition = resolveCopy(terminator->operands[0]);
+        if(condition->opcode != IROP_CONST) continue;
+        int taken = condition->constant ? 0 : 1;
+        if(terminator->opcode == IROP_SWITCH)
+        {
+            int width = terminator->operands[0]->width;
+            long long value = normalizeConstant(condition->constant, width, false);
+            taken = 0;
+            for(int i = 0; i < terminator->caseCount; i++)
+            {
+                if(normalizeConstant(terminator->caseValues[i], width, false) == value)
+                    taken = terminator->caseTargets[i];
+            }
+        }
+        for(int t = 0; t < terminator->targetCount; t++)
+        {
+            if(t != taken)
+                removePredecessor(terminator->targets[t], block);
+        }
+        terminator->opcode = IROP_JMP;
+        terminator->operandCount = 0;
+        terminator->targets[0] = terminator->targets[taken];
+        terminator->targetCount = 1;
+        terminator->caseCount = 0;
+        changed = true;
+    }
+
+    //Drop unreachable blocks, detaching them from the phis of the blocks they jumped to
+    bool *reachable = countedCalloc(fn->blockCount, sizeof(bool));
+    markReachable(fn->entry, reachable);
+    for(IrBlock *block = fn->entry; block; block = block->next)
+    {
+        if(reachable[block->id]) continue;
+        IrBlock **successors;
+        int successorCount = irBlockSuccessors(block, &successors);
+        for(int i = 0; i < successorCount; i++)
+        {
+            if(reachable[successors[i]->id])
+                removePredecessor(successors[i], block);
+        }
+    }
+    IrBlock *previous = NULL;
+    for(IrBlock *block = fn->entry; block; block = block->next)
+    {
+        if(reachable[block->id])
+        {
+            previous = block;
+            continue;
+        }
+        previous->next = block->next;
+        if(fn->lastBlock == block)
+            fn->lastBlock = previous;
+        changed = true;
+    }
+    free(reachable);
+
+    //Mark everything that feeds a side effect, then sweep the rest
+    int worklistCapacity = 64;
+    int worklistLength = 0;
+    IrInstr **worklist = countedMalloc(sizeof(IrInstr*) * worklistCapacity);
+    for(IrBlock *block = fn->entry; block; block = block->next)
+    {
+        for(IrInstr *instr = block->first; instr; instr = instr->next)
+        {
+            instr->mark = false;
+            if(!irInstrHasSideEffects(instr)) continue;
+            instr->mark = true;
+            if(worklistLength == worklistCapacity)
+            {
+                worklistCapacity *= 2;
+                worklist = countedRealloc(worklist, sizeof(IrInstr*) * worklistCapacity);
+            }
+            worklist[worklistLength++] = instr;
+        }
+    }
+    while(worklistLength)
+    {
+        IrInstr *instr = worklist[--worklistLength];
+        for(int i = 0; i < instr->operandCount; i++)
+        {
+            IrInstr *operand = instr->operands[i];
+            if(operand->mark) continue;
+            operand->mark = true;
+            if(worklistLength == worklistCapacity)
+            {
+                worklistCapacity *= 2;
+                worklist = countedRealloc(worklist, sizeof(IrInstr*) * worklistCapacity);
+            }
+            worklist[worklistLength++] = operand;
+        }
+    }
+    free(worklist);
+
+    for(IrBlock *block = fn->entry; block; block = block->next)
+    {
+        for(IrInstr *instr = block->first; instr; )
+        {
+            IrInstr *next = instr->next;
+            if(!instr->mark)
+            {
+                irInstrRemove(instr);
+                changed = true;
+            }
+            instr = next;
+        }
+    }
+    return changed;
+}
+
+//Value numbering over the dominator tree. Expressions are looked up in a chained hash table whose entries are
+//pushed when a block is entered and popped when its dominator subtree has been processed.
+typedef struct GvnEntry GvnEntry;
+struct GvnEntry
+{
+    IrInstr *instr;
+    unsigned int hash;
+    GvnEntry *next;
+};
+
+typedef struct
+{
+    GvnEntry **buckets;
+    unsigned int bucketMask;
+    GvnEntry *entries;
+    int entryCount;
+    int entryCapacity;
+} GvnTable;
+
+static bool isPureOpcode(IrOpcode opcode)
+{
+    switch(opcode)
+    {
+        case IROP_CONST:
+        case IROP_PARAM:
+        case IROP_PHI:
+        case IROP_ADD:
+        case IROP_SUB:
+        case IROP_MUL:
+        case IROP_DIV:
+        case IROP_MOD:
+        case IROP_MULHI:
+        case IROP_SHL:
+        case IROP_SHR:
+        case IROP_SAR:
+        case IROP_SEXT:
+        case IROP_ZEXT:
+        case IROP_TRUNC:
+        case IROP_FRAMEADDR:
+        case IROP_DATAADDR:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static unsigned int gvnHash(IrInstr *instr)
+{
+    unsigned long long hash = 1469598103934665603ULL;
+    hash = (hash ^ instr->opcode) * 1099511628211ULL;
+    hash = (hash ^ (unsigned long long)instr->width) * 1099511628211ULL;
+    hash = (hash ^ (unsigned long long)instr->isSigned) * 1099511628211ULL;
+    hash = (hash ^ (unsigned long long)instr->constant) * 1099511628211ULL;
+    if(instr->opcode == IROP_PHI)
+        hash = (hash ^ (unsigned long long)(size_t)instr->block) * 1099511628211ULL;
+    for(int i = 0; i < instr->operandCount; i++)
+        hash = (hash ^ (unsigned long long)instr->operands[i]->vreg) * 1099511628211ULL;
+    return (unsigned int)(hash ^ (hash >> 32));
+}
+
+static bool gvnEqual(IrInstr *a, IrInstr *b)
+{
+    if(a->opcode != b->opcode || a->width != b->width || a->isSigned != b->isSigned) return false;
+    if(a->constant != b->constant || a->operandCount != b->operandCount) return false;
+    if(a->opcode == IROP_PHI && a->block != b->block) return false;
+    for(int i = 0; i < a->operandCount; i++)
+    {
+        if(a->operands[i] != b->operands[i]) return false;
+    }
+    return true;
+}
+
+static IrInstr *gvnLookupOrInsert(GvnTable *table, IrInstr *instr)
+{
+    unsigned int hash = gvnHash(instr);
+    for(GvnEntry *entry = table->buckets[hash & table->bucketMask]; entry; entry = entry->next)
+    {
+        if(entry->hash == hash && gvnEqual(entry->instr, instr))
+            return entry->instr;
+    }
+    GvnEntry *entry = &table->entries[table->entryCount++];
+    entry->instr = instr;
+    entry->hash = hash;
+    entry->next = table->buckets[hash & table->bucketMask];
+    table->buckets[hash & table->bucketMask] = entry;
+    return instr;
+}
+
+static void gvnPopTo(GvnTable *table, int entryCount)
+{
+    while(table->entryCount > entryCount)
+    {
+        GvnEntry *entry = &table->entries[--table->entryCount];
+        table->buckets[entry->hash & table->bucketMask] = entry->next;
+    }
+}
+
+//The bits of value as an unsigned number of width words
+static unsigned long long constantBits(long long value, int width)
+{
+    if(width >= 4) return (unsigned long long)value;
+    return (unsigned long long)value & ((1ULL << (width * 16)) - 1);
+}
+
+//Evaluates a binary operator on two constants. Division by zero and the one signed division that overflows are
+//left to run.
+static bool foldBinary(IrInstr *instr, long long left, long long right, long long *result)
+{
+    int width = instr->width;
+    bool isSigned = instr->isSigned;
+    unsigned long long leftBits = constantBits(left, width);
+    unsigned long long rightBits = constantBits(right, width);
+    switch(instr->opcode)
+    {
+        case IROP_ADD:
+            *result = (long long)(leftBits + rightBits);
+            return true;
+        case IROP_SUB:
+            *result = (long long)(leftBits - rightBits);
+            return true;
+        case IROP_MUL:
+            *result = (long long)(leftBits * rightBits);
+            return true;
+        case IROP_DIV:
+        case IROP_MOD:
+        {
+            if(!rightBits) return false;
+            if(!isSigned)
+            {
+                *result = (long long)(instr->opcode == IROP_DIV ? leftBits / rightBits : leftBits % rightBits);
+                return true;
+            }
+            long long dividend = normalizeConstant(left, width, true);
+            long long divisor = normalizeConstant(right, width, true);
+            if(dividend == LLONG_MIN && divisor == -1) return false;
+            *result = instr->opcode == IROP_DIV ? dividend / divisor : dividend % divisor;
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+//Folds instr when its operands are constants or it is an identity. Returns true if instr was rewritten.
+static bool foldInstr(IrFunction *fn, IrInstr *instr)
+{
+    switch(instr->opcode)
+    {
+        case IROP_ADD:
+        case IROP_SUB:
+        case IROP_MUL:
+        case IROP_DIV:
+        case IROP_MOD:
+        case IROP_MULHI:
+        case IROP_SHL:
+        case IROP_SHR:
+        case IROP_SAR:
+        case IROP_SEXT:
+        case IROP_ZEXT:
+        case IROP_TRUNC:
+            break;
+        default:
+            return false;
+    }
+    IrInstr *left = instr->operands[0];
+    IrInstr *right = instr->operandCount > 1 ? instr->operands[1] : NULL;
+
+    if(!right)
+    {
+        int count = (int)instr->constant;
+        bool isShift = instr->opcode == IROP_SHL || instr->opcode == IROP_SHR || instr->opcode == IROP_SAR;
+        if(isShift && !count)
+        {
+            replaceWithCopy(fn, instr, left);
+            return true;
+        }
+        if(left->opcode != IROP_CONST) return false;
+        //The extension decides how the operand's bits are read, a copy may have changed the signedness on the way
+        long long value = left->constant;
+        if(instr->opcode == IROP_ZEXT)
+            value = normalizeConstant(value, left->width, false);
+        else if(instr->opcode == IROP_SEXT)
+            value = normalizeConstant(value, left->width, true);
+        else if(instr->opcode == IROP_SHL)
+            value = (long long)(constantBits(value, left->width) << count);
+        else if(instr->opcode == IROP_SHR)
+            value = (long long)(constantBits(value, left->width) >> count);
+        else if(instr->opcode == IROP_SAR)
+            value = normalizeConstant(value, left->width, true) >> count;
+        else if(instr->opcode == IROP_MULHI)
+            value = normalizeConstant(value, 1, instr->isSigned) * instr->constant >> 16;
+        replaceWithConst(instr, normalizeConstant(value, instr->width, instr->isSigned));
+        return true;
+    }
+    if(left->opcode == IROP_CONST && right->opcode == IROP_CONST)
+    {
+        long long value;
+        if(!foldBinary(instr, left->constant, right->constant, &value)) return false;
+        replaceWithConst(instr, normalizeConstant(value, instr->width, instr->isSigned));
+        return true;
+    }
+    if(instr->opcode != IROP_ADD && instr->opcode != IROP_SUB) return false;
+    //A constant offset from a data address is another data address, which the linker relocates just the same
+    IrInstr *address = left->opcode == IROP_DATAADDR ? left : instr->opcode == IROP_ADD ? right : NULL;
+    IrInstr *offset = address == left ? right : left;
+    if(address && address->opcode == IROP_DATAADDR && offset->opcode == IROP_CONST && instr->width == 1)
+    {
+        long long value = instr->opcode == IROP_ADD ? address->constant + offset->constant
+                                                    : address->constant - offset->constant;
+        instr->opcode = IROP_DATAADDR;
+        instr->isSigned = false;
+        instr->operandCount = 0;
+        instr->constant = normalizeConstant(value, 1, false);
+        return true;
+    }
+    if(right->opcode == IROP_CONST && right->constant == 0)
+    {
+        replaceWithCopy(fn, instr, left);
+        return true;
+    }
+    if(instr->opcode == IROP_ADD && left->opcode == IROP_CONST && left->constant == 0)
+    {
+        replaceWithCopy(fn, instr, right);
+        return true;
+    }
+    if(instr->opcode == IROP_SUB && left == right)
+    {
+        replaceWithConst(instr, 0);
+        return true;
+    }
+    return false;
+}
+
+bool irNumberValues(IrFunction *fn)
+{
+    irComputeDominators(fn);
+
+    int instrCount = 0;
+    for(IrBlock *block = fn->entry; block; block = block->next)
+    {
+        for(IrInstr *instr = block->first; instr; instr = instr->next)
+            instrCount++;
+    }
+
+    //Dominator tree as first-child/next-sibling arrays indexed by block id
+    IrBlock **firstChild = countedCalloc(fn->blockCount, sizeof(IrBlock*));
+    IrBlock **nextSibling = countedCalloc(fn->blockCount, sizeof(IrBlock*));
+    for(IrBlock *block = fn->entry; block; block = block->next)
+    {
+        if(block == fn->entry || !block->idom) continue;
+        nextSibling[block->id] = firstChild[block->idom->id];
+        firstChild[block->idom->id] = block;
+    }
+
+    GvnTable table = {0};
+    unsigned int bucketCount = 64;
+    while(bucketCount < (unsigned int)instrCount * 2) bucketCount *= 2;
+    table.buckets = countedCalloc(bucketCount, sizeof(GvnEntry*));
+    table.bucketMask = bucketCount - 1;
+    table.entries = countedMalloc(sizeof(GvnEntry) * (instrCount + 1));
+
+    typedef struct
+    {
+        IrBlock *block;
+        int entryCount;
+    } GvnFrame;
+    GvnFrame *stack = countedMalloc(sizeof(GvnFrame) * (fn->blockCount + 1));
+    int stackLength = 0;
+    bool changed = false;
+
+    stack[stackLength++] = (GvnFrame){fn->entry, -1};
+    while(stackLength)
+    {
+        GvnFrame *frame = &stack[stackLength - 1];
+        if(frame->entryCount >= 0)
+        {
+            //Subtree finished, forget the expressions it made available
+            gvnPopTo(&table, frame->entryCount);
+            stackLength--;
+            continue;
+        }
+        frame->entryCount = table.entryCount;
+        IrBlock *block = frame->block;
+        for(IrInstr *instr = block->first; instr; instr = instr->next)
+        {
+            for(int i = 0; i < instr->operandCount; i++)
+                instr->operands[i] = resolveCopy(instr->operands[i]);
+            if(foldInstr(fn, instr))
+                changed = true;
+            if(!isPureOpcode(instr->opcode)) continue;
+            if((instr->opcode == IROP_ADD || instr->opcode == IROP_MUL) &&
+               instr->operands[0]->vreg > instr->operands[1]->vreg)
+            {
+                IrInstr *swap = instr->operands[0];
+                instr->operands[0] = instr->operands[1];
+                instr->operands[1] = swap;
+            }
+            IrInstr *existing = gvnLookupOrInsert(&table, instr);
+            if(existing != instr)
+            {
+                replaceWithCopy(fn, instr, existing);
+                changed = true;
+            }
+        }
+        for(IrBlock *child = firstChild[block->id]; child; child = nextSibling[child->id])
+            stack[stackLength++] = (GvnFrame){child, -1};
+    }
+
+    free(stack);
+    free(table.entries);
+    free(table.buckets);
+    free(nextSibling);
+    free(firstChild);
+    return changed;
+}
+
+//Multiplications by constants with more non-zero digits than this call the runtime routine instead, which is
+//smaller and, for values of one or two words, not much slower
+#define MULTIPLY_MAX_TERMS 5
+
+//value times multiplier as a sum of shifted copies of value, one per signed digit of the multiplier. NULL if the
+//multiplier has more than maxTerms of them.
+static IrInstr *multiplyByConstant(IrFunction *fn, IrInstr *value, unsigned long long multiplier, int maxTerms)
+{
+    int shifts[64];
+    int signs[64];
+    int termCount = irSignedDigits(multiplier, value->width * 16, shifts, signs);
+    if(termCount > maxTerms) return NULL;
+    if(!termCount)
+        return irBuildConst(fn, 0, value->width, value->isSigned);
+    IrInstr *product = NULL;
+    for(int i = termCount - 1; i >= 0; i--)
+    {
+        IrInstr *term = shifts[i] ? irBuildShift(fn, IROP_SHL, value, shifts[i]) : value;
+        if(!product && signs[i] > 0)
+            product = term;
+        else if(!product)
+            product = irBuildBinary(fn, IROP_SUB, irBuildConst(fn, 0, value->width, value->isSigned), term);
+        else
+            product = irBuildBinary(fn, signs[i] > 0 ? IROP_ADD : IROP_SUB, product, term);
+    }
+    return product;
+}
+
+static int log2Exact(unsigned long long value)
+{
+    if(!value || (value & (value - 1))) return -1;
+    int log = 0;
+    while(value >>= 1) log++;
+    return log;
+}
+
+/*
+Multiplier and shift for dividing any one word unsigned value by divisor as (value * multiplier) >> (16 + shift).
+With multiplier = ceil(2^(16 + shift) / divisor) that is exact whenever multiplier * divisor - 2^(16 + shift) is at
+most 2^shift, see Granlund and Montgomery, "Division by Invariant Integers using Multiplication". Some shift up to
+16 always qualifies, though the multiplier may then take 17 bits. False when none does.
+*/
+static bool unsignedMagic(unsigned long long divisor, unsigned long long *multiplier, int *shift)
+{
+    for(int s = 0; s <= 16; s++)
+    {
+        unsigned long long power = 1ULL << (16 + s);
+        unsigned long long m = (power + divisor - 1) / divisor;
+        if(m * divisor - power <= 1ULL << s)
+        {
+            *multiplier = m;
+            *shift = s;
+            return true;
+        }
+    }
+    return false;
+}
+
+//The same for signed values and a divisor magnitude that is not a power of two. The looser bound of 2^(shift + 1)
+//keeps the multiplier within 16 bits and still rounds correctly for every one word value, which was checked
+//exhaustively over all divisors. False when no shift qualifies.
+static bool signedMagic(unsigned long long divisor, unsigned long long *multiplier, int *shift)
+{
+    for(int s = 0; s < 16; s++)
+    {
+        unsigned long long power = 1ULL << (16 + s);
+        unsigned long long m = (power + divisor - 1) / divisor;
+        if(m > 0xFFFF) break;
+        if(m * divisor - power <= 1ULL << (s + 1))
+        {
+            *multiplier = m;
+            *shift = s;
+            return true;
+        }
+    }
+    return false;
+}
+
+//value / divisor without a division, NULL when that takes the runtime routine
+static IrInstr *divideByConstant(IrFunction *fn, IrInstr *value, long long divisor, bool isSigned)
+{
+    int width = value->width;
+    int bits = width * 16;
+    unsigned long long divisorBits = constantBits(divisor, width);
+    if(!divisorBits) return NULL;
+    if(!isSigned)
+    {
+        int log = log2Exact(divisorBits);
+        if(log >= 0)
+            return irBuildShift(fn, IROP_SHR, value, log);
+        if(width != 1) return NULL;
+        unsigned long long multiplier;
+        int shift;
+        if(!unsignedMagic(divisorBits, &multiplier, &shift)) return NULL;
+        if(multiplier <= 0xFFFF)
+            return irBuildShift(fn, IROP_SHR, irBuildMultiplyHigh(fn, value, (long long)multiplier, false), shift);
+        //The multiplier takes 17 bits: multiply by the low 16 and add the value back in without overflowing,
+        //q = (t + ((value - t) >> 1)) >> (shift - 1)
+        IrInstr *high = irBuildMultiplyHigh(fn, value, (long long)(multiplier - 0x10000), false);
+        IrInstr *half = irBuildShift(fn, IROP_SHR, irBuildBinary(fn, IROP_SUB, value, high), 1);
+        return irBuildShift(fn, IROP_SHR, irBuildBinary(fn, IROP_ADD, high, half), shift - 1);
+    }
+
+    long long signedDivisor = normalizeConstant(divisor, width, true);
+    bool negative = signedDivisor < 0;
+    unsigned long long magnitude = negative ? 0ULL - (unsigned long long)signedDivisor : (unsigned long long)signedDivisor;
+    int log = log2Exact(magnitude);
+    IrInstr *quotient = NULL;
+    if(log == 0)
+        quotient = value;
+    else if(log > 0)
+    {
+        //Shifting rounds down, so negative values are biased by divisor - 1 first to round toward zero
+        IrInstr *sign = irBuildShift(fn, IROP_SAR, value, bits - 1);
+        IrInstr *bias = irBuildShift(fn, IROP_SHR, sign, bits - log);
+        quotient = irBuildShift(fn, IROP_SAR, irBuildBinary(fn, IROP_ADD, value, bias), log);
+    }
+    else
+    {
+        if(width != 1) return NULL;
+        unsigned long long multiplier;
+        int shift;
+        if(!signedMagic(magnitude, &multiplier, &shift)) return NULL;
+        //The product rounds down, adding 1 for negative values rounds toward zero instead
+        IrInstr *high = irBuildShift(fn, IROP_SAR, irBuildMultiplyHigh(fn, value, (long long)multiplier, true), shift);
+        quotient = irBuildBinary(fn, IROP_ADD, high, irBuildShift(fn, IROP_SHR, value, 15));
+    }
+    if(negative)
+        quotient = irBuildBinary(fn, IROP_SUB, irBuildConst(fn, 0, width, true), quotient);
+    return quotient;
+}
+
+//value % divisor as value - value / divisor * divisor, NULL when the division takes the runtime routine
+static IrInstr *moduloByConstant(IrFunction *fn, IrInstr *value, long long divisor, bool isSigned)
+{
+    int bits = value->width * 16;
+    unsigned long long divisorBits = constantBits(divisor, value->width);
+    int log = log2Exact(divisorBits);
+    if(!isSigned && log >= 0)
+    {
+        //Keep the low bits
+        if(!log) return irBuildConst(fn, 0, value->width, isSigned);
+        IrInstr *high = irBuildShift(fn, IROP_SHL, value, bits - log);
+        return irBuildShift(fn, IROP_SHR, high, bits - log);
+    }
+    IrInstr *quotient = divideByConstant(fn, value, divisor, isSigned);
+    if(!quotient) return NULL;
+    IrInstr *product = multiplyByConstant(fn, quotient, divisorBits, 64);
+    return irBuildBinary(fn, IROP_SUB, value, product);
+}
+
+static IrInstr *callRuntime(IrFunction *fn, IrInstr *instr)
+{
+    RuntimeOperation operation = RUNTIME_MULTIPLY;
+    if(instr->opcode == IROP_DIV)
+        operation = instr->isSigned ? RUNTIME_DIVIDE_SIGNED : RUNTIME_DIVIDE_UNSIGNED;
+    else if(instr->opcode == IROP_MOD)
+        operation = instr->isSigned ? RUNTIME_MODULO_SIGNED : RUNTIME_MODULO_UNSIGNED;
+    return irBuildCall(fn, runtimeHelperSymbol(operation, instr->width), instr->operands, 2, instr->width,
+                       instr->isSigned);
+}
+
+bool irLowerArithmetic(IrFunction *fn)
+{
+    bool changed = false;
+    for(IrBlock *block = fn->entry; block; block = block->next)
+    {
+        for(IrInstr *instr = block->first; instr; instr = instr->next)
+        {
+            if(instr->opcode != IROP_MUL && instr->opcode != IROP_DIV && instr->opcode != IROP_MOD) continue;
+            IrInstr *left = instr->operands[0];
+            IrInstr *right = instr->operands[1];
+            irSetInsertionPoint(fn, instr);
+            IrInstr *result = NULL;
+            if(instr->opcode == IROP_MUL && (right->opcode == IROP_CONST || left->opcode == IROP_CONST))
+            {
+                IrInstr *constant = right->opcode == IROP_CONST ? right : left;
+                IrInstr *other = constant == right ? left : right;
+                result = multiplyByConstant(fn, other, constantBits(constant->constant, instr->width),
+                                            MULTIPLY_MAX_TERMS);
+            }
+            else if(instr->opcode == IROP_DIV && right->opcode == IROP_CONST)
+                result = divideByConstant(fn, left, right->constant, instr->isSigned);
+            else if(instr->opcode == IROP_MOD && right->opcode == IROP_CONST)
+                result = moduloByConstant(fn, left, right->constant, instr->isSigned);
+            if(!result)
+                result = callRuntime(fn, instr);
+            replaceWithCopy(fn, instr, result);
+            changed = true;
+        }
+    }
+    irSetInsertionPoint(fn, NULL);
+    return changed;
+}
+
+/*
+Natural loops: a header and every block that reaches one of the header's back edges, the edges into it from blocks
+it dominates, without passing through the header. Loops are optimized innermost first, so code hoisted out of an
+inner loop lands in its preheader, which belongs to the outer loop and may leave that next.
+*/
+typedef struct
+{
+    IrBlock *header;
+    //The only block that enters the loop from outside, NULL if there are several
+    IrBlock *preheader;
+    //Members in reverse postorder, which starts with the header
+    IrBlock **blocks;
+    int blockCount;
+    //Membership by block id
+    bool *contains;
+} IrLoop;
+
+static int compareLoopSize(const void *a, const void *b)
+{
+    const IrLoop *left = a;
+    const IrLoop *right = b;
+    return left->blockCount - right->blockCount;
+}
+
+static void freeLoops(IrLoop *loops, int loopCount)
+{
+    for(int i = 0; i < loopCount; i++)
+    {
+        free(loops[i].blocks);
+        free(loops[i].contains);
+    }
+    free(loops);
+}
+
+//The natural loops of fn, innermost first. Back edges into the same header make one loop.
+static IrLoop *findLoops(IrFunction *fn, int *loopCount)
+{
+    irComputeDominators(fn);
+    IrBlock **order = countedMalloc(sizeof(IrBlock*) * fn->blockCount);
+    int reachableCount = 0;
+    for(IrBlock *block = fn->entry; block; block = block->next)
+    {
+        if(block->rpoIndex < 0) continue;
+        order[block->rpoIndex] = block;
+        reachableCount++;
+    }
+
+    IrLoop *loops = NULL;
+    int count = 0;
+    int capacity = 0;
+    IrBlock **stack = countedMalloc(sizeof(IrBlock*) * fn->blockCount);
+    for(int h = 0; h < reachableCount; h++)
+    {
+        IrBlock *header = order[h];
+        bool *contains = NULL;
+        int stackLength = 0;
+        for(int p = 0; p < header->predCount; p++)
+        {
+            IrBlock *latch = header->preds[p];
+            if(!irDominates(header, latch)) continue;
+            if(!contains)
+            {
+                contains = countedCalloc(fn->blockCount, sizeof(bool));
+                contains[header->id] = true;
+            }
+            if(contains[latch->id]) continue;
+            contains[latch->id] = true;
+            stack[stackLength++] = latch;
+        }
+        if(!contains) continue;
+        //Walk backwards from the latches, the header stops the walk
+        while(stackLength)
+        {
+            IrBlock *block = stack[--stackLength];
+            for(int p = 0; p < block->predCount; p++)
+            {
+                IrBlock *pred = block->preds[p];
+                if(pred->rpoIndex < 0 || contains[pred->id]) continue;
+                contains[pred->id] = true;
+                stack[stackLength++] = pred;
+            }
+        }
+
+        IrLoop loop = {0};
+        loop.header = header;
+        loop.contains = contains;
+        //The header dominates every member, so none comes before it in reverse postorder
+        loop.blocks = countedMalloc(sizeof(IrBlock*) * (reachableCount - h));
+        for(int i = h; i < reachableCount; i++)
+        {
+            if(contains[order[i]->id])
+                loop.blocks[loop.blockCount++] = order[i];
+        }
+        int entryCount = 0;
+        for(int p = 0; p < header->predCount; p++)
+        {
+            IrBlock *pred = header->preds[p];
+            if(pred->rpoIndex < 0 || contains[pred->id]) continue;
+            loop.preheader = pred;
+            entryCount++;
+        }
+        if(entryCount != 1)
+            loop.preheader = NULL;
+        if(count == capacity)
+        {
+            capacity = capacity * 2 + 4;
+            loops = countedRealloc(loops, sizeof(IrLoop) * capacity);
+        }
+        loops[count++] = loop;
+    }
+    free(stack);
+    free(order);
+    if(count > 1)
+        qsort(loops, count, sizeof(IrLoop), compareLoopSize);
+    *loopCount = count;
+    return loops;
+}
+
+static bool loopInvariant(IrLoop *loop, IrInstr *value)
+{
+    return !loop->contains[value->block->id];
+}
+
+//Instructions that compute the same value wherever they run from the same operands. Loads qualify in loops that
+//neither store nor call, divisions only by constants other than zero, so the preheader never divides by zero when
+//the loop body would not have run.
+static bool isHoistable(IrInstr *instr, bool loopWritesMemory)
+{
+    switch(instr->opcode)
+    {
+        case IROP_CONST:
+        case IROP_ADD:
+        case IROP_SUB:
+        case IROP_MUL:
+        case IROP_MULHI:
+        case IROP_SHL:
+        case IROP_SHR:
+        case IROP_SAR:
+        case IROP_SEXT:
+        case IROP_ZEXT:
+        case IROP_TRUNC:
+            return true;
+        case IROP_DIV:
+        case IROP_MOD:
+        {
+            IrInstr *divisor = instr->operands[1];
+            return divisor->opcode == IROP_CONST && constantBits(divisor->constant, divisor->width);
+        }
+        case IROP_LOAD:
+            return !loopWritesMemory;
+        default:
+            return false;
+    }
+}
+
+//Moves every instruction whose operands are all defined outside of loop to the end of its preheader. Blocks are
+//visited in reverse postorder, so an instruction's operands have been hoisted by the time it is looked at.
+static bool hoistInvariants(IrLoop *loop)
+{
+    bool writesMemory = false;
+    for(int b = 0; b < loop->blockCount; b++)
+    {
+        for(IrInstr *instr = loop->blocks[b]->first; instr; instr = instr->next)
+        {
+            if(instr->opcode == IROP_STORE || instr->opcode == IROP_CALL)
+                writesMemory = true;
+        }
+    }
+    IrInstr *terminator = loop->preheader->last;
+    bool changed = false;
+    for(int b = 0; b < loop->blockCount; b++)
+    {
+        for(IrInstr *instr = loop->blocks[b]->first; instr; )
+        {
+            IrInstr *next = instr->next;
+            bool invariant = isHoistable(instr, writesMemory);
+            for(int i = 0; invariant && i < instr->operandCount; i++)
+                invariant = loopInvariant(loop, instr->operands[i]);
+            if(invariant)
+            {
+                irInstrRemove(instr);
+                irInstrInsertBefore(instr, terminator);
+                changed = true;
+            }
+            instr = next;
+        }
+    }
+    return changed;
+}
+
+//A value that grows by step, an invariant the preheader computes, from one iteration of the loop to the next
+typedef struct
+{
+    IrInstr *phi;
+    IrInstr *step;
+} InductionVariable;
+
+//value as an operand of code in the preheader: itself if it is invariant, a new constant for a constant inside
+//the loop, NULL otherwise. Builds at the insertion point.
+static IrInstr *preheaderOperand(IrFunction *fn, IrLoop *loop, IrInstr *value)
+{
+    if(loopInvariant(loop, value)) return value;
+    if(value->opcode == IROP_CONST)
+        return irBuildConst(fn, value->constant, value->width, value->isSigned);
+    return NULL;
+}
+
+//left * right, folded when both are constants
+static IrInstr *buildProduct(IrFunction *fn, IrInstr *left, IrInstr *right)
+{
+    int width = left->width;
+    bool isSigned = left->isSigned && right->isSigned;
+    if(left->opcode == IROP_CONST && right->opcode == IROP_CONST)
+    {
+        unsigned long long product = constantBits(left->constant, width) * constantBits(right->constant, width);
+        return irBuildConst(fn, normalizeConstant((long long)product, width, isSigned), width, isSigned);
+    }
+    if(left->opcode == IROP_CONST && constantBits(left->constant, width) == 1) return right;
+    if(right->opcode == IROP_CONST && constantBits(right->constant, width) == 1) return left;
+    return irBuildBinary(fn, IROP_MUL, left, right);
+}
+
+/*
+How much the header phi grows per iteration if it is a basic induction variable, one that every back edge brings
+back as phi + c or phi - c for the same invariant c. The step is built in the preheader, the insertion point.
+Returns NULL for any other phi.
+*/
+static IrInstr *basicInductionStep(IrFunction *fn, IrLoop *loop, IrInstr *phi)
+{
+    IrBlock *header = loop->header;
+    if(phi->operandCount != header->predCount) return NULL;
+    IrInstr *increment = NULL;
+    bool negated = false;
+    for(int p = 0; p < header->predCount; p++)
+    {
+        if(!loop->contains[header->preds[p]->id]) continue;
+        IrInstr *update = resolveCopy(phi->operands[p]);
+        if(update->width != phi->width || update->operandCount != 2) return NULL;
+        IrInstr *left = resolveCopy(update->operands[0]);
+        IrInstr *right = resolveCopy(update->operands[1]);
+        IrInstr *other;
+        if(update->opcode == IROP_ADD && (left == phi || right == phi))
+            other = left == phi ? right : left;
+        else if(update->opcode == IROP_SUB && left == phi)
+            other = right;
+        else
+            return NULL;
+        if(other == phi || (!loopInvariant(loop, other) && other->opcode != IROP_CONST)) return NULL;
+        bool otherNegated = update->opcode == IROP_SUB;
+        if(increment)
+        {
+            bool sameConstant = increment->opcode == IROP_CONST && other->opcode == IROP_CONST &&
+                                constantBits(increment->constant, phi->width) ==
+                                constantBits(other->constant, phi->width);
+            if(otherNegated != negated || (increment != other && !sameConstant)) return NULL;
+        }
+        increment = other;
+        negated = otherNegated;
+    }
+    if(!increment) return NULL;
+    if(increment->opcode == IROP_CONST)
+    {
+        long long value = negated ? (long long)(0ULL - (unsigned long long)increment->constant) : increment->constant;
+        return irBuildConst(fn, normalizeConstant(value, phi->width, phi->isSigned), phi->width, phi->isSigned);
+    }
+    if(!negated) return increment;
+    return irBuildBinary(fn, IROP_SUB, irBuildConst(fn, 0, phi->width, phi->isSigned), increment);
+}
+
+//Adds a phi to the header of loop that starts at init and grows by step on every back edge, and makes instr, which
+//computes the same values, a copy of it. Leaves the insertion point at the end of the preheader.
+static IrInstr *addInductionVariable(IrFunction *fn, IrLoop *loop, IrInstr *init, IrInstr *step, IrInstr *instr)
+{
+    IrBlock *header = loop->header;
+    IrInstr *phi = irBuildPhi(header, instr->width, instr->isSigned);
+    for(int p = 0; p < header->predCount; p++)
+    {
+        IrBlock *pred = header->preds[p];
+        if(!loop->contains[pred->id])
+        {
+            irInstrAddOperand(fn, phi, init);
+            continue;
+        }
+        irSetInsertionPoint(fn, pred->last);
+        irInstrAddOperand(fn, phi, irBuildBinary(fn, IROP_ADD, phi, step));
+    }
+    irSetInsertionPoint(fn, loop->preheader->last);
+    replaceWithCopy(fn, instr, phi);
+    return phi;
+}
+
+/*
+Strength reduction of i * k for a basic induction variable i and an invariant k, which becomes a variable that
+starts at i0 * k and grows by step * k, and of base + i * k for an invariant base, which becomes a pointer that
+grows the same way. Walking an array then takes an addition per iteration instead of a multiplication and an
+addition.
+*/
+static bool reduceInductionVariables(IrFunction *fn, IrLoop *loop)
+{
+    IrBlock *header = loop->header;
+    int preheaderIndex = 0;
+    while(header->preds[preheaderIndex] != loop->preheader) preheaderIndex++;
+
+    //The candidates are taken before anything is added, so the additions that advance new variables are not
+    int candidateCount = 0;
+    int phiCount = 0;
+    for(int b = 0; b < loop->blockCount; b++)
+    {
+        for(IrInstr *instr = loop->blocks[b]->first; instr; instr = instr->next)
+        {
+            if(instr->opcode == IROP_MUL || instr->opcode == IROP_ADD || instr->opcode == IROP_SUB)
+                candidateCount++;
+            if(instr->opcode == IROP_PHI && instr->block == header)
+                phiCount++;
+        }
+    }
+    if(!candidateCount || !phiCount) return false;
+    IrInstr **candidates = countedMalloc(sizeof(IrInstr*) * candidateCount);
+    candidateCount = 0;
+    for(int b = 0; b < loop->blockCount; b++)
+    {
+        for(IrInstr *instr = loop->blocks[b]->first; instr; instr = instr->next)
+        {
+            if(instr->opcode == IROP_MUL || instr->opcode == IROP_ADD || instr->opcode == IROP_SUB)
+                candidates[candidateCount++] = instr;
+        }
+    }
+
+    irSetInsertionPoint(fn, loop->preheader->last);
+    InductionVariable *basics = countedMalloc(sizeof(InductionVariable) * phiCount);
+    int basicCount = 0;
+    //Copies left by SSA construction may still sit between the phis
+    for(IrInstr *phi = header->first; phi; phi = phi->next)
+    {
+        if(phi->opcode != IROP_PHI) continue;
+        IrInstr *step = basicInductionStep(fn, loop, phi);
+        if(step)
+            basics[basicCount++] = (InductionVariable){phi, step};
+    }
+
+    bool changed = false;
+    InductionVariable *products = countedMalloc(sizeof(InductionVariable) * candidateCount);
+    int productCount = 0;
+    for(int c = 0; c < candidateCount; c++)
+    {
+        IrInstr *instr = candidates[c];
+        if(instr->opcode != IROP_MUL) continue;
+        for(int v = 0; v < basicCount; v++)
+        {
+            InductionVariable *basic = &basics[v];
+            IrInstr *left = resolveCopy(instr->operands[0]);
+            IrInstr *right = resolveCopy(instr->operands[1]);
+            if((left != basic->phi && right != basic->phi) || instr->width != basic->phi->width) continue;
+            IrInstr *factor = preheaderOperand(fn, loop, left == basic->phi ? right : left);
+            if(!factor || factor->width != instr->width) break;
+            IrInstr *init = buildProduct(fn, basic->phi->operands[preheaderIndex], factor);
+            IrInstr *step = buildProduct(fn, basic->step, factor);
+            IrInstr *phi = addInductionVariable(fn, loop, init, step, instr);
+            products[productCount++] = (InductionVariable){phi, step};
+            changed = true;
+            break;
+        }
+    }
+    for(int c = 0; c < candidateCount && productCount; c++)
+    {
+        IrInstr *instr = candidates[c];
+        if(instr->opcode != IROP_ADD && instr->opcode != IROP_SUB) continue;
+        for(int v = 0; v < productCount; v++)
+        {
+            InductionVariable *product = &products[v];
+            IrInstr *left = resolveCopy(instr->operands[0]);
+            IrInstr *right = resolveCopy(instr->operands[1]);
+            bool matches = left == product->phi || (instr->opcode == IROP_ADD && right == product->phi);
+            if(!matches || instr->width != product->phi->width) continue;
+            IrInstr *base = preheaderOperand(fn, loop, left == product->phi ? right : left);
+            if(!base || base->width != instr->width) break;
+            IrInstr *productInit = product->phi->operands[preheaderIndex];
+            IrInstr *init = instr->opcode == IROP_SUB ? irBuildBinary(fn, IROP_SUB, productInit, base) :
+                            irBuildBinary(fn, IROP_ADD, base, productInit);
+            addInductionVariable(fn, loop, init, product->step, instr);
+            changed = true;
+            break;
+        }
+    }
+    irSetInsertionPoint(fn, NULL);
+    free(products);
+    free(basics);
+    free(candidates);
+    return changed;
+}
+
+bool irOptimizeLoops(IrFunction *fn)
+{
+    int loopCount;
+    IrLoop *loops = findLoops(fn, &loopCount);
+    //Loops entered from a block that branches elsewhere too get a block of their own to hoist into
+    bool changed = false;
+    for(int i = 0; i < loopCount; i++)
+    {
+        if(loops[i].preheader && loops[i].preheader->last->targetCount > 1)
+        {
+            irSplitEdge(fn, loops[i].preheader, loops[i].header);
+            changed = true;
+        }
+    }
+    if(changed)
+    {
+        freeLoops(loops, loopCount);
+        loops = findLoops(fn, &loopCount);
+    }
+    for(int i = 0; i < loopCount; i++)
+    {
+        IrLoop *loop = &loops[i];
+        if(!loop->preheader) continue;
+        if(hoistInvariants(loop))
+            changed = true;
+        if(reduceInductionVariables(fn, loop))
+            changed = true;
+    }
+    freeLoops(loops, loopCount);
+    return changed;
+}
+
+//Target instructions a call costs beyond the pushes of its arguments: the call, moving the result and the callee's
+//prologue and epilogue
+#define INLINE_CALL_COST 5
+//Values live across a call are spilled around it, which inlining a callee that makes no calls itself avoids
+#define INLINE_LEAF_BONUS 6
+//Callers stop taking in callees once they are estimated at this many target instructions
+#define INLINE_MAX_CALLER_SIZE 2000
+//A call that ran more often than its caller was entered sits in a loop, its budget is multiplied by this much
+#define INLINE_HOT_BUDGET_SCALE 4
+
+//What a call costs at the call site and in the callee's frame handling, all of which inlining removes
+static int callCost(IrInstr *call)
+{
+    int argumentWords = 0;
+    for(int i = 0; i < call->operandCount; i++)
+        argumentWords += call->operands[i]->width;
+    //Arguments are pushed one word at a time and dropped by adjusting sp in three instructions
+    return INLINE_CALL_COST + call->width + (argumentWords ? argumentWords + 3 : 0);
+}
+
+//Multiplication, division or modulo that the arithmetic lowering will turn into a call of a runtime routine
+static bool isRuntimeCall(IrInstr *instr)
+{
+    if(instr->opcode != IROP_MUL && instr->opcode != IROP_DIV && instr->opcode != IROP_MOD) return false;
+    if(instr->operands[1]->opcode == IROP_CONST) return false;
+    return instr->opcode != IROP_MUL || instr->operands[0]->opcode != IROP_CONST;
+}
+
+//Roughly how many target instructions the backend makes of instr. Constants are rematerialized and parameters read
+//where they are used, copies mostly coalesce, so those count nothing of their own.
+static int instrCost(IrInstr *instr)
+{
+    int width = instr->width;
+    switch(instr->opcode)
+    {
+        case IROP_CONST:
+        case IROP_PARAM:
+        case IROP_COPY:
+            return 0;
+        case IROP_PHI:
+        case IROP_SEXT:
+        case IROP_ZEXT:
+        case IROP_TRUNC:
+            return width;
+        case IROP_ADD:
+        case IROP_SUB:
+        case IROP_SHL:
+        case IROP_SHR:
+        case IROP_SAR:
+        case IROP_LOAD:
+            return 2 * width;
+        case IROP_STORE:
+            return 2 * instr->operands[1]->width;
+        case IROP_MUL:
+        case IROP_DIV:
+        case IROP_MOD:
+            //Strength reduced with a constant operand
+            if(!isRuntimeCall(instr))
+                return 4 * width;
+            return INLINE_CALL_COST + 3 * width + 3;
+        case IROP_MULHI:
+        {
+            int shifts[17];
+            int signs[17];
+            return 4 + 6 * irSignedDigits((unsigned long long)instr->constant, 17, shifts, signs);
+        }
+        case IROP_FRAMEADDR:
+        case IROP_DATAADDR:
+            return 2;
+        case IROP_COUNTER:
+            //Two word increment in memory, addresses loaded three times
+            return 14;
+        case IROP_CALL:
+            return callCost(instr);
+        case IROP_JMP:
+            return 1;
+        case IROP_BRANCH:
+            return instr->operands[0]->width + 1;
+        case IROP_SWITCH:
+            //Between a jump table entry and a node of a comparison tree per case
+            return instr->operands[0]->width + 3 * instr->caseCount + 2;
+        case IROP_RET:
+            return instr->operandCount ? instr->operands[0]->width + 1 : 1;
+    }
+    return 1;
+}
+
+//Estimated size of fn in target instructions, its prologue and epilogue included. isLeaf is set if it makes no
+//calls, not even to the runtime routines.
+static int estimateSize(IrFunction *fn, bool *isLeaf)
+{
+    int size = INLINE_CALL_COST;
+    *isLeaf = true;
+    for(IrBlock *block = fn->entry; block; block = block->next)
+    {
+        for(IrInstr *instr = block->first; instr; instr = instr->next)
+        {
+            size += instrCost(instr);
+            if(instr->opcode == IROP_CALL || isRuntimeCall(instr))
+                *isLeaf = false;
+        }
+    }
+    return size;
+}
+
+static uint32_t functionNameHash(Token *name)
+{
+    return vecHashBytes(name->tokenStr, name->tokenStrLength);
+}
+
+static bool functionNamesEqual(Token *a, Token *b)
+{
+    return a->tokenStrLength == b->tokenStrLength && !memcmp(a->tokenStr, b->tokenStr, a->tokenStrLength);
+}
+
+hashMapDeclare(Token*, int, IrFunctionIndexMap);
+hashMapDefine(Token*, int, IrFunctionIndexMap, functionNameHash, functionNamesEqual);
+
+typedef enum
+{
+    INLINE_UNVISITED,
+    //Its callees are being processed, so a call of it from one of them is recursive
+    INLINE_IN_PROGRESS,
+    INLINE_DONE
+} InlineState;
+
+//A function of the unit and the calls it makes to the others
+typedef struct
+{
+    IrFunction *fn;
+    IrInstr **calls;
+    int *callees;
+    int callCount;
+    int size;
+    bool isLeaf;
+    InlineState state;
+} InlineNode;
+
+//Budget for a call of fn. With a profile, calls that never ran only inline where that makes the code no bigger and
+//calls in hot loops get more.
+static int callBudget(IrFunction *fn, IrInstr *call, int budget)
+{
+    if(!fn->hasProfile) return budget;
+    unsigned long long count = call->block->profileCount;
+    if(!count)
+        return 0;
+    if(count > fn->entry->profileCount)
+        return budget * INLINE_HOT_BUDGET_SCALE;
+    return budget;
+}
+
+//Inlines the calls of node whose callees are done and small enough, then sizes node up for its own callers
+static void inlineCallees(InlineNode *nodes, InlineNode *node, int budget)
+{
+    int size = estimateSize(node->fn, &node->isLeaf);
+    for(int i = 0; i < node->callCount; i++)
+    {
+        InlineNode *callee = &nodes[node->callees[i]];
+        if(callee->state != INLINE_DONE) continue;
+        int growth = callee->size - callCost(node->calls[i]) - (callee->isLeaf ? INLINE_LEAF_BONUS : 0);
+        if(growth > callBudget(node->fn, node->calls[i], budget) || size + growth > INLINE_MAX_CALLER_SIZE) continue;
+        if(irInlineCall(node->fn, node->calls[i], callee->fn))
+            size += growth;
+    }
+    node->size = estimateSize(node->fn, &node->isLeaf);
+}
+
+void irInlineCalls(IrFunction *functions, int budget)
+{
+    if(budget < 0) return;
+    int functionCount = 0;
+    IrFunctionIndexMap indices = {0};
+    for(IrFunction *fn = functions; fn; fn = fn->next)
+        hashMapInsertIrFunctionIndexMap(&indices, fn->name, functionCount++);
+    InlineNode *nodes = countedCalloc(functionCount ? functionCount : 1, sizeof(InlineNode));
+    int index = 0;
+    for(IrFunction *fn = functions; fn; fn = fn->next)
+    {
+        InlineNode *node = &nodes[index++];
+        node->fn = fn;
+        int capacity = 0;
+        for(IrBlock *block = fn->entry; block; block = block->next)
+        {
+            for(IrInstr *instr = block->first; instr; instr = instr->next)
+            {
+                if(instr->opcode != IROP_CALL) continue;
+                int *callee = hashMapFindIrFunctionIndexMap(&indices, instr->symbol);
+                if(!callee) continue;
+                if(node->callCount == capacity)
+                {
+                    capacity = capacity * 2 + 4;
+                    node->calls = countedRealloc(node->calls, sizeof(IrInstr*) * capacity);
+                    node->callees = countedRealloc(node->callees, sizeof(int) * capacity);
+                }
+                node->calls[node->callCount] = instr;
+                node->callees[node->callCount++] = *callee;
+            }
+        }
+    }
+
+    //Depth first over the call graph with an explicit stack, finishing callees before their callers so what gets
+    //inlined has had its own calls inlined already
+    int *stack = countedMalloc(sizeof(int) * (functionCount + 1));
+    int *nextCall = countedCalloc(functionCount ? functionCount : 1, sizeof(int));
+    for(int root = 0; root < functionCount; root++)
+    {
+        if(nodes[root].state != INLINE_UNVISITED) continue;
+        int stackLength = 0;
+        stack[stackLength++] = root;
+        nodes[root].state = INLINE_IN_PROGRESS;
+        while(stackLength)
+        {
+            InlineNode *node = &nodes[stack[stackLength - 1]];
+            int current = stack[stackLength - 1];
+            if(nextCall[current] < node->callCount)
+            {
+                int callee = node->callees[nextCall[current]++];
+                if(nodes[callee].state != INLINE_UNVISITED) continue;
+                nodes[callee].state = INLINE_IN_PROGRESS;
+                stack[stackLength++] = callee;
+                continue;
+            }
+            inlineCallees(nodes, node, budget);
+            node->state = INLINE_DONE;
+            stackLength--;
+        }
+    }
+
+    for(int i = 0; i < functionCount; i++)
+    {
+        free(nodes[i].calls);
+        free(nodes[i].callees);
+    }
+    free(nextCall);
+    free(stack);
+    free(nodes);
+    hashMapFreeIrFunctionIndexMap(&indices);
+}
+
+typedef struct
+{
+    const char *name;
+    bool (*run)(IrFunction *fn);
+} IrPass;
+
+void irOptimize(IrFunction *fn, FILE *dumpStream)
+{
+    static const IrPass passes[] = {
+            {"copy-propagation", irPropagateCopies},
+            {"gvn", irNumberValues},
+            {"loops", irOptimizeLoops},
+            {"lower-arithmetic", irLowerArithmetic},
+            {"copy-propagation", irPropagateCopies},
+            {"dce", irEliminateDeadCode},
+    };
+    if(dumpStream)
+    {
+        fputs("; input\n", dumpStream);
+        irDumpFunction(fn, dumpStream);
+    }
+    //Folding a branch can expose more redundancy, so iterate a few rounds until nothing changes
+    for(int round = 0; round < 4; round++)
+    {
+        bool changed = false;
+        for(int i = 0; i < (int)(sizeof(passes) / sizeof(passes[0])); i++)
+        {
+            if(!passes[i].run(fn)) continue;
+            changed = true;
+            if(dumpStream)
+            {
+                fprintf(dumpStream, "; after %s\n", passes[i].name);
+                irDumpFunction(fn, dumpStream);
+            }
+        }
+        if(!changed) break;
+    }
+}
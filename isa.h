@@ -0,0 +1,108 @@
+#ifndef CCOMPILER_ISA_H
+#define CCOMPILER_ISA_H
+#include "tokenize.h"
+#include "vec.h"
+
+#define ISA_SP_REGISTER 8
+#define ISA_BP_REGISTER 5
+
+/*
+Immediate forms operate on r0. ADD/ADC/SUB/SBC are dst op= src and are the only instructions that touch the carry
+flag, so address arithmetic may be interleaved with multi-word carry chains.
+LDR loads dst from the word addressed by src, STR stores src to the word addressed by dst.
+SHL, SHR and SAR shift dst left, right or right arithmetically by the count 1-15 held in the src field itself rather
+than in a register. They leave carry alone.
+JMPT jumps through a table of code addresses that directly follows it, to entry src counted from 0. The table is
+made of WORD pseudo instructions, each holding the address of a label.
+*/
+/*
+Binary encoding, one 16 bit word per instruction with the InstructionType value as opcode in the high byte:
+    register forms  [opcode:8][dst:4][src:4]
+    immediate forms [opcode:8][imm:8]
+CALL, JMP and BNZ take a second word holding the absolute word address of the target, BNZ tests the register in
+the src field. WORD is the bare address of its label. LABEL occupies no space. ADDRESS is the LHI and ORI pair
+that loads the address of a word of static data into r0, kept as one instruction so an object file can say where
+the linker has to put the final address. New instruction types must be appended to keep existing opcodes stable.
+*/
+#define ISA_IMMEDIATE_MAX 0xFF
+
+enum InstructionType
+{
+    IT_ADD,
+    IT_SUB,
+    IT_SUBI,
+    IT_ADC,
+    IT_ADDI,
+    IT_MOV,
+    IT_MOVI,
+    IT_LHI,
+    IT_ORI,
+    IT_PUSH,
+    IT_LDR,
+    IT_SBC,
+    IT_STR,
+    IT_POP,
+    IT_CALL,
+    IT_RET,
+    IT_JMP,
+    IT_BNZ,
+    IT_SHL,
+    IT_SHR,
+    IT_SAR,
+    IT_JMPT,
+    IT_WORD,
+    IT_LABEL,
+    IT_ADDRESS,
+};
+
+struct Instruction
+{
+    enum InstructionType type;
+};
+typedef struct Instruction Instruction;
+struct InstructionRegReg
+{
+    struct Instruction instruction;
+    int srcReg;
+    int dstReg;
+};
+struct InstructionImm
+{
+    struct Instruction instruction;
+    long long iValue;
+};
+//Control flow and label pseudo instructions. Labels are either numbered (blocks) or named by a symbol (functions).
+struct InstructionLabel
+{
+    struct Instruction instruction;
+    int srcReg;
+    int labelId;
+    Token *symbol;
+};
+typedef struct InstructionRegReg MovInstruction;
+typedef struct InstructionRegReg AddInstruction;
+typedef struct InstructionRegReg AdcInstruction;
+typedef struct InstructionRegReg SubInstruction;
+typedef struct InstructionRegReg SbcInstruction;
+typedef struct InstructionRegReg PushInstruction;
+typedef struct InstructionRegReg PopInstruction;
+typedef struct InstructionRegReg LdrInstruction;
+typedef struct InstructionRegReg StrInstruction;
+//srcReg is the shift count
+typedef struct InstructionRegReg ShiftInstruction;
+typedef struct InstructionRegReg JmptInstruction;
+typedef struct InstructionImm AddiInstruction;
+typedef struct InstructionImm SubiInstruction;
+typedef struct InstructionImm MoviInstruction;
+typedef struct InstructionImm LhiInstruction;
+typedef struct InstructionImm OriInstruction;
+//iValue is the offset of the word in the static data of the unit
+typedef struct InstructionImm AddressInstruction;
+typedef struct InstructionLabel LabelInstruction;
+typedef struct InstructionLabel JmpInstruction;
+typedef struct InstructionLabel BnzInstruction;
+typedef struct InstructionLabel CallInstruction;
+typedef struct InstructionLabel WordInstruction;
+listDeclare(Instruction*, InstructionPtrList);
+
+#endif //CCOMPILER_ISA_H
@@ -0,0 +1,861 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "link.h"
+#include "emit.h"
+#include "bytes.h"
+
+#define LINK_STATE_MAGIC "cclink-state"
+#define LINK_STATE_VERSION 1
+#define LINK_STATE_SUFFIX ".state"
+//Longest function name and object path the state file holds
+#define LINK_NAME_MAX 255
+#define LINK_PATH_MAX 4095
+//Code addresses are one word, and the last one is the return address that halts the simulator
+#define LINK_CODE_LIMIT 0xFFFF
+
+typedef struct
+{
+    char *name;
+    //Word address in the object's code
+    uint32_t address;
+    uint32_t flags;
+} LinkSymbol;
+
+typedef struct
+{
+    uint32_t offset;
+    uint32_t kind;
+    //Callee of a RELOCATION_SYMBOL
+    char *symbol;
+} LinkRelocation;
+
+typedef struct
+{
+    char *name;
+    uint32_t checksum;
+    uint32_t counterOffset;
+    uint32_t counterCount;
+} LinkProfileRange;
+
+typedef struct
+{
+    char *path;
+    //The file as it was when the object was read, to tell whether it changed since
+    uint64_t fileSize;
+    int64_t modified;
+    uint64_t hash;
+    uint32_t codeBase;
+    uint32_t codeCapacity;
+    uint32_t codeWords;
+    uint32_t dataBase;
+    uint32_t dataCapacity;
+    uint32_t dataWords;
+    //Functions the object defines
+    LinkSymbol *symbols;
+    int symbolCount;
+    //Every relocation of an object read from its file, only the calls of one known from the state
+    LinkRelocation *relocations;
+    int relocationCount;
+    LinkProfileRange *profileRanges;
+    int profileRangeCount;
+    //Sections of an object read from its file, NULL for one known from the state
+    uint16_t *code;
+    uint16_t *data;
+} LinkObject;
+
+static uint64_t contentHash(const unsigned char *bytes, size_t length)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for(size_t i = 0; i < length; i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    return hash;
+}
+
+static char *copyName(const unsigned char *strings, uint32_t offset, uint32_t length)
+{
+    char *name = malloc(length + 1);
+    memcpy(name, strings + offset, length);
+    name[length] = 0;
+    return name;
+}
+
+static void freeObject(LinkObject *object)
+{
+    for(int i = 0; i < object->symbolCount; i++)
+        free(object->symbols[i].name);
+    for(int i = 0; i < object->relocationCount; i++)
+        free(object->relocations[i].symbol);
+    for(int i = 0; i < object->profileRangeCount; i++)
+        free(object->profileRanges[i].name);
+    free(object->symbols);
+    free(object->relocations);
+    free(object->profileRanges);
+    free(object->code);
+    free(object->data);
+    free(object->path);
+    memset(object, 0, sizeof(LinkObject));
+}
+
+static void freeObjects(LinkObject *objects, int objectCount)
+{
+    for(int i = 0; i < objectCount; i++)
+        freeObject(&objects[i]);
+    free(objects);
+}
+
+//Checks the names of an object, which also end up in the state file
+static bool validName(const unsigned char *strings, uint32_t stringBytes, uint32_t offset, uint32_t length)
+{
+    if(!length || length > LINK_NAME_MAX || (uint64_t)offset + length > stringBytes) return false;
+    for(uint32_t i = 0; i < length; i++)
+    {
+        if(strings[offset + i] <= ' ') return false;
+    }
+    return true;
+}
+
+static bool parseObject(LinkObject *object, const unsigned char *file, size_t size)
+{
+    if(get32(file + 4) != OBJECT_VERSION) return false;
+    uint32_t codeOffset = get32(file + 8);
+    uint32_t codeWords = get32(file + 12);
+    uint32_t dataOffset = get32(file + 16);
+    uint32_t dataWords = get32(file + 20);
+    uint32_t symbolOffset = get32(file + 24);
+    uint32_t symbolCount = get32(file + 28);
+    uint32_t relocationOffset = get32(file + 32);
+    uint32_t relocationCount = get32(file + 36);
+    uint32_t profileRangeOffset = get32(file + 40);
+    uint32_t profileRangeCount = get32(file + 44);
+    uint32_t stringOffset = get32(file + 48);
+    uint32_t stringBytes = get32(file + 52);
+    if(!sectionFits(size, codeOffset, (uint64_t)codeWords * 2) ||
+       !sectionFits(size, dataOffset, (uint64_t)dataWords * 2) ||
+       !sectionFits(size, symbolOffset, (uint64_t)symbolCount * sizeof(ObjectSymbol)) ||
+       !sectionFits(size, relocationOffset, (uint64_t)relocationCount * sizeof(ObjectRelocation)) ||
+       !sectionFits(size, profileRangeOffset, (uint64_t)profileRangeCount * sizeof(BinaryProfileRange)) ||
+       !sectionFits(size, stringOffset, stringBytes))
+        return false;
+    const unsigned char *strings = file + stringOffset;
+
+    object->codeWords = codeWords;
+    object->code = malloc(sizeof(uint16_t) * (codeWords ? codeWords : 1));
+    for(uint32_t i = 0; i < codeWords; i++)
+        object->code[i] = (uint16_t)get16(file + codeOffset + i * 2);
+    object->dataWords = dataWords;
+    object->data = malloc(sizeof(uint16_t) * (dataWords ? dataWords : 1));
+    for(uint32_t i = 0; i < dataWords; i++)
+        object->data[i] = (uint16_t)get16(file + dataOffset + i * 2);
+
+    object->symbols = malloc(sizeof(LinkSymbol) * (symbolCount ? symbolCount : 1));
+    for(uint32_t i = 0; i < symbolCount; i++)
+    {
+        const unsigned char *entry = file + symbolOffset + i * sizeof(ObjectSymbol);
+        uint32_t nameOffset = get32(entry);
+        uint32_t nameLength = get32(entry + 4);
+        uint32_t flags = get32(entry + 8);
+        uint32_t address = get32(entry + 12);
+        if(!validName(strings, stringBytes, nameOffset, nameLength)) return false;
+        if(!(flags & OBJECT_SYMBOL_DEFINED)) continue;
+        if(address >= codeWords) return false;
+        LinkSymbol *symbol = &object->symbols[object->symbolCount++];
+        symbol->name = copyName(strings, nameOffset, nameLength);
+        symbol->address = address;
+        symbol->flags = flags;
+    }
+
+    object->relocations = malloc(sizeof(LinkRelocation) * (relocationCount ? relocationCount : 1));
+    for(uint32_t i = 0; i < relocationCount; i++)
+    {
+        const unsigned char *entry = file + relocationOffset + i * sizeof(ObjectRelocation);
+        uint32_t offset = get32(entry);
+        uint32_t kind = get32(entry + 4);
+        uint32_t index = get32(entry + 8);
+        uint32_t words = kind == RELOCATION_DATA ? 2 : 1;
+        if(kind > RELOCATION_DATA || (uint64_t)offset + words > codeWords) return false;
+        if(kind == RELOCATION_SYMBOL && index >= symbolCount) return false;
+        LinkRelocation *relocation = &object->relocations[object->relocationCount++];
+        relocation->offset = offset;
+        relocation->kind = kind;
+        relocation->symbol = NULL;
+        if(kind == RELOCATION_SYMBOL)
+        {
+            const unsigned char *symbol = file + symbolOffset + index * sizeof(ObjectSymbol);
+            relocation->symbol = copyName(strings, get32(symbol), get32(symbol + 4));
+        }
+    }
+
+    object->profileRanges = malloc(sizeof(LinkProfileRange) * (profileRangeCount ? profileRangeCount : 1));
+    for(uint32_t i = 0; i < profileRangeCount; i++)
+    {
+        const unsigned char *entry = file + profileRangeOffset + i * sizeof(BinaryProfileRange);
+        uint32_t nameOffset = get32(entry);
+        uint32_t nameLength = get32(entry + 4);
+        uint32_t counterOffset = get32(entry + 12);
+        uint32_t counterCount = get32(entry + 16);
+        if(!validName(strings, stringBytes, nameOffset, nameLength) ||
+           (uint64_t)counterOffset + (uint64_t)counterCount * 2 > dataWords)
+            return false;
+        LinkProfileRange *range = &object->profileRanges[object->profileRangeCount++];
+        range->name = copyName(strings, nameOffset, nameLength);
+        range->checksum = get32(entry + 8);
+        range->counterOffset = counterOffset;
+        range->counterCount = counterCount;
+    }
+    return true;
+}
+
+static bool readObject(LinkObject *object, const char *path, FILE *log)
+{
+    memset(object, 0, sizeof(LinkObject));
+    object->path = malloc(strlen(path) + 1);
+    strcpy(object->path, path);
+    struct stat info;
+    if(strlen(path) > LINK_PATH_MAX || strchr(path, '\n') || stat(path, &info) != 0)
+    {
+        fprintf(log, "Failed to open '%s'\n", path);
+        return false;
+    }
+    object->fileSize = (uint64_t)info.st_size;
+    object->modified = (int64_t)info.st_mtime;
+    size_t size;
+    unsigned char *file = readFile(path, &size, log);
+    if(!file) return false;
+    object->hash = contentHash(file, size);
+    bool result = size >= sizeof(ObjectHeader) && !memcmp(file, OBJECT_MAGIC, 4);
+    if(!result)
+        fprintf(log, "'%s' is not an object file\n", path);
+    else if(!(result = parseObject(object, file, size)))
+        fprintf(log, "Object '%s' is malformed\n", path);
+    free(file);
+    return result;
+}
+
+//Address of every function in the image by name, open addressing with linear probing
+typedef struct
+{
+    const char **names;
+    uint32_t *addresses;
+    uint32_t *flags;
+    //Object that defines the function
+    int *objects;
+    unsigned int mask;
+} LinkSymbolTable;
+
+static int symbolSlot(LinkSymbolTable *table, const char *name)
+{
+    unsigned int index = 2166136261u;
+    for(const char *c = name; *c; c++)
+        index = (index ^ (unsigned char)*c) * 16777619u;
+    index &= table->mask;
+    while(table->names[index] && strcmp(table->names[index], name))
+        index = (index + 1) & table->mask;
+    return (int)index;
+}
+
+static void symbolTableFree(LinkSymbolTable *table)
+{
+    free(table->names);
+    free(table->addresses);
+    free(table->flags);
+    free(table->objects);
+    memset(table, 0, sizeof(LinkSymbolTable));
+}
+
+//Enters the functions of the objects at the addresses the objects were placed at and checks that every call finds
+//its callee. Errors go to log unless it is NULL.
+static bool resolveSymbols(LinkObject *objects, int objectCount, LinkSymbolTable *table, FILE *log)
+{
+    int symbolCount = 0;
+    for(int i = 0; i < objectCount; i++)
+        symbolCount += objects[i].symbolCount;
+    unsigned int capacity = 16;
+    while(capacity < (unsigned int)symbolCount * 2) capacity *= 2;
+    table->names = calloc(capacity, sizeof(char*));
+    table->addresses = calloc(capacity, sizeof(uint32_t));
+    table->flags = calloc(capacity, sizeof(uint32_t));
+    table->objects = calloc(capacity, sizeof(int));
+    table->mask = capacity - 1;
+
+    bool result = true;
+    for(int i = 0; i < objectCount; i++)
+    {
+        LinkObject *object = &objects[i];
+        for(int s = 0; s < object->symbolCount; s++)
+        {
+            LinkSymbol *symbol = &object->symbols[s];
+            int slot = symbolSlot(table, symbol->name);
+            if(table->names[slot])
+            {
+                if(symbol->flags & table->flags[slot] & OBJECT_SYMBOL_SHARED) continue;
+                if(log)
+                    fprintf(log, "Function '%s' is defined in both '%s' and '%s'\n", symbol->name,
+                            objects[table->objects[slot]].path, object->path);
+                result = false;
+                continue;
+            }
+            table->names[slot] = symbol->name;
+            table->addresses[slot] = object->codeBase + symbol->address;
+            table->flags[slot] = symbol->flags;
+            table->objects[slot] = i;
+        }
+    }
+    for(int i = 0; i < objectCount; i++)
+    {
+        LinkObject *object = &objects[i];
+        for(int r = 0; r < object->relocationCount; r++)
+        {
+            LinkRelocation *relocation = &object->relocations[r];
+            if(relocation->kind != RELOCATION_SYMBOL || table->names[symbolSlot(table, relocation->symbol)])
+                continue;
+            if(log)
+                fprintf(log, "Undefined function '%s' called from '%s'\n", relocation->symbol, object->path);
+            result = false;
+        }
+    }
+    return result;
+}
+
+//Places the objects one after the other. With roomToGrow every object gets extra room as long as everything fits.
+static bool placeObjects(LinkObject *objects, int objectCount, bool roomToGrow, FILE *log)
+{
+    uint64_t codeWords = 0;
+    uint64_t dataWords = 0;
+    for(int attempt = roomToGrow ? 0 : 1; attempt < 2; attempt++)
+    {
+        codeWords = 0;
+        dataWords = 0;
+        for(int i = 0; i < objectCount; i++)
+        {
+            LinkObject *object = &objects[i];
+            object->codeCapacity = object->codeWords + (attempt ? 0 : object->codeWords / 4 + 8);
+            object->dataCapacity = object->dataWords + (attempt ? 0 : object->dataWords / 4 + 8);
+            object->codeBase = (uint32_t)codeWords;
+            object->dataBase = BINARY_DATA_ADDRESS + (uint32_t)dataWords;
+            codeWords += object->codeCapacity;
+            dataWords += object->dataCapacity;
+        }
+        if(codeWords < LINK_CODE_LIMIT && BINARY_DATA_ADDRESS + dataWords <= BINARY_DATA_LIMIT)
+            return true;
+    }
+    if(codeWords >= LINK_CODE_LIMIT)
+        fprintf(log, "The code of the objects exceeds %d words\n", LINK_CODE_LIMIT - 1);
+    else
+        fprintf(log, "The static data of the objects exceeds %d words\n", BINARY_DATA_LIMIT - BINARY_DATA_ADDRESS);
+    return false;
+}
+
+//The object's code as it runs at its place in the image, padded with zeros to its capacity
+static void relocateCode(LinkObject *object, LinkSymbolTable *table, uint16_t *code)
+{
+    memcpy(code, object->code, sizeof(uint16_t) * object->codeWords);
+    memset(code + object->codeWords, 0, sizeof(uint16_t) * (object->codeCapacity - object->codeWords));
+    for(int i = 0; i < object->relocationCount; i++)
+    {
+        LinkRelocation *relocation = &object->relocations[i];
+        uint16_t *word = code + relocation->offset;
+        switch(relocation->kind)
+        {
+            case RELOCATION_CODE:
+                word[0] = (uint16_t)(word[0] + object->codeBase);
+                break;
+            case RELOCATION_SYMBOL:
+                word[0] = (uint16_t)table->addresses[symbolSlot(table, relocation->symbol)];
+                break;
+            case RELOCATION_DATA:
+            {
+                //The immediates of the LHI and ORI
+                uint32_t address = ((word[0] & 0xFFu) << 8 | (word[1] & 0xFFu)) + object->dataBase;
+                word[0] = (uint16_t)((word[0] & 0xFF00u) | (address >> 8 & 0xFF));
+                word[1] = (uint16_t)((word[1] & 0xFF00u) | (address & 0xFF));
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+//Sections of an image the linker writes. The code and the data come first, so they keep their place when the
+//symbols after them change.
+typedef struct
+{
+    uint32_t codeOffset;
+    uint32_t codeWords;
+    uint32_t dataOffset;
+    uint32_t dataWords;
+    uint32_t symbolOffset;
+    uint32_t symbolCount;
+    uint32_t profileRangeOffset;
+    uint32_t profileRangeCount;
+    uint32_t stringOffset;
+    uint32_t stringBytes;
+    uint32_t imageSize;
+} ImageLayout;
+
+static bool keepsSymbol(LinkSymbolTable *table, int objectIndex, LinkSymbol *symbol)
+{
+    return table->objects[symbolSlot(table, symbol->name)] == objectIndex;
+}
+
+static void imageLayoutInit(ImageLayout *layout, LinkObject *objects, int objectCount, LinkSymbolTable *table)
+{
+    memset(layout, 0, sizeof(ImageLayout));
+    for(int i = 0; i < objectCount; i++)
+    {
+        LinkObject *object = &objects[i];
+        layout->codeWords += object->codeCapacity;
+        layout->dataWords += object->dataCapacity;
+        for(int s = 0; s < object->symbolCount; s++)
+        {
+            if(!keepsSymbol(table, i, &object->symbols[s])) continue;
+            layout->symbolCount++;
+            layout->stringBytes += (uint32_t)strlen(object->symbols[s].name);
+        }
+        layout->profileRangeCount += (uint32_t)object->profileRangeCount;
+        for(int p = 0; p < object->profileRangeCount; p++)
+            layout->stringBytes += (uint32_t)strlen(object->profileRanges[p].name);
+    }
+    layout->codeOffset = align8(sizeof(BinaryHeader));
+    layout->dataOffset = align8(layout->codeOffset + layout->codeWords * 2);
+    layout->symbolOffset = align8(layout->dataOffset + layout->dataWords * 2);
+    layout->profileRangeOffset = layout->symbolOffset + layout->symbolCount * (uint32_t)sizeof(BinarySymbol);
+    layout->stringOffset = layout->profileRangeOffset + layout->profileRangeCount * (uint32_t)sizeof(BinaryProfileRange);
+    layout->imageSize = align8(layout->stringOffset + layout->stringBytes);
+}
+
+static void putHeader(unsigned char *header, ImageLayout *layout)
+{
+    memset(header, 0, layout->codeOffset);
+    memcpy(header, BINARY_MAGIC, 4);
+    put32(header + 4, BINARY_VERSION);
+    put32(header + 8, layout->codeOffset);
+    put32(header + 12, layout->codeWords);
+    put32(header + 16, layout->symbolOffset);
+    put32(header + 20, layout->symbolCount);
+    put32(header + 24, layout->stringOffset);
+    put32(header + 28, layout->stringBytes);
+    put32(header + 32, layout->profileRangeOffset);
+    put32(header + 36, layout->profileRangeCount);
+    put32(header + 40, layout->dataOffset);
+    put32(header + 44, BINARY_DATA_ADDRESS);
+    put32(header + 48, layout->dataWords);
+}
+
+//The symbols, profile ranges and strings, which start at symbolOffset and run to the end of the image
+static unsigned char *buildTail(ImageLayout *layout, LinkObject *objects, int objectCount, LinkSymbolTable *table)
+{
+    unsigned char *tail = calloc(layout->imageSize - layout->symbolOffset, 1);
+    unsigned char *symbol = tail;
+    unsigned char *range = tail + (layout->profileRangeOffset - layout->symbolOffset);
+    unsigned char *strings = tail + (layout->stringOffset - layout->symbolOffset);
+    uint32_t stringCursor = 0;
+    for(int i = 0; i < objectCount; i++)
+    {
+        LinkObject *object = &objects[i];
+        for(int s = 0; s < object->symbolCount; s++)
+        {
+            if(!keepsSymbol(table, i, &object->symbols[s])) continue;
+            uint32_t length = (uint32_t)strlen(object->symbols[s].name);
+            put32(symbol, stringCursor);
+            put32(symbol + 4, length);
+            put32(symbol + 8, object->codeBase + object->symbols[s].address);
+            memcpy(strings + stringCursor, object->symbols[s].name, length);
+            stringCursor += length;
+            symbol += sizeof(BinarySymbol);
+        }
+    }
+    for(int i = 0; i < objectCount; i++)
+    {
+        LinkObject *object = &objects[i];
+        for(int p = 0; p < object->profileRangeCount; p++)
+        {
+            LinkProfileRange *profileRange = &object->profileRanges[p];
+            uint32_t length = (uint32_t)strlen(profileRange->name);
+            put32(range, stringCursor);
+            put32(range + 4, length);
+            put32(range + 8, profileRange->checksum);
+            put32(range + 12, object->dataBase + profileRange->counterOffset);
+            put32(range + 16, profileRange->counterCount);
+            memcpy(strings + stringCursor, profileRange->name, length);
+            stringCursor += length;
+            range += sizeof(BinaryProfileRange);
+        }
+    }
+    return tail;
+}
+
+//Writes the relocated code and the data of an object into the image at their places in it
+static void putObject(unsigned char *image, ImageLayout *layout, LinkObject *object, LinkSymbolTable *table)
+{
+    uint16_t *code = malloc(sizeof(uint16_t) * (object->codeCapacity ? object->codeCapacity : 1));
+    relocateCode(object, table, code);
+    for(uint32_t i = 0; i < object->codeCapacity; i++)
+        put16(image + (object->codeBase + i) * 2, code[i]);
+    free(code);
+    unsigned char *data = image + (layout->dataOffset - layout->codeOffset) +
+                          (object->dataBase - BINARY_DATA_ADDRESS) * 2;
+    for(uint32_t i = 0; i < object->dataWords; i++)
+        put16(data + i * 2, object->data[i]);
+}
+
+static bool writeState(const char *path, LinkObject *objects, int objectCount, uint32_t imageSize, int64_t linkTime,
+                       FILE *log)
+{
+    FILE *file = fopen(path, "w");
+    if(!file)
+    {
+        fprintf(log, "Failed to write link state '%s'\n", path);
+        return false;
+    }
+    fprintf(file, "%s %d\nimage %u %lld\n", LINK_STATE_MAGIC, LINK_STATE_VERSION, imageSize, (long long)linkTime);
+    for(int i = 0; i < objectCount; i++)
+    {
+        LinkObject *object = &objects[i];
+        int callCount = 0;
+        for(int r = 0; r < object->relocationCount; r++)
+            callCount += object->relocations[r].kind == RELOCATION_SYMBOL;
+        fprintf(file, "object %llu %lld %016llx %u %u %u %u %u %u %d %d %d %s\n",
+                (unsigned long long)object->fileSize, (long long)object->modified, (unsigned long long)object->hash,
+                object->codeBase, object->codeCapacity, object->codeWords, object->dataBase, object->dataCapacity,
+                object->dataWords, object->symbolCount, callCount, object->profileRangeCount, object->path);
+        for(int s = 0; s < object->symbolCount; s++)
+            fprintf(file, "symbol %u %u %s\n", object->symbols[s].address, object->symbols[s].flags,
+                    object->symbols[s].name);
+        for(int r = 0; r < object->relocationCount; r++)
+        {
+            if(object->relocations[r].kind == RELOCATION_SYMBOL)
+                fprintf(file, "call %u %s\n", object->relocations[r].offset, object->relocations[r].symbol);
+        }
+        for(int p = 0; p < object->profileRangeCount; p++)
+        {
+            LinkProfileRange *range = &object->profileRanges[p];
+            fprintf(file, "profile %08x %u %u %s\n", range->checksum, range->counterOffset, range->counterCount,
+                    range->name);
+        }
+    }
+    bool result = !ferror(file);
+    if(fclose(file) != 0)
+        result = false;
+    if(!result)
+        fprintf(log, "Failed to write link state '%s'\n", path);
+    return result;
+}
+
+static char *copyString(const char *str)
+{
+    char *copy = malloc(strlen(str) + 1);
+    strcpy(copy, str);
+    return copy;
+}
+
+static bool readStateObject(FILE *file, LinkObject *object, int symbolCount, int callCount, int profileRangeCount)
+{
+    char name[LINK_NAME_MAX + 1];
+    object->symbols = malloc(sizeof(LinkSymbol) * (symbolCount ? symbolCount : 1));
+    for(; object->symbolCount < symbolCount; object->symbolCount++)
+    {
+        LinkSymbol *symbol = &object->symbols[object->symbolCount];
+        if(fscanf(file, " symbol %u %u %255s", &symbol->address, &symbol->flags, name) != 3) return false;
+        symbol->name = copyString(name);
+    }
+    object->relocations = malloc(sizeof(LinkRelocation) * (callCount ? callCount : 1));
+    for(; object->relocationCount < callCount; object->relocationCount++)
+    {
+        LinkRelocation *relocation = &object->relocations[object->relocationCount];
+        relocation->kind = RELOCATION_SYMBOL;
+        if(fscanf(file, " call %u %255s", &relocation->offset, name) != 2) return false;
+        relocation->symbol = copyString(name);
+    }
+    object->profileRanges = malloc(sizeof(LinkProfileRange) * (profileRangeCount ? profileRangeCount : 1));
+    for(; object->profileRangeCount < profileRangeCount; object->profileRangeCount++)
+    {
+        LinkProfileRange *range = &object->profileRanges[object->profileRangeCount];
+        if(fscanf(file, " profile %x %u %u %255s", &range->checksum, &range->counterOffset, &range->counterCount,
+                  name) != 4)
+            return false;
+        range->name = copyString(name);
+    }
+    return true;
+}
+
+//Objects as the last incremental link left them, without their code and data
+static bool readState(const char *path, LinkObject **objects, int *objectCount, uint32_t *imageSize,
+                      int64_t *linkTime)
+{
+    FILE *file = fopen(path, "r");
+    if(!file) return false;
+    char magic[16];
+    int version;
+    long long time;
+    bool result = fscanf(file, "%15s %d image %u %lld", magic, &version, imageSize, &time) == 4 &&
+                  !strcmp(magic, LINK_STATE_MAGIC) && version == LINK_STATE_VERSION;
+    *linkTime = time;
+    *objects = NULL;
+    *objectCount = 0;
+    int capacity = 0;
+    char objectPath[LINK_PATH_MAX + 1];
+    unsigned long long fileSize;
+    long long modified;
+    unsigned long long hash;
+    int symbolCount;
+    int callCount;
+    int profileRangeCount;
+    int fields = 0;
+    while(result)
+    {
+        LinkObject object = {0};
+        fields = fscanf(file, " object %llu %lld %llx %u %u %u %u %u %u %d %d %d %4095[^\n]", &fileSize, &modified,
+                        &hash, &object.codeBase, &object.codeCapacity, &object.codeWords, &object.dataBase,
+                        &object.dataCapacity, &object.dataWords, &symbolCount, &callCount, &profileRangeCount,
+                        objectPath);
+        if(fields != 13) break;
+        if(symbolCount < 0 || callCount < 0 || profileRangeCount < 0 || symbolCount > LINK_CODE_LIMIT ||
+           callCount > LINK_CODE_LIMIT || profileRangeCount > LINK_CODE_LIMIT)
+        {
+            result = false;
+            break;
+        }
+        object.path = copyString(objectPath);
+        object.fileSize = fileSize;
+        object.modified = modified;
+        object.hash = hash;
+        result = readStateObject(file, &object, symbolCount, callCount, profileRangeCount);
+        if(*objectCount == capacity)
+        {
+            capacity = capacity * 2 + 8;
+            *objects = realloc(*objects, sizeof(LinkObject) * capacity);
+        }
+        (*objects)[(*objectCount)++] = object;
+    }
+    if(fields != EOF)
+        result = false;
+    fclose(file);
+    if(!result)
+    {
+        freeObjects(*objects, *objectCount);
+        *objects = NULL;
+        *objectCount = 0;
+    }
+    return result;
+}
+
+static bool writeImage(const char *path, unsigned char *image, uint32_t imageSize, FILE *log)
+{
+    FILE *file = fopen(path, "wb");
+    bool result = file && fwrite(image, 1, imageSize, file) == imageSize;
+    if(file && fclose(file) != 0)
+        result = false;
+    if(!result)
+        fprintf(log, "Failed to write '%s'\n", path);
+    return result;
+}
+
+static bool fullLink(const char **objectPaths, int objectCount, const char *outputPath, const char *statePath,
+                     bool incremental, int64_t linkTime, LinkStats *stats, FILE *log)
+{
+    //Whatever happens, a state left from before no longer describes the image
+    remove(statePath);
+    stats->fullLink = true;
+    LinkObject *objects = calloc(objectCount, sizeof(LinkObject));
+    bool result = true;
+    for(int i = 0; i < objectCount; i++)
+    {
+        stats->objectsRead++;
+        if(!readObject(&objects[i], objectPaths[i], log))
+            result = false;
+    }
+    LinkSymbolTable table = {0};
+    result = result && placeObjects(objects, objectCount, incremental, log) &&
+             resolveSymbols(objects, objectCount, &table, log);
+    if(result)
+    {
+        ImageLayout layout;
+        imageLayoutInit(&layout, objects, objectCount, &table);
+        unsigned char *image = calloc(layout.imageSize, 1);
+        putHeader(image, &layout);
+        for(int i = 0; i < objectCount; i++)
+            putObject(image + layout.codeOffset, &layout, &objects[i], &table);
+        unsigned char *tail = buildTail(&layout, objects, objectCount, &table);
+        memcpy(image + layout.symbolOffset, tail, layout.imageSize - layout.symbolOffset);
+        free(tail);
+        result = writeImage(outputPath, image, layout.imageSize, log);
+        free(image);
+        if(result && incremental)
+            result = writeState(statePath, objects, objectCount, layout.imageSize, linkTime, log);
+    }
+    symbolTableFree(&table);
+    freeObjects(objects, objectCount);
+    return result;
+}
+
+static bool writeAt(FILE *file, long offset, const unsigned char *bytes, size_t length)
+{
+    return fseek(file, offset, SEEK_SET) == 0 && fwrite(bytes, 1, length, file) == length;
+}
+
+//Rewrites what changed in the image the last incremental link left. Returns false with *fallBack set when only a
+//full link will do.
+static bool relink(const char **objectPaths, int objectCount, const char *outputPath, const char *statePath,
+                   int64_t linkTime, LinkStats *stats, bool *fallBack, FILE *log)
+{
+    *fallBack = true;
+    LinkObject *objects;
+    int stateObjectCount;
+    uint32_t imageSize;
+    int64_t lastLinkTime;
+    if(!readState(statePath, &objects, &stateObjectCount, &imageSize, &lastLinkTime)) return false;
+    struct stat imageInfo;
+    bool result = stateObjectCount == objectCount && stat(outputPath, &imageInfo) == 0 &&
+                  (uint64_t)imageInfo.st_size == imageSize;
+    for(int i = 0; i < objectCount && result; i++)
+        result = !strcmp(objects[i].path, objectPaths[i]);
+    LinkSymbolTable previous = {0};
+    result = result && resolveSymbols(objects, objectCount, &previous, NULL);
+
+    bool *changed = calloc(objectCount, sizeof(bool));
+    //The previous symbols still point into the objects that were replaced
+    LinkObject *replaced = calloc(objectCount, sizeof(LinkObject));
+    for(int i = 0; i < objectCount && result; i++)
+    {
+        LinkObject *object = &objects[i];
+        struct stat info;
+        if(stat(objectPaths[i], &info) != 0)
+        {
+            result = false;
+            break;
+        }
+        //A file written in the same second as the last link may have changed without its time showing it
+        if((uint64_t)info.st_size == object->fileSize && (int64_t)info.st_mtime == object->modified &&
+           object->modified < lastLinkTime)
+            continue;
+        LinkObject fresh;
+        stats->objectsRead++;
+        if(!readObject(&fresh, objectPaths[i], log))
+        {
+            freeObject(&fresh);
+            *fallBack = false;
+            result = false;
+            break;
+        }
+        if(fresh.hash == object->hash)
+        {
+            object->fileSize = fresh.fileSize;
+            object->modified = fresh.modified;
+            freeObject(&fresh);
+            continue;
+        }
+        if(fresh.codeWords > object->codeCapacity || fresh.dataWords > object->dataCapacity)
+        {
+            freeObject(&fresh);
+            result = false;
+            break;
+        }
+        fresh.codeBase = object->codeBase;
+        fresh.codeCapacity = object->codeCapacity;
+        fresh.dataBase = object->dataBase;
+        fresh.dataCapacity = object->dataCapacity;
+        replaced[i] = *object;
+        *object = fresh;
+        changed[i] = true;
+    }
+
+    LinkSymbolTable table = {0};
+    if(result)
+    {
+        *fallBack = false;
+        result = resolveSymbols(objects, objectCount, &table, log);
+    }
+    FILE *image = NULL;
+    if(result)
+    {
+        remove(statePath);
+        image = fopen(outputPath, "r+b");
+        result = image != NULL;
+    }
+    if(result)
+    {
+        ImageLayout layout;
+        imageLayoutInit(&layout, objects, objectCount, &table);
+        unsigned char *header = malloc(layout.codeOffset);
+        putHeader(header, &layout);
+        result = writeAt(image, 0, header, layout.codeOffset);
+        free(header);
+        for(int i = 0; i < objectCount && result; i++)
+        {
+            LinkObject *object = &objects[i];
+            if(changed[i])
+            {
+                //The whole room of the object, so nothing of a longer old version is left behind
+                size_t codeBytes = (size_t)object->codeCapacity * 2;
+                size_t dataBytes = (size_t)object->dataCapacity * 2;
+                unsigned char *bytes = calloc(codeBytes + dataBytes + 1, 1);
+                uint16_t *code = malloc(sizeof(uint16_t) * (object->codeCapacity ? object->codeCapacity : 1));
+                relocateCode(object, &table, code);
+                for(uint32_t w = 0; w < object->codeCapacity; w++)
+                    put16(bytes + w * 2, code[w]);
+                for(uint32_t w = 0; w < object->dataWords; w++)
+                    put16(bytes + codeBytes + w * 2, object->data[w]);
+                free(code);
+                result = writeAt(image, (long)(layout.codeOffset + object->codeBase * 2), bytes, codeBytes) &&
+                         writeAt(image, (long)(layout.dataOffset + (object->dataBase - BINARY_DATA_ADDRESS) * 2),
+                                 bytes + codeBytes, dataBytes);
+                free(bytes);
+                continue;
+            }
+            //Only the calls into functions that moved
+            for(int r = 0; r < object->relocationCount && result; r++)
+            {
+                LinkRelocation *relocation = &object->relocations[r];
+                uint32_t address = table.addresses[symbolSlot(&table, relocation->symbol)];
+                if(address == previous.addresses[symbolSlot(&previous, relocation->symbol)]) continue;
+                unsigned char word[2];
+                put16(word, address);
+                result = writeAt(image, (long)(layout.codeOffset + (object->codeBase + relocation->offset) * 2),
+                                 word, 2);
+            }
+        }
+        unsigned char *tail = buildTail(&layout, objects, objectCount, &table);
+        result = result && writeAt(image, (long)layout.symbolOffset, tail, layout.imageSize - layout.symbolOffset);
+        free(tail);
+        result = result && fflush(image) == 0 && ftruncate(fileno(image), (off_t)layout.imageSize) == 0;
+        if(fclose(image) != 0)
+            result = false;
+        if(!result)
+            fprintf(log, "Failed to write '%s'\n", outputPath);
+        else
+            result = writeState(statePath, objects, objectCount, layout.imageSize, linkTime, log);
+    }
+    symbolTableFree(&table);
+    symbolTableFree(&previous);
+    freeObjects(replaced, objectCount);
+    free(changed);
+    freeObjects(objects, stateObjectCount);
+    return result;
+}
+
+bool linkImage(const char **objectPaths, int objectCount, const char *outputPath, bool incremental,
+               LinkStats *stats, FILE *log)
+{
+    LinkStats ignored;
+    if(!stats) stats = &ignored;
+    memset(stats, 0, sizeof(LinkStats));
+    char *statePath = malloc(strlen(outputPath) + sizeof(LINK_STATE_SUFFIX));
+    strcat(strcpy(statePath, outputPath), LINK_STATE_SUFFIX);
+    int64_t linkTime = (int64_t)time(NULL);
+    bool fallBack = true;
+    bool result = incremental && relink(objectPaths, objectCount, outputPath, statePath, linkTime, stats, &fallBack,
+                                        log);
+    if(!result && fallBack)
+    {
+        memset(stats, 0, sizeof(LinkStats));
+        result = fullLink(objectPaths, objectCount, outputPath, statePath, incremental, linkTime, stats, log);
+    }
+    free(statePath);
+    return result;
+}
@@ -0,0 +1,31 @@
+#ifndef CCOMPILER_LINK_H
+#define CCOMPILER_LINK_H
+#include <stdio.h>
+#include <stdbool.h>
+
+/*
+Combines relocatable objects written by ccompiler -c into a program image like the ones emitBinary writes. The code
+of the objects goes one after the other from address 0 and their data one after the other from
+BINARY_DATA_ADDRESS, in the order they are given. Only one object may define a function, except for the runtime
+routines, of which the first copy is kept and the others are left unused.
+
+An incremental link also writes a state file next to the image, the image path with ".state" appended. It records
+where every object went, the functions each one defines and calls and its profile ranges, and every object gets a
+quarter of its size as room to grow. A relink reads only the objects whose content changed since then. Their code
+and data are written over their old place in the image, the calls from the other objects are patched where the
+functions they call moved, and the symbols after the data are rewritten. The relink falls back to a full link when
+the list of objects changed, an object outgrew its room, or the state does not match the image.
+*/
+
+typedef struct
+{
+    //Objects read from their files, every one for a full link
+    int objectsRead;
+    bool fullLink;
+} LinkStats;
+
+//Errors go to log. stats may be NULL.
+extern bool linkImage(const char **objectPaths, int objectCount, const char *outputPath, bool incremental,
+                      LinkStats *stats, FILE *log);
+
+#endif //CCOMPILER_LINK_H
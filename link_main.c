@@ -0,0 +1,37 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "link.h"
+
+int main(int argc, char **argv)
+{
+    const char *outputPath = "a.out";
+    bool incremental = false;
+    bool verbose = false;
+    const char **objectPaths = malloc(sizeof(char*) * (argc + 1));
+    int objectCount = 0;
+    for(int i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "-o") && i + 1 < argc)
+            outputPath = argv[++i];
+        else if(!strcmp(argv[i], "-incremental"))
+            incremental = true;
+        else if(!strcmp(argv[i], "-v"))
+            verbose = true;
+        else
+            objectPaths[objectCount++] = argv[i];
+    }
+    if(!objectCount)
+    {
+        printf("Usage: cclink [-o image] [-incremental] [-v] objects...\n");
+        free(objectPaths);
+        return 1;
+    }
+    LinkStats stats;
+    bool result = linkImage(objectPaths, objectCount, outputPath, incremental, &stats, stdout);
+    if(result && verbose)
+        printf("%s link, read %d of %d objects\n", stats.fullLink ? "Full" : "Incremental", stats.objectsRead,
+               objectCount);
+    free(objectPaths);
+    return result ? 0 : 1;
+}
@@ -2,68 +2,209 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <pthread.h>
 #include "tokenize.h"
+#include "preprocess.h"
+#include "pch.h"
 #include "ast.h"
+#include "ir.h"
+#include "isa.h"
+#include "runtime.h"
+#include "emit.h"
+#include "profile.h"
+#include "frame.h"
+#include "threadpool.h"
+#include "cache.h"
+#include "timereport.h"
+#include "server.h"
 #include "vec.h"
+#include "alloc.h"
 
-#define ISA_SP_REGISTER 8
-#define ISA_BP_REGISTER 5
-
-TokenVector tokenVector;
+//Never handed out by useRegister while a function is being compiled. Used to stage values that live in memory.
+#define ISA_SCRATCH_REGISTER 4
+#define MAX_CALL_ARGUMENTS 16
+//r1 to r3, the register allocator keeps r0 and r4 for staging
+#define ALLOCATABLE_REGISTERS 3
+//Values live across a call are spilled, so a call needs more registers than there are
+#define CALL_REGISTER_NEED (ALLOCATABLE_REGISTERS + 1)
+//Units with fewer functions per worker than this are lowered on fewer threads, down to one
+#define CODEGEN_FUNCTIONS_PER_THREAD 8
+//Switches with at most this many clusters of cases compare one after the other, larger ones bisect
+#define SWITCH_LINEAR_MAX 3
+//Jump tables cover at least this many cases, in at least this percentage of their entries
+#define SWITCH_TABLE_MIN_CASES 4
+#define SWITCH_TABLE_MIN_DENSITY 40
+#define SWITCH_TABLE_MAX_ENTRIES 1024
 
 struct CodeVariable
 {
     char *identifierName;
     int identifierNameLength;
     int width;
-    int registerNumber;
-    int bpRelativeAddress;
     int scope;
-    bool inRegister;
     bool isSigned;
     bool isPointer;
+    int pointeeWidth;
+    bool pointeeSigned;
+    //SSA variable number, or the frame slot for variables whose address is taken
+    int irVariable;
+    int frameSlot;
+    bool inMemory;
+    //A table defined at file scope, a constant pointer to its first element in the data section
+    bool isTable;
+    int tableOffset;
+    //Index of the variable of the same name this one shadows, -1 if none is in scope
+    int shadowed;
 };
 typedef struct CodeVariable CodeVariable;
 listDeclare(CodeVariable , CodeVariableList);
 listDefine(CodeVariable , CodeVariableList);
 
-bool r1Used = false;
-bool r2Used = false;
-bool r3Used = false;
-bool r4Used = false;
+typedef struct
+{
+    //Converted to the type of the controlling expression
+    long long value;
+    //Orders the values as that type does
+    unsigned long long key;
+    IrBlock *target;
+    Token *label;
+} SwitchCase;
+listDeclare(SwitchCase, SwitchCaseList);
+listDefine(SwitchCase, SwitchCaseList);
+
+//Labels collected while parsing the body of a switch statement
+typedef struct
+{
+    int width;
+    bool isSigned;
+    SwitchCaseList cases;
+    IrBlock *defaultTarget;
+} SwitchStatement;
+//Identifiers by spelling
+hashMapDeclare(Token*, bool, TokenSet);
+hashMapDeclare(Token*, int, TokenIndexMap);
+
+//Memory of one compilation, in one region per kind of data so a memory report shows where it goes. Reset when the
+//compilation ends and handed to the next one, so batch and server runs keep reusing the same chunks.
+typedef struct UnitRegions UnitRegions;
+struct UnitRegions
+{
+    //The preprocessed token stream
+    Region tokens;
+    //Expression trees and the variable table of the parser
+    Region syntax;
+    //Intermediate code of the functions, including what the passes on other threads add to it
+    Region ir;
+    //Temporary memory of macro expansions, reset after each one, so its usage is that of the last expansion
+    Region macros;
+    //Instructions, including those lowered on other threads
+    Region code;
+    UnitRegions *next;
+};
+
+//Regions not in use by any compilation. Outlives the driver in a compile server.
+typedef struct
+{
+    pthread_mutex_t lock;
+    UnitRegions *available;
+} RegionPool;
+
+//Everything a single compilation touches, so translation units can be compiled on separate threads
+typedef struct
+{
+    TokenVector tokenVector;
+    InstructionPtrList instructions;
+    //Where expression trees and variables, and instructions, are allocated. NULL is the heap.
+    Allocator *syntaxAllocator;
+    Allocator *codeAllocator;
+    //Where functions are built, always a region
+    Allocator *irAllocator;
+    bool r1Used;
+    bool r2Used;
+    bool r3Used;
+    bool r4Used;
+    int stackSize;
+    int labelCount;
+
+    IrFunction *currentFunction;
+    IrFunction *functionsHead;
+    IrFunction *functionsTail;
+    //Signatures of the functions declared without a body, typically defined in another unit, as bodiless functions
+    IrFunction *declarations;
+    //Contents of the tables of the unit, on the heap
+    DataSection data;
+    //Set when the unit becomes an object, whose data only gets its address from the linker
+    bool relocatableData;
+    //Variables in scope, innermost last. variableIndices maps a name to the innermost variable of that name, and
+    //each variable links to the one it shadows, so lookup, declaration and leaving a scope never scan the list.
+    CodeVariableList variables;
+    TokenIndexMap variableIndices;
+    TokenSet addressTakenNames;
+    int currentScope;
+    int irVariableCount;
+    //Innermost switch statement being parsed, NULL outside of one
+    SwitchStatement *currentSwitch;
+    //Blocks break and continue jump to, NULL outside of the statements they apply to
+    IrBlock *breakTarget;
+    IrBlock *continueTarget;
+
+    //Tokens point into the main file, its headers and strings the preprocessor made
+    SourceFile *mainFile;
+    Preprocessor *preprocessor;
+    //Diagnostics and -fdump-ir output
+    FILE *log;
+} CompilerContext;
 
 //Returns an integer representing the next available register, or 0 if none.
 //Reserves the register and requires caller to call freeRegister when no longer in use.
-int useRegister()
+int useRegister(CompilerContext *ctx)
 {
-    if(!r1Used) return 1;
-    if(!r2Used) return 2;
-    if(!r3Used) return 3;
-    if(!r4Used) return 4;
+    if(!ctx->r1Used)
+    {
+        ctx->r1Used = true;
+        return 1;
+    }
+    if(!ctx->r2Used)
+    {
+        ctx->r2Used = true;
+        return 2;
+    }
+    if(!ctx->r3Used)
+    {
+        ctx->r3Used = true;
+        return 3;
+    }
+    if(!ctx->r4Used)
+    {
+        ctx->r4Used = true;
+        return 4;
+    }
     return 0;
 }
-void freeRegister(int registerNumber)
+void freeRegister(CompilerContext *ctx, int registerNumber)
 {
     switch (registerNumber)
     {
         case 1:
         {
-            r1Used = false;
+            ctx->r1Used = false;
             return;
         }
         case 2:
         {
-            r2Used = false;
+            ctx->r2Used = false;
             return;
         }
         case 3:
         {
-            r3Used = false;
+            ctx->r3Used = false;
             return;
         }
         case 4:
         {
-            r4Used = false;
+            ctx->r4Used = false;
             return;
         }
         default:
@@ -71,60 +212,16 @@ void freeRegister(int registerNumber)
     }
 }
 
-int stackSize = 0;
-
-enum InstructionType
-{
-    IT_ADD,
-    IT_SUB,
-    IT_SUBI,
-    IT_ADC,
-    IT_ADDI,
-    IT_MOV,
-    IT_MOVI,
-    IT_LHI,
-    IT_ORI,
-    IT_PUSH,
-    IT_LDR,
-};
-
-struct Instruction
-{
-    enum InstructionType type;
-};
-typedef struct Instruction Instruction;
-struct InstructionRegReg
-{
-    struct Instruction instruction;
-    int srcReg;
-    int dstReg;
-};
-struct InstructionImm
-{
-    struct Instruction instruction;
-    long long iValue;
-};
-typedef struct InstructionRegReg MovInstruction;
-typedef struct InstructionRegReg AddInstruction;
-typedef struct InstructionRegReg AdcInstruction;
-typedef struct InstructionRegReg SubInstruction;
-typedef struct InstructionRegReg PushInstruction;
-typedef struct InstructionRegReg LdrInstruction;
-typedef struct InstructionImm AddiInstruction;
-typedef struct InstructionImm SubiInstruction;
-typedef struct InstructionImm MoviInstruction;
-typedef struct InstructionImm LhiInstruction;
-typedef struct InstructionImm OriInstruction;
-listDeclare(Instruction*, InstructionPtrList);
 listDefine(Instruction*, InstructionPtrList);
 
-InstructionPtrList instructions;
 
 typedef struct
 {
     bool isRegister;
     bool isBpRelative;
     bool isIntegerLiteral;
+    //Address of the word of static data at offset integerLiteral, which only the linker knows
+    bool isDataAddress;
     bool isSigned;
     int width;
     int registerNumber;
@@ -132,247 +229,3542 @@ typedef struct
     long long integerLiteral;
 } AstNodeValue;
 
+static void emitRegReg(CompilerContext *ctx, enum InstructionType type, int dstReg, int srcReg)
+{
+    struct InstructionRegReg *instruction = allocatorAllocate(ctx->codeAllocator, sizeof(struct InstructionRegReg));
+    instruction->instruction.type = type;
+    instruction->srcReg = srcReg;
+    instruction->dstReg = dstReg;
+    listPushInstructionPtrList(&ctx->instructions, (Instruction*)instruction);
+}
+
+static void emitImm(CompilerContext *ctx, enum InstructionType type, long long iValue)
+{
+    struct InstructionImm *instruction = allocatorAllocate(ctx->codeAllocator, sizeof(struct InstructionImm));
+    instruction->instruction.type = type;
+    instruction->iValue = iValue;
+    listPushInstructionPtrList(&ctx->instructions, (Instruction*)instruction);
+}
+
+static void emitLabel(CompilerContext *ctx, enum InstructionType type, int srcReg, int labelId, Token *symbol)
+{
+    LabelInstruction *instruction = allocatorAllocate(ctx->codeAllocator, sizeof(LabelInstruction));
+    instruction->instruction.type = type;
+    instruction->srcReg = srcReg;
+    instruction->labelId = labelId;
+    instruction->symbol = symbol;
+    listPushInstructionPtrList(&ctx->instructions, (Instruction*)instruction);
+}
+
+static void emitRet(CompilerContext *ctx)
+{
+    Instruction *ret = allocatorAllocate(ctx->codeAllocator, sizeof(Instruction));
+    ret->type = IT_RET;
+    listPushInstructionPtrList(&ctx->instructions, ret);
+}
+
+//Adds value to r0 in steps that fit the immediate field
+static void emitAddImmediate(CompilerContext *ctx, long long value)
+{
+    enum InstructionType type = value < 0 ? IT_SUBI : IT_ADDI;
+    long long magnitude = value < 0 ? -value : value;
+    while(magnitude > 0)
+    {
+        long long step = magnitude > ISA_IMMEDIATE_MAX ? ISA_IMMEDIATE_MAX : magnitude;
+        emitImm(ctx, type, step);
+        magnitude -= step;
+    }
+}
+
+//Loads the low 16 bits of value into r0
+static void emitLoadImmediate(CompilerContext *ctx, long long value)
+{
+    long long hiValue = (value >> 8) & 0xFF;
+    long long loValue = value & 0xFF;
+    if(hiValue)
+    {
+        emitImm(ctx, IT_LHI, hiValue);
+        if(loValue)
+            emitImm(ctx, IT_ORI, loValue);
+    }
+    else
+    {
+        emitImm(ctx, IT_MOVI, loValue);
+    }
+}
+
+//Loads the address of the word at offset in the unit's static data into r0
+static void emitDataAddress(CompilerContext *ctx, long long offset)
+{
+    if(!ctx->relocatableData)
+    {
+        emitLoadImmediate(ctx, BINARY_DATA_ADDRESS + offset);
+        return;
+    }
+    AddressInstruction *address = allocatorAllocate(ctx->codeAllocator, sizeof(AddressInstruction));
+    address->instruction.type = IT_ADDRESS;
+    address->iValue = offset;
+    listPushInstructionPtrList(&ctx->instructions, (Instruction*)address);
+}
+
+//Leaves bp - offset in r0
+static void emitBpOffset(CompilerContext *ctx, int offset)
+{
+    emitRegReg(ctx, IT_MOV, 0, ISA_BP_REGISTER);
+    emitAddImmediate(ctx, -offset);
+}
+
 /*
 Moves the specified zero-based word index of the provided value into the register number specified.
 If the wordIndex is greater than the width of the value, 0xFFFF is loaded into the register if the value is signed,
 otherwise 0 is loaded.
 */
-void moveValueToRegister(AstNodeValue *value, int wordIndex, int registerNumber)
+void moveValueToRegister(CompilerContext *ctx, AstNodeValue *value, int wordIndex, int registerNumber)
 {
     if(wordIndex >= value->width && value->isSigned)
     {
-        LhiInstruction *lhi = malloc(sizeof(LhiInstruction));
+        LhiInstruction *lhi = allocatorAllocate(ctx->codeAllocator, sizeof(LhiInstruction));
         lhi->instruction.type = IT_LHI;
         lhi->iValue = 0xFF;
-        listPushInstructionPtrList(&instructions, (Instruction*)lhi);
+        listPushInstructionPtrList(&ctx->instructions, (Instruction*)lhi);
 
-        OriInstruction *ori = malloc(sizeof(OriInstruction));
+        OriInstruction *ori = allocatorAllocate(ctx->codeAllocator, sizeof(OriInstruction));
         ori->instruction.type = IT_ORI;
         ori->iValue = 0xFF;
-        listPushInstructionPtrList(&instructions, (Instruction*)ori);
+        listPushInstructionPtrList(&ctx->instructions, (Instruction*)ori);
 
-        MovInstruction *mov = malloc(sizeof(MovInstruction));
+        MovInstruction *mov = allocatorAllocate(ctx->codeAllocator, sizeof(MovInstruction));
         mov->instruction.type = IT_MOV;
         mov->srcReg = 0;
         mov->dstReg = registerNumber;
-        listPushInstructionPtrList(&instructions, (Instruction*)mov);
+        listPushInstructionPtrList(&ctx->instructions, (Instruction*)mov);
 
         return;
     }
     if(wordIndex >= value->width && !value->isSigned)
     {
-        MoviInstruction *movi = malloc(sizeof(MoviInstruction));
+        MoviInstruction *movi = allocatorAllocate(ctx->codeAllocator, sizeof(MoviInstruction));
         movi->instruction.type = IT_MOVI;
         movi->iValue = 0;
-        listPushInstructionPtrList(&instructions, (Instruction*)movi);
+        listPushInstructionPtrList(&ctx->instructions, (Instruction*)movi);
 
-        MovInstruction *mov = malloc(sizeof(MovInstruction));
+        MovInstruction *mov = allocatorAllocate(ctx->codeAllocator, sizeof(MovInstruction));
         mov->instruction.type = IT_MOV;
         mov->srcReg = 0;
         mov->dstReg = registerNumber;
-        listPushInstructionPtrList(&instructions, (Instruction*)mov);
+        listPushInstructionPtrList(&ctx->instructions, (Instruction*)mov);
 
         return;
     }
     if(value->isRegister)
     {
         if(value->registerNumber == registerNumber) return;
-        MovInstruction *mov = malloc(sizeof(MovInstruction));
+        MovInstruction *mov = allocatorAllocate(ctx->codeAllocator, sizeof(MovInstruction));
         mov->instruction.type = IT_MOV;
         mov->srcReg = value->registerNumber;
         mov->dstReg = registerNumber;
-        listPushInstructionPtrList(&instructions, (Instruction*)mov);
+        listPushInstructionPtrList(&ctx->instructions, (Instruction*)mov);
         return;
     }
     if(value->isBpRelative)
     {
-        MovInstruction *mov = malloc(sizeof(MovInstruction));
-        mov->instruction.type = IT_MOV;
-        mov->srcReg = ISA_BP_REGISTER;
-        mov->dstReg = 0;
-        listPushInstructionPtrList(&instructions, (Instruction*)mov);
-
-        SubiInstruction *subi = malloc(sizeof(SubiInstruction));
-        subi->instruction.type = IT_SUBI;
-        subi->iValue = value->bpRelativeAddress + value->width - 1 - wordIndex;
-        listPushInstructionPtrList(&instructions, (Instruction*)subi);
+        emitBpOffset(ctx, value->bpRelativeAddress + value->width - 1 - wordIndex);
 
-        LdrInstruction *ldr = malloc(sizeof(LdrInstruction));
+        LdrInstruction *ldr = allocatorAllocate(ctx->codeAllocator, sizeof(LdrInstruction));
         ldr->instruction.type = IT_LDR;
         ldr->srcReg = 0;
         ldr->dstReg = registerNumber;
-        listPushInstructionPtrList(&instructions, (Instruction*)ldr);
+        listPushInstructionPtrList(&ctx->instructions, (Instruction*)ldr);
 
         return;
     }
-    if(value->isIntegerLiteral)
+    if(value->isDataAddress)
     {
-        long long hiValue = (value->integerLiteral >> (16 * wordIndex + 8)) & 0xFF;
-        long long loValue = (value->integerLiteral >> (16 * wordIndex)) & 0xFF;
-
-        LhiInstruction *lhi = malloc(sizeof(LhiInstruction));
-        lhi->instruction.type = IT_MOVI;
-        lhi->iValue = hiValue;
-        listPushInstructionPtrList(&instructions, (Instruction*)lhi);
+        emitDataAddress(ctx, value->integerLiteral);
+        if(registerNumber != 0)
+            emitRegReg(ctx, IT_MOV, registerNumber, 0);
 
-        OriInstruction *ori = malloc(sizeof(OriInstruction));
-        ori->instruction.type = IT_ORI;
-        ori->iValue = loValue;
-        listPushInstructionPtrList(&instructions, (Instruction*)ori);
+        return;
+    }
+    if(value->isIntegerLiteral)
+    {
+        emitLoadImmediate(ctx, value->integerLiteral >> (16 * wordIndex));
+        if(registerNumber != 0)
+            emitRegReg(ctx, IT_MOV, registerNumber, 0);
 
-        MovInstruction *mov = malloc(sizeof(MovInstruction));
-        mov->instruction.type = IT_MOV;
-        mov->srcReg = 0;
-        mov->dstReg = registerNumber;
-        listPushInstructionPtrList(&instructions, (Instruction*)mov);
+        return;
+    }
+}
 
+//Stores a register into the specified word of a register or bp relative value. Clobbers r0 for memory values,
+//so registerNumber must not be 0 in that case.
+void moveRegisterToValue(CompilerContext *ctx, int registerNumber, AstNodeValue *value, int wordIndex)
+{
+    if(value->isRegister)
+    {
+        if(value->registerNumber != registerNumber)
+            emitRegReg(ctx, IT_MOV, value->registerNumber, registerNumber);
         return;
     }
+    if(value->isBpRelative)
+    {
+        emitBpOffset(ctx, value->bpRelativeAddress + value->width - 1 - wordIndex);
+        emitRegReg(ctx, IT_STR, 0, registerNumber);
+    }
+}
+
+//Returns the register holding the word, loading it into preferredRegister if the value is not in a register.
+static int valueWordInRegister(CompilerContext *ctx, AstNodeValue *value, int wordIndex, int preferredRegister)
+{
+    if(value->isRegister && wordIndex < value->width) return value->registerNumber;
+    moveValueToRegister(ctx, value, wordIndex, preferredRegister);
+    return preferredRegister;
+}
+
+static bool tokenIs(Token *token, const char *str)
+{
+    if(!token) return false;
+    return (int)strlen(str) == token->tokenStrLength && !strncmp(token->tokenStr, str, token->tokenStrLength);
+}
+
+static bool tokensEqual(Token *a, Token *b)
+{
+    return a->tokenStrLength == b->tokenStrLength && !strncmp(a->tokenStr, b->tokenStr, a->tokenStrLength);
+}
+
+static uint32_t tokenHash(Token *token)
+{
+    return vecHashBytes(token->tokenStr, token->tokenStrLength);
+}
+hashMapDefine(Token*, bool, TokenSet, tokenHash, tokensEqual);
+hashMapDefine(Token*, int, TokenIndexMap, tokenHash, tokensEqual);
+
+//Prints a diagnostic prefixed with the file, line and column of token
+static void reportAt(CompilerContext *ctx, Token *token, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    preprocessorReportV(ctx->preprocessor, ctx->log, token, format, args);
+    va_end(args);
+}
+
+//Token to report a diagnostic about node at, its own or that of its leftmost operand
+static Token *nodeToken(AstNode *node)
+{
+    while(node && !node->tokenValue)
+        node = node->left;
+    return node ? node->tokenValue : NULL;
+}
+
+//Innermost variable with the given name, or NULL
+static CodeVariable *findVariable(CompilerContext *ctx, Token *name)
+{
+    int *index = hashMapFindTokenIndexMap(&ctx->variableIndices, name);
+    return index ? listAtCodeVariableList(&ctx->variables, *index) : NULL;
 }
 
-AstNodeValue compileAdd(AstNodeValue *leftValue, AstNodeValue *rightValue, int dstReg)
+static void enterScope(CompilerContext *ctx)
 {
-    int resultWidth = leftValue->width;
-    if(rightValue->width > resultWidth)
-        resultWidth = rightValue->width;
+    ctx->currentScope++;
+}
 
-    for(int i = 0; i < resultWidth; i++)
+//Drops the variables of the innermost scope, uncovering the ones they shadowed
+static void leaveScope(CompilerContext *ctx)
+{
+    while(ctx->variables.length && ctx->variables.data[ctx->variables.length - 1].scope == ctx->currentScope)
     {
-        moveValueToRegister(leftValue, i, 1);
-        moveValueToRegister(rightValue, i, 2);
+        CodeVariable cv = listPopCodeVariableList(&ctx->variables);
+        Token name = {.tokenStr = cv.identifierName, .tokenStrLength = cv.identifierNameLength};
+        if(cv.shadowed >= 0)
+            hashMapInsertTokenIndexMap(&ctx->variableIndices, &name, cv.shadowed);
+        else
+            hashMapRemoveTokenIndexMap(&ctx->variableIndices, &name);
     }
+    ctx->currentScope--;
 }
 
-AstNodeValue compileExpression(AstNode *ast, bool left)
+static IrFunction *findFunction(CompilerContext *ctx, Token *name)
 {
-    AstNodeValue leftValue;
-    AstNodeValue rightValue;
-    if(ast->left)
-        leftValue = compileExpression(ast->left, true);
-    if(ast->right)
-        rightValue = compileExpression(ast->right, false);
+    for(IrFunction *fn = ctx->functionsHead; fn; fn = fn->next)
+    {
+        if(tokensEqual(fn->name, name)) return fn;
+    }
+    for(IrFunction *fn = ctx->declarations; fn; fn = fn->next)
+    {
+        if(tokensEqual(fn->name, name)) return fn;
+    }
+    return NULL;
+}
 
-    if(ast->operator == ASTOPTYPE_INVALID)
+//Parses declaration specifiers and pointer stars into cv. Returns the index of the first token after them.
+static int parseType(CompilerContext *ctx, int start, CodeVariable *cv)
+{
+    int longCount = 0;
+    bool sawType = false;
+    cv->width = 1;
+    cv->isSigned = true;
+    int i = start;
+    for(; i < ctx->tokenVector.length; i++)
+    {
+        Token *token = &ctx->tokenVector.tokens[i];
+        if(token->tokenType == TT_STORAGE_CLASS || token->tokenType == TT_TYPE_QUALIFIER ||
+           token->tokenType == TT_FUNC_SPECIFIER)
+            continue;
+        if(token->tokenType != TT_TYPE_SPECIFIER) break;
+        sawType = true;
+        if(tokenIs(token, "unsigned")) cv->isSigned = false;
+        if(tokenIs(token, "long")) longCount++;
+        if(tokenIs(token, "void")) cv->width = 0;
+    }
+    if(!sawType) return -1;
+    if(longCount == 1) cv->width = 2;
+    if(longCount >= 2) cv->width = 4;
+    while(i < ctx->tokenVector.length && tokenIs(&ctx->tokenVector.tokens[i], "*"))
     {
-        if(ast->tokenValue->tokenType == TT_INT_LITERAL)
+        if(!cv->isPointer)
         {
-            char *endPtr = ast->tokenValue->tokenStr;
-            AstNodeValue value = {0};
-            value.isIntegerLiteral = true;
-            value.integerLiteral = strtoll(ast->tokenValue->tokenStr, &endPtr, 10);
-            value.width = 1;
-            return value;
+            cv->pointeeWidth = cv->width ? cv->width : 1;
+            cv->pointeeSigned = cv->isSigned;
         }
-        puts("Non operator type was countered while compiling expression that cannot be handled.");
-        return (AstNodeValue){0};
+        else
+        {
+            //Pointer to pointer
+            cv->pointeeWidth = 1;
+            cv->pointeeSigned = false;
+        }
+        cv->isPointer = true;
+        cv->width = 1;
+        cv->isSigned = false;
+        i++;
     }
+    return i;
+}
 
-    if(ast->operator == ASTOPTYPE_ADD)
+//Index of the ';' ending the statement starting at start, skipping over parenthesized tokens. -1 if missing.
+static int findStatementEnd(CompilerContext *ctx, int start)
+{
+    int depth = 0;
+    for(int i = start; i < ctx->tokenVector.length; i++)
     {
-        return compileAdd(&leftValue, &rightValue);
+        Token *token = &ctx->tokenVector.tokens[i];
+        if(tokenIs(token, "(")) depth++;
+        if(tokenIs(token, ")")) depth--;
+        if(depth == 0 && tokenIs(token, ";")) return i;
     }
+    return -1;
+}
 
-    puts("An unhandled operator type was encountered while compiling expression.");
-    return (AstNodeValue){0};
+static int findClosingBrace(CompilerContext *ctx, int start)
+{
+    int depth = 0;
+    for(int i = start; i < ctx->tokenVector.length; i++)
+    {
+        Token *token = &ctx->tokenVector.tokens[i];
+        if(tokenIs(token, "{")) depth++;
+        if(tokenIs(token, "}"))
+        {
+            depth--;
+            if(depth == 0) return i;
+        }
+    }
+    return -1;
 }
 
-//Parses a variable definition and returns the token vector index of the last token in the definition + 1
-//Returns -1 on failure
-int parseDefinition(int start)
+static int findClosingParenthesis(CompilerContext *ctx, int start)
 {
-    bool pointer = false;
-    Token *identifierToken = NULL;
-    int tokenIndex = 0;
-    for(int i = start; i < tokenVector.length; i++)
+    int depth = 0;
+    for(int i = start; i < ctx->tokenVector.length; i++)
     {
-        tokenIndex = i;
-        identifierToken = tokenVectorAt(&tokenVector, i);
-        if(!identifierToken) return -1;
-        if (!strncmp("(", identifierToken->tokenStr, identifierToken->tokenStrLength))
-            continue;
-        if (!strncmp("*", identifierToken->tokenStr, identifierToken->tokenStrLength))
+        Token *token = &ctx->tokenVector.tokens[i];
+        if(tokenIs(token, "(")) depth++;
+        if(tokenIs(token, ")"))
         {
-            pointer = true;
-            continue;
+            depth--;
+            if(depth == 0) return i;
         }
-        break;
     }
-    if(!identifierToken) return -1;
-    CodeVariable cv = {0};
-    cv.identifierName = identifierToken->tokenStr;
-    cv.identifierNameLength = identifierToken->tokenStrLength;
-    cv.width = 1;
-    int reg = useRegister();
-    if(reg)
+    return -1;
+}
+
+static bool isAddressTaken(CompilerContext *ctx, Token *name)
+{
+    return hashMapFindTokenSet(&ctx->addressTakenNames, name) != NULL;
+}
+
+//Defines cv in the current scope, giving it a frame slot if its address is taken anywhere in the function
+static CodeVariable *declareVariable(CompilerContext *ctx, CodeVariable cv, Token *name)
+{
+    cv.identifierName = name->tokenStr;
+    cv.identifierNameLength = name->tokenStrLength;
+    cv.scope = ctx->currentScope;
+    cv.irVariable = ctx->irVariableCount++;
+    if(!cv.isTable && isAddressTaken(ctx, name))
+    {
+        cv.inMemory = true;
+        cv.frameSlot = irFrameSlotCreate(ctx->currentFunction, cv.width);
+    }
+    int *shadowed = hashMapFindTokenIndexMap(&ctx->variableIndices, name);
+    cv.shadowed = shadowed ? *shadowed : -1;
+    listPushCodeVariableList(&ctx->variables, cv);
+    hashMapInsertTokenIndexMap(&ctx->variableIndices, name, ctx->variables.length - 1);
+    return listAtCodeVariableList(&ctx->variables, ctx->variables.length - 1);
+}
+
+//Code after a return, break or continue goes to a fresh block, so definitions there never reach the jump target
+static void leaveTerminatedBlock(IrFunction *fn)
+{
+    if(!irBlockTerminated(fn->currentBlock)) return;
+    IrBlock *dead = irBlockCreate(fn);
+    irSealBlock(dead);
+    irSetBlock(fn, dead);
+}
+
+static void writeVariable(CompilerContext *ctx, CodeVariable *cv, IrInstr *value)
+{
+    value = irBuildCast(ctx->currentFunction, value, cv->width, cv->isSigned);
+    if(cv->inMemory)
+    {
+        IrInstr *address = irBuildFrameAddr(ctx->currentFunction, cv->frameSlot);
+        irBuildStore(ctx->currentFunction, address, value);
+        return;
+    }
+    leaveTerminatedBlock(ctx->currentFunction);
+    irWriteVariable(ctx->currentFunction->currentBlock, cv->irVariable, value);
+}
+
+static IrInstr *readVariable(CompilerContext *ctx, CodeVariable *cv)
+{
+    if(cv->isTable)
+        return irBuildDataAddr(ctx->currentFunction, cv->tableOffset);
+    if(cv->inMemory)
+    {
+        IrInstr *address = irBuildFrameAddr(ctx->currentFunction, cv->frameSlot);
+        return irBuildLoad(ctx->currentFunction, address, cv->width, cv->isSigned);
+    }
+    return irReadVariable(ctx->currentFunction->currentBlock, cv->irVariable, cv->width, cv->isSigned);
+}
+
+static long long literalValue(Token *token)
+{
+    long long literal = 0;
+    if(token->tokenType == TT_INT_LITERAL)
     {
-        cv.registerNumber = reg;
-        cv.inRegister = true;
+        char *endPtr = token->tokenStr;
+        literal = strtoll(token->tokenStr, &endPtr, 0);
     }
     else
     {
-        stackSize += cv.width;
-        cv.bpRelativeAddress = -stackSize - 1;
-        //TODO: Emit instructions to increase stack size
+        char c = token->tokenStr[1];
+        if(c == '\\')
+        {
+            switch(token->tokenStr[2])
+            {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case '0': c = '\0'; break;
+                default: c = token->tokenStr[2]; break;
+            }
+        }
+        literal = c;
     }
-    tokenIndex++;
-    Token *nextToken = tokenVectorAt(&tokenVector, tokenIndex);
-    if(nextToken == NULL)
-        return tokenIndex;
-    if(strncmp("=", nextToken->tokenStr, nextToken->tokenStrLength))
-        return tokenIndex;
+    return literal;
+}
+
+static IrInstr *compileLiteral(CompilerContext *ctx, Token *token)
+{
+    long long literal = literalValue(token);
+    int width = 1;
+    if(literal > 0x7FFF || literal < -0x8000) width = 2;
+    if(literal > 0x7FFFFFFFLL || literal < -0x80000000LL) width = 4;
+    return irBuildConst(ctx->currentFunction, literal, width, true);
+}
+
+//Collects the arguments of an ASTOPTYPE_CALL in source order
+static int flattenArguments(CompilerContext *ctx, AstNode *node, AstNode **arguments, int count)
+{
+    if(!node || count < 0) return count;
+    if(node->operator == ASTOPTYPE_COMMA)
+    {
+        count = flattenArguments(ctx, node->left, arguments, count);
+        return flattenArguments(ctx, node->right, arguments, count);
+    }
+    if(count == MAX_CALL_ARGUMENTS)
+    {
+        reportAt(ctx, nodeToken(node), "Too many arguments in function call.");
+        return -1;
+    }
+    arguments[count] = node;
+    return count + 1;
+}
+
+static IrInstr *compileExpression(CompilerContext *ctx, AstNode *ast);
+
+static int maxInt(int a, int b)
+{
+    return a > b ? a : b;
+}
+
+//The pointer variable an expression consists of, NULL for any other expression
+static CodeVariable *pointerVariable(CompilerContext *ctx, AstNode *ast)
+{
+    if(ast->operator != ASTOPTYPE_INVALID || !ast->tokenValue) return NULL;
+    CodeVariable *pointer = findVariable(ctx, ast->tokenValue);
+    return pointer && pointer->isPointer ? pointer : NULL;
+}
+
+static bool isLiteral(AstNode *ast)
+{
+    return ast->operator == ASTOPTYPE_INVALID && ast->tokenValue &&
+           (ast->tokenValue->tokenType == TT_INT_LITERAL || ast->tokenValue->tokenType == TT_CHAR_LITERAL);
+}
 
-    //TODO: Parse expression and emit instructions
+static bool isRuntimeOperator(AstOperatorType operator)
+{
+    return operator == ASTOPTYPE_MULTIPLY || operator == ASTOPTYPE_DIVIDE || operator == ASTOPTYPE_MODULO;
 }
 
-void parseFunction()
+/*
+Sethi-Ullman labels, extended to how this backend keeps values. A one word value takes a register from when it is
+computed until it is used. Wider values always live in a frame slot, constants are rematerialized at every use and
+SSA variables are in a register already, so none of those hold one for the expression. A binary operator takes the
+cheaper of its two evaluation orders, where evaluating a first costs max(need(a), held(a) + need(b)). The order is
+only changed if at most one operand has side effects, so those still happen left to right.
+*/
+static void labelExpression(CompilerContext *ctx, AstNode *ast)
 {
-    for(int i = 0; i < tokenVector.length; i++)
+    ast->registerNeed = 0;
+    ast->heldRegisters = 0;
+    ast->valueWidth = 1;
+    ast->hasSideEffects = false;
+    ast->rightFirst = false;
+    if(ast->operator == ASTOPTYPE_INVALID)
+    {
+        Token *token = ast->tokenValue;
+        CodeVariable *cv = token && token->tokenType == TT_IDENTIFIER ? findVariable(ctx, token) : NULL;
+        if(cv)
+        {
+            ast->valueWidth = cv->width;
+            //Address taken variables are loaded
+            if(cv->inMemory && cv->width == 1)
+                ast->registerNeed = ast->heldRegisters = 1;
+        }
+        return;
+    }
+    if(ast->operator == ASTOPTYPE_CALL)
+    {
+        //Arguments are labeled for the calls nested in them, the call itself outweighs them all
+        if(ast->left)
+            labelExpression(ctx, ast->left);
+        IrFunction *callee = findFunction(ctx, ast->tokenValue);
+        ast->valueWidth = callee ? callee->returnWidth : 1;
+        ast->registerNeed = CALL_REGISTER_NEED;
+        ast->heldRegisters = ast->valueWidth == 1;
+        ast->hasSideEffects = true;
+        return;
+    }
+    if(ast->operator == ASTOPTYPE_REFERENCE)
+    {
+        ast->registerNeed = ast->heldRegisters = 1;
+        return;
+    }
+    AstNode *left = ast->left;
+    AstNode *right = ast->right;
+    if(left) labelExpression(ctx, left);
+    if(right) labelExpression(ctx, right);
+    if(ast->operator == ASTOPTYPE_DEREFERENCE)
     {
-        Token *iToken = &tokenVector.tokens[i];
-        if(iToken->tokenType == TT_TYPE_SPECIFIER)
+        CodeVariable *pointer = pointerVariable(ctx, left);
+        ast->valueWidth = pointer ? pointer->pointeeWidth : 1;
+        ast->registerNeed = maxInt(left->registerNeed, 1);
+        ast->heldRegisters = ast->valueWidth == 1;
+        return;
+    }
+    if(!left || !right)
+    {
+        //A comma node holding the only argument of a call
+        AstNode *only = left ? left : right;
+        if(only)
         {
-            parseDefinition(i);
+            ast->registerNeed = only->registerNeed;
+            ast->heldRegisters = only->heldRegisters;
+            ast->valueWidth = only->valueWidth;
+            ast->hasSideEffects = only->hasSideEffects;
         }
+        return;
+    }
+    ast->hasSideEffects = left->hasSideEffects || right->hasSideEffects;
+    if(ast->operator == ASTOPTYPE_COMMA)
+    {
+        //The left value is dead once the right side starts
+        ast->registerNeed = maxInt(left->registerNeed, right->registerNeed);
+        ast->heldRegisters = right->heldRegisters;
+        ast->valueWidth = right->valueWidth;
+        return;
+    }
+    if(ast->operator == ASTOPTYPE_EQUALS)
+    {
+        //The value is computed before the target, see compileAssignment
+        ast->registerNeed = maxInt(right->registerNeed, right->heldRegisters + left->registerNeed);
+        ast->heldRegisters = right->heldRegisters;
+        ast->valueWidth = right->valueWidth;
+        ast->hasSideEffects = true;
+        return;
     }
+    int leftFirst = maxInt(left->registerNeed, left->heldRegisters + right->registerNeed);
+    int rightFirst = maxInt(right->registerNeed, right->heldRegisters + left->registerNeed);
+    ast->rightFirst = rightFirst < leftFirst && !(left->hasSideEffects && right->hasSideEffects);
+    ast->valueWidth = maxInt(left->valueWidth, right->valueWidth);
+    ast->heldRegisters = ast->valueWidth == 1;
+    ast->registerNeed = maxInt(ast->rightFirst ? rightFirst : leftFirst, ast->heldRegisters);
+    //Without a literal to strength reduce with, the operation is a call to a runtime routine
+    bool literalFactor = isLiteral(right) || (ast->operator == ASTOPTYPE_MULTIPLY && isLiteral(left));
+    if(isRuntimeOperator(ast->operator) && !literalFactor)
+        ast->registerNeed = CALL_REGISTER_NEED;
 }
 
-int main() {
-    FILE *file = fopen("C:/code/junk/sampleExpression.c", "rb");
-    if(!file)
+static IrInstr *compileAssignment(CompilerContext *ctx, AstNode *ast)
+{
+    IrInstr *value = compileExpression(ctx, ast->right);
+    if(!value) return NULL;
+    AstNode *target = ast->left;
+    if(target->operator == ASTOPTYPE_DEREFERENCE)
     {
-        puts("Failed to open file!");
-        return 1;
+        IrInstr *address = compileExpression(ctx, target->left);
+        if(!address) return NULL;
+        CodeVariable *pointer = pointerVariable(ctx, target->left);
+        int width = pointer ? pointer->pointeeWidth : 1;
+        bool isSigned = pointer ? pointer->pointeeSigned : true;
+        value = irBuildCast(ctx->currentFunction, value, width, isSigned);
+        irBuildStore(ctx->currentFunction, address, value);
+        return value;
     }
-    fseek(file, 0, SEEK_END);
-    long fileLength = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    if(fileLength == 0)
+    if(target->operator != ASTOPTYPE_INVALID || !target->tokenValue ||
+       target->tokenValue->tokenType != TT_IDENTIFIER)
     {
-        fclose(file);
-        puts("File is length 0");
-        return 1;
+        reportAt(ctx, nodeToken(target), "Left side of assignment is not assignable.");
+        return NULL;
+    }
+    CodeVariable *cv = findVariable(ctx, target->tokenValue);
+    if(!cv)
+    {
+        reportAt(ctx, target->tokenValue, "Use of undeclared identifier '%.*s'", target->tokenValue->tokenStrLength,
+                 target->tokenValue->tokenStr);
+        return NULL;
+    }
+    if(cv->isTable)
+    {
+        reportAt(ctx, target->tokenValue, "Cannot assign to table '%.*s'", target->tokenValue->tokenStrLength,
+                 target->tokenValue->tokenStr);
+        return NULL;
+    }
+    writeVariable(ctx, cv, value);
+    return value;
+}
+
+static IrInstr *compileCall(CompilerContext *ctx, AstNode *ast)
+{
+    AstNode *argumentNodes[MAX_CALL_ARGUMENTS];
+    int argumentCount = flattenArguments(ctx, ast->left, argumentNodes, 0);
+    if(argumentCount < 0) return NULL;
+    IrFunction *callee = findFunction(ctx, ast->tokenValue);
+    if(callee && callee->paramCount != argumentCount)
+    {
+        reportAt(ctx, ast->tokenValue, "Wrong number of arguments in call");
+        return NULL;
+    }
+    IrInstr *arguments[MAX_CALL_ARGUMENTS];
+    for(int i = 0; i < argumentCount; i++)
+    {
+        arguments[i] = compileExpression(ctx, argumentNodes[i]);
+        if(!arguments[i]) return NULL;
+        if(callee)
+            arguments[i] = irBuildCast(ctx->currentFunction, arguments[i], callee->paramWidths[i], arguments[i]->isSigned);
+    }
+    //Undeclared functions are assumed to return int
+    int width = callee ? callee->returnWidth : 1;
+    bool isSigned = callee ? callee->returnSigned : true;
+    return irBuildCall(ctx->currentFunction, ast->tokenValue, arguments, argumentCount, width, isSigned);
+}
+
+static IrInstr *compileExpression(CompilerContext *ctx, AstNode *ast)
+{
+    if(ast->operator == ASTOPTYPE_INVALID)
+    {
+        Token *token = ast->tokenValue;
+        if(token->tokenType == TT_INT_LITERAL || token->tokenType == TT_CHAR_LITERAL)
+            return compileLiteral(ctx, token);
+        if(token->tokenType == TT_IDENTIFIER)
+        {
+            CodeVariable *cv = findVariable(ctx, token);
+            if(!cv)
+            {
+                reportAt(ctx, token, "Use of undeclared identifier '%.*s'", token->tokenStrLength, token->tokenStr);
+                return NULL;
+            }
+            return readVariable(ctx, cv);
+        }
+        reportAt(ctx, token, "Non operator type was countered while compiling expression that cannot be handled.");
+        return NULL;
     }
-    char *fileBuffer = (char*)malloc(fileLength + 1);
-    fread(fileBuffer, 1, fileLength, file);
-    fileBuffer[fileLength] = 0;
-    fclose(file);
 
-    instructions = listInitInstructionPtrList(10);
-    tokenVectorCreate(&tokenVector);
-    tokenize(&tokenVector, fileBuffer, fileLength);
+    if(ast->operator == ASTOPTYPE_EQUALS)
+        return compileAssignment(ctx, ast);
+    if(ast->operator == ASTOPTYPE_CALL)
+        return compileCall(ctx, ast);
 
-    AstNode *head = NULL;
-    bool result = ast(&tokenVector, 0, &head);
-    if(result)
+    if(ast->operator == ASTOPTYPE_REFERENCE)
     {
-        ast_node_pretty_print(head);
+        CodeVariable *cv = ast->left->tokenValue ? findVariable(ctx, ast->left->tokenValue) : NULL;
+        if(!cv || !cv->inMemory)
+        {
+            reportAt(ctx, nodeToken(ast->left), "Operand of & must be a variable.");
+            return NULL;
+        }
+        return irBuildFrameAddr(ctx->currentFunction, cv->frameSlot);
     }
-    else
+
+    if(ast->operator == ASTOPTYPE_DEREFERENCE)
     {
-        puts("Failed to parse expression.");
+        IrInstr *address = compileExpression(ctx, ast->left);
+        if(!address) return NULL;
+        CodeVariable *pointer = pointerVariable(ctx, ast->left);
+        int width = pointer ? pointer->pointeeWidth : 1;
+        bool isSigned = pointer ? pointer->pointeeSigned : true;
+        return irBuildLoad(ctx->currentFunction, address, width, isSigned);
     }
-    ast_node_free_tree(head);
 
-    tokenVectorDispose(&tokenVector);
-    free(fileBuffer);
+    if(ast->operator == ASTOPTYPE_COMMA)
+    {
+        IrInstr *leftValue = compileExpression(ctx, ast->left);
+        if(!leftValue) return NULL;
+        return ast->right ? compileExpression(ctx, ast->right) : leftValue;
+    }
+    //The operand that needs more registers goes first, see labelExpression
+    IrInstr *rightValue = ast->rightFirst ? compileExpression(ctx, ast->right) : NULL;
+    if(ast->rightFirst && !rightValue) return NULL;
+    IrInstr *leftValue = compileExpression(ctx, ast->left);
+    if(!leftValue) return NULL;
+    if(!ast->rightFirst)
+        rightValue = compileExpression(ctx, ast->right);
+    if(!rightValue) return NULL;
+
+    IrOpcode opcode;
+    switch(ast->operator)
+    {
+        case ASTOPTYPE_ADD: opcode = IROP_ADD; break;
+        case ASTOPTYPE_SUBTRACT: opcode = IROP_SUB; break;
+        case ASTOPTYPE_MULTIPLY: opcode = IROP_MUL; break;
+        case ASTOPTYPE_DIVIDE: opcode = IROP_DIV; break;
+        case ASTOPTYPE_MODULO: opcode = IROP_MOD; break;
+        default:
+            reportAt(ctx, nodeToken(ast), "An unhandled operator type was encountered while compiling expression.");
+            return NULL;
+    }
+    //Usual arithmetic conversions: widen to the larger operand, unsigned if either side is
+    int width = leftValue->width > rightValue->width ? leftValue->width : rightValue->width;
+    bool isSigned = leftValue->isSigned && rightValue->isSigned;
+    leftValue = irBuildCast(ctx->currentFunction, leftValue, width, isSigned);
+    rightValue = irBuildCast(ctx->currentFunction, rightValue, width, isSigned);
+    return irBuildBinary(ctx->currentFunction, opcode, leftValue, rightValue);
+}
+
+//Parses the expression starting at start and ending at ';' or ')'. Returns NULL on failure.
+static IrInstr *parseExpression(CompilerContext *ctx, int start)
+{
+    AstNode *tree = NULL;
+    bool result = ast(ctx->syntaxAllocator, &ctx->tokenVector, start, &tree, ctx->log, ctx->preprocessor);
+    IrInstr *value = NULL;
+    if(result)
+    {
+        labelExpression(ctx, tree);
+        value = compileExpression(ctx, tree);
+    }
+    else
+        fprintf(ctx->log, "Failed to parse expression.\n");
+    ast_node_free_tree(ctx->syntaxAllocator, tree);
+    return value;
+}
+
+static int parseStatement(CompilerContext *ctx, int start);
+
+//Parses a variable definition and returns the token vector index of the last token in the definition + 1
+//Returns -1 on failure
+int parseDefinition(CompilerContext *ctx, int start)
+{
+    CodeVariable cv = {0};
+    int tokenIndex = parseType(ctx, start, &cv);
+    if(tokenIndex < 0)
+    {
+        reportAt(ctx, tokenVectorAt(&ctx->tokenVector, start), "Expected a type in definition.");
+        return -1;
+    }
+    Token *identifierToken = tokenVectorAt(&ctx->tokenVector, tokenIndex);
+    if(!identifierToken || identifierToken->tokenType != TT_IDENTIFIER)
+    {
+        reportAt(ctx, identifierToken ? identifierToken : tokenVectorAt(&ctx->tokenVector, start),
+                 "Expected an identifier in definition.");
+        return -1;
+    }
+    if(cv.width == 0)
+    {
+        reportAt(ctx, identifierToken, "Variable declared void");
+        return -1;
+    }
+    tokenIndex++;
+    Token *nextToken = tokenVectorAt(&ctx->tokenVector, tokenIndex);
+    if(nextToken == NULL)
+    {
+        reportAt(ctx, identifierToken, "Expected ';' after definition");
+        return -1;
+    }
+
+    IrInstr *initializer = NULL;
+    if(tokenIs(nextToken, "="))
+    {
+        int end = findStatementEnd(ctx, tokenIndex);
+        if(end < 0)
+        {
+            reportAt(ctx, identifierToken, "Expected ';' after definition");
+            return -1;
+        }
+        initializer = parseExpression(ctx, tokenIndex + 1);
+        if(!initializer) return -1;
+        tokenIndex = end;
+    }
+    if(!tokenIs(tokenVectorAt(&ctx->tokenVector, tokenIndex), ";"))
+    {
+        reportAt(ctx, identifierToken, "Expected ';' after definition");
+        return -1;
+    }
+
+    CodeVariable *variable = declareVariable(ctx, cv, identifierToken);
+    //Uninitialized locals still get a definition so SSA construction never sees a shadowed variable's value
+    if(!initializer)
+        initializer = irBuildConst(ctx->currentFunction, 0, variable->width, variable->isSigned);
+    writeVariable(ctx, variable, initializer);
+    return tokenIndex + 1;
+}
+
+static int parseReturn(CompilerContext *ctx, int start)
+{
+    Token *next = tokenVectorAt(&ctx->tokenVector, start + 1);
+    if(tokenIs(next, ";"))
+    {
+        irBuildReturn(ctx->currentFunction, NULL);
+        return start + 2;
+    }
+    int end = findStatementEnd(ctx, start + 1);
+    if(end < 0)
+    {
+        reportAt(ctx, tokenVectorAt(&ctx->tokenVector, start), "Expected ';' after return.");
+        return -1;
+    }
+    IrInstr *value = parseExpression(ctx, start + 1);
+    if(!value) return -1;
+    value = irBuildCast(ctx->currentFunction, value, ctx->currentFunction->returnWidth, ctx->currentFunction->returnSigned);
+    irBuildReturn(ctx->currentFunction, value);
+    return end + 1;
+}
+
+static int parseBlock(CompilerContext *ctx, int start)
+{
+    int end = findClosingBrace(ctx, start);
+    if(end < 0)
+    {
+        reportAt(ctx, tokenVectorAt(&ctx->tokenVector, start), "Could not find the closing brace of block.");
+        return -1;
+    }
+    enterScope(ctx);
+    int i = start + 1;
+    while(i < end && i >= 0)
+        i = parseStatement(ctx, i);
+    leaveScope(ctx);
+    if(i < 0) return -1;
+    return end + 1;
+}
+
+static int compareSwitchCases(const void *a, const void *b)
+{
+    const SwitchCase *left = a;
+    const SwitchCase *right = b;
+    return left->key < right->key ? -1 : left->key > right->key;
+}
+
+/*
+Ends the switch whose controlling value is value with the jump from dispatch to the cases. irBuildSwitch orders
+cases as unsigned numbers, so when some are negative all of them are rebased to make the smallest 0, which keeps a
+range like -2 to 5 together.
+*/
+static bool buildSwitch(CompilerContext *ctx, SwitchStatement *statement, IrBlock *dispatch, IrInstr *value,
+                        IrBlock *exit)
+{
+    IrFunction *fn = ctx->currentFunction;
+    SwitchCase *cases = statement->cases.data;
+    int caseCount = statement->cases.length;
+    if(caseCount > 1)
+        qsort(cases, caseCount, sizeof(SwitchCase), compareSwitchCases);
+    for(int i = 1; i < caseCount; i++)
+    {
+        if(cases[i].key == cases[i - 1].key)
+        {
+            reportAt(ctx, cases[i].label, "Duplicate case value");
+            return false;
+        }
+    }
+    unsigned long long mask = statement->width >= 4 ? ~0ULL : (1ULL << (statement->width * 16)) - 1;
+    long long base = caseCount && cases[0].value < 0 ? cases[0].value : 0;
+    long long *values = countedMalloc(sizeof(long long) * (caseCount + 1));
+    IrBlock **targets = countedMalloc(sizeof(IrBlock*) * (caseCount + 1));
+    for(int i = 0; i < caseCount; i++)
+    {
+        values[i] = (long long)(((unsigned long long)cases[i].value - (unsigned long long)base) & mask);
+        targets[i] = cases[i].target;
+    }
+    irSetBlock(fn, dispatch);
+    IrInstr *index = value;
+    if(base)
+        index = irBuildBinary(fn, IROP_SUB, value, irBuildConst(fn, base, value->width, value->isSigned));
+    irBuildSwitch(fn, index, statement->defaultTarget ? statement->defaultTarget : exit, values, targets, caseCount);
+    free(targets);
+    free(values);
+    return true;
+}
+
+static int parseSwitch(CompilerContext *ctx, int start)
+{
+    IrFunction *fn = ctx->currentFunction;
+    Token *token = tokenVectorAt(&ctx->tokenVector, start);
+    int close = tokenIs(tokenVectorAt(&ctx->tokenVector, start + 1), "(") ? findClosingParenthesis(ctx, start + 1) : -1;
+    if(close < 0)
+    {
+        reportAt(ctx, token, "Expected a parenthesized expression after switch");
+        return -1;
+    }
+    //Code after a return still needs a block of its own to dispatch from
+    leaveTerminatedBlock(fn);
+    IrInstr *value = parseExpression(ctx, start + 2);
+    if(!value) return -1;
+    if(!value->width)
+    {
+        reportAt(ctx, token, "Switch on a void value");
+        return -1;
+    }
+    IrBlock *dispatch = fn->currentBlock;
+    IrBlock *exit = irBlockCreate(fn);
+    //Statements before the first label are never reached
+    IrBlock *unreachable = irBlockCreate(fn);
+    irSealBlock(unreachable);
+    irSetBlock(fn, unreachable);
+
+    SwitchStatement statement = {0};
+    statement.width = value->width;
+    statement.isSigned = value->isSigned;
+    SwitchStatement *outerSwitch = ctx->currentSwitch;
+    IrBlock *outerBreakTarget = ctx->breakTarget;
+    ctx->currentSwitch = &statement;
+    ctx->breakTarget = exit;
+    int end = parseStatement(ctx, close + 1);
+    ctx->currentSwitch = outerSwitch;
+    ctx->breakTarget = outerBreakTarget;
+
+    if(end >= 0)
+    {
+        if(!irBlockTerminated(fn->currentBlock))
+            irBuildJump(fn, exit);
+        if(buildSwitch(ctx, &statement, dispatch, value, exit))
+        {
+            //Every jump to the labels and to the exit is known now
+            for(int i = 0; i < statement.cases.length; i++)
+                irSealBlock(statement.cases.data[i].target);
+            if(statement.defaultTarget)
+                irSealBlock(statement.defaultTarget);
+            irSealBlock(exit);
+            irMoveBlockToEnd(fn, exit);
+            irSetBlock(fn, exit);
+        }
+        else
+            end = -1;
+    }
+    listFreeSwitchCaseList(&statement.cases);
+    return end;
+}
+
+//Parses 'case constant:' or 'default:', which starts a new block that the statements before fall through into
+static int parseCaseLabel(CompilerContext *ctx, int start)
+{
+    IrFunction *fn = ctx->currentFunction;
+    Token *token = tokenVectorAt(&ctx->tokenVector, start);
+    SwitchStatement *statement = ctx->currentSwitch;
+    if(!statement)
+    {
+        reportAt(ctx, token, "'%.*s' outside of a switch", token->tokenStrLength, token->tokenStr);
+        return -1;
+    }
+    bool isDefault = tokenIs(token, "default");
+    int colon = start + 1;
+    long long value = 0;
+    if(!isDefault)
+    {
+        //Case values are integer or character literals with an optional sign
+        Token *sign = tokenVectorAt(&ctx->tokenVector, colon);
+        bool negative = tokenIs(sign, "-");
+        if(negative || tokenIs(sign, "+")) colon++;
+        Token *literal = tokenVectorAt(&ctx->tokenVector, colon);
+        if(!literal || (literal->tokenType != TT_INT_LITERAL && literal->tokenType != TT_CHAR_LITERAL))
+        {
+            reportAt(ctx, token, "Case values must be integer constants");
+            return -1;
+        }
+        value = literalValue(literal);
+        if(negative) value = -value;
+        colon++;
+    }
+    if(!tokenIs(tokenVectorAt(&ctx->tokenVector, colon), ":"))
+    {
+        reportAt(ctx, token, "Expected ':' after case label");
+        return -1;
+    }
+    if(isDefault && statement->defaultTarget)
+    {
+        reportAt(ctx, token, "Multiple default labels in one switch");
+        return -1;
+    }
+
+    IrBlock *block = irBlockCreate(fn);
+    if(!irBlockTerminated(fn->currentBlock))
+        irBuildJump(fn, block);
+    irSetBlock(fn, block);
+    if(isDefault)
+    {
+        statement->defaultTarget = block;
+        return colon + 1;
+    }
+    if(statement->width < 4)
+    {
+        int bits = statement->width * 16;
+        unsigned long long mask = (1ULL << bits) - 1;
+        unsigned long long bitsValue = (unsigned long long)value & mask;
+        if(statement->isSigned && (bitsValue >> (bits - 1)) & 1)
+            bitsValue |= ~mask;
+        value = (long long)bitsValue;
+    }
+    SwitchCase switchCase = {0};
+    switchCase.value = value;
+    switchCase.key = statement->isSigned ? (unsigned long long)value ^ (1ULL << 63) : (unsigned long long)value;
+    switchCase.target = block;
+    switchCase.label = token;
+    listPushSwitchCaseList(&statement->cases, switchCase);
+    return colon + 1;
+}
+
+//Parses break or continue, which jump to target
+static int parseJumpStatement(CompilerContext *ctx, int start, IrBlock *target, const char *context)
+{
+    Token *token = tokenVectorAt(&ctx->tokenVector, start);
+    if(!target)
+    {
+        reportAt(ctx, token, "'%.*s' outside of a %s", token->tokenStrLength, token->tokenStr, context);
+        return -1;
+    }
+    if(!tokenIs(tokenVectorAt(&ctx->tokenVector, start + 1), ";"))
+    {
+        reportAt(ctx, token, "Expected ';' after %.*s", token->tokenStrLength, token->tokenStr);
+        return -1;
+    }
+    irBuildJump(ctx->currentFunction, target);
+    return start + 2;
+}
+
+//Parses the body of a loop, which ends by jumping to continueTarget. A case label in the body would enter the loop
+//in the middle, so the body is outside of any switch.
+static int parseLoopBody(CompilerContext *ctx, int start, IrBlock *breakTarget, IrBlock *continueTarget)
+{
+    SwitchStatement *outerSwitch = ctx->currentSwitch;
+    IrBlock *outerBreakTarget = ctx->breakTarget;
+    IrBlock *outerContinueTarget = ctx->continueTarget;
+    ctx->currentSwitch = NULL;
+    ctx->breakTarget = breakTarget;
+    ctx->continueTarget = continueTarget;
+    int end = parseStatement(ctx, start);
+    ctx->currentSwitch = outerSwitch;
+    ctx->breakTarget = outerBreakTarget;
+    ctx->continueTarget = outerContinueTarget;
+    if(end >= 0 && !irBlockTerminated(ctx->currentFunction->currentBlock))
+        irBuildJump(ctx->currentFunction, continueTarget);
+    return end;
+}
+
+//Ends the current block with a branch to body while the expression from start to end is not zero and to exit
+//once it is. An empty condition loops until a break.
+static bool buildLoopCondition(CompilerContext *ctx, Token *token, int start, int end, IrBlock *body, IrBlock *exit)
+{
+    IrFunction *fn = ctx->currentFunction;
+    if(start == end)
+    {
+        irBuildJump(fn, body);
+        return true;
+    }
+    IrInstr *condition = parseExpression(ctx, start);
+    if(!condition) return false;
+    if(!condition->width)
+    {
+        reportAt(ctx, token, "Loop condition has a void value");
+        return false;
+    }
+    irBuildBranch(fn, condition, body, exit);
+    return true;
+}
+
+//Every jump into the blocks of a loop is known once its condition is built. The code after the loop goes last.
+static void finishLoop(IrFunction *fn, IrBlock *test, IrBlock *body, IrBlock *exit)
+{
+    irSealBlock(test);
+    irSealBlock(body);
+    irSealBlock(exit);
+    irMoveBlockToEnd(fn, exit);
+    irSetBlock(fn, exit);
+}
+
+/*
+while(condition) body. The condition is tested after the body, which is entered by jumping to the test the first
+time, so every further iteration takes a single branch:
+        jmp test
+    body:
+        ...
+    test:
+        bnz condition, body
+    exit:
+*/
+static int parseWhile(CompilerContext *ctx, int start)
+{
+    IrFunction *fn = ctx->currentFunction;
+    Token *token = tokenVectorAt(&ctx->tokenVector, start);
+    int close = tokenIs(tokenVectorAt(&ctx->tokenVector, start + 1), "(") ? findClosingParenthesis(ctx, start + 1) : -1;
+    if(close < 0 || close == start + 2)
+    {
+        reportAt(ctx, token, "Expected a parenthesized condition after while");
+        return -1;
+    }
+    IrBlock *test = irBlockCreate(fn);
+    IrBlock *body = irBlockCreate(fn);
+    IrBlock *exit = irBlockCreate(fn);
+    irBuildJump(fn, test);
+    irSetBlock(fn, body);
+    int end = parseLoopBody(ctx, close + 1, exit, test);
+    if(end < 0) return -1;
+    irMoveBlockToEnd(fn, test);
+    irSetBlock(fn, test);
+    if(!buildLoopCondition(ctx, token, start + 2, close, body, exit)) return -1;
+    finishLoop(fn, test, body, exit);
+    return end;
+}
+
+//do body while(condition); continue jumps to the test, which follows the body
+static int parseDo(CompilerContext *ctx, int start)
+{
+    IrFunction *fn = ctx->currentFunction;
+    Token *token = tokenVectorAt(&ctx->tokenVector, start);
+    IrBlock *body = irBlockCreate(fn);
+    IrBlock *test = irBlockCreate(fn);
+    IrBlock *exit = irBlockCreate(fn);
+    irBuildJump(fn, body);
+    irSetBlock(fn, body);
+    int end = parseLoopBody(ctx, start + 1, exit, test);
+    if(end < 0) return -1;
+    int close = -1;
+    if(tokenIs(tokenVectorAt(&ctx->tokenVector, end), "while") && tokenIs(tokenVectorAt(&ctx->tokenVector, end + 1), "("))
+        close = findClosingParenthesis(ctx, end + 1);
+    if(close < 0 || close == end + 2 || !tokenIs(tokenVectorAt(&ctx->tokenVector, close + 1), ";"))
+    {
+        reportAt(ctx, token, "Expected 'while (condition);' after the body of do");
+        return -1;
+    }
+    irMoveBlockToEnd(fn, test);
+    irSetBlock(fn, test);
+    if(!buildLoopCondition(ctx, token, end + 2, close, body, exit)) return -1;
+    finishLoop(fn, test, body, exit);
+    return close + 2;
+}
+
+//for(init; condition; step) body, laid out like while with the step between the body and the test. Variables
+//defined by init are scoped to the loop.
+static int parseForClauses(CompilerContext *ctx, int start)
+{
+    IrFunction *fn = ctx->currentFunction;
+    Token *token = tokenVectorAt(&ctx->tokenVector, start);
+    int close = tokenIs(tokenVectorAt(&ctx->tokenVector, start + 1), "(") ? findClosingParenthesis(ctx, start + 1) : -1;
+    if(close < 0)
+    {
+        reportAt(ctx, token, "Expected '(' after for");
+        return -1;
+    }
+    int conditionStart = start + 3;
+    Token *init = tokenVectorAt(&ctx->tokenVector, start + 2);
+    if(init->tokenType == TT_TYPE_SPECIFIER || init->tokenType == TT_TYPE_QUALIFIER)
+        conditionStart = parseDefinition(ctx, start + 2);
+    else if(!tokenIs(init, ";"))
+    {
+        int semicolon = findStatementEnd(ctx, start + 2);
+        if(semicolon < 0 || semicolon > close)
+        {
+            reportAt(ctx, token, "Expected two ';' in the clauses of for");
+            return -1;
+        }
+        if(!parseExpression(ctx, start + 2)) return -1;
+        conditionStart = semicolon + 1;
+    }
+    if(conditionStart < 0) return -1;
+    if(conditionStart > close)
+    {
+        reportAt(ctx, token, "Expected two ';' in the clauses of for");
+        return -1;
+    }
+    int conditionEnd = findStatementEnd(ctx, conditionStart);
+    if(conditionEnd < 0 || conditionEnd > close)
+    {
+        reportAt(ctx, token, "Expected two ';' in the clauses of for");
+        return -1;
+    }
+
+    IrBlock *test = irBlockCreate(fn);
+    IrBlock *body = irBlockCreate(fn);
+    IrBlock *step = irBlockCreate(fn);
+    IrBlock *exit = irBlockCreate(fn);
+    irBuildJump(fn, test);
+    irSetBlock(fn, body);
+    int end = parseLoopBody(ctx, close + 1, exit, step);
+    if(end < 0) return -1;
+    irSealBlock(step);
+    irMoveBlockToEnd(fn, step);
+    irSetBlock(fn, step);
+    if(conditionEnd + 1 < close && !parseExpression(ctx, conditionEnd + 1)) return -1;
+    irBuildJump(fn, test);
+    irMoveBlockToEnd(fn, test);
+    irSetBlock(fn, test);
+    if(!buildLoopCondition(ctx, token, conditionStart, conditionEnd, body, exit)) return -1;
+    finishLoop(fn, test, body, exit);
+    return end;
+}
+
+static int parseFor(CompilerContext *ctx, int start)
+{
+    enterScope(ctx);
+    int end = parseForClauses(ctx, start);
+    leaveScope(ctx);
+    return end;
+}
+
+static int parseStatement(CompilerContext *ctx, int start)
+{
+    Token *token = tokenVectorAt(&ctx->tokenVector, start);
+    if(!token) return -1;
+    if(tokenIs(token, ";")) return start + 1;
+    if(tokenIs(token, "{")) return parseBlock(ctx, start);
+    if(token->tokenType == TT_TYPE_SPECIFIER || token->tokenType == TT_TYPE_QUALIFIER ||
+       token->tokenType == TT_STORAGE_CLASS)
+        return parseDefinition(ctx, start);
+    if(token->tokenType == TT_KEYWORD && tokenIs(token, "return"))
+        return parseReturn(ctx, start);
+    if(token->tokenType == TT_KEYWORD && tokenIs(token, "switch"))
+        return parseSwitch(ctx, start);
+    if(token->tokenType == TT_KEYWORD && (tokenIs(token, "case") || tokenIs(token, "default")))
+        return parseCaseLabel(ctx, start);
+    if(token->tokenType == TT_KEYWORD && tokenIs(token, "break"))
+        return parseJumpStatement(ctx, start, ctx->breakTarget, "loop or switch");
+    if(token->tokenType == TT_KEYWORD && tokenIs(token, "continue"))
+        return parseJumpStatement(ctx, start, ctx->continueTarget, "loop");
+    if(token->tokenType == TT_KEYWORD && tokenIs(token, "while"))
+        return parseWhile(ctx, start);
+    if(token->tokenType == TT_KEYWORD && tokenIs(token, "do"))
+        return parseDo(ctx, start);
+    if(token->tokenType == TT_KEYWORD && tokenIs(token, "for"))
+        return parseFor(ctx, start);
+    if(token->tokenType == TT_KEYWORD)
+    {
+        reportAt(ctx, token, "Unsupported statement");
+        return -1;
+    }
+    int end = findStatementEnd(ctx, start);
+    if(end < 0)
+    {
+        reportAt(ctx, token, "Expected ';'");
+        return -1;
+    }
+    if(!parseExpression(ctx, start)) return -1;
+    return end + 1;
+}
+
+//Records every identifier that has & applied to it between start and end, those variables have to live in memory
+static void collectAddressTakenNames(CompilerContext *ctx, int start, int end)
+{
+    hashMapClearTokenSet(&ctx->addressTakenNames);
+    for(int i = start; i + 1 < end; i++)
+    {
+        Token *token = &ctx->tokenVector.tokens[i];
+        Token *next = &ctx->tokenVector.tokens[i + 1];
+        if(tokenIs(token, "&") && next->tokenType == TT_IDENTIFIER)
+            hashMapInsertTokenSet(&ctx->addressTakenNames, next, true);
+    }
+}
+
+//Appends the words of value, low word first, to the data section
+static bool appendTableValue(CompilerContext *ctx, Token *name, long long value, int width)
+{
+    DataSection *data = &ctx->data;
+    if(data->address + data->length + width > BINARY_DATA_LIMIT)
+    {
+        reportAt(ctx, name, "Tables exceed the %d words of static data", BINARY_DATA_LIMIT - BINARY_DATA_ADDRESS);
+        return false;
+    }
+    if(data->length + width > data->capacity)
+    {
+        data->capacity = data->capacity * 2 + 256;
+        data->words = countedRealloc(data->words, sizeof(uint16_t) * data->capacity);
+    }
+    for(int w = 0; w < width; w++)
+        data->words[data->length++] = (uint16_t)((unsigned long long)value >> (16 * w));
+    return true;
+}
+
+/*
+Defines a table at file scope: type name[size] = {values}; where the size is optional and every value an integer
+literal, possibly negated. Tables of any size come as one TT_INITIALIZER_LIST token whose values go straight into the
+data section. A list the tokenizer could not take in one piece, because a macro or a character literal is in it,
+is read token by token. Returns the index after the ';' or -1.
+*/
+static int parseTable(CompilerContext *ctx, int start, CodeVariable type)
+{
+    TokenVector *tokens = &ctx->tokenVector;
+    Token *name = tokenVectorAt(tokens, start);
+    int i = start + 2;
+    long long size = -1;
+    Token *sizeToken = tokenVectorAt(tokens, i);
+    if(sizeToken && (sizeToken->tokenType == TT_INT_LITERAL || sizeToken->tokenType == TT_CHAR_LITERAL))
+    {
+        size = literalValue(sizeToken);
+        i++;
+    }
+    if(!type.width || size == 0 || !tokenIs(tokenVectorAt(tokens, i), "]") ||
+       !tokenIs(tokenVectorAt(tokens, i + 1), "="))
+    {
+        reportAt(ctx, name, "Invalid table definition");
+        return -1;
+    }
+    i += 2;
+    DataSection *data = &ctx->data;
+    uint32_t first = data->length;
+    long long count = 0;
+    long long value;
+    Token *list = tokenVectorAt(tokens, i);
+    if(list && list->tokenType == TT_INITIALIZER_LIST)
+    {
+        int offset = 0;
+        for(; initializerListNext(list, &offset, &value); count++)
+        {
+            if(!appendTableValue(ctx, name, value, type.width)) return -1;
+        }
+        i++;
+    }
+    else if(tokenIs(list, "{"))
+    {
+        for(i++; !tokenIs(tokenVectorAt(tokens, i), "}"); count++)
+        {
+            bool negative = tokenIs(tokenVectorAt(tokens, i), "-");
+            if(negative || tokenIs(tokenVectorAt(tokens, i), "+")) i++;
+            Token *literal = tokenVectorAt(tokens, i);
+            if(!literal || (literal->tokenType != TT_INT_LITERAL && literal->tokenType != TT_CHAR_LITERAL))
+            {
+                reportAt(ctx, literal ? literal : name, "Table values must be integer literals");
+                return -1;
+            }
+            value = literalValue(literal);
+            if(!appendTableValue(ctx, name, negative ? -value : value, type.width)) return -1;
+            i++;
+            if(tokenIs(tokenVectorAt(tokens, i), ","))
+                i++;
+            else if(!tokenIs(tokenVectorAt(tokens, i), "}"))
+            {
+                reportAt(ctx, name, "Expected ',' or '}' in the values of '%.*s'", name->tokenStrLength,
+                         name->tokenStr);
+                return -1;
+            }
+        }
+        i++;
+    }
+    else
+    {
+        reportAt(ctx, name, "Tables must be initialized with a list of values");
+        return -1;
+    }
+    if((size >= 0 && count > size) || (size < 0 && !count))
+    {
+        reportAt(ctx, name, "%s values for table '%.*s'", count ? "Too many" : "No", name->tokenStrLength,
+                 name->tokenStr);
+        return -1;
+    }
+    //Elements without a value are zero
+    for(; count < size; count++)
+    {
+        if(!appendTableValue(ctx, name, 0, type.width)) return -1;
+    }
+    if(!tokenIs(tokenVectorAt(tokens, i), ";"))
+    {
+        reportAt(ctx, name, "Expected ';' after table '%.*s'", name->tokenStrLength, name->tokenStr);
+        return -1;
+    }
+
+    CodeVariable table = {0};
+    table.width = 1;
+    table.isSigned = false;
+    table.isPointer = true;
+    table.pointeeWidth = type.width;
+    table.pointeeSigned = type.isSigned;
+    table.isTable = true;
+    table.tableOffset = (int)first;
+    declareVariable(ctx, table, name);
+    return i + 1;
+}
+
+//Parses a function definition starting at its return type. Returns the index after the closing brace or -1.
+int parseFunction(CompilerContext *ctx, int start)
+{
+    CodeVariable returnType = {0};
+    int i = parseType(ctx, start, &returnType);
+    if(i < 0)
+    {
+        reportAt(ctx, tokenVectorAt(&ctx->tokenVector, start), "Expected a type at file scope.");
+        return -1;
+    }
+    Token *nameToken = tokenVectorAt(&ctx->tokenVector, i);
+    if(nameToken && nameToken->tokenType == TT_IDENTIFIER && tokenIs(tokenVectorAt(&ctx->tokenVector, i + 1), "["))
+        return parseTable(ctx, i, returnType);
+    if(!nameToken || nameToken->tokenType != TT_IDENTIFIER || !tokenIs(tokenVectorAt(&ctx->tokenVector, i + 1), "("))
+    {
+        reportAt(ctx, nameToken ? nameToken : tokenVectorAt(&ctx->tokenVector, start),
+                 "Only function and table definitions are supported at file scope.");
+        return -1;
+    }
+    int paramsEnd = i + 1;
+    while(paramsEnd < ctx->tokenVector.length && !tokenIs(&ctx->tokenVector.tokens[paramsEnd], ")"))
+        paramsEnd++;
+    if(paramsEnd >= ctx->tokenVector.length)
+    {
+        reportAt(ctx, nameToken, "Expected ')' after the parameters of '%.*s'", nameToken->tokenStrLength,
+                 nameToken->tokenStr);
+        return -1;
+    }
+
+    //First pass over the parameter list just counts them
+    CodeVariable params[MAX_CALL_ARGUMENTS];
+    Token *paramNames[MAX_CALL_ARGUMENTS];
+    int paramCount = 0;
+    int p = i + 2;
+    if(p + 1 == paramsEnd && tokenIs(&ctx->tokenVector.tokens[p], "void"))
+        p = paramsEnd;
+    while(p < paramsEnd)
+    {
+        if(paramCount == MAX_CALL_ARGUMENTS)
+        {
+            reportAt(ctx, &ctx->tokenVector.tokens[p], "Too many parameters in function definition.");
+            return -1;
+        }
+        CodeVariable param = {0};
+        p = parseType(ctx, p, &param);
+        if(p < 0 || p >= paramsEnd || ctx->tokenVector.tokens[p].tokenType != TT_IDENTIFIER)
+        {
+            reportAt(ctx, nameToken, "Invalid parameter");
+            return -1;
+        }
+        params[paramCount] = param;
+        paramNames[paramCount] = &ctx->tokenVector.tokens[p];
+        paramCount++;
+        p++;
+        if(p < paramsEnd && tokenIs(&ctx->tokenVector.tokens[p], ",")) p++;
+    }
+
+    Token *bodyStart = tokenVectorAt(&ctx->tokenVector, paramsEnd + 1);
+    if(tokenIs(bodyStart, ";"))
+    {
+        //Calls convert their arguments and read their result by the declared types
+        IrFunction *declaration = irFunctionCreate(ctx->irAllocator, nameToken, paramCount);
+        declaration->returnWidth = returnType.width;
+        declaration->returnSigned = returnType.isSigned;
+        for(int k = 0; k < paramCount; k++)
+            declaration->paramWidths[k] = params[k].width;
+        declaration->next = ctx->declarations;
+        ctx->declarations = declaration;
+        return paramsEnd + 2;
+    }
+    if(!tokenIs(bodyStart, "{"))
+    {
+        reportAt(ctx, nameToken, "Expected function body");
+        return -1;
+    }
+    int bodyEnd = findClosingBrace(ctx, paramsEnd + 1);
+    if(bodyEnd < 0)
+    {
+        reportAt(ctx, bodyStart, "Could not find the closing brace of function body.");
+        return -1;
+    }
+
+    ctx->currentFunction = irFunctionCreate(ctx->irAllocator, nameToken, paramCount);
+    ctx->currentFunction->returnWidth = returnType.width;
+    ctx->currentFunction->returnSigned = returnType.isSigned;
+    //Registered before the body so recursive calls see the signature
+    if(ctx->functionsTail)
+        ctx->functionsTail->next = ctx->currentFunction;
+    else
+        ctx->functionsHead = ctx->currentFunction;
+    ctx->functionsTail = ctx->currentFunction;
+
+    collectAddressTakenNames(ctx, paramsEnd + 1, bodyEnd);
+    ctx->irVariableCount = 0;
+    enterScope(ctx);
+    for(int k = 0; k < paramCount; k++)
+    {
+        CodeVariable *param = declareVariable(ctx, params[k], paramNames[k]);
+        writeVariable(ctx, param, irBuildParam(ctx->currentFunction, k, param->width, param->isSigned));
+    }
+    int result = parseBlock(ctx, paramsEnd + 1);
+    leaveScope(ctx);
+    if(result < 0) return -1;
+
+    //Falling off the end returns zero
+    if(!irBlockTerminated(ctx->currentFunction->currentBlock))
+    {
+        IrInstr *value = NULL;
+        if(ctx->currentFunction->returnWidth)
+            value = irBuildConst(ctx->currentFunction, 0, ctx->currentFunction->returnWidth, ctx->currentFunction->returnSigned);
+        irBuildReturn(ctx->currentFunction, value);
+    }
+    return result;
+}
+
+bool parseTranslationUnit(CompilerContext *ctx)
+{
+    int i = 0;
+    while(i < ctx->tokenVector.length)
+    {
+        i = parseFunction(ctx, i);
+        if(i < 0) return false;
+    }
+    return true;
+}
+
+typedef struct
+{
+    int start;
+    int end;
+    bool crossesCall;
+    bool spilled;
+    int useCount;
+    //Times the definition and uses ran in the profile, 0 without one
+    unsigned long long weight;
+    int frameSlot;
+    AstNodeValue location;
+} LiveInterval;
+
+//Per-function state shared by the instruction selection helpers
+typedef struct
+{
+    LiveInterval *intervals;
+    int *slotOffsets;
+    int labelBase;
+    bool hasFramePointer;
+} FunctionCodegen;
+
+static void extendInterval(LiveInterval *interval, int position)
+{
+    if(position < interval->start) interval->start = position;
+    if(position > interval->end) interval->end = position;
+}
+
+//Constants and data addresses are rematerialized at every use instead of occupying a register
+static bool needsLocation(IrInstr *instr)
+{
+    return instr->vreg && instr->opcode != IROP_CONST && instr->opcode != IROP_DATAADDR;
+}
+
+static AstNodeValue valueLocation(IrInstr *value, LiveInterval *intervals)
+{
+    if(value->opcode == IROP_CONST)
+    {
+        AstNodeValue literal = {0};
+        literal.isIntegerLiteral = true;
+        literal.integerLiteral = value->constant;
+        literal.width = value->width;
+        literal.isSigned = value->isSigned;
+        return literal;
+    }
+    if(value->opcode == IROP_DATAADDR)
+    {
+        AstNodeValue address = {0};
+        address.isDataAddress = true;
+        address.integerLiteral = value->constant;
+        address.width = 1;
+        return address;
+    }
+    return intervals[value->vreg].location;
+}
+
+//The frame offset is filled in once the frame layout is known
+static void spillInterval(LiveInterval *interval)
+{
+    interval->spilled = true;
+    interval->location.isRegister = false;
+    interval->location.registerNumber = 0;
+    interval->location.isBpRelative = true;
+}
+
+static int compareIntervalStart(const void *a, const void *b)
+{
+    const LiveInterval *left = *(LiveInterval * const *)a;
+    const LiveInterval *right = *(LiveInterval * const *)b;
+    return left->start - right->start;
+}
+
+//Live ranges as one [start, end] span per vreg over the linearized block order, from block level liveness
+static void computeLiveIntervals(IrFunction *fn, LiveInterval *intervals, int vregCount)
+{
+    int setWords = (vregCount + 63) / 64;
+    unsigned long long *liveIn = countedCalloc((size_t)fn->blockCount * setWords, sizeof(unsigned long long));
+    unsigned long long *liveOut = countedCalloc((size_t)fn->blockCount * setWords, sizeof(unsigned long long));
+    unsigned long long *scratch = countedMalloc(sizeof(unsigned long long) * setWords);
+    //Blocks in layout order so the fixpoint can run backwards, which converges fastest
+    IrBlock **blocks = countedMalloc(sizeof(IrBlock*) * fn->blockCount);
+    int blockCount = 0;
+    for(IrBlock *block = fn->entry; block; block = block->next)
+        blocks[blockCount++] = block;
+
+    bool changed = true;
+    while(changed)
+    {
+        changed = false;
+        for(int b = blockCount - 1; b >= 0; b--)
+        {
+            IrBlock *block = blocks[b];
+            unsigned long long *out = liveOut + (size_t)block->id * setWords;
+            IrBlock **successors;
+            int successorCount = irBlockSuccessors(block, &successors);
+            for(int s = 0; s < successorCount; s++)
+            {
+                IrBlock *successor = successors[s];
+                unsigned long long *in = liveIn + (size_t)successor->id * setWords;
+                for(int w = 0; w < setWords; w++)
+                    out[w] |= in[w];
+                int predIndex = 0;
+                while(predIndex < successor->predCount && successor->preds[predIndex] != block) predIndex++;
+                for(IrInstr *phi = successor->first; phi && phi->opcode == IROP_PHI; phi = phi->next)
+                {
+                    if(predIndex >= phi->operandCount) continue;
+                    IrInstr *operand = phi->operands[predIndex];
+                    if(needsLocation(operand))
+                        out[operand->vreg / 64] |= 1ULL << (operand->vreg % 64);
+                }
+            }
+
+            memcpy(scratch, out, sizeof(unsigned long long) * setWords);
+            for(IrInstr *instr = block->last; instr; instr = instr->prev)
+            {
+                if(instr->vreg)
+                    scratch[instr->vreg / 64] &= ~(1ULL << (instr->vreg % 64));
+                if(instr->opcode == IROP_PHI) continue;
+                for(int o = 0; o < instr->operandCount; o++)
+                {
+                    IrInstr *operand = instr->operands[o];
+                    if(needsLocation(operand))
+                        scratch[operand->vreg / 64] |= 1ULL << (operand->vreg % 64);
+                }
+            }
+            unsigned long long *in = liveIn + (size_t)block->id * setWords;
+            if(memcmp(in, scratch, sizeof(unsigned long long) * setWords))
+            {
+                memcpy(in, scratch, sizeof(unsigned long long) * setWords);
+                changed = true;
+            }
+
+        }
+    }
+
+    for(int v = 0; v < vregCount; v++)
+    {
+        intervals[v].start = INT_MAX;
+        intervals[v].end = -1;
+    }
+    for(IrBlock *block = fn->entry; block; block = block->next)
+    {
+        unsigned long long *in = liveIn + (size_t)block->id * setWords;
+        unsigned long long *out = liveOut + (size_t)block->id * setWords;
+        for(int v = 0; v < vregCount; v++)
+        {
+            if(in[v / 64] & (1ULL << (v % 64))) extendInterval(&intervals[v], block->startPosition);
+            if(out[v / 64] & (1ULL << (v % 64))) extendInterval(&intervals[v], block->endPosition);
+        }
+        for(IrInstr *instr = block->first; instr; instr = instr->next)
+        {
+            if(needsLocation(instr))
+            {
+                extendInterval(&intervals[instr->vreg],
+                               instr->opcode == IROP_PHI ? block->startPosition : instr->position);
+                intervals[instr->vreg].useCount++;
+                intervals[instr->vreg].weight += block->profileCount;
+            }
+            for(int o = 0; o < instr->operandCount; o++)
+            {
+                if(!needsLocation(instr->operands[o])) continue;
+                intervals[instr->operands[o]->vreg].useCount++;
+                intervals[instr->operands[o]->vreg].weight += block->profileCount;
+                if(instr->opcode != IROP_PHI)
+                    extendInterval(&intervals[instr->operands[o]->vreg], instr->position);
+            }
+        }
+    }
+
+    free(blocks);
+    free(scratch);
+    free(liveOut);
+    free(liveIn);
+}
+
+//Whether a is the better one to spill of two intervals competing for a register: the one that ends last, or with a
+//profile the one used least often
+static bool betterSpill(LiveInterval *a, LiveInterval *b, bool hasProfile)
+{
+    if(hasProfile && a->weight != b->weight) return a->weight < b->weight;
+    return a->end > b->end;
+}
+
+//Linear scan over r1-r3. Values wider than a word, values live across a call and spilled values get frame slots.
+static void allocateRegisters(CompilerContext *ctx, IrFunction *fn, LiveInterval *intervals, int vregCount)
+{
+    int callCount = 0;
+    for(IrBlock *block = fn->entry; block; block = block->next)
+    {
+        for(IrInstr *instr = block->first; instr; instr = instr->next)
+            if(instr->opcode == IROP_CALL) callCount++;
+    }
+    int *callPositions = countedMalloc(sizeof(int) * (callCount + 1));
+    callCount = 0;
+    for(IrBlock *block = fn->entry; block; block = block->next)
+    {
+        for(IrInstr *instr = block->first; instr; instr = instr->next)
+            if(instr->opcode == IROP_CALL) callPositions[callCount++] = instr->position;
+    }
+
+    LiveInterval **sorted = countedMalloc(sizeof(LiveInterval*) * (vregCount + 1));
+    int sortedCount = 0;
+    for(int v = 0; v < vregCount; v++)
+    {
+        LiveInterval *interval = &intervals[v];
+        if(interval->end < 0 || interval->location.isBpRelative) continue;
+        //Binary search for the first call after the interval starts
+        int low = 0;
+        int high = callCount;
+        while(low < high)
+        {
+            int mid = (low + high) / 2;
+            if(callPositions[mid] <= interval->start) low = mid + 1;
+            else high = mid;
+        }
+        interval->crossesCall = low < callCount && callPositions[low] < interval->end;
+        sorted[sortedCount++] = interval;
+    }
+    qsort(sorted, sortedCount, sizeof(LiveInterval*), compareIntervalStart);
+
+    LiveInterval *active[4];
+    int activeCount = 0;
+    for(int i = 0; i < sortedCount; i++)
+    {
+        LiveInterval *current = sorted[i];
+        for(int a = 0; a < activeCount; a++)
+        {
+            if(active[a]->end >= current->start) continue;
+            freeRegister(ctx, active[a]->location.registerNumber);
+            active[a--] = active[--activeCount];
+        }
+
+        int width = current->location.width;
+        if(width > 1 || current->crossesCall)
+        {
+            spillInterval(current);
+            continue;
+        }
+        int reg = useRegister(ctx);
+        if(reg)
+        {
+            current->location.isRegister = true;
+            current->location.registerNumber = reg;
+            active[activeCount++] = current;
+            continue;
+        }
+        int victim = 0;
+        for(int a = 1; a < activeCount; a++)
+        {
+            if(betterSpill(active[a], active[victim], fn->hasProfile)) victim = a;
+        }
+        if(activeCount && betterSpill(active[victim], current, fn->hasProfile))
+        {
+            current->location.isRegister = true;
+            current->location.registerNumber = active[victim]->location.registerNumber;
+            spillInterval(active[victim]);
+            active[victim] = current;
+        }
+        else
+        {
+            spillInterval(current);
+        }
+    }
+    for(int a = 0; a < activeCount; a++)
+        freeRegister(ctx, active[a]->location.registerNumber);
+
+    free(sorted);
+    free(callPositions);
+}
+
+static int blockLabel(IrBlock *block, int labelBase)
+{
+    return labelBase + block->id;
+}
+
+static void emitEpilogue(CompilerContext *ctx, FunctionCodegen *codegen)
+{
+    if(codegen->hasFramePointer)
+    {
+        emitRegReg(ctx, IT_MOV, ISA_SP_REGISTER, ISA_BP_REGISTER);
+        emitRegReg(ctx, IT_POP, ISA_BP_REGISTER, 0);
+    }
+    emitRet(ctx);
+}
+
+static bool sameLocation(AstNodeValue *a, AstNodeValue *b)
+{
+    if(a->isRegister && b->isRegister) return a->registerNumber == b->registerNumber;
+    if(a->isBpRelative && b->isBpRelative) return a->bpRelativeAddress == b->bpRelativeAddress;
+    return false;
+}
+
+static void copyValue(CompilerContext *ctx, AstNodeValue *source, AstNodeValue *destination, int width)
+{
+    for(int i = 0; i < width; i++)
+    {
+        if(destination->isRegister)
+        {
+            moveValueToRegister(ctx, source, i, destination->registerNumber);
+            continue;
+        }
+        int reg = valueWordInRegister(ctx, source, i, ISA_SCRATCH_REGISTER);
+        moveRegisterToValue(ctx, reg, destination, i);
+    }
+}
+
+//Resolves the phis of successor for the edge coming from block. Copies that would overwrite another copy's source
+//go through the stack so they behave as one parallel copy.
+static void emitPhiCopies(CompilerContext *ctx, IrBlock *block, IrBlock *successor, LiveInterval *intervals)
+{
+    int predIndex = 0;
+    while(predIndex < successor->predCount && successor->preds[predIndex] != block) predIndex++;
+    bool conflict = false;
+    int phiCount = 0;
+    for(IrInstr *phi = successor->first; phi && phi->opcode == IROP_PHI; phi = phi->next)
+    {
+        phiCount++;
+        AstNodeValue destination = valueLocation(phi, intervals);
+        for(IrInstr *other = successor->first; other && other->opcode == IROP_PHI; other = other->next)
+        {
+            if(other == phi) continue;
+            AstNodeValue source = valueLocation(other->operands[predIndex], intervals);
+            if(sameLocation(&destination, &source)) conflict = true;
+        }
+    }
+    if(!phiCount) return;
+
+    if(!conflict)
+    {
+        for(IrInstr *phi = successor->first; phi && phi->opcode == IROP_PHI; phi = phi->next)
+        {
+            AstNodeValue source = valueLocation(phi->operands[predIndex], intervals);
+            AstNodeValue destination = valueLocation(phi, intervals);
+            if(!sameLocation(&source, &destination))
+                copyValue(ctx, &source, &destination, phi->width);
+        }
+        return;
+    }
+
+    IrInstr *last = NULL;
+    for(IrInstr *phi = successor->first; phi && phi->opcode == IROP_PHI; phi = phi->next)
+    {
+        AstNodeValue source = valueLocation(phi->operands[predIndex], intervals);
+        for(int i = phi->width - 1; i >= 0; i--)
+            emitRegReg(ctx, IT_PUSH, 0, valueWordInRegister(ctx, &source, i, ISA_SCRATCH_REGISTER));
+        last = phi;
+    }
+    for(IrInstr *phi = last; phi; phi = phi->prev)
+    {
+        AstNodeValue destination = valueLocation(phi, intervals);
+        for(int i = 0; i < phi->width; i++)
+        {
+            emitRegReg(ctx, IT_POP, ISA_SCRATCH_REGISTER, 0);
+            moveRegisterToValue(ctx, ISA_SCRATCH_REGISTER, &destination, i);
+        }
+    }
+}
+
+/*
+Builds every destination word from the two source words it straddles, (word << bits) + (neighbour >> (16 - bits))
+for a left shift and the mirror image for right shifts. The words are produced in the order that never overwrites
+a source word still to be read, so the destination may share the source's frame slot.
+*/
+static void compileShift(CompilerContext *ctx, IrInstr *instr, AstNodeValue *source, AstNodeValue *destination)
+{
+    int width = instr->width;
+    int wordShift = (int)(instr->constant / 16);
+    int bitShift = (int)(instr->constant % 16);
+    bool left = instr->opcode == IROP_SHL;
+    int accumulator = destination->isRegister ? destination->registerNumber : ISA_SCRATCH_REGISTER;
+    for(int step = 0; step < width; step++)
+    {
+        int i = left ? width - 1 - step : step;
+        int word = left ? i - wordShift : i + wordShift;
+        int neighbour = left ? word - 1 : word + 1;
+        if(word < 0 || word >= width)
+        {
+            if(instr->opcode == IROP_SAR)
+            {
+                moveValueToRegister(ctx, source, width - 1, accumulator);
+                emitRegReg(ctx, IT_SAR, accumulator, 15);
+            }
+            else
+            {
+                emitImm(ctx, IT_MOVI, 0);
+                emitRegReg(ctx, IT_MOV, accumulator, 0);
+            }
+        }
+        else
+        {
+            moveValueToRegister(ctx, source, word, accumulator);
+            if(bitShift)
+            {
+                enum InstructionType type = IT_SHL;
+                if(!left)
+                    type = instr->opcode == IROP_SAR && word == width - 1 ? IT_SAR : IT_SHR;
+                emitRegReg(ctx, type, accumulator, bitShift);
+                if(neighbour >= 0 && neighbour < width)
+                {
+                    moveValueToRegister(ctx, source, neighbour, 0);
+                    emitRegReg(ctx, left ? IT_SHR : IT_SHL, 0, 16 - bitShift);
+                    emitRegReg(ctx, IT_ADD, accumulator, 0);
+                }
+            }
+        }
+        if(!destination->isRegister)
+            moveRegisterToValue(ctx, accumulator, destination, i);
+    }
+}
+
+/*
+Sums the two word products of the source with the signed digits of the multiplier. Shifts leave carry alone, so
+each term's high half can be shifted into r0 between the low and the high addition. The low word only feeds the
+carries and stays in the scratch register. The high word takes the destination register, or a register saved on
+the stack meanwhile when the destination is in memory or still holds the source.
+*/
+static void compileMultiplyHigh(CompilerContext *ctx, IrInstr *instr, AstNodeValue *source, AstNodeValue *destination)
+{
+    int sourceRegister = source->isRegister ? source->registerNumber : 0;
+    bool saved = !destination->isRegister || destination->registerNumber == sourceRegister;
+    int high = saved ? (sourceRegister == 1 ? 2 : 1) : destination->registerNumber;
+    if(saved)
+        emitRegReg(ctx, IT_PUSH, 0, high);
+    emitImm(ctx, IT_MOVI, 0);
+    emitRegReg(ctx, IT_MOV, ISA_SCRATCH_REGISTER, 0);
+    emitRegReg(ctx, IT_MOV, high, 0);
+
+    int shifts[17];
+    int signs[17];
+    int termCount = irSignedDigits((unsigned long long)instr->constant, 17, shifts, signs);
+    for(int i = 0; i < termCount; i++)
+    {
+        int shift = shifts[i];
+        enum InstructionType first = signs[i] > 0 ? IT_ADD : IT_SUB;
+        moveValueToRegister(ctx, source, 0, 0);
+        if(shift == 16)
+        {
+            //Nothing reaches the low word
+            emitRegReg(ctx, first, high, 0);
+            continue;
+        }
+        if(shift)
+            emitRegReg(ctx, IT_SHL, 0, shift);
+        emitRegReg(ctx, first, ISA_SCRATCH_REGISTER, 0);
+        if(shift)
+        {
+            moveValueToRegister(ctx, source, 0, 0);
+            emitRegReg(ctx, instr->isSigned ? IT_SAR : IT_SHR, 0, 16 - shift);
+        }
+        else if(instr->isSigned)
+        {
+            moveValueToRegister(ctx, source, 0, 0);
+            emitRegReg(ctx, IT_SAR, 0, 15);
+        }
+        else
+            emitImm(ctx, IT_MOVI, 0);
+        emitRegReg(ctx, signs[i] > 0 ? IT_ADC : IT_SBC, high, 0);
+    }
+
+    moveRegisterToValue(ctx, high, destination, 0);
+    if(saved)
+        emitRegReg(ctx, IT_POP, high, 0);
+}
+
+//Cases of a switch tested together: a single value, or a jump table over low to high
+typedef struct
+{
+    int first;
+    int last;
+    long long low;
+    long long high;
+} SwitchCluster;
+
+typedef struct
+{
+    IrInstr *instr;
+    SwitchCluster *clusters;
+    //Holds the index, which the tests leave alone
+    int indexRegister;
+    int defaultLabel;
+    int labelBase;
+} SwitchLowering;
+
+//Greedily takes the longest run of cases from each position that is dense enough for a table
+static int clusterSwitchCases(IrInstr *instr, SwitchCluster *clusters)
+{
+    long long *values = instr->caseValues;
+    int count = 0;
+    for(int i = 0; i < instr->caseCount; )
+    {
+        int last = i;
+        for(int j = i + SWITCH_TABLE_MIN_CASES - 1; j < instr->caseCount; j++)
+        {
+            long long entries = values[j] - values[i] + 1;
+            if(entries > SWITCH_TABLE_MAX_ENTRIES) break;
+            if((j - i + 1) * 100 >= entries * SWITCH_TABLE_MIN_DENSITY) last = j;
+        }
+        clusters[count].first = i;
+        clusters[count].last = last;
+        clusters[count].low = values[i];
+        clusters[count].high = values[last];
+        count++;
+        i = last + 1;
+    }
+    return count;
+}
+
+//There are no compare instructions. (bound - 1) - index borrows exactly when index >= bound, and r0 - r0 - borrow
+//turns the borrow into a word BNZ can test.
+static void emitBranchIfAtLeast(CompilerContext *ctx, int indexRegister, long long bound, int label)
+{
+    emitLoadImmediate(ctx, bound - 1);
+    emitRegReg(ctx, IT_SUB, 0, indexRegister);
+    emitRegReg(ctx, IT_SBC, 0, 0);
+    emitLabel(ctx, IT_BNZ, 0, label, NULL);
+}
+
+static void emitBranchIfBelow(CompilerContext *ctx, int indexRegister, long long bound, int label)
+{
+    emitLoadImmediate(ctx, bound - 1);
+    emitRegReg(ctx, IT_SUB, 0, indexRegister);
+    emitRegReg(ctx, IT_SBC, 0, 0);
+    emitImm(ctx, IT_ADDI, 1);
+    emitLabel(ctx, IT_BNZ, 0, label, NULL);
+}
+
+static int switchCaseLabel(SwitchLowering *lowering, int caseIndex)
+{
+    IrInstr *instr = lowering->instr;
+    return blockLabel(instr->targets[instr->caseTargets[caseIndex]], lowering->labelBase);
+}
+
+//Tests the cases of cluster on an index known to lie within low to high, going to failLabel if none matches
+static void emitSwitchCluster(CompilerContext *ctx, SwitchLowering *lowering, SwitchCluster *cluster, long long low,
+                              long long high, int failLabel)
+{
+    int indexRegister = lowering->indexRegister;
+    if(cluster->first == cluster->last)
+    {
+        if(low != high)
+        {
+            emitLoadImmediate(ctx, cluster->low);
+            emitRegReg(ctx, IT_SUB, 0, indexRegister);
+            emitLabel(ctx, IT_BNZ, 0, failLabel, NULL);
+        }
+        emitLabel(ctx, IT_JMP, 0, switchCaseLabel(lowering, cluster->first), NULL);
+        return;
+    }
+
+    if(low < cluster->low)
+        emitBranchIfBelow(ctx, indexRegister, cluster->low, failLabel);
+    if(high > cluster->high)
+        emitBranchIfAtLeast(ctx, indexRegister, cluster->high + 1, failLabel);
+    int tableIndex = indexRegister;
+    if(cluster->low)
+    {
+        if(indexRegister != ISA_SCRATCH_REGISTER)
+            emitRegReg(ctx, IT_MOV, ISA_SCRATCH_REGISTER, indexRegister);
+        emitLoadImmediate(ctx, cluster->low);
+        emitRegReg(ctx, IT_SUB, ISA_SCRATCH_REGISTER, 0);
+        tableIndex = ISA_SCRATCH_REGISTER;
+    }
+    emitRegReg(ctx, IT_JMPT, 0, tableIndex);
+    //Values between the cases take the default
+    int caseIndex = cluster->first;
+    for(long long value = cluster->low; value <= cluster->high; value++)
+    {
+        int label = lowering->defaultLabel;
+        if(lowering->instr->caseValues[caseIndex] == value)
+            label = switchCaseLabel(lowering, caseIndex++);
+        emitLabel(ctx, IT_WORD, 0, label, NULL);
+    }
+}
+
+//Bisects the clusters first to last on the lowest value of the middle one, so a switch over n clusters costs
+//log2(n) comparisons, until few enough are left to test in turn
+static void emitSwitchTree(CompilerContext *ctx, SwitchLowering *lowering, int first, int last, long long low,
+                           long long high)
+{
+    if(last - first < SWITCH_LINEAR_MAX)
+    {
+        for(int c = first; c <= last; c++)
+        {
+            int failLabel = c == last ? lowering->defaultLabel : ctx->labelCount++;
+            emitSwitchCluster(ctx, lowering, &lowering->clusters[c], low, high, failLabel);
+            if(c != last)
+                emitLabel(ctx, IT_LABEL, 0, failLabel, NULL);
+        }
+        return;
+    }
+    int middle = (first + last + 1) / 2;
+    long long bound = lowering->clusters[middle].low;
+    int upperLabel = ctx->labelCount++;
+    emitBranchIfAtLeast(ctx, lowering->indexRegister, bound, upperLabel);
+    emitSwitchTree(ctx, lowering, first, middle - 1, low, bound - 1);
+    emitLabel(ctx, IT_LABEL, 0, upperLabel, NULL);
+    emitSwitchTree(ctx, lowering, middle, last, bound, high);
+}
+
+/*
+Dense runs of cases become jump tables and the rest single value tests, arranged in a balanced tree of range
+checks. An index wider than a word takes the default when any of its high words is set. If some case does not fit
+in a word either, every word of every case is compared in turn instead.
+*/
+static void compileSwitch(CompilerContext *ctx, IrInstr *instr, AstNodeValue *index, int labelBase)
+{
+    int width = instr->operands[0]->width;
+    int defaultLabel = blockLabel(instr->targets[0], labelBase);
+    bool wordCases = !instr->caseCount || (unsigned long long)instr->caseValues[instr->caseCount - 1] <= 0xFFFF;
+    if(!wordCases)
+    {
+        for(int c = 0; c < instr->caseCount; c++)
+        {
+            int nextLabel = ctx->labelCount++;
+            for(int i = 0; i < width; i++)
+            {
+                int reg = valueWordInRegister(ctx, index, i, ISA_SCRATCH_REGISTER);
+                emitLoadImmediate(ctx, instr->caseValues[c] >> (16 * i));
+                emitRegReg(ctx, IT_SUB, 0, reg);
+                emitLabel(ctx, IT_BNZ, 0, nextLabel, NULL);
+            }
+            emitLabel(ctx, IT_JMP, 0, blockLabel(instr->targets[instr->caseTargets[c]], labelBase), NULL);
+            emitLabel(ctx, IT_LABEL, 0, nextLabel, NULL);
+        }
+        emitLabel(ctx, IT_JMP, 0, defaultLabel, NULL);
+        return;
+    }
+
+    for(int i = 1; i < width; i++)
+        emitLabel(ctx, IT_BNZ, valueWordInRegister(ctx, index, i, ISA_SCRATCH_REGISTER), defaultLabel, NULL);
+    if(!instr->caseCount)
+    {
+        emitLabel(ctx, IT_JMP, 0, defaultLabel, NULL);
+        return;
+    }
+    SwitchLowering lowering = {0};
+    lowering.instr = instr;
+    lowering.clusters = countedMalloc(sizeof(SwitchCluster) * instr->caseCount);
+    lowering.indexRegister = valueWordInRegister(ctx, index, 0, ISA_SCRATCH_REGISTER);
+    lowering.defaultLabel = defaultLabel;
+    lowering.labelBase = labelBase;
+    int clusterCount = clusterSwitchCases(instr, lowering.clusters);
+    emitSwitchTree(ctx, &lowering, 0, clusterCount - 1, 0, 0xFFFF);
+    free(lowering.clusters);
+}
+
+static void compileInstr(CompilerContext *ctx, IrInstr *instr, FunctionCodegen *codegen)
+{
+    LiveInterval *intervals = codegen->intervals;
+    int labelBase = codegen->labelBase;
+    AstNodeValue destination = {0};
+    if(instr->vreg)
+        destination = valueLocation(instr, intervals);
+    AstNodeValue operands[2] = {0};
+    for(int i = 0; i < instr->operandCount && i < 2; i++)
+        operands[i] = valueLocation(instr->operands[i], intervals);
+
+    switch(instr->opcode)
+    {
+        case IROP_CONST:
+        case IROP_DATAADDR:
+        case IROP_PARAM:
+        case IROP_PHI:
+            return;
+        case IROP_COPY:
+            if(!sameLocation(&operands[0], &destination))
+                copyValue(ctx, &operands[0], &destination, instr->width);
+            return;
+        case IROP_ADD:
+        case IROP_SUB:
+        {
+            enum InstructionType first = instr->opcode == IROP_ADD ? IT_ADD : IT_SUB;
+            enum InstructionType carry = instr->opcode == IROP_ADD ? IT_ADC : IT_SBC;
+            int accumulator = destination.isRegister ? destination.registerNumber : ISA_SCRATCH_REGISTER;
+            for(int i = 0; i < instr->width; i++)
+            {
+                moveValueToRegister(ctx, &operands[0], i, accumulator);
+                int source = valueWordInRegister(ctx, &operands[1], i, 0);
+                emitRegReg(ctx, i == 0 ? first : carry, accumulator, source);
+                if(!destination.isRegister)
+                    moveRegisterToValue(ctx, accumulator, &destination, i);
+            }
+            return;
+        }
+        case IROP_MUL:
+        case IROP_DIV:
+        case IROP_MOD:
+            //irLowerArithmetic has replaced these
+            return;
+        case IROP_SHL:
+        case IROP_SHR:
+        case IROP_SAR:
+            compileShift(ctx, instr, &operands[0], &destination);
+            return;
+        case IROP_MULHI:
+            compileMultiplyHigh(ctx, instr, &operands[0], &destination);
+            return;
+        case IROP_SEXT:
+        case IROP_ZEXT:
+        case IROP_TRUNC:
+        {
+            int sourceWidth = instr->operands[0]->width;
+            int copied = sourceWidth < instr->width ? sourceWidth : instr->width;
+            copyValue(ctx, &operands[0], &destination, copied);
+            if(copied == instr->width) return;
+            if(instr->opcode == IROP_SEXT)
+            {
+                //Shift the sign bit into carry and subtract the register from itself with borrow
+                moveValueToRegister(ctx, &operands[0], sourceWidth - 1, ISA_SCRATCH_REGISTER);
+                emitRegReg(ctx, IT_ADD, ISA_SCRATCH_REGISTER, ISA_SCRATCH_REGISTER);
+                emitRegReg(ctx, IT_SBC, ISA_SCRATCH_REGISTER, ISA_SCRATCH_REGISTER);
+            }
+            else
+            {
+                emitImm(ctx, IT_MOVI, 0);
+                emitRegReg(ctx, IT_MOV, ISA_SCRATCH_REGISTER, 0);
+            }
+            for(int i = copied; i < instr->width; i++)
+                moveRegisterToValue(ctx, ISA_SCRATCH_REGISTER, &destination, i);
+            return;
+        }
+        case IROP_FRAMEADDR:
+        {
+            emitBpOffset(ctx, codegen->slotOffsets[instr->constant] + instr->block->function->slotWidths[instr->constant] - 1);
+            if(destination.isRegister)
+            {
+                emitRegReg(ctx, IT_MOV, destination.registerNumber, 0);
+                return;
+            }
+            emitRegReg(ctx, IT_MOV, ISA_SCRATCH_REGISTER, 0);
+            moveRegisterToValue(ctx, ISA_SCRATCH_REGISTER, &destination, 0);
+            return;
+        }
+        case IROP_LOAD:
+        {
+            int accumulator = destination.isRegister ? destination.registerNumber : ISA_SCRATCH_REGISTER;
+            for(int i = 0; i < instr->width; i++)
+            {
+                moveValueToRegister(ctx, &operands[0], 0, 0);
+                if(i)
+                    emitImm(ctx, IT_ADDI, i);
+                emitRegReg(ctx, IT_LDR, accumulator, 0);
+                if(!destination.isRegister)
+                    moveRegisterToValue(ctx, accumulator, &destination, i);
+            }
+            return;
+        }
+        case IROP_STORE:
+        {
+            for(int i = 0; i < instr->operands[1]->width; i++)
+            {
+                int source = valueWordInRegister(ctx, &operands[1], i, ISA_SCRATCH_REGISTER);
+                moveValueToRegister(ctx, &operands[0], 0, 0);
+                if(i)
+                    emitImm(ctx, IT_ADDI, i);
+                emitRegReg(ctx, IT_STR, 0, source);
+            }
+            return;
+        }
+        case IROP_COUNTER:
+        {
+            //Two word increment through r4, the carry of the low word goes into the high word
+            emitDataAddress(ctx, instr->constant);
+            emitRegReg(ctx, IT_LDR, ISA_SCRATCH_REGISTER, 0);
+            emitImm(ctx, IT_MOVI, 1);
+            emitRegReg(ctx, IT_ADD, ISA_SCRATCH_REGISTER, 0);
+            emitDataAddress(ctx, instr->constant);
+            emitRegReg(ctx, IT_STR, 0, ISA_SCRATCH_REGISTER);
+            emitImm(ctx, IT_ADDI, 1);
+            emitRegReg(ctx, IT_LDR, ISA_SCRATCH_REGISTER, 0);
+            emitImm(ctx, IT_MOVI, 0);
+            emitRegReg(ctx, IT_ADC, ISA_SCRATCH_REGISTER, 0);
+            emitDataAddress(ctx, instr->constant + 1);
+            emitRegReg(ctx, IT_STR, 0, ISA_SCRATCH_REGISTER);
+            return;
+        }
+        case IROP_CALL:
+        {
+            int pushedWords = 0;
+            for(int a = instr->operandCount - 1; a >= 0; a--)
+            {
+                AstNodeValue argument = valueLocation(instr->operands[a], intervals);
+                for(int i = argument.width - 1; i >= 0; i--)
+                    emitRegReg(ctx, IT_PUSH, 0, valueWordInRegister(ctx, &argument, i, ISA_SCRATCH_REGISTER));
+                pushedWords += argument.width;
+            }
+            emitLabel(ctx, IT_CALL, 0, -1, instr->symbol);
+            if(pushedWords)
+            {
+                emitRegReg(ctx, IT_MOV, 0, ISA_SP_REGISTER);
+                emitAddImmediate(ctx, pushedWords);
+                emitRegReg(ctx, IT_MOV, ISA_SP_REGISTER, 0);
+            }
+            //Results come back in r1 upwards
+            if(instr->vreg && destination.width)
+            {
+                for(int i = 0; i < instr->width && i < 4; i++)
+                    moveRegisterToValue(ctx, 1 + i, &destination, i);
+            }
+            return;
+        }
+        case IROP_RET:
+        {
+            if(instr->operandCount)
+            {
+                for(int i = 0; i < instr->operands[0]->width && i < 4; i++)
+                    moveValueToRegister(ctx, &operands[0], i, 1 + i);
+            }
+            emitEpilogue(ctx, codegen);
+            return;
+        }
+        case IROP_JMP:
+        {
+            if(instr->block->next != instr->targets[0])
+                emitLabel(ctx, IT_JMP, 0, blockLabel(instr->targets[0], labelBase), NULL);
+            return;
+        }
+        case IROP_BRANCH:
+        {
+            //Any non-zero word takes the branch
+            for(int i = 0; i < instr->operands[0]->width; i++)
+            {
+                int reg = valueWordInRegister(ctx, &operands[0], i, ISA_SCRATCH_REGISTER);
+                emitLabel(ctx, IT_BNZ, reg, blockLabel(instr->targets[0], labelBase), NULL);
+            }
+            if(instr->block->next != instr->targets[1])
+                emitLabel(ctx, IT_JMP, 0, blockLabel(instr->targets[1], labelBase), NULL);
+            return;
+        }
+        case IROP_SWITCH:
+            compileSwitch(ctx, instr, &operands[0], labelBase);
+            return;
+    }
+}
+
+/*
+Adds a frame slot for every address-taken local and stores its index in slotIndices.
+A slot lives from its first address computation to the last use of that address. Memory keeps its value around
+loops, so the range is widened over every backward edge it overlaps. A slot whose address escapes into a call,
+another variable or arithmetic is kept for the whole function.
+*/
+static void addVariableSlots(IrFunction *fn, LiveInterval *intervals, FrameLayout *layout, int *slotIndices)
+{
+    if(!fn->slotCount) return;
+    int *starts = countedMalloc(sizeof(int) * fn->slotCount);
+    int *ends = countedMalloc(sizeof(int) * fn->slotCount);
+    int *accessCounts = countedCalloc(fn->slotCount, sizeof(int));
+    bool *escapes = countedCalloc(fn->slotCount, sizeof(bool));
+    for(int s = 0; s < fn->slotCount; s++)
+    {
+        starts[s] = INT_MAX;
+        ends[s] = -1;
+    }
+
+    int lastPosition = 0;
+    int backEdgeCount = 0;
+    for(IrBlock *block = fn->entry; block; block = block->next)
+    {
+        lastPosition = block->endPosition;
+        IrBlock **successors;
+        int successorCount = irBlockSuccessors(block, &successors);
+        for(int i = 0; i < successorCount; i++)
+            if(successors[i]->startPosition <= block->startPosition) backEdgeCount++;
+        for(IrInstr *instr = block->first; instr; instr = instr->next)
+        {
+            for(int o = 0; o < instr->operandCount; o++)
+            {
+                IrInstr *operand = instr->operands[o];
+                if(operand->opcode != IROP_FRAMEADDR) continue;
+                bool addressOnly = o == 0 && (instr->opcode == IROP_LOAD || instr->opcode == IROP_STORE);
+                if(!addressOnly) escapes[operand->constant] = true;
+            }
+            if(instr->opcode != IROP_FRAMEADDR) continue;
+            int slot = (int)instr->constant;
+            accessCounts[slot]++;
+            if(instr->position < starts[slot]) starts[slot] = instr->position;
+            int end = intervals[instr->vreg].end > instr->position ? intervals[instr->vreg].end : instr->position;
+            if(end > ends[slot]) ends[slot] = end;
+        }
+    }
+
+    int *edgeStarts = countedMalloc(sizeof(int) * (backEdgeCount + 1));
+    int *edgeEnds = countedMalloc(sizeof(int) * (backEdgeCount + 1));
+    backEdgeCount = 0;
+    for(IrBlock *block = fn->entry; block; block = block->next)
+    {
+        IrBlock **successors;
+        int successorCount = irBlockSuccessors(block, &successors);
+        for(int i = 0; i < successorCount; i++)
+        {
+            if(successors[i]->startPosition > block->startPosition) continue;
+            edgeStarts[backEdgeCount] = successors[i]->startPosition;
+            edgeEnds[backEdgeCount] = block->endPosition;
+            backEdgeCount++;
+        }
+    }
+
+    for(int s = 0; s < fn->slotCount; s++)
+    {
+        if(escapes[s] || ends[s] < 0)
+        {
+            starts[s] = 0;
+            ends[s] = lastPosition;
+        }
+        bool changed = true;
+        while(changed)
+        {
+            changed = false;
+            for(int e = 0; e < backEdgeCount; e++)
+            {
+                if(starts[s] > edgeEnds[e] || ends[s] < edgeStarts[e]) continue;
+                if(edgeStarts[e] < starts[s])
+                {
+                    starts[s] = edgeStarts[e];
+                    changed = true;
+                }
+                if(edgeEnds[e] > ends[s])
+                {
+                    ends[s] = edgeEnds[e];
+                    changed = true;
+                }
+            }
+        }
+        slotIndices[s] = frameLayoutAddSlot(layout, fn->slotWidths[s], starts[s], ends[s], accessCounts[s]);
+    }
+
+    free(edgeEnds);
+    free(edgeStarts);
+    free(escapes);
+    free(accessCounts);
+    free(ends);
+    free(starts);
+}
+
+//Static code quality numbers reported by -fcodegen-stats
+typedef struct
+{
+    int instructions;
+    int frameSize;
+    int spills;
+} CodegenStats;
+
+typedef struct
+{
+    IrBlock *from;
+    IrBlock *to;
+    unsigned long long count;
+    int order;
+} LayoutEdge;
+
+static int compareLayoutEdges(const void *a, const void *b)
+{
+    const LayoutEdge *left = a;
+    const LayoutEdge *right = b;
+    if(left->count != right->count) return left->count > right->count ? -1 : 1;
+    return left->order - right->order;
+}
+
+//A run of blocks that fall through into each other, see layoutBlocksByProfile
+typedef struct
+{
+    IrBlock *head;
+    unsigned long long hottest;
+    int order;
+} LayoutChain;
+
+static int compareLayoutChains(const void *a, const void *b)
+{
+    const LayoutChain *left = a;
+    const LayoutChain *right = b;
+    if(left->hottest != right->hottest) return left->hottest > right->hottest ? -1 : 1;
+    return left->order - right->order;
+}
+
+/*
+Reorders the blocks of a function with a profile after Pettis and Hansen. Going from the edge that ran most, the
+chain ending in its source and the chain starting with its target are joined, so the edge becomes a fall through.
+Only jumps and the false edge of a branch can fall through. A branch's false target has no other predecessor once
+critical edges are split, so its count is that of the edge. The chain of the entry comes first and the rest follow
+hottest first, which leaves the blocks that never ran at the end.
+*/
+static void layoutBlocksByProfile(IrFunction *fn)
+{
+    int blockCount = fn->blockCount;
+    IrBlock **following = countedCalloc(blockCount, sizeof(IrBlock*));
+    bool *followsAnother = countedCalloc(blockCount, sizeof(bool));
+    IrBlock **heads = countedMalloc(sizeof(IrBlock*) * blockCount);
+    IrBlock **tails = countedMalloc(sizeof(IrBlock*) * blockCount);
+    int *orders = countedMalloc(sizeof(int) * blockCount);
+    LayoutEdge *edges = countedMalloc(sizeof(LayoutEdge) * blockCount);
+    int edgeCount = 0;
+    int order = 0;
+    for(IrBlock *block = fn->entry; block; block = block->next)
+    {
+        heads[block->id] = block;
+        tails[block->id] = block;
+        orders[block->id] = order++;
+        IrInstr *terminator = block->last;
+        if(!terminator) continue;
+        LayoutEdge *edge = &edges[edgeCount];
+        edge->from = block;
+        edge->order = edgeCount;
+        if(terminator->opcode == IROP_JMP)
+        {
+            edge->to = terminator->targets[0];
+            edge->count = block->profileCount;
+            edgeCount++;
+        }
+        else if(terminator->opcode == IROP_BRANCH)
+        {
+            edge->to = terminator->targets[1];
+            edge->count = edge->to->profileCount;
+            edgeCount++;
+        }
+    }
+    qsort(edges, edgeCount, sizeof(LayoutEdge), compareLayoutEdges);
+
+    //heads and tails are kept up to date for the blocks at either end of a chain only
+    for(int e = 0; e < edgeCount; e++)
+    {
+        IrBlock *from = edges[e].from;
+        IrBlock *to = edges[e].to;
+        if(to == fn->entry || following[from->id] || followsAnother[to->id] || heads[from->id] == to) continue;
+        IrBlock *head = heads[from->id];
+        IrBlock *tail = tails[to->id];
+        following[from->id] = to;
+        followsAnother[to->id] = true;
+        tails[head->id] = tail;
+        heads[tail->id] = head;
+    }
+
+    LayoutChain *chains = countedMalloc(sizeof(LayoutChain) * blockCount);
+    int chainCount = 0;
+    for(IrBlock *block = fn->entry; block; block = block->next)
+    {
+        if(followsAnother[block->id]) continue;
+        LayoutChain *chain = &chains[chainCount++];
+        chain->head = block;
+        chain->hottest = 0;
+        chain->order = block == fn->entry ? -1 : orders[block->id];
+        for(IrBlock *member = block; member; member = following[member->id])
+        {
+            if(member->profileCount > chain->hottest) chain->hottest = member->profileCount;
+        }
+    }
+    //The entry's chain is not sorted, it has to stay first
+    qsort(chains + 1, chainCount - 1, sizeof(LayoutChain), compareLayoutChains);
+
+    IrBlock *last = NULL;
+    for(int c = 0; c < chainCount; c++)
+    {
+        for(IrBlock *member = chains[c].head; member; member = following[member->id])
+        {
+            if(last)
+                last->next = member;
+            last = member;
+        }
+    }
+    last->next = NULL;
+    fn->lastBlock = last;
+
+    free(chains);
+    free(edges);
+    free(orders);
+    free(tails);
+    free(heads);
+    free(followsAnother);
+    free(following);
+}
+
+void compileFunction(CompilerContext *ctx, IrFunction *fn, CodegenStats *stats)
+{
+    int firstInstruction = ctx->instructions.length;
+    irSplitCriticalEdges(fn);
+    if(fn->hasProfile)
+        layoutBlocksByProfile(fn);
+
+    int position = 0;
+    for(IrBlock *block = fn->entry; block; block = block->next)
+    {
+        block->startPosition = position++;
+        for(IrInstr *instr = block->first; instr; instr = instr->next)
+            instr->position = position++;
+        block->endPosition = position++;
+    }
+
+    int vregCount = fn->vregCount + 1;
+    LiveInterval *intervals = countedCalloc(vregCount, sizeof(LiveInterval));
+    computeLiveIntervals(fn, intervals, vregCount);
+
+    //Parameters sit above the saved bp and return address
+    for(IrBlock *block = fn->entry; block; block = block->next)
+    {
+        for(IrInstr *instr = block->first; instr; instr = instr->next)
+        {
+            if(!instr->vreg) continue;
+            intervals[instr->vreg].location.width = instr->width;
+            intervals[instr->vreg].location.isSigned = instr->isSigned;
+            if(instr->opcode != IROP_PARAM) continue;
+            int paramOffset = 2;
+            for(int p = 0; p < instr->constant; p++)
+                paramOffset += fn->paramWidths[p];
+            intervals[instr->vreg].location.isBpRelative = true;
+            intervals[instr->vreg].location.bpRelativeAddress = -(paramOffset + instr->width - 1);
+        }
+    }
+
+    ctx->r1Used = false;
+    ctx->r2Used = false;
+    ctx->r3Used = false;
+    ctx->r4Used = true;
+    allocateRegisters(ctx, fn, intervals, vregCount);
+    ctx->r4Used = false;
+
+    //Address-taken locals and spilled values share frame regions wherever their lifetimes allow
+    FrameLayout layout;
+    frameLayoutInit(&layout);
+    int *slotOffsets = countedMalloc(sizeof(int) * (fn->slotCount + 1));
+    addVariableSlots(fn, intervals, &layout, slotOffsets);
+    for(int v = 0; v < vregCount; v++)
+    {
+        LiveInterval *interval = &intervals[v];
+        if(interval->spilled)
+            interval->frameSlot = frameLayoutAddSlot(&layout, interval->location.width, interval->start,
+                                                     interval->end, interval->useCount);
+    }
+    frameLayoutAssign(&layout);
+    for(int s = 0; s < fn->slotCount; s++)
+        slotOffsets[s] = layout.slots.data[slotOffsets[s]].bpRelativeAddress;
+    for(int v = 0; v < vregCount; v++)
+    {
+        if(intervals[v].spilled)
+            intervals[v].location.bpRelativeAddress = layout.slots.data[intervals[v].frameSlot].bpRelativeAddress;
+    }
+    ctx->stackSize = layout.frameSize;
+    frameLayoutDispose(&layout);
+    stats->frameSize = ctx->stackSize;
+    stats->spills = 0;
+    for(int v = 0; v < vregCount; v++)
+    {
+        if(intervals[v].spilled) stats->spills++;
+    }
+
+    FunctionCodegen codegen = {0};
+    codegen.intervals = intervals;
+    codegen.slotOffsets = slotOffsets;
+    codegen.labelBase = ctx->labelCount;
+    //Without locals or parameters nothing is addressed through bp, so the frame pointer is left alone
+    codegen.hasFramePointer = ctx->stackSize || fn->paramCount;
+    ctx->labelCount += fn->blockCount;
+
+    emitLabel(ctx, IT_LABEL, 0, -1, fn->name);
+    if(codegen.hasFramePointer)
+    {
+        emitRegReg(ctx, IT_PUSH, 0, ISA_BP_REGISTER);
+        emitRegReg(ctx, IT_MOV, ISA_BP_REGISTER, ISA_SP_REGISTER);
+    }
+    //The whole frame is reserved with a single adjustment
+    if(ctx->stackSize)
+    {
+        emitRegReg(ctx, IT_MOV, 0, ISA_SP_REGISTER);
+        emitAddImmediate(ctx, -ctx->stackSize);
+        emitRegReg(ctx, IT_MOV, ISA_SP_REGISTER, 0);
+    }
+
+    for(IrBlock *block = fn->entry; block; block = block->next)
+    {
+        emitLabel(ctx, IT_LABEL, 0, blockLabel(block, codegen.labelBase), NULL);
+        for(IrInstr *instr = block->first; instr; instr = instr->next)
+        {
+            if(instr->opcode == IROP_JMP)
+                emitPhiCopies(ctx, block, instr->targets[0], intervals);
+            compileInstr(ctx, instr, &codegen);
+        }
+    }
+
+    stats->instructions = 0;
+    for(int i = firstInstruction; i < ctx->instructions.length; i++)
+    {
+        //The LHI and ORI of a data address are two
+        enum InstructionType type = ctx->instructions.data[i]->type;
+        if(type != IT_LABEL) stats->instructions += type == IT_ADDRESS ? 2 : 1;
+    }
+
+    free(slotOffsets);
+    free(intervals);
+}
+
+
+static void compilerContextInit(CompilerContext *ctx, UnitRegions *regions, FILE *log)
+{
+    memset(ctx, 0, sizeof(CompilerContext));
+    ctx->syntaxAllocator = &regions->syntax.allocator;
+    ctx->codeAllocator = &regions->code.allocator;
+    ctx->irAllocator = &regions->ir.allocator;
+    ctx->instructions = listInitInstructionPtrList(ctx->codeAllocator, 10);
+    ctx->variables = listInitCodeVariableList(ctx->syntaxAllocator, 16);
+    hashMapInitTokenIndexMap(&ctx->variableIndices, 16);
+    hashMapInitTokenSet(&ctx->addressTakenNames, 8);
+    tokenVectorCreate(&ctx->tokenVector, &regions->tokens.allocator);
+    ctx->data.address = BINARY_DATA_ADDRESS;
+    ctx->log = log;
+}
+
+static void compilerContextDispose(CompilerContext *ctx)
+{
+    for(int i = 0; i < ctx->instructions.length && !allocatorReleasesAtOnce(ctx->codeAllocator); i++)
+        allocatorRelease(ctx->codeAllocator, ctx->instructions.data[i]);
+    listFreeInstructionPtrList(&ctx->instructions);
+    listFreeCodeVariableList(&ctx->variables);
+    free(ctx->data.words);
+    hashMapFreeTokenIndexMap(&ctx->variableIndices);
+    hashMapFreeTokenSet(&ctx->addressTakenNames);
+    tokenVectorDispose(&ctx->tokenVector);
+    preprocessorDestroy(ctx->preprocessor);
+    sourceFileDestroy(ctx->mainFile);
+}
+
+typedef struct
+{
+    const char *inputPath;
+    const char *outputPath;
+    const char *statsPath;
+    bool dumpIr;
+    bool emitAssemblyText;
+    //Writes a relocatable object for cclink rather than a program image
+    bool emitObjectFile;
+    //See irInlineCalls, negative to inline nothing
+    int inlineBudget;
+    //Puts counters in every block for a profile of the program, see profile.h
+    bool profileGenerate;
+    //Profile to optimize with, NULL for none. Shared by all jobs.
+    ProfileData *profile;
+    //Writes a precompiled header of the input instead of compiling it
+    bool precompile;
+    //Shared by all jobs
+    HeaderCache *headers;
+    PreprocessorOptions *preprocessorOptions;
+    //Options that change the output, part of the cache key
+    const char *cacheOptions;
+    //NULL when caching is off
+    CompilationCache *cache;
+    //Diagnostics of the job, buffered so they can be printed in input order
+    FILE *log;
+    //Workers that optimize and lower the functions of the unit, 1 to do it on the job's own thread
+    int codegenThreads;
+    //NULL unless -ftime-report or -ftime-report-json was given
+    TimeReport *timeReport;
+    bool printTimeReport;
+    bool printMemoryReport;
+    //The job takes its regions from the pool while it runs
+    RegionPool *regionPool;
+    UnitRegions *regions;
+    bool result;
+} CompileJob;
+
+static int countIrInstructions(IrFunction *fn)
+{
+    int count = 0;
+    for(IrBlock *block = fn->entry; block; block = block->next)
+    {
+        for(IrInstr *instr = block->first; instr; instr = instr->next)
+            count++;
+    }
+    return count;
+}
+
+//Lowering state of one function, so functions can be compiled on separate threads
+typedef struct
+{
+    IrFunction *fn;
+    //Only the instruction list, register and frame fields are used, labels start from 0
+    CompilerContext codegen;
+    CodegenStats stats;
+    FILE *log;
+    bool dumpIr;
+    //NULL unless the job keeps a time report, merged into it once every function is done
+    TimeReport *timeReport;
+    TimeReport timing;
+    //Hold the instructions of a function lowered on a worker, and what the passes add to its intermediate code,
+    //until the unit's regions adopt them. Functions lowered on the job's own thread go straight to the unit's regions.
+    Region code;
+    Region ir;
+} FunctionJob;
+
+static void runFunctionJob(void *argument)
+{
+    FunctionJob *job = argument;
+    TimeReport *report = job->timeReport;
+    job->codegen.instructions = listInitInstructionPtrList(job->codegen.codeAllocator, 64);
+    job->codegen.log = job->log;
+    timeReportBegin(report, PHASE_OPTIMIZE);
+    irOptimize(job->fn, job->dumpIr ? job->log : NULL);
+    timeReportEnd(report, report ? countIrInstructions(job->fn) : 0);
+    timeReportBegin(report, PHASE_CODEGEN);
+    compileFunction(&job->codegen, job->fn, &job->stats);
+    timeReportEnd(report, job->codegen.instructions.length);
+}
+
+/*
+Runs on the functions as the parser left them, before any pass, since that is what a profile's block numbers and
+checksums refer to. With -fprofile-generate every function gets its own run of counters after the tables in the
+static data and a range in ranges saying where they are. With -fprofile-use the counts of the functions that have not changed since the
+profile was made go to their blocks.
+*/
+static bool applyProfile(CompilerContext *ctx, CompileJob *job, ProfileCounterRange **ranges, int *rangeCount)
+{
+    int functionCount = 0;
+    for(IrFunction *fn = ctx->functionsHead; fn; fn = fn->next)
+        functionCount++;
+    if(job->profileGenerate)
+        *ranges = countedMalloc(sizeof(ProfileCounterRange) * (functionCount ? functionCount : 1));
+    DataSection *data = &ctx->data;
+    for(IrFunction *fn = ctx->functionsHead; fn; fn = fn->next)
+    {
+        uint32_t checksum = irChecksum(fn);
+        if(job->profileGenerate)
+        {
+            uint32_t words = 2 * (uint32_t)fn->blockCount;
+            if(data->address + data->length + words > BINARY_DATA_LIMIT)
+            {
+                fprintf(ctx->log, "Too many blocks to profile, the counters would reach the stack.\n");
+                return false;
+            }
+            if(data->length + words > data->capacity)
+            {
+                data->capacity = (data->length + words) * 2;
+                data->words = countedRealloc(data->words, sizeof(uint16_t) * data->capacity);
+            }
+            ProfileCounterRange *range = &(*ranges)[(*rangeCount)++];
+            range->name = fn->name;
+            range->checksum = checksum;
+            range->counterOffset = data->length;
+            range->counterCount = (uint32_t)fn->blockCount;
+            irAddBlockCounters(fn, (int)data->length);
+            memset(data->words + data->length, 0, sizeof(uint16_t) * words);
+            data->length += words;
+        }
+        if(!job->profile) continue;
+        ProfileFunction *function = profileFind(job->profile, fn->name->tokenStr, fn->name->tokenStrLength);
+        if(!function) continue;
+        if(function->checksum != checksum || function->countCount != fn->blockCount)
+        {
+            fprintf(ctx->log, "Warning: profile of '%.*s' is out of date, compiling it without\n",
+                    fn->name->tokenStrLength, fn->name->tokenStr);
+            continue;
+        }
+        for(IrBlock *block = fn->entry; block; block = block->next)
+            block->profileCount = function->counts[block->id];
+        fn->hasProfile = true;
+    }
+    return true;
+}
+
+static bool compileFile(CompilerContext *ctx, CompileJob *job)
+{
+    TimeReport *report = job->timeReport;
+    timeReportBegin(report, PHASE_READ);
+    FILE *file = fopen(job->inputPath, "rb");
+    if(!file)
+    {
+        fprintf(ctx->log, "Failed to open file '%s'!\n", job->inputPath);
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long fileLength = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if(fileLength == 0)
+    {
+        fclose(file);
+        fprintf(ctx->log, "File is length 0\n");
+        return false;
+    }
+    char *fileBuffer = (char*)countedMalloc(fileLength + 1);
+    fread(fileBuffer, 1, fileLength, file);
+    fileBuffer[fileLength] = 0;
+    fclose(file);
+    timeReportEnd(report, (unsigned long long)fileLength);
+
+    if(job->precompile)
+    {
+        timeReportBegin(report, PHASE_TOKENIZE);
+        ctx->mainFile = sourceFileCreate(job->inputPath, fileBuffer, (int)fileLength, ctx->log);
+        timeReportEnd(report, ctx->mainFile->tokens.length);
+        return !ctx->mainFile->tokenizeFailed && pchWrite(ctx->mainFile, job->outputPath, ctx->log);
+    }
+
+    //IR dumps and codegen stats need the real compilation, so those bypass the cache. So does a profile, which is
+    //not part of the key.
+    bool cached = job->cache && !job->dumpIr && !job->statsPath && !job->profile;
+    //A file without directives depends on nothing but its own text, so it can be looked up before preprocessing
+    bool hasDirectives = memchr(fileBuffer, '#', fileLength) != NULL;
+    CacheKey key;
+    if(cached)
+    {
+        key = cacheComputeKey(job->cache, fileBuffer, (size_t)fileLength, job->cacheOptions);
+        if(!hasDirectives && cacheFetch(job->cache, key, job->outputPath))
+        {
+            if(report) report->cached = true;
+            free(fileBuffer);
+            return true;
+        }
+    }
+
+    timeReportBegin(report, PHASE_TOKENIZE);
+    ctx->mainFile = sourceFileCreate(job->inputPath, fileBuffer, (int)fileLength, ctx->log);
+    timeReportEnd(report, ctx->mainFile->tokens.length);
+    if(ctx->mainFile->tokenizeFailed) return false;
+    timeReportBegin(report, PHASE_PREPROCESS);
+    ctx->preprocessor = preprocessorCreate(job->headers, job->preprocessorOptions, &job->regions->macros,
+                                           ctx->log);
+    bool preprocessed = preprocessFile(ctx->preprocessor, ctx->mainFile, &ctx->tokenVector);
+    timeReportEnd(report, ctx->tokenVector.length);
+    if(!preprocessed)
+    {
+        fprintf(ctx->log, "Failed to preprocess translation unit.\n");
+        return false;
+    }
+    if(cached && hasDirectives)
+    {
+        //Every header read is part of the key, by path and by content
+        int includedCount;
+        SourceFile **included = preprocessorIncludedFiles(ctx->preprocessor, &includedCount);
+        for(int i = 0; i < includedCount; i++)
+        {
+            key = cacheExtendKey(key, included[i]->path, strlen(included[i]->path) + 1);
+            key = cacheExtendKey(key, included[i]->buffer, (size_t)included[i]->length);
+        }
+        if(cacheFetch(job->cache, key, job->outputPath))
+        {
+            if(report) report->cached = true;
+            return true;
+        }
+    }
+
+    timeReportBegin(report, PHASE_PARSE);
+    unsigned long long astNodes = ast_node_count();
+    bool result = parseTranslationUnit(ctx);
+    timeReportEnd(report, ast_node_count() - astNodes);
+    if(!result)
+        fprintf(ctx->log, "Failed to compile translation unit.\n");
+    ProfileCounterRange *profileRanges = NULL;
+    int profileRangeCount = 0;
+    if(result && (job->profileGenerate || job->profile))
+        result = applyProfile(ctx, job, &profileRanges, &profileRangeCount);
+    //Inlining works across functions, so it runs here before they are optimized one by one
+    if(result)
+    {
+        timeReportBegin(report, PHASE_OPTIMIZE);
+        irInlineCalls(ctx->functionsHead, job->inlineBudget);
+        timeReportEnd(report, 0);
+    }
+    FILE *statsFile = NULL;
+    if(result && job->statsPath)
+    {
+        statsFile = fopen(job->statsPath, "w");
+        if(!statsFile)
+        {
+            fprintf(ctx->log, "Failed to open stats file!\n");
+            result = false;
+        }
+    }
+    CodegenStats total = {0};
+    int functionCount = 0;
+    for(IrFunction *fn = ctx->functionsHead; fn && result; fn = fn->next)
+        functionCount++;
+    FunctionJob *functionJobs = countedCalloc(functionCount ? functionCount : 1, sizeof(FunctionJob));
+    int index = 0;
+    for(IrFunction *fn = ctx->functionsHead; fn && result; fn = fn->next)
+    {
+        FunctionJob *functionJob = &functionJobs[index++];
+        functionJob->fn = fn;
+        functionJob->log = ctx->log;
+        functionJob->dumpIr = job->dumpIr;
+        functionJob->timeReport = report ? &functionJob->timing : NULL;
+    }
+    //IR dumps go to the log as they are made, so they keep to one thread to stay in order
+    int threads = job->dumpIr ? 1 : job->codegenThreads;
+    if(threads > functionCount / CODEGEN_FUNCTIONS_PER_THREAD)
+        threads = functionCount / CODEGEN_FUNCTIONS_PER_THREAD;
+    ThreadPool *pool = threads > 1 ? threadPoolCreate(threads) : NULL;
+    for(int i = 0; i < functionCount; i++)
+    {
+        regionInit(&functionJobs[i].code, "code");
+        regionInit(&functionJobs[i].ir, "ir");
+        functionJobs[i].codegen.codeAllocator = pool ? &functionJobs[i].code.allocator : ctx->codeAllocator;
+        if(pool)
+            functionJobs[i].fn->allocator = &functionJobs[i].ir.allocator;
+        functionJobs[i].codegen.relocatableData = job->emitObjectFile;
+        if(pool)
+            threadPoolSubmit(pool, runFunctionJob, &functionJobs[i]);
+        else
+            runFunctionJob(&functionJobs[i]);
+    }
+    if(pool)
+    {
+        threadPoolWait(pool);
+        threadPoolDestroy(pool);
+    }
+
+    //Functions are appended in source order and their labels renumbered as if they had been compiled in turn
+    for(int i = 0; i < functionCount; i++)
+    {
+        FunctionJob *functionJob = &functionJobs[i];
+        InstructionPtrList *instructions = &functionJob->codegen.instructions;
+        listReserveInstructionPtrList(&ctx->instructions, ctx->instructions.length + instructions->length);
+        for(int k = 0; k < instructions->length; k++)
+        {
+            Instruction *instruction = instructions->data[k];
+            if(instruction->type == IT_LABEL || instruction->type == IT_JMP || instruction->type == IT_BNZ ||
+               instruction->type == IT_WORD)
+            {
+                LabelInstruction *label = (LabelInstruction*)instruction;
+                if(label->labelId >= 0) label->labelId += ctx->labelCount;
+            }
+            listPushInstructionPtrList(&ctx->instructions, instruction);
+        }
+        ctx->labelCount += functionJob->codegen.labelCount;
+        listFreeInstructionPtrList(instructions);
+        regionAdopt(&job->regions->code, &functionJob->code);
+        regionAdopt(&job->regions->ir, &functionJob->ir);
+        functionJob->fn->allocator = ctx->irAllocator;
+        timeReportMerge(report, functionJob->timeReport);
+
+        CodegenStats *stats = &functionJob->stats;
+        total.instructions += stats->instructions;
+        total.frameSize += stats->frameSize;
+        total.spills += stats->spills;
+        if(statsFile)
+        {
+            Token *name = functionJob->fn->name;
+            fprintf(statsFile, "function %.*s instructions %d frame %d spills %d\n", name->tokenStrLength,
+                    name->tokenStr, stats->instructions, stats->frameSize, stats->spills);
+        }
+    }
+    free(functionJobs);
+    if(result)
+        runtimeAppendHelpers(&ctx->instructions, ctx->codeAllocator, &ctx->labelCount);
+    if(statsFile)
+    {
+        fprintf(statsFile, "total instructions %d frame %d spills %d\n",
+                total.instructions, total.frameSize, total.spills);
+        if(fclose(statsFile) != 0)
+        {
+            fprintf(ctx->log, "Failed to write stats file.\n");
+            result = false;
+        }
+    }
+    if(result)
+    {
+        timeReportBegin(report, PHASE_EMIT);
+        FILE *outputFile = fopen(job->outputPath, job->emitAssemblyText ? "w" : "wb");
+        if(!outputFile)
+        {
+            fprintf(ctx->log, "Failed to open output file!\n");
+            result = false;
+        }
+        else
+        {
+            if(job->emitAssemblyText)
+                result = emitAssembly(&ctx->instructions, &ctx->data, outputFile);
+            else if(job->emitObjectFile)
+                result = emitObject(&ctx->instructions, &ctx->data, profileRanges, profileRangeCount,
+                                    runtimeIsHelper, outputFile, ctx->log);
+            else
+                result = emitBinary(&ctx->instructions, &ctx->data, profileRanges, profileRangeCount, outputFile,
+                                    ctx->log);
+            long written = ftell(outputFile);
+            if(fclose(outputFile) != 0)
+                result = false;
+            if(!result)
+                fprintf(ctx->log, "Failed to write output file.\n");
+            timeReportEnd(report, written > 0 ? (unsigned long long)written : 0);
+        }
+    }
+    if(result && cached)
+        cacheStore(job->cache, key, job->outputPath);
+    free(profileRanges);
+    return result;
+}
+
+static UnitRegions *regionPoolAcquire(RegionPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    UnitRegions *regions = pool->available;
+    if(regions)
+        pool->available = regions->next;
+    pthread_mutex_unlock(&pool->lock);
+    if(!regions)
+    {
+        regions = countedMalloc(sizeof(UnitRegions));
+        regionInit(&regions->tokens, "tokens");
+        regionInit(&regions->syntax, "syntax");
+        regionInit(&regions->ir, "ir");
+        regionInit(&regions->macros, "macros");
+        regionInit(&regions->code, "code");
+    }
+    return regions;
+}
+
+static void regionPoolRelease(RegionPool *pool, UnitRegions *regions)
+{
+    regionReset(&regions->tokens);
+    regionReset(&regions->syntax);
+    regionReset(&regions->ir);
+    regionReset(&regions->macros);
+    regionReset(&regions->code);
+    pthread_mutex_lock(&pool->lock);
+    regions->next = pool->available;
+    pool->available = regions;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void regionPoolDestroy(RegionPool *pool)
+{
+    while(pool->available)
+    {
+        UnitRegions *next = pool->available->next;
+        regionDestroy(&pool->available->tokens);
+        regionDestroy(&pool->available->syntax);
+        regionDestroy(&pool->available->ir);
+        regionDestroy(&pool->available->macros);
+        regionDestroy(&pool->available->code);
+        free(pool->available);
+        pool->available = next;
+    }
+    pthread_mutex_destroy(&pool->lock);
+}
+
+//New chunks stay at 0 once a server or batch run has warmed its regions up
+static void printMemoryReport(UnitRegions *regions, const char *unit, FILE *file)
+{
+    Region *all[] = {&regions->tokens, &regions->syntax, &regions->ir, &regions->macros, &regions->code};
+    fprintf(file, "memory report for %s\n", unit);
+    fprintf(file, "%-12s %10s %12s %12s %10s\n", "region", "allocs", "bytes", "held", "new chunks");
+    for(int i = 0; i < (int)(sizeof(all) / sizeof(all[0])); i++)
+    {
+        RegionUsage *usage = &all[i]->usage;
+        fprintf(file, "%-12s %10llu %12llu %12llu %10llu\n", all[i]->name, usage->allocations, usage->bytes,
+                usage->chunkBytes, usage->newChunks);
+    }
+}
+
+static void runCompileJob(void *argument)
+{
+    CompileJob *job = argument;
+    CompilerContext ctx;
+    job->regions = regionPoolAcquire(job->regionPool);
+    compilerContextInit(&ctx, job->regions, job->log);
+    job->result = compileFile(&ctx, job);
+    compilerContextDispose(&ctx);
+    if(job->printTimeReport)
+        timeReportPrint(job->timeReport, job->inputPath, job->log);
+    if(job->printMemoryReport)
+        printMemoryReport(job->regions, job->inputPath, job->log);
+    regionPoolRelease(job->regionPool, job->regions);
+    job->regions = NULL;
+}
+
+//foo.c becomes foo.s or foo.out next to the input
+static char *defaultOutputPath(const char *inputPath, const char *extension)
+{
+    size_t length = strlen(inputPath);
+    const char *dot = strrchr(inputPath, '.');
+    const char *slash = strrchr(inputPath, '/');
+    if(dot && (!slash || dot > slash)) length = (size_t)(dot - inputPath);
+    char *path = countedMalloc(length + strlen(extension) + 1);
+    memcpy(path, inputPath, length);
+    strcpy(path + length, extension);
+    return path;
+}
+
+//Accepts an optional K, M or G suffix
+static unsigned long long parseByteCount(const char *text)
+{
+    char *end;
+    unsigned long long value = strtoull(text, &end, 10);
+    if(*end == 'K' || *end == 'k') value <<= 10;
+    if(*end == 'M' || *end == 'm') value <<= 20;
+    if(*end == 'G' || *end == 'g') value <<= 30;
+    return value;
+}
+
+//Where the driver runs: the process command line, or a request of the compile server
+typedef struct
+{
+    //Base of relative paths. NULL resolves them against the process working directory.
+    const char *workingDirectory;
+    //Driver messages and the diagnostics of every job
+    FILE *out;
+    HeaderCache *headers;
+    RegionPool *regions;
+    //Compiler executable, tells builds apart in the compilation cache
+    const char *compilerPath;
+    //Jobs run in parallel when -j is not given, 0 for one per processor
+    int defaultJobCount;
+} DriverEnvironment;
+
+//Relative paths of a server request are relative to the client's working directory, not the server's
+static const char *resolvePath(DriverEnvironment *environment, const char *path, char **owned, int *ownedCount)
+{
+    if(!environment->workingDirectory || path[0] == '/') return path;
+    char *resolved = countedMalloc(strlen(environment->workingDirectory) + strlen(path) + 2);
+    strcpy(resolved, environment->workingDirectory);
+    strcat(strcat(resolved, "/"), path);
+    owned[(*ownedCount)++] = resolved;
+    return resolved;
+}
+
+//Compiles the inputs named by the arguments, which exclude the program name. Returns the exit status.
+static int runDriver(int argc, char **argv, DriverEnvironment *environment)
+{
+    FILE *out = environment->out;
+    const char *outputPath = NULL;
+    const char *statsPath = NULL;
+    bool dumpIr = false;
+    bool emitAssemblyText = false;
+    bool emitObjectFile = false;
+    int inlineBudget = IR_INLINE_DEFAULT_BUDGET;
+    bool profileGenerate = false;
+    const char *profilePath = NULL;
+    bool precompile = false;
+    bool printTimeReport = false;
+    bool printMemoryReport = false;
+    const char *timeReportJsonPath = NULL;
+    const char *cacheDirectory = getenv("CCOMPILER_CACHE_DIR");
+    unsigned long long cacheMaxBytes = 0;
+    bool printCacheStats = false;
+    int jobCount = environment->defaultJobCount;
+    PreprocessorOptions preprocessorOptions = {0};
+    preprocessorOptions.includePaths = countedMalloc(sizeof(char*) * (argc + 1));
+    preprocessorOptions.defines = countedMalloc(sizeof(char*) * (argc + 1));
+    int inputCount = 0;
+    const char **inputPaths = countedMalloc(sizeof(char*) * (argc + 1));
+    int resolvedCount = 0;
+    char **resolvedPaths = countedMalloc(sizeof(char*) * (argc + 2));
+    for(int i = 0; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "-fdump-ir"))
+            dumpIr = true;
+        else if(!strcmp(argv[i], "-S"))
+            emitAssemblyText = true;
+        else if(!strcmp(argv[i], "-c"))
+            emitObjectFile = true;
+        else if(!strcmp(argv[i], "-finline-limit") && i + 1 < argc)
+            inlineBudget = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-fno-inline"))
+            inlineBudget = -1;
+        else if(!strcmp(argv[i], "-fprofile-generate"))
+            profileGenerate = true;
+        else if(!strcmp(argv[i], "-fprofile-use") && i + 1 < argc)
+            profilePath = resolvePath(environment, argv[++i], resolvedPaths, &resolvedCount);
+        else if(!strcmp(argv[i], "-fprecompile"))
+            precompile = true;
+        else if(!strcmp(argv[i], "-ftime-report"))
+            printTimeReport = true;
+        else if(!strcmp(argv[i], "-fmemory-report"))
+            printMemoryReport = true;
+        else if(!strcmp(argv[i], "-ftime-report-json") && i + 1 < argc)
+            timeReportJsonPath = resolvePath(environment, argv[++i], resolvedPaths, &resolvedCount);
+        else if(!strcmp(argv[i], "-o") && i + 1 < argc)
+            outputPath = resolvePath(environment, argv[++i], resolvedPaths, &resolvedCount);
+        else if(!strcmp(argv[i], "-fcodegen-stats") && i + 1 < argc)
+            statsPath = resolvePath(environment, argv[++i], resolvedPaths, &resolvedCount);
+        else if(!strcmp(argv[i], "-j") && i + 1 < argc)
+            jobCount = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-fcache-dir") && i + 1 < argc)
+            cacheDirectory = resolvePath(environment, argv[++i], resolvedPaths, &resolvedCount);
+        else if(!strcmp(argv[i], "-fno-cache"))
+            cacheDirectory = NULL;
+        else if(!strcmp(argv[i], "-fcache-max-size") && i + 1 < argc)
+            cacheMaxBytes = parseByteCount(argv[++i]);
+        else if(!strcmp(argv[i], "-fcache-stats"))
+            printCacheStats = true;
+        else if(!strcmp(argv[i], "-I") && i + 1 < argc)
+            preprocessorOptions.includePaths[preprocessorOptions.includePathCount++] =
+                resolvePath(environment, argv[++i], resolvedPaths, &resolvedCount);
+        else if(!strncmp(argv[i], "-I", 2) && argv[i][2])
+            preprocessorOptions.includePaths[preprocessorOptions.includePathCount++] =
+                resolvePath(environment, argv[i] + 2, resolvedPaths, &resolvedCount);
+        else if(!strcmp(argv[i], "-D") && i + 1 < argc)
+            preprocessorOptions.defines[preprocessorOptions.defineCount++] = argv[++i];
+        else if(!strncmp(argv[i], "-D", 2) && argv[i][2])
+            preprocessorOptions.defines[preprocessorOptions.defineCount++] = argv[i] + 2;
+        else
+            inputPaths[inputCount++] = resolvePath(environment, argv[i], resolvedPaths, &resolvedCount);
+    }
+    ProfileData profile = {0};
+    bool failed = false;
+    if(!inputCount)
+    {
+        fputs("Usage: ccompiler [-S | -c] [-o output] [options] files...\n", out);
+        failed = true;
+    }
+    else if(inputCount > 1 && (outputPath || statsPath))
+    {
+        fputs("-o and -fcodegen-stats take a single input file.\n", out);
+        failed = true;
+    }
+    else if(emitAssemblyText && emitObjectFile)
+    {
+        fputs("-S and -c cannot be combined.\n", out);
+        failed = true;
+    }
+    else if(profileGenerate && profilePath)
+    {
+        fputs("-fprofile-generate and -fprofile-use cannot be combined.\n", out);
+        failed = true;
+    }
+    else if(profilePath && !profileRead(&profile, profilePath, out))
+        failed = true;
+    if(failed)
+    {
+        profileFree(&profile);
+        for(int i = 0; i < resolvedCount; i++)
+            free(resolvedPaths[i]);
+        free(resolvedPaths);
+        free(preprocessorOptions.includePaths);
+        free(preprocessorOptions.defines);
+        free(inputPaths);
+        return 1;
+    }
+
+    CompilationCache cache;
+    bool cacheOpened = cacheDirectory && *cacheDirectory &&
+                       cacheOpen(&cache, cacheDirectory, cacheMaxBytes, environment->compilerPath, out);
+    //Include paths matter because they decide which headers are found, not only what is in them
+    size_t cacheOptionsLength = 32;
+    for(int i = 0; i < preprocessorOptions.includePathCount; i++)
+        cacheOptionsLength += strlen(preprocessorOptions.includePaths[i]) + 4;
+    for(int i = 0; i < preprocessorOptions.defineCount; i++)
+        cacheOptionsLength += strlen(preprocessorOptions.defines[i]) + 4;
+    char *cacheOptions = countedMalloc(cacheOptionsLength + 1);
+    strcpy(cacheOptions, emitAssemblyText ? "-S" : emitObjectFile ? "-c" : "");
+    if(inlineBudget != IR_INLINE_DEFAULT_BUDGET)
+        sprintf(cacheOptions + strlen(cacheOptions), " -finline-limit %d", inlineBudget);
+    if(profileGenerate)
+        strcat(cacheOptions, " -fprofile-generate");
+    for(int i = 0; i < preprocessorOptions.includePathCount; i++)
+        strcat(strcat(cacheOptions, " -I"), preprocessorOptions.includePaths[i]);
+    for(int i = 0; i < preprocessorOptions.defineCount; i++)
+        strcat(strcat(cacheOptions, " -D"), preprocessorOptions.defines[i]);
+
+    CompileJob *jobs = countedCalloc(inputCount, sizeof(CompileJob));
+    TimeReport *timeReports =
+        printTimeReport || timeReportJsonPath ? countedCalloc(inputCount, sizeof(TimeReport)) : NULL;
+    char **ownedPaths = countedCalloc(inputCount, sizeof(char*));
+    for(int i = 0; i < inputCount; i++)
+    {
+        CompileJob *job = &jobs[i];
+        job->inputPath = inputPaths[i];
+        job->statsPath = statsPath;
+        job->dumpIr = dumpIr;
+        job->emitAssemblyText = emitAssemblyText;
+        job->emitObjectFile = emitObjectFile;
+        job->inlineBudget = inlineBudget;
+        job->profileGenerate = profileGenerate;
+        job->profile = profilePath ? &profile : NULL;
+        job->precompile = precompile;
+        job->timeReport = timeReports ? &timeReports[i] : NULL;
+        job->printTimeReport = printTimeReport;
+        job->printMemoryReport = printMemoryReport;
+        job->regionPool = environment->regions;
+        job->cache = cacheOpened ? &cache : NULL;
+        job->cacheOptions = cacheOptions;
+        job->headers = environment->headers;
+        job->preprocessorOptions = &preprocessorOptions;
+        if(outputPath)
+            job->outputPath = outputPath;
+        else if(precompile)
+        {
+            //foo.h becomes foo.h.pch, where the preprocessor looks for it
+            ownedPaths[i] = countedMalloc(strlen(inputPaths[i]) + 5);
+            strcpy(ownedPaths[i], inputPaths[i]);
+            strcat(ownedPaths[i], ".pch");
+            job->outputPath = ownedPaths[i];
+        }
+        else if(emitObjectFile)
+            job->outputPath = ownedPaths[i] = defaultOutputPath(inputPaths[i], ".o");
+        else if(inputCount == 1)
+            job->outputPath = resolvePath(environment, emitAssemblyText ? "a.s" : "a.out", resolvedPaths,
+                                          &resolvedCount);
+        else
+            job->outputPath = ownedPaths[i] = defaultOutputPath(inputPaths[i], emitAssemblyText ? ".s" : ".out");
+    }
+
+    if(jobCount <= 0)
+        jobCount = threadPoolDefaultWorkerCount();
+    //Workers left over once every input has one go to the functions of a single input
+    for(int i = 0; i < inputCount; i++)
+        jobs[i].codegenThreads = inputCount == 1 ? jobCount : 1;
+    if(jobCount > inputCount)
+        jobCount = inputCount;
+    ThreadPool *pool = jobCount > 1 ? threadPoolCreate(jobCount) : NULL;
+    if(pool)
+    {
+        for(int i = 0; i < inputCount; i++)
+        {
+            jobs[i].log = tmpfile();
+            if(!jobs[i].log) jobs[i].log = out;
+            threadPoolSubmit(pool, runCompileJob, &jobs[i]);
+        }
+        threadPoolWait(pool);
+        threadPoolDestroy(pool);
+    }
+    else
+    {
+        for(int i = 0; i < inputCount; i++)
+        {
+            jobs[i].log = out;
+            runCompileJob(&jobs[i]);
+        }
+    }
+
+    //Diagnostics come out in the order the inputs were given, whichever job finished first
+    bool result = true;
+    for(int i = 0; i < inputCount; i++)
+    {
+        CompileJob *job = &jobs[i];
+        if(job->log != out)
+        {
+            rewind(job->log);
+            char buffer[4096];
+            size_t length;
+            while((length = fread(buffer, 1, sizeof(buffer), job->log)) > 0)
+                fwrite(buffer, 1, length, out);
+            fclose(job->log);
+        }
+        if(!job->result)
+        {
+            if(inputCount > 1)
+                fprintf(out, "%s: compilation failed.\n", job->inputPath);
+            result = false;
+        }
+        free(ownedPaths[i]);
+    }
+    if(timeReportJsonPath)
+    {
+        FILE *jsonFile = fopen(timeReportJsonPath, "w");
+        if(!jsonFile || !timeReportWriteJson(timeReports, inputPaths, inputCount, jsonFile))
+        {
+            fprintf(out, "Failed to write time report '%s'\n", timeReportJsonPath);
+            result = false;
+        }
+        if(jsonFile && fclose(jsonFile) != 0)
+            result = false;
+    }
+    if(cacheOpened)
+    {
+        cacheTrim(&cache);
+        if(printCacheStats)
+            cachePrintStats(&cache, out);
+        cacheClose(&cache);
+    }
+    for(int i = 0; i < resolvedCount; i++)
+        free(resolvedPaths[i]);
+    free(resolvedPaths);
+    free(cacheOptions);
+    profileFree(&profile);
+    free(preprocessorOptions.includePaths);
+    free(preprocessorOptions.defines);
+    free(timeReports);
+    free(ownedPaths);
+    free(jobs);
+    free(inputPaths);
+    return result ? 0 : 1;
+}
+
+static int serveCompileRequest(int argumentCount, char **arguments, const char *workingDirectory, FILE *out,
+                               void *context)
+{
+    DriverEnvironment environment = *(DriverEnvironment*)context;
+    environment.workingDirectory = workingDirectory;
+    environment.out = out;
+    return runDriver(argumentCount, arguments, &environment);
+}
+
+int main(int argc, char **argv) {
+    //The header cache and the regions are the state a compile server keeps warm between requests
+    DriverEnvironment environment = {0};
+    RegionPool regions = {0};
+    pthread_mutex_init(&regions.lock, NULL);
+    environment.regions = &regions;
+    environment.out = stdout;
+    environment.compilerPath = argc ? argv[0] : NULL;
+    bool server = false;
+    char socketPath[SERVER_SOCKET_PATH_MAX];
+    serverDefaultSocketPath(socketPath, sizeof(socketPath));
+    int workerCount = 0;
+    for(int i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "-fserver"))
+            server = true;
+        else if(!strcmp(argv[i], "-fserver-socket") && i + 1 < argc)
+            snprintf(socketPath, sizeof(socketPath), "%s", argv[++i]);
+        else if(!strcmp(argv[i], "-j") && i + 1 < argc)
+            workerCount = atoi(argv[++i]);
+    }
+
+    int status;
+    if(server)
+    {
+        //Requests already run in parallel, so each one compiles its inputs in turn unless it asks for -j
+        environment.headers = headerCacheCreate(true);
+        environment.defaultJobCount = 1;
+        status = serverRun(socketPath, workerCount, serveCompileRequest, &environment) ? 0 : 1;
+    }
+    else
+    {
+        environment.headers = headerCacheCreate(false);
+        status = argc ? runDriver(argc - 1, argv + 1, &environment) : 1;
+    }
+    headerCacheDestroy(environment.headers);
+    regionPoolDestroy(&regions);
+    return status;
 }
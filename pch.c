@@ -0,0 +1,131 @@
+#define _XOPEN_SOURCE 700
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "pch.h"
+#include "bytes.h"
+#include "alloc.h"
+
+bool pchWrite(SourceFile *file, const char *outputPath, FILE *log)
+{
+    struct stat info;
+    if(stat(file->path, &info) != 0)
+    {
+        fprintf(log, "Failed to stat '%s'\n", file->path);
+        return false;
+    }
+    uint64_t tokenOffset = align8(sizeof(PchHeader));
+    uint64_t sourceOffset = align8(tokenOffset + (uint64_t)file->tokens.length * sizeof(PchToken));
+    uint64_t imageSize = sourceOffset + (uint64_t)file->length + 1;
+    if(imageSize > UINT32_MAX)
+    {
+        fprintf(log, "'%s' is too large to precompile\n", file->path);
+        return false;
+    }
+
+    unsigned char *image = countedCalloc(imageSize, 1);
+    memcpy(image, PCH_MAGIC, 4);
+    put32(image + 4, PCH_VERSION);
+    put32(image + 8, (uint32_t)tokenOffset);
+    put32(image + 12, (uint32_t)file->tokens.length);
+    put32(image + 16, (uint32_t)sourceOffset);
+    put32(image + 20, (uint32_t)file->length);
+    put32(image + 24, file->guardMacro ? (uint32_t)(file->guardMacro - file->tokens.tokens) : PCH_NO_GUARD);
+    put64(image + 32, (uint64_t)(int64_t)info.st_mtime);
+    for(int i = 0; i < file->tokens.length; i++)
+    {
+        Token *token = &file->tokens.tokens[i];
+        unsigned char *record = image + tokenOffset + (uint64_t)i * sizeof(PchToken);
+        put32(record, (uint32_t)(token->tokenStr - file->buffer));
+        put32(record + 4, (uint32_t)token->tokenStrLength);
+        record[8] = (unsigned char)token->tokenType;
+        record[9] = token->startsLine ? PCH_TOKEN_STARTS_LINE : 0;
+    }
+    memcpy(image + sourceOffset, file->buffer, file->length);
+
+    FILE *output = fopen(outputPath, "wb");
+    bool result = output != NULL;
+    if(output)
+    {
+        //The whole file goes out in a single write
+        if(fwrite(image, 1, imageSize, output) != imageSize)
+            result = false;
+        if(fclose(output) != 0)
+            result = false;
+    }
+    if(!result)
+        fprintf(log, "Failed to write precompiled header '%s'\n", outputPath);
+    free(image);
+    return result;
+}
+
+SourceFile *pchLoad(const char *sourcePath, const char *pchPath)
+{
+    int descriptor = open(pchPath, O_RDONLY);
+    if(descriptor < 0) return NULL;
+    struct stat pchInfo;
+    struct stat sourceInfo;
+    if(fstat(descriptor, &pchInfo) != 0 || stat(sourcePath, &sourceInfo) != 0 ||
+       (size_t)pchInfo.st_size < sizeof(PchHeader))
+    {
+        close(descriptor);
+        return NULL;
+    }
+    size_t imageSize = (size_t)pchInfo.st_size;
+    void *mapping = mmap(NULL, imageSize, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if(mapping == MAP_FAILED) return NULL;
+
+    //Anything unexpected, including a header edited since, falls back to lexing the header itself
+    const unsigned char *image = mapping;
+    uint32_t tokenOffset = get32(image + 8);
+    uint32_t tokenCount = get32(image + 12);
+    uint32_t sourceOffset = get32(image + 16);
+    uint32_t sourceLength = get32(image + 20);
+    uint32_t guardToken = get32(image + 24);
+    bool valid = !memcmp(image, PCH_MAGIC, 4) && get32(image + 4) == PCH_VERSION &&
+                 tokenCount <= INT32_MAX && sourceLength < INT32_MAX &&
+                 sectionFits(imageSize, tokenOffset, (uint64_t)tokenCount * sizeof(PchToken)) &&
+                 sectionFits(imageSize, sourceOffset, (uint64_t)sourceLength + 1) &&
+                 (uint64_t)sourceInfo.st_size == sourceLength &&
+                 (int64_t)get64(image + 32) == (int64_t)sourceInfo.st_mtime;
+    //The records are decoded into Tokens in one pass, O(tokenCount), the spellings are not copied
+    TokenVector tokens = {0};
+    if(valid)
+    {
+        tokens.tokens = countedMalloc(sizeof(Token) * (tokenCount ? tokenCount : 1));
+        tokens.capacity = (int)tokenCount;
+    }
+    char *source = (char*)image + sourceOffset;
+    for(uint32_t i = 0; i < tokenCount && valid; i++)
+    {
+        const unsigned char *record = image + tokenOffset + (uint64_t)i * sizeof(PchToken);
+        uint32_t offset = get32(record);
+        uint32_t length = get32(record + 4);
+        if((uint64_t)offset + length > sourceLength || record[8] > TT_INITIALIZER_LIST)
+        {
+            valid = false;
+            break;
+        }
+        Token *token = &tokens.tokens[tokens.length++];
+        token->tokenStr = source + offset;
+        token->tokenStrLength = (int)length;
+        token->tokenType = (TokenType)record[8];
+        token->startsLine = (record[9] & PCH_TOKEN_STARTS_LINE) != 0;
+    }
+    if(!valid)
+    {
+        free(tokens.tokens);
+        munmap(mapping, imageSize);
+        return NULL;
+    }
+
+    SourceFile *file = sourceFileCreateLexed(sourcePath, source, (int)sourceLength, tokens,
+                                             guardToken == PCH_NO_GUARD ? -1 : (int)guardToken);
+    file->mapping = mapping;
+    file->mappingLength = imageSize;
+    return file;
+}
@@ -0,0 +1,53 @@
+#ifndef CCOMPILER_PCH_H
+#define CCOMPILER_PCH_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "preprocess.h"
+
+/*
+Precompiled header: the source text of a header together with its token stream, so the compiler can map the file and
+hand the tokens to the preprocessor without running the lexer. All fields are little endian and every section starts
+8 byte aligned. Tokens name their spelling by offset into the source section, which keeps the file position
+independent and leaves the spelling of neighbouring tokens adjacent, as # relies on. Loading is still a linear pass:
+each record is decoded into a Token whose text points into the mapping, since a Token holds a pointer and so cannot be
+stored in a file that maps at any address. That pass only copies fixed size records and skips the lexer.
+    PchHeader
+    PchToken tokens[tokenCount]
+    char source[sourceLength + 1]
+*/
+#define PCH_MAGIC "CCPH"
+#define PCH_VERSION 2
+#define PCH_NO_GUARD 0xFFFFFFFFu
+#define PCH_TOKEN_STARTS_LINE 1
+
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t tokenOffset;
+    uint32_t tokenCount;
+    uint32_t sourceOffset;
+    uint32_t sourceLength;
+    //Token index of the include guard macro, PCH_NO_GUARD if the header has none
+    uint32_t guardToken;
+    uint32_t reserved;
+    //Modification time of the header when it was precompiled. A different time or length means the file is stale.
+    int64_t sourceModified;
+} PchHeader;
+
+typedef struct
+{
+    uint32_t offset;
+    uint32_t length;
+    uint8_t type;
+    uint8_t flags;
+    uint16_t reserved;
+} PchToken;
+
+extern bool pchWrite(SourceFile *file, const char *outputPath, FILE *log);
+//Maps the precompiled form of the header at sourcePath and decodes its token records, the source text stays in the
+//mapping. NULL if there is none or it is out of date.
+extern SourceFile *pchLoad(const char *sourcePath, const char *pchPath);
+
+#endif //CCOMPILER_PCH_H
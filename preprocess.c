@@ -0,0 +1,1652 @@
+#define _XOPEN_SOURCE 700
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "preprocess.h"
+#include "pch.h"
+#include "alloc.h"
+
+static bool tokenIs(const Token *token, const char *str)
+{
+    return (int)strlen(str) == token->tokenStrLength && !strncmp(token->tokenStr, str, token->tokenStrLength);
+}
+
+static bool tokensEqual(const Token *a, const Token *b)
+{
+    return a->tokenStrLength == b->tokenStrLength && !strncmp(a->tokenStr, b->tokenStr, a->tokenStrLength);
+}
+
+//Identifiers, keywords and type names can all be macro names
+static bool isWord(const Token *token)
+{
+    return token->tokenType != TT_STRING_LITERAL && token->tokenType != TT_CHAR_LITERAL &&
+           isIdentifierCharacter(token->tokenStr[0], true);
+}
+
+static uint32_t hashBytes(const char *bytes, int length)
+{
+    uint32_t hash = 2166136261u;
+    for(int i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static char *copyString(const char *str, int length)
+{
+    char *copy = countedMalloc(length + 1);
+    memcpy(copy, str, length);
+    copy[length] = 0;
+    return copy;
+}
+
+static bool isDirectiveStart(Token *tokens, int index)
+{
+    return tokens[index].startsLine && tokenIs(&tokens[index], "#");
+}
+
+//Index of the first token of the next logical line
+static int lineEnd(Token *tokens, int index, int count)
+{
+    int end = index + 1;
+    while(end < count && !tokens[end].startsLine)
+        end++;
+    return end;
+}
+
+static bool isConditionalStart(Token *directive)
+{
+    return tokenIs(directive, "if") || tokenIs(directive, "ifdef") || tokenIs(directive, "ifndef");
+}
+
+/*
+Recognizes the usual multiple-include guard
+    #ifndef GUARD
+    #define GUARD
+    ...
+    #endif
+where nothing but comments sits outside the conditional. Once GUARD is defined, including the file again has no
+effect, so the preprocessor can skip it without reading a single token.
+*/
+static Token *detectIncludeGuard(SourceFile *file)
+{
+    Token *tokens = file->tokens.tokens;
+    int count = file->tokens.length;
+    if(count < 7 || !isDirectiveStart(tokens, 0) || !tokenIs(&tokens[1], "ifndef") || !isWord(&tokens[2]) ||
+       lineEnd(tokens, 0, count) != 3)
+        return NULL;
+    if(!isDirectiveStart(tokens, 3) || !tokenIs(&tokens[4], "define") || !tokensEqual(&tokens[5], &tokens[2]))
+        return NULL;
+
+    int depth = 0;
+    int i = 0;
+    while(i < count)
+    {
+        if(!isDirectiveStart(tokens, i) || i + 1 >= count || tokens[i + 1].startsLine)
+        {
+            i++;
+            continue;
+        }
+        int end = lineEnd(tokens, i, count);
+        if(isConditionalStart(&tokens[i + 1]))
+            depth++;
+        else if(tokenIs(&tokens[i + 1], "endif") && --depth == 0)
+            return end == count ? &tokens[2] : NULL;
+        i = end;
+    }
+    return NULL;
+}
+
+static SourceFile *sourceFileAllocate(const char *path, char *buffer, int length)
+{
+    SourceFile *file = countedCalloc(1, sizeof(SourceFile));
+    int pathLength = (int)strlen(path);
+    file->path = copyString(path, pathLength);
+    const char *slash = strrchr(path, '/');
+    file->directory = slash ? copyString(path, (int)(slash - path)) : copyString(".", 1);
+    file->buffer = buffer;
+    file->length = length;
+    atomic_init(&file->lines, NULL);
+    return file;
+}
+
+SourceFile *sourceFileCreate(const char *path, char *buffer, int length, FILE *log)
+{
+    SourceFile *file = sourceFileAllocate(path, buffer, length);
+    tokenVectorCreate(&file->tokens, NULL);
+    file->tokenizeFailed = !tokenize(&file->tokens, buffer, length, path, log);
+    file->guardMacro = detectIncludeGuard(file);
+    return file;
+}
+
+SourceLocation sourceFileLocate(SourceFile *file, int offset)
+{
+    LineIndex *lines = atomic_load_explicit(&file->lines, memory_order_acquire);
+    if(!lines)
+    {
+        //Two threads may both build one, the loser drops its copy
+        LineIndex *built = countedMalloc(sizeof(LineIndex));
+        lineIndexBuild(built, file->buffer, file->length);
+        LineIndex *expected = NULL;
+        if(atomic_compare_exchange_strong_explicit(&file->lines, &expected, built, memory_order_acq_rel,
+                                                   memory_order_acquire))
+            lines = built;
+        else
+        {
+            lineIndexDispose(built);
+            free(built);
+            lines = expected;
+        }
+    }
+    SourceLocation location;
+    location.path = file->path;
+    lineIndexLocate(lines, offset, &location.line, &location.column);
+    return location;
+}
+
+SourceFile *sourceFileCreateLexed(const char *path, char *buffer, int length, TokenVector tokens, int guardIndex)
+{
+    SourceFile *file = sourceFileAllocate(path, buffer, length);
+    file->tokens = tokens;
+    file->guardMacro = guardIndex >= 0 && guardIndex < tokens.length ? &file->tokens.tokens[guardIndex] : NULL;
+    return file;
+}
+
+void sourceFileDestroy(SourceFile *file)
+{
+    if(!file) return;
+    LineIndex *lines = atomic_load(&file->lines);
+    if(lines)
+    {
+        lineIndexDispose(lines);
+        free(lines);
+    }
+    tokenVectorDispose(&file->tokens);
+    if(file->mapping)
+        munmap(file->mapping, file->mappingLength);
+    else
+        free(file->buffer);
+    free(file->directory);
+    free(file->path);
+    free(file);
+}
+
+typedef struct
+{
+    char *path;
+    SourceFile *file;
+    //File modification time and size when it was read, only recorded when the cache revalidates
+    time_t modified;
+    off_t size;
+} HeaderEntry;
+
+struct HeaderCache
+{
+    pthread_mutex_t lock;
+    HeaderEntry *entries;
+    unsigned int capacity;
+    unsigned int count;
+    bool revalidate;
+    //Replaced versions of edited headers. Preprocessors running at the time may still point into them.
+    SourceFile **retired;
+    int retiredCount;
+    int retiredCapacity;
+};
+
+HeaderCache *headerCacheCreate(bool revalidate)
+{
+    HeaderCache *cache = countedCalloc(1, sizeof(HeaderCache));
+    cache->revalidate = revalidate;
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->capacity = 64;
+    cache->entries = countedCalloc(cache->capacity, sizeof(HeaderEntry));
+    return cache;
+}
+
+void headerCacheDestroy(HeaderCache *cache)
+{
+    if(!cache) return;
+    for(unsigned int i = 0; i < cache->capacity; i++)
+    {
+        if(!cache->entries[i].path) continue;
+        free(cache->entries[i].path);
+        sourceFileDestroy(cache->entries[i].file);
+    }
+    for(int i = 0; i < cache->retiredCount; i++)
+        sourceFileDestroy(cache->retired[i]);
+    free(cache->retired);
+    free(cache->entries);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+static unsigned int headerSlot(HeaderEntry *entries, unsigned int capacity, const char *path)
+{
+    unsigned int mask = capacity - 1;
+    unsigned int slot = hashBytes(path, (int)strlen(path)) & mask;
+    while(entries[slot].path && strcmp(entries[slot].path, path))
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+static char *readWholeFile(const char *path, int *length)
+{
+    FILE *file = fopen(path, "rb");
+    if(!file) return NULL;
+    fseek(file, 0, SEEK_END);
+    long fileLength = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if(fileLength < 0 || fileLength > INT32_MAX)
+    {
+        fclose(file);
+        return NULL;
+    }
+    char *buffer = countedMalloc(fileLength + 1);
+    if(fread(buffer, 1, fileLength, file) != (size_t)fileLength)
+    {
+        free(buffer);
+        fclose(file);
+        return NULL;
+    }
+    buffer[fileLength] = 0;
+    fclose(file);
+    *length = (int)fileLength;
+    return buffer;
+}
+
+SourceFile *headerCacheLoad(HeaderCache *cache, const char *path, FILE *log)
+{
+    //Different spellings of the same header share one entry, which keeps #pragma once reliable
+    char *canonical = realpath(path, NULL);
+    if(!canonical) return NULL;
+    struct stat info;
+    bool stamped = cache->revalidate && stat(canonical, &info) == 0;
+
+    pthread_mutex_lock(&cache->lock);
+    HeaderEntry *entry = &cache->entries[headerSlot(cache->entries, cache->capacity, canonical)];
+    SourceFile *file = entry->file;
+    if(file && stamped && (entry->modified != info.st_mtime || entry->size != info.st_size))
+        file = NULL;
+    pthread_mutex_unlock(&cache->lock);
+    if(file)
+    {
+        free(canonical);
+        return file;
+    }
+
+    //Read and tokenized outside the lock. If another thread wins the race its copy is kept and ours dropped.
+    //An up to date header.h.pch next to the header replaces both.
+    size_t canonicalLength = strlen(canonical);
+    char *pchPath = countedMalloc(canonicalLength + 5);
+    memcpy(pchPath, canonical, canonicalLength);
+    strcpy(pchPath + canonicalLength, ".pch");
+    SourceFile *loaded = pchLoad(canonical, pchPath);
+    free(pchPath);
+    if(!loaded)
+    {
+        int length;
+        char *buffer = readWholeFile(canonical, &length);
+        if(!buffer)
+        {
+            free(canonical);
+            return NULL;
+        }
+        loaded = sourceFileCreate(canonical, buffer, length, log);
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    unsigned int slot = headerSlot(cache->entries, cache->capacity, canonical);
+    entry = &cache->entries[slot];
+    if(entry->path && (!stamped || (entry->modified == info.st_mtime && entry->size == info.st_size)))
+    {
+        file = entry->file;
+        free(canonical);
+        sourceFileDestroy(loaded);
+    }
+    else if(entry->path)
+    {
+        //The header changed on disk. The old copy stays alive until the cache is destroyed.
+        if(cache->retiredCount == cache->retiredCapacity)
+        {
+            cache->retiredCapacity = cache->retiredCapacity ? cache->retiredCapacity * 2 : 8;
+            cache->retired = countedRealloc(cache->retired, sizeof(SourceFile*) * cache->retiredCapacity);
+        }
+        cache->retired[cache->retiredCount++] = entry->file;
+        entry->file = loaded;
+        entry->modified = info.st_mtime;
+        entry->size = info.st_size;
+        free(canonical);
+        file = loaded;
+    }
+    else
+    {
+        if((cache->count + 1) * 2 > cache->capacity)
+        {
+            unsigned int capacity = cache->capacity * 2;
+            HeaderEntry *entries = countedCalloc(capacity, sizeof(HeaderEntry));
+            for(unsigned int i = 0; i < cache->capacity; i++)
+            {
+                if(cache->entries[i].path)
+                    entries[headerSlot(entries, capacity, cache->entries[i].path)] = cache->entries[i];
+            }
+            free(cache->entries);
+            cache->entries = entries;
+            cache->capacity = capacity;
+            slot = headerSlot(cache->entries, cache->capacity, canonical);
+        }
+        cache->entries[slot].path = canonical;
+        cache->entries[slot].file = loaded;
+        if(stamped)
+        {
+            cache->entries[slot].modified = info.st_mtime;
+            cache->entries[slot].size = info.st_size;
+        }
+        cache->count++;
+        file = loaded;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return file;
+}
+
+typedef struct Macro Macro;
+struct Macro
+{
+    Token name;
+    bool functionLike;
+    bool variadic;
+    bool defined;
+    //Set while the expansion of the macro is being rescanned, the macro is not expanded again inside it
+    bool active;
+    int paramCount;
+    Token *params;
+    //Replacement list, a slice of the defining file's tokens
+    Token *body;
+    int bodyLength;
+    //No parameters, # or ## in the body, so an expansion is the body itself
+    bool plainBody;
+};
+
+typedef struct
+{
+    Token *tokens;
+    int length;
+} TokenSlice;
+
+/*
+One macro expansion being rescanned, or a run of source tokens. The tokens are the concatenation of the segments,
+which point into source files, replacement lists, arguments or scratch memory.
+*/
+typedef struct
+{
+    TokenSlice *segments;
+    int segmentCount;
+    int segment;
+    int index;
+    //Disabled while the frame is on the stack
+    Macro *macro;
+    //Used instead of segments when those are NULL
+    TokenSlice single;
+} ExpansionFrame;
+
+typedef struct
+{
+    ExpansionFrame *frames;
+    int length;
+    int capacity;
+} FrameStack;
+
+typedef struct
+{
+    bool active;
+    //Some group of this conditional was already taken
+    bool taken;
+    bool parentActive;
+    bool sawElse;
+} Conditional;
+
+typedef struct
+{
+    void **items;
+    unsigned int capacity;
+    unsigned int count;
+} PointerSet;
+
+typedef struct
+{
+    char *key;
+    SourceFile *file;
+} ResolvedInclude;
+
+//Spelling made by # or ##, located at the token it was made for
+typedef struct
+{
+    char *str;
+    int size;
+    Token origin;
+} KeptString;
+
+struct Preprocessor
+{
+    HeaderCache *headers;
+    PreprocessorOptions *options;
+    FILE *log;
+    Macro **macros;
+    unsigned int macroCapacity;
+    unsigned int macroCount;
+    //Includes already resolved, keyed by the including directory and the spelling
+    ResolvedInclude *resolved;
+    unsigned int resolvedCapacity;
+    unsigned int resolvedCount;
+    PointerSet onceFiles;
+    PointerSet includedSet;
+    SourceFile **included;
+    int includedCount;
+    int includedCapacity;
+    Conditional *conditionals;
+    int conditionalCount;
+    int conditionalCapacity;
+    //Spellings created by # and ##
+    KeptString *strings;
+    int stringCount;
+    int stringCapacity;
+    //Command line definitions
+    SourceFile **ownedFiles;
+    int ownedFileCount;
+    //Segment lists, argument lists and tokens made by # and ##. Reset once the outermost expansion is done, since
+    //the output holds copies of the tokens.
+    Region *scratch;
+    int expansionDepth;
+    SourceFile *mainFile;
+    SourceFile *currentFile;
+    int depth;
+    bool failed;
+};
+
+static void preprocessError(Preprocessor *pp, const Token *at, const char *format, ...)
+{
+    SourceLocation location;
+    if(at && preprocessorLocate(pp, at, &location))
+        fprintf(pp->log, "%s:%d:%d: ", location.path, location.line, location.column);
+    else
+        fprintf(pp->log, "%s: ", pp->currentFile ? pp->currentFile->path : "<unknown>");
+    va_list args;
+    va_start(args, format);
+    vfprintf(pp->log, format, args);
+    va_end(args);
+    fprintf(pp->log, "\n");
+    pp->failed = true;
+}
+
+static unsigned int pointerHash(void *pointer)
+{
+    uintptr_t value = (uintptr_t)pointer;
+    value ^= value >> 17;
+    value *= 0x9E3779B1u;
+    return (unsigned int)(value ^ (value >> 15));
+}
+
+static bool pointerSetContains(PointerSet *set, void *pointer)
+{
+    if(!set->count) return false;
+    unsigned int mask = set->capacity - 1;
+    for(unsigned int slot = pointerHash(pointer) & mask; set->items[slot]; slot = (slot + 1) & mask)
+    {
+        if(set->items[slot] == pointer) return true;
+    }
+    return false;
+}
+
+//Returns true if the pointer was not in the set yet
+static bool pointerSetInsert(PointerSet *set, void *pointer)
+{
+    if(pointerSetContains(set, pointer)) return false;
+    if((set->count + 1) * 2 > set->capacity)
+    {
+        unsigned int capacity = set->capacity ? set->capacity * 2 : 16;
+        void **items = countedCalloc(capacity, sizeof(void*));
+        for(unsigned int i = 0; i < set->capacity; i++)
+        {
+            if(!set->items[i]) continue;
+            unsigned int slot = pointerHash(set->items[i]) & (capacity - 1);
+            while(items[slot]) slot = (slot + 1) & (capacity - 1);
+            items[slot] = set->items[i];
+        }
+        free(set->items);
+        set->items = items;
+        set->capacity = capacity;
+    }
+    unsigned int mask = set->capacity - 1;
+    unsigned int slot = pointerHash(pointer) & mask;
+    while(set->items[slot]) slot = (slot + 1) & mask;
+    set->items[slot] = pointer;
+    set->count++;
+    return true;
+}
+
+static unsigned int macroSlot(Macro **macros, unsigned int capacity, const char *name, int length)
+{
+    unsigned int mask = capacity - 1;
+    unsigned int slot = hashBytes(name, length) & mask;
+    while(macros[slot] && (macros[slot]->name.tokenStrLength != length ||
+                           strncmp(macros[slot]->name.tokenStr, name, length)))
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+static Macro *findMacro(Preprocessor *pp, const Token *name)
+{
+    if(!pp->macroCount || !isWord(name)) return NULL;
+    Macro *macro = pp->macros[macroSlot(pp->macros, pp->macroCapacity, name->tokenStr, name->tokenStrLength)];
+    return macro && macro->defined ? macro : NULL;
+}
+
+//Returns the table entry for name, adding an undefined one if there is none
+static Macro *macroEntry(Preprocessor *pp, const Token *name)
+{
+    unsigned int slot = macroSlot(pp->macros, pp->macroCapacity, name->tokenStr, name->tokenStrLength);
+    if(pp->macros[slot]) return pp->macros[slot];
+    if((pp->macroCount + 1) * 2 > pp->macroCapacity)
+    {
+        unsigned int capacity = pp->macroCapacity * 2;
+        Macro **macros = countedCalloc(capacity, sizeof(Macro*));
+        for(unsigned int i = 0; i < pp->macroCapacity; i++)
+        {
+            Macro *macro = pp->macros[i];
+            if(macro)
+                macros[macroSlot(macros, capacity, macro->name.tokenStr, macro->name.tokenStrLength)] = macro;
+        }
+        free(pp->macros);
+        pp->macros = macros;
+        pp->macroCapacity = capacity;
+        slot = macroSlot(pp->macros, pp->macroCapacity, name->tokenStr, name->tokenStrLength);
+    }
+    Macro *macro = countedCalloc(1, sizeof(Macro));
+    macro->name = *name;
+    pp->macros[slot] = macro;
+    pp->macroCount++;
+    return macro;
+}
+
+static char *keepString(Preprocessor *pp, char *str, int size, const Token *origin)
+{
+    if(pp->stringCount == pp->stringCapacity)
+    {
+        pp->stringCapacity = pp->stringCapacity ? pp->stringCapacity * 2 : 16;
+        pp->strings = countedRealloc(pp->strings, sizeof(KeptString) * pp->stringCapacity);
+    }
+    pp->strings[pp->stringCount].str = str;
+    pp->strings[pp->stringCount].size = size;
+    pp->strings[pp->stringCount].origin = *origin;
+    pp->stringCount++;
+    return str;
+}
+
+static void *scratchAlloc(Preprocessor *pp, size_t size)
+{
+    return allocatorAllocate(&pp->scratch->allocator, size);
+}
+
+static int paramIndex(Macro *macro, const Token *token)
+{
+    if(!macro->functionLike || !isWord(token)) return -1;
+    for(int i = 0; i < macro->paramCount; i++)
+    {
+        if(tokensEqual(&macro->params[i], token)) return i;
+    }
+    return -1;
+}
+
+static bool defineMacro(Preprocessor *pp, Token *line, int count)
+{
+    if(count < 1 || !isWord(&line[0]))
+    {
+        preprocessError(pp, count ? &line[0] : NULL, "macro name must be an identifier");
+        return false;
+    }
+    Token *name = &line[0];
+    bool functionLike = count > 1 && tokenIs(&line[1], "(") &&
+                        line[1].tokenStr == name->tokenStr + name->tokenStrLength;
+    Token *params = NULL;
+    int paramCount = 0;
+    bool variadic = false;
+    int i = 1;
+    if(functionLike)
+    {
+        params = countedMalloc(sizeof(Token) * count);
+        i = 2;
+        while(i < count && !tokenIs(&line[i], ")"))
+        {
+            if(tokenIs(&line[i], "..."))
+            {
+                static char variadicName[] = "__VA_ARGS__";
+                Token vaArgs = line[i];
+                vaArgs.tokenStr = variadicName;
+                vaArgs.tokenStrLength = (int)strlen(variadicName);
+                vaArgs.tokenType = TT_IDENTIFIER;
+                params[paramCount++] = vaArgs;
+                variadic = true;
+            }
+            else if(isWord(&line[i]))
+                params[paramCount++] = line[i];
+            else
+                break;
+            i++;
+            if(i < count && tokenIs(&line[i], ",") && !variadic) i++;
+        }
+        if(i >= count || !tokenIs(&line[i], ")"))
+        {
+            free(params);
+            preprocessError(pp, name, "invalid parameter list for macro '%.*s'", name->tokenStrLength, name->tokenStr);
+            return false;
+        }
+        i++;
+    }
+
+    Macro *macro = macroEntry(pp, name);
+    free(macro->params);
+    macro->name = *name;
+    macro->functionLike = functionLike;
+    macro->variadic = variadic;
+    macro->paramCount = paramCount;
+    macro->params = params;
+    macro->body = line + i;
+    macro->bodyLength = count - i;
+    macro->defined = true;
+    macro->plainBody = true;
+    for(int b = 0; b < macro->bodyLength; b++)
+    {
+        if(tokenIs(&macro->body[b], "##") || (functionLike && tokenIs(&macro->body[b], "#")) ||
+           paramIndex(macro, &macro->body[b]) >= 0)
+            macro->plainBody = false;
+    }
+    return true;
+}
+
+static Token stringify(Preprocessor *pp, TokenSlice argument, const Token *at)
+{
+    int capacity = 3;
+    for(int i = 0; i < argument.length; i++)
+        capacity += argument.tokens[i].tokenStrLength * 2 + 1;
+    char *str = keepString(pp, countedMalloc(capacity), capacity, at);
+    int length = 0;
+    str[length++] = '"';
+    for(int i = 0; i < argument.length; i++)
+    {
+        Token *token = &argument.tokens[i];
+        Token *previous = i ? &argument.tokens[i - 1] : NULL;
+        if(previous && previous->tokenStr + previous->tokenStrLength != token->tokenStr)
+            str[length++] = ' ';
+        bool quoted = token->tokenType == TT_STRING_LITERAL || token->tokenType == TT_CHAR_LITERAL;
+        for(int c = 0; c < token->tokenStrLength; c++)
+        {
+            char ch = token->tokenStr[c];
+            if(quoted && (ch == '"' || ch == '\\')) str[length++] = '\\';
+            str[length++] = ch;
+        }
+    }
+    str[length++] = '"';
+    str[length] = 0;
+
+    Token result = {0};
+    result.tokenStr = str;
+    result.tokenStrLength = length;
+    result.tokenType = TT_STRING_LITERAL;
+    return result;
+}
+
+static bool pasteTokens(Preprocessor *pp, const Token *left, const Token *right, Token *result)
+{
+    int length = left->tokenStrLength + right->tokenStrLength;
+    char *str = keepString(pp, countedMalloc(length + 1), length + 1, left);
+    memcpy(str, left->tokenStr, left->tokenStrLength);
+    memcpy(str + left->tokenStrLength, right->tokenStr, right->tokenStrLength);
+    str[length] = 0;
+    TokenVector pasted = {0};
+    tokenize(&pasted, str, length, NULL, NULL);
+    bool valid = pasted.length == 1 && pasted.tokens[0].tokenStrLength == length;
+    if(valid)
+    {
+        *result = pasted.tokens[0];
+        result->startsLine = false;
+    }
+    else
+        preprocessError(pp, left, "pasting '%.*s' and '%.*s' does not give a valid token", left->tokenStrLength,
+                        left->tokenStr, right->tokenStrLength, right->tokenStr);
+    free(pasted.tokens);
+    return valid;
+}
+
+//Next token of the innermost unfinished frame. Finished frames are popped, which re-enables their macros.
+static Token *framePeek(FrameStack *stack)
+{
+    while(stack->length)
+    {
+        ExpansionFrame *frame = &stack->frames[stack->length - 1];
+        TokenSlice *segments = frame->segments ? frame->segments : &frame->single;
+        while(frame->segment < frame->segmentCount && frame->index >= segments[frame->segment].length)
+        {
+            frame->segment++;
+            frame->index = 0;
+        }
+        if(frame->segment < frame->segmentCount)
+            return &segments[frame->segment].tokens[frame->index];
+        if(frame->macro) frame->macro->active = false;
+        stack->length--;
+    }
+    return NULL;
+}
+
+static Token *frameNext(FrameStack *stack)
+{
+    Token *token = framePeek(stack);
+    if(token) stack->frames[stack->length - 1].index++;
+    return token;
+}
+
+static void framePush(FrameStack *stack, TokenSlice *segments, int segmentCount, TokenSlice single, Macro *macro)
+{
+    if(stack->length == stack->capacity)
+    {
+        stack->capacity = stack->capacity ? stack->capacity * 2 : 16;
+        stack->frames = countedRealloc(stack->frames, sizeof(ExpansionFrame) * stack->capacity);
+    }
+    stack->frames[stack->length++] = (ExpansionFrame){segments, segmentCount, 0, 0, macro, single};
+    if(macro) macro->active = true;
+}
+
+static void framePushSlice(FrameStack *stack, Token *tokens, int length, Macro *macro)
+{
+    framePush(stack, NULL, 1, (TokenSlice){tokens, length}, macro);
+}
+
+static bool expandFrames(Preprocessor *pp, FrameStack *stack, TokenVector *output);
+
+static TokenSlice expandArgument(Preprocessor *pp, TokenSlice argument)
+{
+    //An argument without macro names is its own expansion
+    int i = 0;
+    while(i < argument.length && !findMacro(pp, &argument.tokens[i]))
+        i++;
+    if(i == argument.length) return argument;
+
+    FrameStack stack = {0};
+    framePushSlice(&stack, argument.tokens, argument.length, NULL);
+    TokenVector expanded = {.allocator = &pp->scratch->allocator};
+    expandFrames(pp, &stack, &expanded);
+    free(stack.frames);
+    return (TokenSlice){expanded.tokens, expanded.length};
+}
+
+static void addSegment(TokenSlice *segments, int *count, TokenSlice slice)
+{
+    if(!slice.length) return;
+    //Neighbouring slices of the same array are merged, so a run of replacement tokens stays one segment
+    TokenSlice *last = *count ? &segments[*count - 1] : NULL;
+    if(last && last->tokens + last->length == slice.tokens)
+        last->length += slice.length;
+    else
+        segments[(*count)++] = slice;
+}
+
+/*
+Describes the expansion as a list of slices over the replacement list and the arguments, nothing is copied. Only the
+results of # and ## are new tokens, those live in scratch memory until the expansion is finished.
+*/
+static TokenSlice *buildSegments(Preprocessor *pp, Macro *macro, const Token *invocation, TokenSlice *arguments,
+                                 int *segmentCount)
+{
+    Token *body = macro->body;
+    int bodyLength = macro->bodyLength;
+    //A body token adds at most one segment, a paste at most two
+    TokenSlice *segments = scratchAlloc(pp, sizeof(TokenSlice) * (bodyLength * 2 + 1));
+    TokenSlice *expanded = NULL;
+    if(macro->paramCount)
+    {
+        expanded = scratchAlloc(pp, sizeof(TokenSlice) * macro->paramCount);
+        for(int p = 0; p < macro->paramCount; p++)
+            expanded[p].tokens = NULL;
+    }
+    if(bodyLength && tokenIs(&body[0], "##"))
+    {
+        preprocessError(pp, invocation, "'##' cannot appear at either end of a macro expansion");
+        return NULL;
+    }
+    int count = 0;
+    //The previous operand was an empty argument, ## then leaves the other operand alone
+    bool lastEmpty = false;
+    for(int j = 0; j < bodyLength; j++)
+    {
+        Token *token = &body[j];
+        int param;
+        if(macro->functionLike && tokenIs(token, "#") && j + 1 < bodyLength &&
+           (param = paramIndex(macro, &body[j + 1])) >= 0)
+        {
+            Token *stringized = scratchAlloc(pp, sizeof(Token));
+            *stringized = stringify(pp, arguments[param], invocation);
+            addSegment(segments, &count, (TokenSlice){stringized, 1});
+            lastEmpty = false;
+            j++;
+            continue;
+        }
+        if(tokenIs(token, "##"))
+        {
+            if(j + 1 >= bodyLength)
+            {
+                preprocessError(pp, invocation, "'##' cannot appear at either end of a macro expansion");
+                return NULL;
+            }
+            Token *operand = &body[++j];
+            param = paramIndex(macro, operand);
+            TokenSlice right = param >= 0 ? arguments[param] : (TokenSlice){operand, 1};
+            if(!lastEmpty && right.length)
+            {
+                TokenSlice *last = &segments[count - 1];
+                Token *left = &last->tokens[last->length - 1];
+                if(!--last->length) count--;
+                Token *pasted = scratchAlloc(pp, sizeof(Token));
+                if(!pasteTokens(pp, left, &right.tokens[0], pasted)) return NULL;
+                segments[count++] = (TokenSlice){pasted, 1};
+                right.tokens++;
+                right.length--;
+            }
+            addSegment(segments, &count, right);
+            lastEmpty = lastEmpty && !right.length;
+            continue;
+        }
+        param = paramIndex(macro, token);
+        if(param < 0)
+        {
+            addSegment(segments, &count, (TokenSlice){token, 1});
+            lastEmpty = false;
+            continue;
+        }
+        //Operands of ## are used as written, other arguments are fully macro expanded first
+        TokenSlice argument = arguments[param];
+        if(j + 1 >= bodyLength || !tokenIs(&body[j + 1], "##"))
+        {
+            if(!expanded[param].tokens)
+                expanded[param] = expandArgument(pp, argument);
+            argument = expanded[param];
+        }
+        addSegment(segments, &count, argument);
+        lastEmpty = !argument.length;
+    }
+    *segmentCount = count;
+    return segments;
+}
+
+//Collects the arguments of a function-like macro invocation whose '(' was just consumed
+static TokenSlice *collectArguments(Preprocessor *pp, FrameStack *stack, Macro *macro, const Token *invocation)
+{
+    int capacity = macro->paramCount > 0 ? macro->paramCount + 1 : 2;
+    TokenSlice *arguments = scratchAlloc(pp, sizeof(TokenSlice) * capacity);
+    int count = 1;
+    int depth = 0;
+    //Tokens that come one after another in memory are referenced in place, an argument only gets its own array
+    //when it spans several frames
+    TokenSlice current = {NULL, 0};
+    TokenVector copied = {.allocator = &pp->scratch->allocator};
+    while(true)
+    {
+        Token *token = frameNext(stack);
+        if(!token)
+        {
+            preprocessError(pp, invocation, "unterminated argument list invoking macro '%.*s'",
+                            invocation->tokenStrLength, invocation->tokenStr);
+            return NULL;
+        }
+        bool close = tokenIs(token, ")") && !depth;
+        if(tokenIs(token, "(")) depth++;
+        if(tokenIs(token, ")") && depth) depth--;
+        //The variadic parameter takes the remaining arguments, commas included
+        bool comma = !depth && tokenIs(token, ",") && !(macro->variadic && count == macro->paramCount);
+        if(close || comma)
+        {
+            if(copied.tokens)
+            {
+                current = (TokenSlice){copied.tokens, copied.length};
+                copied = (TokenVector){.allocator = &pp->scratch->allocator};
+            }
+            if(count > capacity)
+            {
+                preprocessError(pp, invocation, "macro '%.*s' expects %d arguments, more given",
+                                invocation->tokenStrLength, invocation->tokenStr, macro->paramCount);
+                return NULL;
+            }
+            arguments[count - 1] = current;
+            current = (TokenSlice){NULL, 0};
+            if(close) break;
+            count++;
+            continue;
+        }
+        if(copied.tokens)
+            tokenVectorPush(&copied, token);
+        else if(!current.length || current.tokens + current.length == token)
+        {
+            if(!current.length) current.tokens = token;
+            current.length++;
+        }
+        else
+        {
+            for(int i = 0; i < current.length; i++)
+                tokenVectorPush(&copied, &current.tokens[i]);
+            tokenVectorPush(&copied, token);
+        }
+    }
+
+    if(macro->paramCount == 0 && count == 1 && !arguments[0].length)
+        count = 0;
+    if(macro->variadic && count == macro->paramCount - 1)
+        arguments[count++] = (TokenSlice){NULL, 0};
+    if(count != macro->paramCount)
+    {
+        preprocessError(pp, invocation, "macro '%.*s' expects %d arguments, %d given", invocation->tokenStrLength,
+                        invocation->tokenStr, macro->paramCount, count);
+        return NULL;
+    }
+    return arguments;
+}
+
+static bool expandFrames(Preprocessor *pp, FrameStack *stack, TokenVector *output)
+{
+    pp->expansionDepth++;
+    Token *token;
+    while(!pp->failed && (token = frameNext(stack)))
+    {
+        Macro *macro = findMacro(pp, token);
+        //A macro name met inside its own expansion is never expanded
+        if(!macro || macro->active)
+        {
+            tokenVectorPush(output, token);
+            continue;
+        }
+        if(macro->plainBody)
+        {
+            if(macro->functionLike)
+            {
+                Token *open = framePeek(stack);
+                if(!open || !tokenIs(open, "("))
+                {
+                    tokenVectorPush(output, token);
+                    continue;
+                }
+                frameNext(stack);
+                if(!collectArguments(pp, stack, macro, token)) break;
+            }
+            framePushSlice(stack, macro->body, macro->bodyLength, macro);
+            continue;
+        }
+
+        TokenSlice *arguments = NULL;
+        if(macro->functionLike)
+        {
+            Token *open = framePeek(stack);
+            if(!open || !tokenIs(open, "("))
+            {
+                tokenVectorPush(output, token);
+                continue;
+            }
+            frameNext(stack);
+            arguments = collectArguments(pp, stack, macro, token);
+            if(!arguments) break;
+        }
+        int segmentCount;
+        TokenSlice *segments = buildSegments(pp, macro, token, arguments, &segmentCount);
+        if(!segments) break;
+        framePush(stack, segments, segmentCount, (TokenSlice){NULL, 0}, macro);
+    }
+    //After an error the macros of the abandoned expansions must not stay disabled
+    for(int i = 0; i < stack->length; i++)
+    {
+        if(stack->frames[i].macro) stack->frames[i].macro->active = false;
+    }
+    stack->length = 0;
+    if(--pp->expansionDepth == 0)
+        regionReset(pp->scratch);
+    return !pp->failed;
+}
+
+typedef struct
+{
+    Preprocessor *pp;
+    Token *tokens;
+    int length;
+    int index;
+    //Cleared in the operand that && and || do not evaluate
+    bool evaluating;
+} ConditionParser;
+
+static long long parseConditionalExpression(ConditionParser *parser);
+
+static Token *conditionPeek(ConditionParser *parser)
+{
+    return parser->index < parser->length ? &parser->tokens[parser->index] : NULL;
+}
+
+static long long parseConditionPrimary(ConditionParser *parser)
+{
+    Token *token = conditionPeek(parser);
+    if(!token)
+    {
+        preprocessError(parser->pp, parser->length ? &parser->tokens[parser->length - 1] : NULL,
+                        "expected a value in preprocessor expression");
+        return 0;
+    }
+    parser->index++;
+    if(tokenIs(token, "("))
+    {
+        long long value = parseConditionalExpression(parser);
+        Token *close = conditionPeek(parser);
+        if(!close || !tokenIs(close, ")"))
+        {
+            preprocessError(parser->pp, token, "expected ')' in preprocessor expression");
+            return 0;
+        }
+        parser->index++;
+        return value;
+    }
+    if(tokenIs(token, "!")) return !parseConditionPrimary(parser);
+    if(tokenIs(token, "-")) return -parseConditionPrimary(parser);
+    if(tokenIs(token, "+")) return parseConditionPrimary(parser);
+    if(tokenIs(token, "~")) return ~parseConditionPrimary(parser);
+    if(token->tokenType == TT_INT_LITERAL)
+    {
+        char digits[64];
+        int length = token->tokenStrLength < 63 ? token->tokenStrLength : 63;
+        memcpy(digits, token->tokenStr, length);
+        digits[length] = 0;
+        return (long long)strtoull(digits, NULL, 0);
+    }
+    if(token->tokenType == TT_CHAR_LITERAL && token->tokenStrLength >= 3)
+        return token->tokenStr[1] == '\\' ? token->tokenStr[2] == 'n' ? '\n' : token->tokenStr[2] == '0' ? 0 :
+                                                                                    token->tokenStr[2]
+                                          : token->tokenStr[1];
+    //Identifiers left after macro expansion evaluate to 0
+    if(isWord(token)) return 0;
+    preprocessError(parser->pp, token, "unexpected '%.*s' in preprocessor expression", token->tokenStrLength,
+                    token->tokenStr);
+    return 0;
+}
+
+static int binaryPrecedence(Token *token)
+{
+    static const struct
+    {
+        const char *op;
+        int precedence;
+    } operators[] = {
+            {"*", 10}, {"/", 10}, {"%", 10}, {"+", 9}, {"-", 9}, {"<<", 8}, {">>", 8}, {"<", 7}, {">", 7},
+            {"<=", 7}, {">=", 7}, {"==", 6}, {"!=", 6}, {"&", 5}, {"^", 4}, {"|", 3}, {"&&", 2}, {"||", 1},
+    };
+    if(!token || token->tokenType != TT_PUNCTUATOR) return 0;
+    for(size_t i = 0; i < sizeof(operators) / sizeof(operators[0]); i++)
+    {
+        if(tokenIs(token, operators[i].op)) return operators[i].precedence;
+    }
+    return 0;
+}
+
+static long long parseConditionBinary(ConditionParser *parser, int minimumPrecedence)
+{
+    long long left = parseConditionPrimary(parser);
+    while(!parser->pp->failed)
+    {
+        Token *op = conditionPeek(parser);
+        int precedence = binaryPrecedence(op);
+        if(!precedence || precedence < minimumPrecedence) break;
+        parser->index++;
+        bool evaluating = parser->evaluating;
+        if((tokenIs(op, "&&") && !left) || (tokenIs(op, "||") && left))
+            parser->evaluating = false;
+        long long right = parseConditionBinary(parser, precedence + 1);
+        parser->evaluating = evaluating;
+        if(tokenIs(op, "*")) left *= right;
+        else if(tokenIs(op, "/") || tokenIs(op, "%"))
+        {
+            if(!right)
+            {
+                if(parser->evaluating) preprocessError(parser->pp, op, "division by zero in preprocessor expression");
+                left = 0;
+            }
+            else
+                left = tokenIs(op, "/") ? left / right : left % right;
+        }
+        else if(tokenIs(op, "+")) left += right;
+        else if(tokenIs(op, "-")) left -= right;
+        else if(tokenIs(op, "<<")) left = (long long)((unsigned long long)left << (right & 63));
+        else if(tokenIs(op, ">>")) left >>= (right & 63);
+        else if(tokenIs(op, "<")) left = left < right;
+        else if(tokenIs(op, ">")) left = left > right;
+        else if(tokenIs(op, "<=")) left = left <= right;
+        else if(tokenIs(op, ">=")) left = left >= right;
+        else if(tokenIs(op, "==")) left = left == right;
+        else if(tokenIs(op, "!=")) left = left != right;
+        else if(tokenIs(op, "&")) left &= right;
+        else if(tokenIs(op, "^")) left ^= right;
+        else if(tokenIs(op, "|")) left |= right;
+        else if(tokenIs(op, "&&")) left = left && right;
+        else left = left || right;
+    }
+    return left;
+}
+
+static long long parseConditionalExpression(ConditionParser *parser)
+{
+    long long condition = parseConditionBinary(parser, 1);
+    Token *question = conditionPeek(parser);
+    if(!question || !tokenIs(question, "?")) return condition;
+    parser->index++;
+    long long whenTrue = parseConditionalExpression(parser);
+    Token *colon = conditionPeek(parser);
+    if(!colon || !tokenIs(colon, ":"))
+    {
+        preprocessError(parser->pp, question, "expected ':' in preprocessor expression");
+        return 0;
+    }
+    parser->index++;
+    long long whenFalse = parseConditionalExpression(parser);
+    return condition ? whenTrue : whenFalse;
+}
+
+static bool evaluateCondition(Preprocessor *pp, Token *directive, Token *line, int count, bool *value)
+{
+    static char one[] = "1";
+    static char zero[] = "0";
+    //defined is resolved before macro expansion so its operand is not expanded
+    TokenVector replaced = {0};
+    for(int i = 0; i < count; i++)
+    {
+        if(!tokenIs(&line[i], "defined"))
+        {
+            tokenVectorPush(&replaced, &line[i]);
+            continue;
+        }
+        bool parenthesized = i + 1 < count && tokenIs(&line[i + 1], "(");
+        int nameIndex = i + (parenthesized ? 2 : 1);
+        if(nameIndex >= count || !isWord(&line[nameIndex]) ||
+           (parenthesized && (nameIndex + 1 >= count || !tokenIs(&line[nameIndex + 1], ")"))))
+        {
+            preprocessError(pp, &line[i], "'defined' expects a macro name");
+            free(replaced.tokens);
+            return false;
+        }
+        Token literal = line[i];
+        literal.tokenType = TT_INT_LITERAL;
+        literal.tokenStr = findMacro(pp, &line[nameIndex]) ? one : zero;
+        literal.tokenStrLength = 1;
+        tokenVectorPush(&replaced, &literal);
+        i = nameIndex + (parenthesized ? 1 : 0);
+    }
+
+    TokenVector expanded = {0};
+    FrameStack stack = {0};
+    framePushSlice(&stack, replaced.tokens, replaced.length, NULL);
+    bool result = expandFrames(pp, &stack, &expanded);
+    free(stack.frames);
+    free(replaced.tokens);
+    if(result)
+    {
+        ConditionParser parser = {pp, expanded.tokens, expanded.length, 0, true};
+        if(!expanded.length)
+            preprocessError(pp, directive, "#%.*s with no expression", directive->tokenStrLength, directive->tokenStr);
+        else
+        {
+            *value = parseConditionalExpression(&parser) != 0;
+            if(!pp->failed && parser.index != parser.length)
+                preprocessError(pp, &expanded.tokens[parser.index], "unexpected '%.*s' in preprocessor expression",
+                                expanded.tokens[parser.index].tokenStrLength, expanded.tokens[parser.index].tokenStr);
+        }
+        result = !pp->failed;
+    }
+    free(expanded.tokens);
+    return result;
+}
+
+static bool isSkipping(Preprocessor *pp)
+{
+    return pp->conditionalCount && !pp->conditionals[pp->conditionalCount - 1].active;
+}
+
+static void pushConditional(Preprocessor *pp, bool parentActive, bool value)
+{
+    if(pp->conditionalCount == pp->conditionalCapacity)
+    {
+        pp->conditionalCapacity = pp->conditionalCapacity ? pp->conditionalCapacity * 2 : 16;
+        pp->conditionals = countedRealloc(pp->conditionals, sizeof(Conditional) * pp->conditionalCapacity);
+    }
+    pp->conditionals[pp->conditionalCount++] = (Conditional){parentActive && value, value, parentActive, false};
+}
+
+static SourceFile *resolveInclude(Preprocessor *pp, SourceFile *from, const char *name, int nameLength, bool quoted)
+{
+    const char *directory = quoted ? from->directory : "";
+    int directoryLength = (int)strlen(directory);
+    int keyLength = directoryLength + 1 + nameLength;
+    char *key = countedMalloc(keyLength + 1);
+    memcpy(key, directory, directoryLength);
+    key[directoryLength] = '\n';
+    memcpy(key + directoryLength + 1, name, nameLength);
+    key[keyLength] = 0;
+
+    unsigned int mask = pp->resolvedCapacity - 1;
+    unsigned int slot = hashBytes(key, keyLength) & mask;
+    while(pp->resolved[slot].key && strcmp(pp->resolved[slot].key, key))
+        slot = (slot + 1) & mask;
+    if(pp->resolved[slot].key)
+    {
+        free(key);
+        return pp->resolved[slot].file;
+    }
+
+    SourceFile *file = NULL;
+    int pathCapacity = nameLength + 2 + directoryLength;
+    for(int i = 0; i < pp->options->includePathCount; i++)
+    {
+        int length = (int)strlen(pp->options->includePaths[i]) + nameLength + 2;
+        if(length > pathCapacity) pathCapacity = length;
+    }
+    char *path = countedMalloc(pathCapacity);
+    if(name[0] == '/')
+    {
+        snprintf(path, pathCapacity, "%.*s", nameLength, name);
+        file = headerCacheLoad(pp->headers, path, pp->log);
+    }
+    if(!file && name[0] != '/' && quoted)
+    {
+        snprintf(path, pathCapacity, "%s/%.*s", from->directory, nameLength, name);
+        file = headerCacheLoad(pp->headers, path, pp->log);
+    }
+    for(int i = 0; !file && name[0] != '/' && i < pp->options->includePathCount; i++)
+    {
+        snprintf(path, pathCapacity, "%s/%.*s", pp->options->includePaths[i], nameLength, name);
+        file = headerCacheLoad(pp->headers, path, pp->log);
+    }
+    free(path);
+    if(!file)
+    {
+        free(key);
+        return NULL;
+    }
+
+    if((pp->resolvedCount + 1) * 2 > pp->resolvedCapacity)
+    {
+        unsigned int capacity = pp->resolvedCapacity * 2;
+        ResolvedInclude *resolved = countedCalloc(capacity, sizeof(ResolvedInclude));
+        for(unsigned int i = 0; i < pp->resolvedCapacity; i++)
+        {
+            if(!pp->resolved[i].key) continue;
+            unsigned int s = hashBytes(pp->resolved[i].key, (int)strlen(pp->resolved[i].key)) & (capacity - 1);
+            while(resolved[s].key) s = (s + 1) & (capacity - 1);
+            resolved[s] = pp->resolved[i];
+        }
+        free(pp->resolved);
+        pp->resolved = resolved;
+        pp->resolvedCapacity = capacity;
+        mask = capacity - 1;
+        slot = hashBytes(key, keyLength) & mask;
+        while(pp->resolved[slot].key) slot = (slot + 1) & mask;
+    }
+    pp->resolved[slot].key = key;
+    pp->resolved[slot].file = file;
+    pp->resolvedCount++;
+    return file;
+}
+
+static bool preprocessSource(Preprocessor *pp, SourceFile *file, TokenVector *output);
+
+static bool includeFile(Preprocessor *pp, SourceFile *from, Token *line, int count, TokenVector *output)
+{
+    const char *name = NULL;
+    int nameLength = 0;
+    bool quoted = false;
+    if(count >= 1 && line[0].tokenType == TT_STRING_LITERAL && line[0].tokenStrLength >= 2)
+    {
+        name = line[0].tokenStr + 1;
+        nameLength = line[0].tokenStrLength - 2;
+        quoted = true;
+    }
+    else if(count >= 2 && tokenIs(&line[0], "<"))
+    {
+        //The header name is the raw text between the brackets
+        for(int i = 1; i < count; i++)
+        {
+            if(!tokenIs(&line[i], ">")) continue;
+            name = line[0].tokenStr + 1;
+            nameLength = (int)(line[i].tokenStr - name);
+            break;
+        }
+    }
+    if(!name || nameLength <= 0)
+    {
+        preprocessError(pp, count ? &line[0] : NULL, "#include expects \"FILENAME\" or <FILENAME>");
+        return false;
+    }
+
+    SourceFile *header = resolveInclude(pp, from, name, nameLength, quoted);
+    if(!header)
+    {
+        preprocessError(pp, &line[0], "cannot find include file '%.*s'", nameLength, name);
+        return false;
+    }
+    if(header->tokenizeFailed)
+    {
+        preprocessError(pp, &line[0], "include file '%.*s' could not be tokenized", nameLength, name);
+        return false;
+    }
+    if(pointerSetInsert(&pp->includedSet, header))
+    {
+        if(pp->includedCount == pp->includedCapacity)
+        {
+            pp->includedCapacity = pp->includedCapacity ? pp->includedCapacity * 2 : 16;
+            pp->included = countedRealloc(pp->included, sizeof(SourceFile*) * pp->includedCapacity);
+        }
+        pp->included[pp->includedCount++] = header;
+    }
+    //Repeated includes of guarded headers end here, at the cost of a hash lookup
+    if(pointerSetContains(&pp->onceFiles, header)) return true;
+    if(header->guardMacro && findMacro(pp, header->guardMacro)) return true;
+    if(pp->depth >= PREPROCESS_MAX_INCLUDE_DEPTH)
+    {
+        preprocessError(pp, &line[0], "#include nested too deeply");
+        return false;
+    }
+    return preprocessSource(pp, header, output);
+}
+
+static bool handleDirective(Preprocessor *pp, SourceFile *file, Token *line, int count, int conditionalBase,
+                            TokenVector *output)
+{
+    if(!count) return true;
+    Token *directive = &line[0];
+    Token *rest = line + 1;
+    int restCount = count - 1;
+    bool skipping = isSkipping(pp);
+
+    if(isConditionalStart(directive))
+    {
+        bool value = false;
+        if(!skipping)
+        {
+            if(tokenIs(directive, "if"))
+            {
+                if(!evaluateCondition(pp, directive, rest, restCount, &value)) return false;
+            }
+            else
+            {
+                if(!restCount || !isWord(&rest[0]))
+                {
+                    preprocessError(pp, directive, "#%.*s expects a macro name", directive->tokenStrLength,
+                                    directive->tokenStr);
+                    return false;
+                }
+                value = (findMacro(pp, &rest[0]) != NULL) == tokenIs(directive, "ifdef");
+            }
+        }
+        pushConditional(pp, !skipping, value);
+        return true;
+    }
+    if(tokenIs(directive, "elif") || tokenIs(directive, "else") || tokenIs(directive, "endif"))
+    {
+        if(pp->conditionalCount <= conditionalBase)
+        {
+            preprocessError(pp, directive, "#%.*s without #if", directive->tokenStrLength, directive->tokenStr);
+            return false;
+        }
+        Conditional *conditional = &pp->conditionals[pp->conditionalCount - 1];
+        if(tokenIs(directive, "endif"))
+        {
+            pp->conditionalCount--;
+            return true;
+        }
+        if(conditional->sawElse)
+        {
+            preprocessError(pp, directive, "#%.*s after #else", directive->tokenStrLength, directive->tokenStr);
+            return false;
+        }
+        if(tokenIs(directive, "else"))
+        {
+            conditional->sawElse = true;
+            conditional->active = conditional->parentActive && !conditional->taken;
+            conditional->taken = true;
+            return true;
+        }
+        conditional->active = false;
+        if(!conditional->parentActive || conditional->taken) return true;
+        bool value = false;
+        if(!evaluateCondition(pp, directive, rest, restCount, &value)) return false;
+        conditional->active = value;
+        conditional->taken = value;
+        return true;
+    }
+    if(skipping) return true;
+
+    if(tokenIs(directive, "include"))
+        return includeFile(pp, file, rest, restCount, output);
+    if(tokenIs(directive, "define"))
+        return defineMacro(pp, rest, restCount);
+    if(tokenIs(directive, "undef"))
+    {
+        if(!restCount || !isWord(&rest[0]))
+        {
+            preprocessError(pp, directive, "#undef expects a macro name");
+            return false;
+        }
+        Macro *macro = findMacro(pp, &rest[0]);
+        if(macro) macro->defined = false;
+        return true;
+    }
+    if(tokenIs(directive, "pragma"))
+    {
+        if(restCount && tokenIs(&rest[0], "once"))
+            pointerSetInsert(&pp->onceFiles, file);
+        return true;
+    }
+    if(tokenIs(directive, "error") || tokenIs(directive, "warning"))
+    {
+        const char *start = restCount ? rest[0].tokenStr : "";
+        const char *end = restCount ? rest[restCount - 1].tokenStr + rest[restCount - 1].tokenStrLength : start;
+        bool error = tokenIs(directive, "error");
+        SourceLocation location = sourceFileLocate(file, (int)(directive->tokenStr - file->buffer));
+        fprintf(pp->log, "%s:%d:%d: %s: %.*s\n", location.path, location.line, location.column,
+                error ? "error" : "warning", (int)(end - start), start);
+        if(error) pp->failed = true;
+        return !error;
+    }
+    if(tokenIs(directive, "line"))
+        return true;
+    preprocessError(pp, directive, "unknown directive #%.*s", directive->tokenStrLength, directive->tokenStr);
+    return false;
+}
+
+static bool preprocessSource(Preprocessor *pp, SourceFile *file, TokenVector *output)
+{
+    SourceFile *previous = pp->currentFile;
+    pp->currentFile = file;
+    pp->depth++;
+    int conditionalBase = pp->conditionalCount;
+    Token *tokens = file->tokens.tokens;
+    int count = file->tokens.length;
+    FrameStack frames = {0};
+
+    int i = 0;
+    while(i < count && !pp->failed)
+    {
+        if(isDirectiveStart(tokens, i))
+        {
+            int end = lineEnd(tokens, i, count);
+            handleDirective(pp, file, tokens + i + 1, end - i - 1, conditionalBase, output);
+            i = end;
+            continue;
+        }
+        int end = i + 1;
+        while(end < count && !isDirectiveStart(tokens, end))
+            end++;
+        if(!isSkipping(pp))
+        {
+            if(!pp->macroCount)
+            {
+                for(int k = i; k < end; k++)
+                    tokenVectorPush(output, &tokens[k]);
+            }
+            else
+            {
+                framePushSlice(&frames, tokens + i, end - i, NULL);
+                expandFrames(pp, &frames, output);
+            }
+        }
+        i = end;
+    }
+    if(!pp->failed && pp->conditionalCount != conditionalBase)
+        preprocessError(pp, count ? &tokens[count - 1] : NULL, "unterminated conditional directive");
+    pp->conditionalCount = conditionalBase;
+    pp->depth--;
+    pp->currentFile = previous;
+    free(frames.frames);
+    return !pp->failed;
+}
+
+Preprocessor *preprocessorCreate(HeaderCache *headers, PreprocessorOptions *options, Region *scratch, FILE *log)
+{
+    static PreprocessorOptions noOptions = {0};
+    Preprocessor *pp = countedCalloc(1, sizeof(Preprocessor));
+    pp->headers = headers;
+    pp->options = options ? options : &noOptions;
+    pp->scratch = scratch;
+    pp->log = log;
+    pp->macroCapacity = 64;
+    pp->macros = countedCalloc(pp->macroCapacity, sizeof(Macro*));
+    pp->resolvedCapacity = 16;
+    pp->resolved = countedCalloc(pp->resolvedCapacity, sizeof(ResolvedInclude));
+
+    if(pp->options->defineCount)
+        pp->ownedFiles = countedMalloc(sizeof(SourceFile*) * pp->options->defineCount);
+    for(int i = 0; i < pp->options->defineCount; i++)
+    {
+        //-D NAME=VALUE is #define NAME VALUE, a bare -D NAME defines it as 1
+        const char *define = pp->options->defines[i];
+        const char *equals = strchr(define, '=');
+        int nameLength = equals ? (int)(equals - define) : (int)strlen(define);
+        const char *value = equals ? equals + 1 : "1";
+        int length = nameLength + (int)strlen(value) + 10;
+        char *buffer = countedMalloc(length + 1);
+        length = snprintf(buffer, length + 1, "#define %.*s %s\n", nameLength, define, value);
+        SourceFile *file = sourceFileCreate("<command line>", buffer, length, pp->log);
+        pp->ownedFiles[pp->ownedFileCount++] = file;
+        TokenVector unused = {0};
+        preprocessSource(pp, file, &unused);
+        free(unused.tokens);
+    }
+    return pp;
+}
+
+void preprocessorDestroy(Preprocessor *pp)
+{
+    if(!pp) return;
+    for(unsigned int i = 0; i < pp->macroCapacity; i++)
+    {
+        if(!pp->macros[i]) continue;
+        free(pp->macros[i]->params);
+        free(pp->macros[i]);
+    }
+    free(pp->macros);
+    for(unsigned int i = 0; i < pp->resolvedCapacity; i++)
+        free(pp->resolved[i].key);
+    free(pp->resolved);
+    for(int i = 0; i < pp->stringCount; i++)
+        free(pp->strings[i].str);
+    free(pp->strings);
+    for(int i = 0; i < pp->ownedFileCount; i++)
+        sourceFileDestroy(pp->ownedFiles[i]);
+    free(pp->ownedFiles);
+    free(pp->onceFiles.items);
+    free(pp->includedSet.items);
+    free(pp->included);
+    free(pp->conditionals);
+    free(pp);
+}
+
+bool preprocessFile(Preprocessor *pp, SourceFile *file, TokenVector *output)
+{
+    pp->includedCount = 0;
+    pp->includedSet.count = 0;
+    if(pp->includedSet.items)
+        memset(pp->includedSet.items, 0, sizeof(void*) * pp->includedSet.capacity);
+    pp->failed = false;
+    pp->mainFile = file;
+    return preprocessSource(pp, file, output);
+}
+
+SourceFile **preprocessorIncludedFiles(Preprocessor *pp, int *count)
+{
+    *count = pp->includedCount;
+    return pp->included;
+}
+
+static bool spellingIn(const char *spelling, const char *start, size_t size)
+{
+    return (uintptr_t)spelling >= (uintptr_t)start && (uintptr_t)spelling < (uintptr_t)start + size;
+}
+
+static SourceFile *fileContaining(Preprocessor *pp, const char *spelling)
+{
+    //The end of the buffer counts too, for tokens at the very end of a file
+    if(pp->mainFile && spellingIn(spelling, pp->mainFile->buffer, (size_t)pp->mainFile->length + 1))
+        return pp->mainFile;
+    for(int i = 0; i < pp->includedCount; i++)
+    {
+        if(spellingIn(spelling, pp->included[i]->buffer, (size_t)pp->included[i]->length + 1))
+            return pp->included[i];
+    }
+    for(int i = 0; i < pp->ownedFileCount; i++)
+    {
+        if(spellingIn(spelling, pp->ownedFiles[i]->buffer, (size_t)pp->ownedFiles[i]->length + 1))
+            return pp->ownedFiles[i];
+    }
+    return NULL;
+}
+
+bool preprocessorLocate(Preprocessor *pp, const Token *token, SourceLocation *location)
+{
+    //Only runs for diagnostics, so plain searches are fast enough. Every origin was made before the string it
+    //stands for, which bounds the chain.
+    const char *spelling = token->tokenStr;
+    for(int hops = 0; hops <= pp->stringCount; hops++)
+    {
+        SourceFile *file = fileContaining(pp, spelling);
+        if(file)
+        {
+            *location = sourceFileLocate(file, (int)(spelling - file->buffer));
+            return true;
+        }
+        int kept = pp->stringCount - 1;
+        while(kept >= 0 && !spellingIn(spelling, pp->strings[kept].str, (size_t)pp->strings[kept].size))
+            kept--;
+        if(kept < 0) return false;
+        spelling = pp->strings[kept].origin.tokenStr;
+    }
+    return false;
+}
+
+void preprocessorReportV(Preprocessor *pp, FILE *log, const Token *token, const char *format, va_list args)
+{
+    SourceLocation location;
+    if(pp && token && preprocessorLocate(pp, token, &location))
+        fprintf(log, "%s:%d:%d: ", location.path, location.line, location.column);
+    vfprintf(log, format, args);
+    fputc('\n', log);
+}
+
+void preprocessorReport(Preprocessor *pp, FILE *log, const Token *token, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    preprocessorReportV(pp, log, token, format, args);
+    va_end(args);
+}
@@ -0,0 +1,90 @@
+#ifndef CCOMPILER_PREPROCESS_H
+#define CCOMPILER_PREPROCESS_H
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "tokenize.h"
+#include "alloc.h"
+
+#define PREPROCESS_MAX_INCLUDE_DEPTH 200
+
+//A source file and its raw token stream. Tokens point into buffer, which the file owns.
+typedef struct
+{
+    char *path;
+    //Directory searched first for quoted includes
+    char *directory;
+    char *buffer;
+    int length;
+    TokenVector tokens;
+    //The lexer stopped at a character that starts no token, tokens holds the ones before it
+    bool tokenizeFailed;
+    //Macro of an #ifndef/#define/#endif guard around the whole file, NULL if the file has none
+    Token *guardMacro;
+    //Set when buffer lies in a mapped precompiled header rather than in memory the file owns
+    void *mapping;
+    size_t mappingLength;
+    //Built by the first sourceFileLocate. Headers are shared between threads, so it is published atomically.
+    _Atomic(LineIndex*) lines;
+} SourceFile;
+
+typedef struct
+{
+    const char *path;
+    int line;
+    int column;
+} SourceLocation;
+
+//A character that starts no token is reported to log and sets tokenizeFailed
+extern SourceFile *sourceFileCreate(const char *path, char *buffer, int length, FILE *log);
+//Takes tokens lexed earlier instead of running the lexer. guardIndex is the index of the guard macro or -1.
+extern SourceFile *sourceFileCreateLexed(const char *path, char *buffer, int length, TokenVector tokens,
+                                         int guardIndex);
+extern void sourceFileDestroy(SourceFile *file);
+//Location of the byte at offset in the buffer of file
+extern SourceLocation sourceFileLocate(SourceFile *file, int offset);
+
+/*
+Headers read so far, keyed by their canonical path. Every header is read and tokenized once per process and shared
+by all preprocessors, which only ever read the cached files. Safe to use from several threads.
+*/
+typedef struct HeaderCache HeaderCache;
+
+//A revalidating cache checks the modification time and size of a header on every load and rereads it when either
+//changed, for processes that outlive edits to the headers
+extern HeaderCache *headerCacheCreate(bool revalidate);
+extern void headerCacheDestroy(HeaderCache *cache);
+//Returns NULL if the file cannot be read. Tokenizing errors go to log, only for the thread that reads the header.
+extern SourceFile *headerCacheLoad(HeaderCache *cache, const char *path, FILE *log);
+
+typedef struct
+{
+    const char **includePaths;
+    int includePathCount;
+    //NAME or NAME=VALUE, as given to -D
+    const char **defines;
+    int defineCount;
+} PreprocessorOptions;
+
+typedef struct Preprocessor Preprocessor;
+
+//Macro expansions take their temporary memory from scratch, which is reset after each one
+extern Preprocessor *preprocessorCreate(HeaderCache *headers, PreprocessorOptions *options, Region *scratch,
+                                        FILE *log);
+//Frees the macro table. Strings created by # and ## live until then, so output tokens must not outlive it.
+extern void preprocessorDestroy(Preprocessor *pp);
+//Appends the preprocessed tokens of file to output
+extern bool preprocessFile(Preprocessor *pp, SourceFile *file, TokenVector *output);
+//Every header the last preprocessFile read, in the order they were first included
+extern SourceFile **preprocessorIncludedFiles(Preprocessor *pp, int *count);
+//Where a token of the last preprocessFile came from. Tokens made by # and ## are placed where they were made.
+//False for tokens that lie in none of the files the preprocessor read.
+extern bool preprocessorLocate(Preprocessor *pp, const Token *token, SourceLocation *location);
+//Writes a diagnostic line to log, prefixed with the file, line and column of token when pp can locate it. pp and
+//token may be NULL.
+extern void preprocessorReport(Preprocessor *pp, FILE *log, const Token *token, const char *format, ...);
+extern void preprocessorReportV(Preprocessor *pp, FILE *log, const Token *token, const char *format, va_list args);
+
+#endif //CCOMPILER_PREPROCESS_H
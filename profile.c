@@ -0,0 +1,124 @@
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+#include "alloc.h"
+
+ProfileFunction *profileAddFunction(ProfileData *profile, const char *name, int nameLength, uint32_t checksum,
+                                    int countCount)
+{
+    if(profile->functionCount == profile->capacity)
+    {
+        profile->capacity = profile->capacity * 2 + 8;
+        profile->functions = countedRealloc(profile->functions, sizeof(ProfileFunction) * profile->capacity);
+    }
+    ProfileFunction *function = &profile->functions[profile->functionCount++];
+    function->name = countedMalloc(nameLength + 1);
+    memcpy(function->name, name, nameLength);
+    function->name[nameLength] = 0;
+    function->checksum = checksum;
+    function->counts = countedCalloc(countCount ? countCount : 1, sizeof(unsigned long long));
+    function->countCount = countCount;
+    return function;
+}
+
+ProfileFunction *profileFind(ProfileData *profile, const char *name, int nameLength)
+{
+    for(int i = 0; i < profile->functionCount; i++)
+    {
+        ProfileFunction *function = &profile->functions[i];
+        if((int)strlen(function->name) == nameLength && !memcmp(function->name, name, nameLength))
+            return function;
+    }
+    return NULL;
+}
+
+bool profileRead(ProfileData *profile, const char *path, FILE *log)
+{
+    FILE *file = fopen(path, "r");
+    if(!file)
+    {
+        fprintf(log, "Failed to open profile '%s'\n", path);
+        return false;
+    }
+    char magic[16];
+    int version;
+    if(fscanf(file, "%15s %d", magic, &version) != 2 || strcmp(magic, PROFILE_MAGIC))
+    {
+        fprintf(log, "'%s' is not a profile\n", path);
+        fclose(file);
+        return false;
+    }
+    if(version != PROFILE_VERSION)
+    {
+        fprintf(log, "Unsupported profile version %d in '%s'\n", version, path);
+        fclose(file);
+        return false;
+    }
+    char name[PROFILE_NAME_MAX + 1];
+    unsigned int checksum;
+    int countCount;
+    int fields = 0;
+    bool result = true;
+    while(result && (fields = fscanf(file, " function %255s %x %d", name, &checksum, &countCount)) == 3)
+    {
+        if(countCount < 0) break;
+        ProfileFunction *function = profileAddFunction(profile, name, (int)strlen(name), checksum, countCount);
+        for(int i = 0; i < countCount && result; i++)
+            result = fscanf(file, "%llu", &function->counts[i]) == 1;
+    }
+    if(!result || fields != EOF)
+    {
+        fprintf(log, "Profile '%s' is malformed\n", path);
+        result = false;
+    }
+    fclose(file);
+    return result;
+}
+
+bool profileWrite(ProfileData *profile, FILE *file)
+{
+    fprintf(file, "%s %d\n", PROFILE_MAGIC, PROFILE_VERSION);
+    for(int i = 0; i < profile->functionCount; i++)
+    {
+        ProfileFunction *function = &profile->functions[i];
+        fprintf(file, "function %s %08x %d\n", function->name, function->checksum, function->countCount);
+        for(int c = 0; c < function->countCount; c++)
+            fprintf(file, c ? " %llu" : "%llu", function->counts[c]);
+        fputc('\n', file);
+    }
+    return !ferror(file);
+}
+
+void profileMerge(ProfileData *into, ProfileData *from)
+{
+    for(int i = 0; i < from->functionCount; i++)
+    {
+        ProfileFunction *source = &from->functions[i];
+        int nameLength = (int)strlen(source->name);
+        ProfileFunction *target = profileFind(into, source->name, nameLength);
+        if(target && (target->checksum != source->checksum || target->countCount != source->countCount))
+        {
+            free(target->counts);
+            target->counts = countedCalloc(source->countCount ? source->countCount : 1, sizeof(unsigned long long));
+            target->countCount = source->countCount;
+            target->checksum = source->checksum;
+        }
+        if(!target)
+            target = profileAddFunction(into, source->name, nameLength, source->checksum, source->countCount);
+        for(int c = 0; c < source->countCount; c++)
+            target->counts[c] += source->counts[c];
+    }
+}
+
+void profileFree(ProfileData *profile)
+{
+    for(int i = 0; i < profile->functionCount; i++)
+    {
+        free(profile->functions[i].name);
+        free(profile->functions[i].counts);
+    }
+    free(profile->functions);
+    profile->functions = NULL;
+    profile->functionCount = 0;
+    profile->capacity = 0;
+}
@@ -0,0 +1,50 @@
+#ifndef CCOMPILER_PROFILE_H
+#define CCOMPILER_PROFILE_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+How often each block of a program ran, collected from a build compiled with -fprofile-generate and fed back into
+the compiler with -fprofile-use. The instrumented program keeps a two word counter per block in data memory, low
+word first, after its static data. Its binary image says where each function's counters are, see
+BinaryProfileRange. Whatever ran it dumps them to a text file:
+    ccprofile 1
+    function <name> <checksum in hex> <block count>
+    <count of block 0> <count of block 1> ...
+Blocks are numbered as they were when the function was parsed, and the checksum of the function at that point, see
+irChecksum, tells when the source has changed since the profile was made.
+*/
+#define PROFILE_MAGIC "ccprofile"
+#define PROFILE_VERSION 1
+//Longest function name a profile can hold
+#define PROFILE_NAME_MAX 255
+
+typedef struct
+{
+    char *name;
+    uint32_t checksum;
+    unsigned long long *counts;
+    int countCount;
+} ProfileFunction;
+
+typedef struct
+{
+    ProfileFunction *functions;
+    int functionCount;
+    int capacity;
+} ProfileData;
+
+//Appends a function with countCount zero counts
+extern ProfileFunction *profileAddFunction(ProfileData *profile, const char *name, int nameLength, uint32_t checksum,
+                                           int countCount);
+extern ProfileFunction *profileFind(ProfileData *profile, const char *name, int nameLength);
+//Problems with the file are reported to log
+extern bool profileRead(ProfileData *profile, const char *path, FILE *log);
+extern bool profileWrite(ProfileData *profile, FILE *file);
+//Adds the counts of from to the functions of into with the same name and checksum. Functions that are new or have
+//changed replace what into had for them, so profiles of several runs of one build add up.
+extern void profileMerge(ProfileData *into, ProfileData *from);
+extern void profileFree(ProfileData *profile);
+
+#endif //CCOMPILER_PROFILE_H
@@ -0,0 +1,314 @@
+#include <stdlib.h>
+#include <string.h>
+#include "runtime.h"
+#include "alloc.h"
+
+#define RUNTIME_WIDTH_COUNT 3
+#define HELPER_SYMBOL(name) {(char*)(name), sizeof(name) - 1, TT_IDENTIFIER, false}
+
+//Indexed by operation and by width 1, 2 and 4. Calls are matched to the routines by the address of these tokens.
+static Token G_RUNTIME_HELPERS[RUNTIME_OPERATION_COUNT][RUNTIME_WIDTH_COUNT] = {
+        {HELPER_SYMBOL("__mul16"), HELPER_SYMBOL("__mul32"), HELPER_SYMBOL("__mul64")},
+        {HELPER_SYMBOL("__divu16"), HELPER_SYMBOL("__divu32"), HELPER_SYMBOL("__divu64")},
+        {HELPER_SYMBOL("__divs16"), HELPER_SYMBOL("__divs32"), HELPER_SYMBOL("__divs64")},
+        {HELPER_SYMBOL("__modu16"), HELPER_SYMBOL("__modu32"), HELPER_SYMBOL("__modu64")},
+        {HELPER_SYMBOL("__mods16"), HELPER_SYMBOL("__mods32"), HELPER_SYMBOL("__mods64")},
+};
+
+//Everything but r0, bp and sp. A routine keeps three operand sized groups of registers and a counter, the first
+//group being the result registers r1 upwards.
+static const int G_HELPER_REGISTERS[] = {1, 2, 3, 4, 6, 7, 9, 10, 11, 12, 13, 14, 15};
+
+static int widthIndex(int width)
+{
+    switch(width)
+    {
+        case 1: return 0;
+        case 2: return 1;
+        case 4: return 2;
+        default: return -1;
+    }
+}
+
+Token *runtimeHelperSymbol(RuntimeOperation operation, int width)
+{
+    int index = widthIndex(width);
+    return index < 0 ? NULL : &G_RUNTIME_HELPERS[operation][index];
+}
+
+typedef struct
+{
+    InstructionPtrList *instructions;
+    Allocator *allocator;
+    int width;
+    //Operand sized register groups and the loop counter
+    const int *result;
+    const int *first;
+    const int *second;
+    int counter;
+} HelperWriter;
+
+static void emitRegReg(HelperWriter *writer, enum InstructionType type, int dstReg, int srcReg)
+{
+    struct InstructionRegReg *instruction = allocatorAllocate(writer->allocator, sizeof(struct InstructionRegReg));
+    instruction->instruction.type = type;
+    instruction->srcReg = srcReg;
+    instruction->dstReg = dstReg;
+    listPushInstructionPtrList(writer->instructions, (Instruction*)instruction);
+}
+
+static void emitImm(HelperWriter *writer, enum InstructionType type, long long iValue)
+{
+    struct InstructionImm *instruction = allocatorAllocate(writer->allocator, sizeof(struct InstructionImm));
+    instruction->instruction.type = type;
+    instruction->iValue = iValue;
+    listPushInstructionPtrList(writer->instructions, (Instruction*)instruction);
+}
+
+static void emitLabel(HelperWriter *writer, enum InstructionType type, int srcReg, int labelId, Token *symbol)
+{
+    LabelInstruction *instruction = allocatorAllocate(writer->allocator, sizeof(LabelInstruction));
+    instruction->instruction.type = type;
+    instruction->srcReg = srcReg;
+    instruction->labelId = labelId;
+    instruction->symbol = symbol;
+    listPushInstructionPtrList(writer->instructions, (Instruction*)instruction);
+}
+
+static void emitRet(HelperWriter *writer)
+{
+    Instruction *ret = allocatorAllocate(writer->allocator, sizeof(Instruction));
+    ret->type = IT_RET;
+    listPushInstructionPtrList(writer->instructions, ret);
+}
+
+//Loads both arguments, which sit above the return address with the first one lowest
+static void loadArguments(HelperWriter *writer, const int *first, const int *second)
+{
+    emitRegReg(writer, IT_MOV, 0, ISA_SP_REGISTER);
+    for(int i = 0; i < writer->width * 2; i++)
+    {
+        emitImm(writer, IT_ADDI, 1);
+        emitRegReg(writer, IT_LDR, i < writer->width ? first[i] : second[i - writer->width], 0);
+    }
+}
+
+//dst op= src over all words, carrying from the low word up
+static void emitChain(HelperWriter *writer, enum InstructionType first, enum InstructionType carry, const int *dst,
+                      const int *src)
+{
+    for(int i = 0; i < writer->width; i++)
+        emitRegReg(writer, i ? carry : first, dst[i], src[i]);
+}
+
+static void emitNegate(HelperWriter *writer, const int *value)
+{
+    for(int i = 0; i < writer->width; i++)
+    {
+        emitImm(writer, IT_MOVI, 0);
+        emitRegReg(writer, i ? IT_SBC : IT_SUB, 0, value[i]);
+        emitRegReg(writer, IT_MOV, value[i], 0);
+    }
+}
+
+//Leaves the carry flag in r0
+static void emitCarryToR0(HelperWriter *writer)
+{
+    emitImm(writer, IT_MOVI, 0);
+    emitRegReg(writer, IT_ADC, 0, 0);
+}
+
+/*
+Shift and add. The multiplicand doubles and the multiplier halves every round, so the loop ends as soon as no set
+bit is left in the multiplier and small multipliers are cheap.
+*/
+static void emitMultiply(HelperWriter *writer, int *labelCount)
+{
+    const int *product = writer->result;
+    const int *multiplicand = writer->first;
+    const int *multiplier = writer->second;
+    int width = writer->width;
+    int loop = (*labelCount)++;
+    int next = (*labelCount)++;
+    int add = (*labelCount)++;
+
+    loadArguments(writer, multiplicand, multiplier);
+    emitImm(writer, IT_MOVI, 0);
+    for(int i = 0; i < width; i++)
+        emitRegReg(writer, IT_MOV, product[i], 0);
+    emitLabel(writer, IT_LABEL, 0, loop, NULL);
+    emitRegReg(writer, IT_MOV, 0, multiplier[0]);
+    emitRegReg(writer, IT_SHL, 0, 15);
+    emitLabel(writer, IT_BNZ, 0, add, NULL);
+    emitLabel(writer, IT_LABEL, 0, next, NULL);
+    emitChain(writer, IT_ADD, IT_ADC, multiplicand, multiplicand);
+    for(int i = 0; i < width; i++)
+    {
+        emitRegReg(writer, IT_SHR, multiplier[i], 1);
+        if(i + 1 == width) break;
+        emitRegReg(writer, IT_MOV, 0, multiplier[i + 1]);
+        emitRegReg(writer, IT_SHL, 0, 15);
+        emitRegReg(writer, IT_ADD, multiplier[i], 0);
+    }
+    for(int i = 0; i < width; i++)
+        emitLabel(writer, IT_BNZ, multiplier[i], loop, NULL);
+    emitRet(writer);
+    emitLabel(writer, IT_LABEL, 0, add, NULL);
+    emitChain(writer, IT_ADD, IT_ADC, product, multiplicand);
+    emitLabel(writer, IT_JMP, 0, next, NULL);
+}
+
+/*
+Restoring division, one quotient bit per round. The dividend shifts out of the quotient registers into the
+remainder while the quotient bits shift in behind it. A bit shifted out of the top of the remainder means it
+exceeds the divisor, so the subtraction stands whatever its borrow says.
+Signed routines divide the magnitudes and fix the signs afterwards: the quotient is negative if exactly one operand
+is, the remainder takes the sign of the dividend.
+*/
+static void emitDivide(HelperWriter *writer, bool isSigned, bool modulo, int *labelCount)
+{
+    const int *quotient = writer->result;
+    const int *remainder = writer->first;
+    const int *divisor = writer->second;
+    int counter = writer->counter;
+    int width = writer->width;
+    int loop = (*labelCount)++;
+    int fits = (*labelCount)++;
+    int restore = (*labelCount)++;
+    int next = (*labelCount)++;
+    int negateDividend = (*labelCount)++;
+    int dividendPositive = (*labelCount)++;
+    int negateDivisor = (*labelCount)++;
+    int divisorPositive = (*labelCount)++;
+    int negateResult = (*labelCount)++;
+
+    loadArguments(writer, quotient, divisor);
+    if(isSigned)
+    {
+        //The counter and the remainder are free until the loop starts
+        emitRegReg(writer, IT_MOV, counter, quotient[width - 1]);
+        emitRegReg(writer, IT_SHR, counter, 15);
+        emitRegReg(writer, IT_MOV, remainder[0], divisor[width - 1]);
+        emitRegReg(writer, IT_SHR, remainder[0], 15);
+        emitLabel(writer, IT_BNZ, counter, negateDividend, NULL);
+        emitLabel(writer, IT_LABEL, 0, dividendPositive, NULL);
+        emitLabel(writer, IT_BNZ, remainder[0], negateDivisor, NULL);
+        emitLabel(writer, IT_LABEL, 0, divisorPositive, NULL);
+        if(!modulo)
+        {
+            //1 + 1 shifted out of the word is 0, so this is non-zero exactly when the signs differ
+            emitRegReg(writer, IT_ADD, counter, remainder[0]);
+            emitRegReg(writer, IT_SHL, counter, 15);
+        }
+        emitRegReg(writer, IT_PUSH, 0, counter);
+    }
+    emitImm(writer, IT_MOVI, 0);
+    for(int i = 0; i < width; i++)
+        emitRegReg(writer, IT_MOV, remainder[i], 0);
+    emitImm(writer, IT_MOVI, width * 16);
+    emitRegReg(writer, IT_MOV, counter, 0);
+
+    emitLabel(writer, IT_LABEL, 0, loop, NULL);
+    emitChain(writer, IT_ADD, IT_ADC, quotient, quotient);
+    for(int i = 0; i < width; i++)
+        emitRegReg(writer, IT_ADC, remainder[i], remainder[i]);
+    emitCarryToR0(writer);
+    emitChain(writer, IT_SUB, IT_SBC, remainder, divisor);
+    emitLabel(writer, IT_BNZ, 0, fits, NULL);
+    emitCarryToR0(writer);
+    emitLabel(writer, IT_BNZ, 0, restore, NULL);
+    emitLabel(writer, IT_LABEL, 0, fits, NULL);
+    emitRegReg(writer, IT_MOV, 0, quotient[0]);
+    emitImm(writer, IT_ADDI, 1);
+    emitRegReg(writer, IT_MOV, quotient[0], 0);
+    emitLabel(writer, IT_JMP, 0, next, NULL);
+    emitLabel(writer, IT_LABEL, 0, restore, NULL);
+    emitChain(writer, IT_ADD, IT_ADC, remainder, divisor);
+    emitLabel(writer, IT_LABEL, 0, next, NULL);
+    emitRegReg(writer, IT_MOV, 0, counter);
+    emitImm(writer, IT_SUBI, 1);
+    emitRegReg(writer, IT_MOV, counter, 0);
+    emitLabel(writer, IT_BNZ, counter, loop, NULL);
+
+    if(modulo)
+    {
+        for(int i = 0; i < width; i++)
+            emitRegReg(writer, IT_MOV, quotient[i], remainder[i]);
+    }
+    if(!isSigned)
+    {
+        emitRet(writer);
+        return;
+    }
+    emitRegReg(writer, IT_POP, counter, 0);
+    emitLabel(writer, IT_BNZ, counter, negateResult, NULL);
+    emitRet(writer);
+    emitLabel(writer, IT_LABEL, 0, negateResult, NULL);
+    emitNegate(writer, quotient);
+    emitRet(writer);
+    emitLabel(writer, IT_LABEL, 0, negateDividend, NULL);
+    emitNegate(writer, quotient);
+    emitLabel(writer, IT_JMP, 0, dividendPositive, NULL);
+    emitLabel(writer, IT_LABEL, 0, negateDivisor, NULL);
+    emitNegate(writer, divisor);
+    emitLabel(writer, IT_JMP, 0, divisorPositive, NULL);
+}
+
+bool runtimeIsHelper(const Token *symbol)
+{
+    const Token *first = &G_RUNTIME_HELPERS[0][0];
+    return symbol >= first && symbol < first + RUNTIME_OPERATION_COUNT * RUNTIME_WIDTH_COUNT;
+}
+
+void runtimeAppendHelpers(InstructionPtrList *instructions, Allocator *allocator, int *labelCount)
+{
+    Token *first = &G_RUNTIME_HELPERS[0][0];
+    Token *end = first + RUNTIME_OPERATION_COUNT * RUNTIME_WIDTH_COUNT;
+    bool used[RUNTIME_OPERATION_COUNT * RUNTIME_WIDTH_COUNT] = {0};
+    bool any = false;
+    for(int i = 0; i < instructions->length; i++)
+    {
+        Instruction *instruction = instructions->data[i];
+        if(instruction->type != IT_CALL) continue;
+        Token *symbol = ((CallInstruction*)instruction)->symbol;
+        if(symbol < first || symbol >= end) continue;
+        used[symbol - first] = true;
+        any = true;
+    }
+    if(!any) return;
+
+    static const int widths[RUNTIME_WIDTH_COUNT] = {1, 2, 4};
+    for(int operation = 0; operation < RUNTIME_OPERATION_COUNT; operation++)
+    {
+        for(int w = 0; w < RUNTIME_WIDTH_COUNT; w++)
+        {
+            if(!used[operation * RUNTIME_WIDTH_COUNT + w]) continue;
+            int width = widths[w];
+            HelperWriter writer;
+            writer.instructions = instructions;
+            writer.allocator = allocator;
+            writer.width = width;
+            writer.result = G_HELPER_REGISTERS;
+            writer.first = G_HELPER_REGISTERS + width;
+            writer.second = G_HELPER_REGISTERS + width * 2;
+            writer.counter = G_HELPER_REGISTERS[width * 3];
+            emitLabel(&writer, IT_LABEL, 0, -1, &G_RUNTIME_HELPERS[operation][w]);
+            switch((RuntimeOperation)operation)
+            {
+                case RUNTIME_MULTIPLY:
+                    emitMultiply(&writer, labelCount);
+                    break;
+                case RUNTIME_DIVIDE_UNSIGNED:
+                case RUNTIME_DIVIDE_SIGNED:
+                case RUNTIME_MODULO_UNSIGNED:
+                case RUNTIME_MODULO_SIGNED:
+                    emitDivide(&writer, operation == RUNTIME_DIVIDE_SIGNED || operation == RUNTIME_MODULO_SIGNED,
+                               operation == RUNTIME_MODULO_UNSIGNED || operation == RUNTIME_MODULO_SIGNED,
+                               labelCount);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef CCOMPILER_RUNTIME_H
+#define CCOMPILER_RUNTIME_H
+#include "isa.h"
+
+/*
+Routines for the arithmetic the instruction set has no instructions for. They are called like any other function,
+take their operands as two arguments of the same width and return the result in r1 upwards. Only the routines a
+unit calls are appended to it, after its functions.
+*/
+
+typedef enum
+{
+    RUNTIME_MULTIPLY,
+    RUNTIME_DIVIDE_UNSIGNED,
+    RUNTIME_DIVIDE_SIGNED,
+    RUNTIME_MODULO_UNSIGNED,
+    RUNTIME_MODULO_SIGNED,
+    RUNTIME_OPERATION_COUNT
+} RuntimeOperation;
+
+//Callee of the routine for operands of width words, which is 1, 2 or 4. NULL for other widths.
+extern Token *runtimeHelperSymbol(RuntimeOperation operation, int width);
+//Whether symbol names one of the routines, which every unit that calls it carries a copy of
+extern bool runtimeIsHelper(const Token *symbol);
+//Appends the routines called from instructions, numbering their labels from *labelCount on
+extern void runtimeAppendHelpers(InstructionPtrList *instructions, Allocator *allocator, int *labelCount);
+
+#endif //CCOMPILER_RUNTIME_H
@@ -0,0 +1,250 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "server.h"
+#include "threadpool.h"
+#include "bytes.h"
+#include "alloc.h"
+
+typedef struct
+{
+    int listener;
+    ServerHandler handler;
+    void *context;
+    atomic_bool stopping;
+} Server;
+
+typedef struct
+{
+    Server *server;
+    int descriptor;
+} Connection;
+
+//Set by SIGINT and SIGTERM. The accept loop only unblocks them inside pselect, so one that arrives while it is busy
+//stays pending and interrupts the next wait instead of going unnoticed until a client connects.
+static volatile sig_atomic_t G_SERVER_SIGNALLED;
+
+static void onStopSignal(int number)
+{
+    (void)number;
+    G_SERVER_SIGNALLED = 1;
+}
+
+static char *readString(int descriptor)
+{
+    unsigned char header[4];
+    if(!serverReadFully(descriptor, header, 4)) return NULL;
+    uint32_t length = get32(header);
+    if(length > SERVER_MAX_STRING) return NULL;
+    char *str = countedMalloc(length + 1);
+    if(!serverReadFully(descriptor, str, length))
+    {
+        free(str);
+        return NULL;
+    }
+    str[length] = 0;
+    return str;
+}
+
+static void serveConnection(void *argument)
+{
+    Connection *connection = argument;
+    Server *server = connection->server;
+    int descriptor = connection->descriptor;
+    free(connection);
+
+    //The handler writes into memory so the client gets the whole log with its exit status
+    char *log = NULL;
+    size_t logLength = 0;
+    FILE *out = open_memstream(&log, &logLength);
+    int status = 1;
+    char *workingDirectory = NULL;
+    char **arguments = NULL;
+    uint32_t argumentCount = 0;
+    unsigned char header[16];
+    bool valid = out && serverReadFully(descriptor, header, sizeof(header)) && !memcmp(header, SERVER_REQUEST_MAGIC, 4);
+    if(valid && get32(header + 4) != SERVER_PROTOCOL_VERSION)
+    {
+        fprintf(out, "Compile server speaks protocol version %d, the client %u\n", SERVER_PROTOCOL_VERSION,
+                get32(header + 4));
+        valid = false;
+    }
+    else if(valid)
+    {
+        argumentCount = get32(header + 12);
+        valid = argumentCount <= SERVER_MAX_ARGUMENTS && (workingDirectory = readString(descriptor));
+        if(valid)
+        {
+            arguments = countedCalloc(argumentCount + 1, sizeof(char*));
+            for(uint32_t i = 0; i < argumentCount && valid; i++)
+                valid = (arguments[i] = readString(descriptor)) != NULL;
+        }
+        if(!valid && out)
+            fputs("Malformed compile server request.\n", out);
+    }
+    if(valid)
+    {
+        uint32_t kind = get32(header + 8);
+        if(kind == SERVER_REQUEST_COMPILE)
+            status = server->handler((int)argumentCount, arguments, workingDirectory, out, server->context);
+        else if(kind == SERVER_REQUEST_SHUTDOWN)
+        {
+            //Wakes the accept loop, requests already running finish first
+            atomic_store(&server->stopping, true);
+            shutdown(server->listener, SHUT_RDWR);
+            status = 0;
+        }
+        else
+            fprintf(out, "Unknown compile server request %u\n", kind);
+    }
+
+    unsigned char response[12];
+    memcpy(response, SERVER_RESPONSE_MAGIC, 4);
+    put32(response + 4, (uint32_t)status);
+    if(out)
+        fclose(out);
+    put32(response + 8, (uint32_t)logLength);
+    //A client that went away only loses its own response
+    if(serverWriteFully(descriptor, response, sizeof(response)))
+        serverWriteFully(descriptor, log, logLength);
+    close(descriptor);
+    free(log);
+    for(uint32_t i = 0; arguments && i < argumentCount; i++)
+        free(arguments[i]);
+    free(arguments);
+    free(workingDirectory);
+}
+
+static bool serverListening(struct sockaddr_un *address)
+{
+    int descriptor = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(descriptor < 0) return false;
+    bool listening = connect(descriptor, (struct sockaddr*)address, sizeof(*address)) == 0;
+    close(descriptor);
+    return listening;
+}
+
+bool serverRun(const char *socketPath, int workerCount, ServerHandler handler, void *context)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(strlen(socketPath) >= sizeof(address.sun_path))
+    {
+        printf("Socket path '%s' is too long\n", socketPath);
+        return false;
+    }
+    strcpy(address.sun_path, socketPath);
+    if(serverListening(&address))
+    {
+        printf("A compile server is already listening on '%s'\n", socketPath);
+        return false;
+    }
+    unlink(socketPath);
+
+    Server server;
+    server.handler = handler;
+    server.context = context;
+    atomic_init(&server.stopping, false);
+    server.listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(server.listener < 0)
+    {
+        printf("Failed to create socket: %s\n", strerror(errno));
+        return false;
+    }
+    //Only the user who started the server may connect to it
+    mode_t mask = umask(077);
+    bool bound = bind(server.listener, (struct sockaddr*)&address, sizeof(address)) == 0;
+    umask(mask);
+    //Non-blocking, so a connection that is gone again between pselect and accept cannot hang the loop
+    int listenerFlags = fcntl(server.listener, F_GETFL);
+    if(!bound || listen(server.listener, SOMAXCONN) != 0 || listenerFlags < 0 ||
+       fcntl(server.listener, F_SETFL, listenerFlags | O_NONBLOCK) != 0)
+    {
+        printf("Failed to listen on '%s': %s\n", socketPath, strerror(errno));
+        close(server.listener);
+        if(bound) unlink(socketPath);
+        return false;
+    }
+
+    //The stop signals stay blocked while the server runs. Workers inherit that, so they are always delivered to the
+    //accept loop, which takes them in pselect.
+    sigset_t stopSignals;
+    sigset_t previousMask;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, &previousMask);
+    ThreadPool *pool = threadPoolCreate(workerCount > 0 ? workerCount : threadPoolDefaultWorkerCount());
+    if(!pool)
+    {
+        pthread_sigmask(SIG_SETMASK, &previousMask, NULL);
+        puts("Failed to start the compile server workers.");
+        close(server.listener);
+        unlink(socketPath);
+        return false;
+    }
+    //No SA_RESTART, the signal has to interrupt pselect
+    struct sigaction action;
+    struct sigaction previousInterrupt;
+    struct sigaction previousTerminate;
+    struct sigaction previousPipe;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onStopSignal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, &previousInterrupt);
+    sigaction(SIGTERM, &action, &previousTerminate);
+    action.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &action, &previousPipe);
+    G_SERVER_SIGNALLED = 0;
+
+    while(!G_SERVER_SIGNALLED && !atomic_load(&server.stopping))
+    {
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(server.listener, &readable);
+        if(pselect(server.listener + 1, &readable, NULL, NULL, NULL, &previousMask) < 0)
+        {
+            if(errno == EINTR) continue;
+            printf("Failed to wait for a connection: %s\n", strerror(errno));
+            break;
+        }
+        int descriptor = accept(server.listener, NULL, NULL);
+        if(descriptor < 0)
+        {
+            if(errno == EINTR || errno == ECONNABORTED || errno == EAGAIN || errno == EWOULDBLOCK) continue;
+            //A shutdown request shuts the listener down, which fails accept
+            if(!atomic_load(&server.stopping))
+                printf("Failed to accept a connection: %s\n", strerror(errno));
+            break;
+        }
+        //Connections are served with blocking reads, whatever accept copied from the listener
+        int descriptorFlags = fcntl(descriptor, F_GETFL);
+        if(descriptorFlags >= 0)
+            fcntl(descriptor, F_SETFL, descriptorFlags & ~O_NONBLOCK);
+        Connection *connection = countedMalloc(sizeof(Connection));
+        connection->server = &server;
+        connection->descriptor = descriptor;
+        threadPoolSubmit(pool, serveConnection, connection);
+    }
+
+    threadPoolWait(pool);
+    threadPoolDestroy(pool);
+    close(server.listener);
+    unlink(socketPath);
+    pthread_sigmask(SIG_SETMASK, &previousMask, NULL);
+    sigaction(SIGINT, &previousInterrupt, NULL);
+    sigaction(SIGTERM, &previousTerminate, NULL);
+    sigaction(SIGPIPE, &previousPipe, NULL);
+    return true;
+}
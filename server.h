@@ -0,0 +1,78 @@
+#ifndef CCOMPILER_SERVER_H
+#define CCOMPILER_SERVER_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+
+/*
+Compile server protocol. A client connects to the Unix domain socket, sends one request, reads one response and
+closes the connection. Integers are 32 bit little endian, a string is its length followed by that many bytes.
+    Request:  "CCRQ" version kind argumentCount string workingDirectory string arguments[argumentCount]
+    Response: "CCRS" exitStatus logLength char log[logLength]
+The arguments are the command line of the compiler without the program name. Relative paths among them are
+relative to workingDirectory.
+*/
+#define SERVER_REQUEST_MAGIC "CCRQ"
+#define SERVER_RESPONSE_MAGIC "CCRS"
+#define SERVER_PROTOCOL_VERSION 1
+#define SERVER_MAX_ARGUMENTS 4096
+#define SERVER_MAX_STRING (64 * 1024)
+#define SERVER_SOCKET_PATH_MAX 108
+
+typedef enum
+{
+    SERVER_REQUEST_COMPILE = 1,
+    SERVER_REQUEST_SHUTDOWN = 2
+} ServerRequestKind;
+
+//Runs one compile request and returns its exit status. Everything meant for the client goes to out.
+typedef int (*ServerHandler)(int argumentCount, char **arguments, const char *workingDirectory, FILE *out,
+                             void *context);
+
+//Serves requests on workerCount threads until a shutdown request, SIGINT or SIGTERM arrives. A stale socket left
+//by a dead server is replaced, a live one is an error.
+extern bool serverRun(const char *socketPath, int workerCount, ServerHandler handler, void *context);
+
+//$CCOMPILER_SERVER, or a socket in /tmp private to the user. Shared with the client.
+static inline void serverDefaultSocketPath(char *path, size_t size)
+{
+    const char *configured = getenv("CCOMPILER_SERVER");
+    if(configured && *configured)
+        snprintf(path, size, "%s", configured);
+    else
+        snprintf(path, size, "/tmp/ccompiler-%ld.sock", (long)getuid());
+}
+
+//Reads or writes all length bytes, retrying after signals. False when the connection fails or closes first.
+static inline bool serverReadFully(int descriptor, void *data, size_t length)
+{
+    unsigned char *bytes = data;
+    while(length)
+    {
+        ssize_t count = read(descriptor, bytes, length);
+        if(count < 0 && errno == EINTR) continue;
+        if(count <= 0) return false;
+        bytes += count;
+        length -= (size_t)count;
+    }
+    return true;
+}
+
+static inline bool serverWriteFully(int descriptor, const void *data, size_t length)
+{
+    const unsigned char *bytes = data;
+    while(length)
+    {
+        ssize_t count = write(descriptor, bytes, length);
+        if(count < 0 && errno == EINTR) continue;
+        if(count <= 0) return false;
+        bytes += count;
+        length -= (size_t)count;
+    }
+    return true;
+}
+
+#endif //CCOMPILER_SERVER_H
@@ -0,0 +1,339 @@
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "emit.h"
+#include "bytes.h"
+
+void simConfigDefault(SimConfig *config)
+{
+    for(int i = 0; i < SIM_OPCODE_COUNT; i++)
+        config->cycleCost[i] = 1;
+    //Every data memory access costs an extra cycle, control transfers refill the fetch
+    config->cycleCost[IT_LDR] = 2;
+    config->cycleCost[IT_STR] = 2;
+    config->cycleCost[IT_PUSH] = 2;
+    config->cycleCost[IT_POP] = 2;
+    config->cycleCost[IT_JMP] = 2;
+    config->cycleCost[IT_BNZ] = 2;
+    config->cycleCost[IT_CALL] = 3;
+    config->cycleCost[IT_RET] = 3;
+    //Reads the table entry from the code before the jump
+    config->cycleCost[IT_JMPT] = 3;
+    config->maxInstructions = 1000000000ULL;
+}
+
+bool simConfigParseCosts(SimConfig *config, const char *costs)
+{
+    const char *cursor = costs;
+    while(*cursor)
+    {
+        const char *equals = strchr(cursor, '=');
+        if(!equals)
+        {
+            printf("Expected mnemonic=cycles in '%s'\n", cursor);
+            return false;
+        }
+        size_t nameLength = (size_t)(equals - cursor);
+        int opcode = -1;
+        for(int i = 0; i < SIM_OPCODE_COUNT; i++)
+        {
+            if(strlen(G_INSTRUCTION_MNEMONICS[i]) == nameLength && !strncmp(G_INSTRUCTION_MNEMONICS[i], cursor, nameLength))
+                opcode = i;
+        }
+        if(opcode < 0)
+        {
+            printf("Unknown mnemonic '%.*s'\n", (int)nameLength, cursor);
+            return false;
+        }
+        char *end;
+        unsigned long cycles = strtoul(equals + 1, &end, 10);
+        if(end == equals + 1 || (*end && *end != ','))
+        {
+            printf("Invalid cycle count for '%.*s'\n", (int)nameLength, cursor);
+            return false;
+        }
+        config->cycleCost[opcode] = (unsigned int)cycles;
+        cursor = *end ? end + 1 : end;
+    }
+    return true;
+}
+
+bool simLoad(Simulator *sim, const unsigned char *image, size_t imageSize, const char *entry, SimConfig *config)
+{
+    memset(sim, 0, sizeof(Simulator));
+    if(config)
+        sim->config = *config;
+    else
+        simConfigDefault(&sim->config);
+
+    if(imageSize < sizeof(BinaryHeader) || memcmp(image, BINARY_MAGIC, 4))
+    {
+        puts("Not a binary image.");
+        return false;
+    }
+    if(get32(image + 4) != BINARY_VERSION)
+    {
+        printf("Unsupported binary image version %u\n", get32(image + 4));
+        return false;
+    }
+    uint32_t codeOffset = get32(image + 8);
+    uint32_t codeWords = get32(image + 12);
+    uint32_t symbolOffset = get32(image + 16);
+    uint32_t symbolCount = get32(image + 20);
+    uint32_t stringOffset = get32(image + 24);
+    uint32_t stringBytes = get32(image + 28);
+    uint32_t profileRangeOffset = get32(image + 32);
+    uint32_t profileRangeCount = get32(image + 36);
+    uint32_t dataOffset = get32(image + 40);
+    uint32_t dataAddress = get32(image + 44);
+    uint32_t dataWords = get32(image + 48);
+    if(!sectionFits(imageSize, codeOffset, (uint64_t)codeWords * 2) ||
+       !sectionFits(imageSize, symbolOffset, (uint64_t)symbolCount * sizeof(BinarySymbol)) ||
+       !sectionFits(imageSize, profileRangeOffset, (uint64_t)profileRangeCount * sizeof(BinaryProfileRange)) ||
+       !sectionFits(imageSize, stringOffset, stringBytes) ||
+       !sectionFits(imageSize, dataOffset, (uint64_t)dataWords * 2) ||
+       (uint64_t)dataAddress + dataWords > SIM_MEMORY_WORDS || codeWords >= SIM_EXIT_ADDRESS)
+    {
+        puts("Binary image is truncated or corrupt.");
+        return false;
+    }
+
+    bool found = false;
+    size_t entryLength = strlen(entry);
+    for(uint32_t i = 0; i < symbolCount; i++)
+    {
+        const unsigned char *symbol = image + symbolOffset + i * sizeof(BinarySymbol);
+        uint32_t nameOffset = get32(symbol);
+        uint32_t nameLength = get32(symbol + 4);
+        if(nameLength != entryLength || (uint64_t)nameOffset + nameLength > stringBytes) continue;
+        if(memcmp(image + stringOffset + nameOffset, entry, entryLength)) continue;
+        sim->entry = get32(symbol + 8);
+        found = true;
+        break;
+    }
+    if(!found)
+    {
+        printf("Entry point '%s' not found\n", entry);
+        return false;
+    }
+
+    sim->codeWords = codeWords;
+    sim->code = malloc(sizeof(uint16_t) * (codeWords + 1));
+    for(uint32_t i = 0; i < codeWords; i++)
+        sim->code[i] = (uint16_t)(image[codeOffset + i * 2] | image[codeOffset + i * 2 + 1] << 8);
+    sim->memory = calloc(SIM_MEMORY_WORDS, sizeof(uint16_t));
+    for(uint32_t i = 0; i < dataWords; i++)
+        sim->memory[dataAddress + i] = (uint16_t)(image[dataOffset + i * 2] | image[dataOffset + i * 2 + 1] << 8);
+
+    sim->profileRanges = calloc(profileRangeCount ? profileRangeCount : 1, sizeof(SimProfileRange));
+    for(uint32_t i = 0; i < profileRangeCount; i++)
+    {
+        const unsigned char *entry = image + profileRangeOffset + i * sizeof(BinaryProfileRange);
+        uint32_t nameOffset = get32(entry);
+        uint32_t nameLength = get32(entry + 4);
+        SimProfileRange *range = &sim->profileRanges[i];
+        range->checksum = get32(entry + 8);
+        range->counterAddress = get32(entry + 12);
+        range->counterCount = get32(entry + 16);
+        if((uint64_t)nameOffset + nameLength > stringBytes ||
+           (uint64_t)range->counterAddress + (uint64_t)range->counterCount * 2 > SIM_MEMORY_WORDS)
+        {
+            puts("Binary image has a corrupt profile range.");
+            return false;
+        }
+        range->name = malloc(nameLength + 1);
+        memcpy(range->name, image + stringOffset + nameOffset, nameLength);
+        range->name[nameLength] = 0;
+        sim->profileRangeCount = i + 1;
+    }
+    return true;
+}
+
+void simDispose(Simulator *sim)
+{
+    for(uint32_t i = 0; i < sim->profileRangeCount; i++)
+        free(sim->profileRanges[i].name);
+    free(sim->profileRanges);
+    free(sim->code);
+    free(sim->memory);
+    sim->profileRanges = NULL;
+    sim->profileRangeCount = 0;
+    sim->code = NULL;
+    sim->memory = NULL;
+}
+
+static uint16_t readMemory(Simulator *sim, uint16_t address)
+{
+    sim->stats.memoryReads++;
+    return sim->memory[address];
+}
+
+static void writeMemory(Simulator *sim, uint16_t address, uint16_t value)
+{
+    sim->stats.memoryWrites++;
+    sim->memory[address] = value;
+}
+
+//The stack grows down and sp addresses the last pushed word
+static void push(Simulator *sim, uint16_t value)
+{
+    sim->registers[ISA_SP_REGISTER]--;
+    writeMemory(sim, sim->registers[ISA_SP_REGISTER], value);
+}
+
+static uint16_t pop(Simulator *sim)
+{
+    uint16_t value = readMemory(sim, sim->registers[ISA_SP_REGISTER]);
+    sim->registers[ISA_SP_REGISTER]++;
+    return value;
+}
+
+bool simRun(Simulator *sim)
+{
+    uint16_t *r = sim->registers;
+    sim->pc = sim->entry;
+    //Stands in for the caller, so it is not counted
+    r[ISA_SP_REGISTER]--;
+    sim->memory[r[ISA_SP_REGISTER]] = SIM_EXIT_ADDRESS;
+
+    while(sim->pc != SIM_EXIT_ADDRESS)
+    {
+        if(sim->pc >= sim->codeWords)
+        {
+            printf("Program counter %u outside of the code section\n", sim->pc);
+            return false;
+        }
+        if(sim->config.maxInstructions && sim->stats.instructions >= sim->config.maxInstructions)
+        {
+            printf("Stopped after %llu instructions\n", sim->stats.instructions);
+            return false;
+        }
+
+        uint16_t word = sim->code[sim->pc];
+        int opcode = word >> 8;
+        int dst = (word >> 4) & 0xF;
+        int src = word & 0xF;
+        uint16_t immediate = word & 0xFF;
+        if(opcode >= SIM_OPCODE_COUNT)
+        {
+            printf("Invalid opcode %d at %u\n", opcode, sim->pc);
+            return false;
+        }
+        sim->stats.instructions++;
+        sim->stats.opcodeCounts[opcode]++;
+        sim->stats.cycles += sim->config.cycleCost[opcode];
+        sim->pc++;
+
+        switch((enum InstructionType)opcode)
+        {
+            case IT_ADD:
+            case IT_ADC:
+            {
+                uint32_t sum = (uint32_t)r[dst] + r[src] + (opcode == IT_ADC && sim->carry);
+                r[dst] = (uint16_t)sum;
+                sim->carry = sum > 0xFFFF;
+                break;
+            }
+            case IT_SUB:
+            case IT_SBC:
+            {
+                //The carry flag holds the borrow
+                uint32_t subtrahend = (uint32_t)r[src] + (opcode == IT_SBC && sim->carry);
+                sim->carry = r[dst] < subtrahend;
+                r[dst] = (uint16_t)(r[dst] - subtrahend);
+                break;
+            }
+            case IT_ADDI:
+                r[0] += immediate;
+                break;
+            case IT_SUBI:
+                r[0] -= immediate;
+                break;
+            case IT_MOV:
+                r[dst] = r[src];
+                break;
+            case IT_MOVI:
+                r[0] = immediate;
+                break;
+            case IT_LHI:
+                r[0] = (uint16_t)(immediate << 8);
+                break;
+            case IT_ORI:
+                r[0] |= immediate;
+                break;
+            case IT_PUSH:
+                push(sim, r[src]);
+                break;
+            case IT_POP:
+                r[dst] = pop(sim);
+                break;
+            case IT_LDR:
+                r[dst] = readMemory(sim, r[src]);
+                break;
+            case IT_STR:
+                writeMemory(sim, r[dst], r[src]);
+                break;
+            case IT_CALL:
+                push(sim, (uint16_t)(sim->pc + 1));
+                sim->pc = sim->code[sim->pc];
+                break;
+            case IT_RET:
+                sim->pc = pop(sim);
+                break;
+            case IT_JMP:
+                sim->pc = sim->code[sim->pc];
+                break;
+            case IT_BNZ:
+                sim->pc = r[src] ? sim->code[sim->pc] : sim->pc + 1;
+                break;
+            case IT_JMPT:
+            {
+                uint32_t entry = sim->pc + r[src];
+                if(entry >= sim->codeWords)
+                {
+                    printf("Jump table entry %u outside of the code section\n", entry);
+                    return false;
+                }
+                sim->pc = sim->code[entry];
+                break;
+            }
+            case IT_SHL:
+                r[dst] = (uint16_t)(r[dst] << src);
+                break;
+            case IT_SHR:
+                r[dst] = (uint16_t)(r[dst] >> src);
+                break;
+            case IT_SAR:
+                r[dst] = (uint16_t)((int16_t)r[dst] >> src);
+                break;
+            default:
+                printf("Invalid opcode %d at %u\n", opcode, sim->pc - 1);
+                return false;
+        }
+    }
+    return true;
+}
+
+void simPrintReport(Simulator *sim, FILE *file)
+{
+    SimStats *stats = &sim->stats;
+    fprintf(file, "result        r1=%d r2=%d r3=%d r4=%d\n",
+            (int16_t)sim->registers[1], (int16_t)sim->registers[2], (int16_t)sim->registers[3], (int16_t)sim->registers[4]);
+    fprintf(file, "instructions  %llu\n", stats->instructions);
+    fprintf(file, "cycles        %llu\n", stats->cycles);
+    fprintf(file, "memory reads  %llu\n", stats->memoryReads);
+    fprintf(file, "memory writes %llu\n", stats->memoryWrites);
+    fprintf(file, "\n%-8s %12s %6s %12s\n", "opcode", "count", "cost", "cycles");
+    for(int i = 0; i < SIM_OPCODE_COUNT; i++)
+    {
+        if(!stats->opcodeCounts[i]) continue;
+        fprintf(file, "%-8s %12llu %6u %12llu\n", G_INSTRUCTION_MNEMONICS[i], stats->opcodeCounts[i],
+                sim->config.cycleCost[i], stats->opcodeCounts[i] * sim->config.cycleCost[i]);
+    }
+}
+
+unsigned long long simProfileCount(Simulator *sim, SimProfileRange *range, uint32_t index)
+{
+    uint32_t address = range->counterAddress + index * 2;
+    return (unsigned long long)sim->memory[address + 1] << 16 | sim->memory[address];
+}
@@ -0,0 +1,69 @@
+#ifndef CCOMPILER_SIM_H
+#define CCOMPILER_SIM_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "isa.h"
+
+//Registers addressable by the 4 bit register fields
+#define SIM_REGISTER_COUNT 16
+//Data memory is a separate 64K word space, code lives in the image
+#define SIM_MEMORY_WORDS 0x10000
+//Return address pushed before entering the program, returning to it halts the machine
+#define SIM_EXIT_ADDRESS 0xFFFF
+#define SIM_OPCODE_COUNT IT_LABEL
+
+typedef struct
+{
+    //Cycles charged for each executed instruction, indexed by InstructionType
+    unsigned int cycleCost[SIM_OPCODE_COUNT];
+    //Execution stops with an error after this many instructions, 0 means no limit
+    unsigned long long maxInstructions;
+} SimConfig;
+
+typedef struct
+{
+    unsigned long long instructions;
+    unsigned long long cycles;
+    unsigned long long opcodeCounts[SIM_OPCODE_COUNT];
+    unsigned long long memoryReads;
+    unsigned long long memoryWrites;
+} SimStats;
+
+//Block counters of a function in a program built with -fprofile-generate, see profile.h
+typedef struct
+{
+    char *name;
+    uint32_t checksum;
+    uint32_t counterAddress;
+    uint32_t counterCount;
+} SimProfileRange;
+
+typedef struct
+{
+    uint16_t *code;
+    uint32_t codeWords;
+    uint32_t entry;
+    uint16_t registers[SIM_REGISTER_COUNT];
+    uint16_t *memory;
+    bool carry;
+    uint32_t pc;
+    SimConfig config;
+    SimStats stats;
+    SimProfileRange *profileRanges;
+    uint32_t profileRangeCount;
+} Simulator;
+
+extern void simConfigDefault(SimConfig *config);
+//Parses a comma separated list of mnemonic=cycles pairs, e.g. "ldr=3,str=3"
+extern bool simConfigParseCosts(SimConfig *config, const char *costs);
+//Loads a binary image as written by emitBinary and points the entry at the named function
+extern bool simLoad(Simulator *sim, const unsigned char *image, size_t imageSize, const char *entry, SimConfig *config);
+extern void simDispose(Simulator *sim);
+//Runs until the entry function returns. The return value is left in r1..r4.
+extern bool simRun(Simulator *sim);
+extern void simPrintReport(Simulator *sim, FILE *file);
+//Value of the two word block counter at index in range, as the program left it in data memory
+extern unsigned long long simProfileCount(Simulator *sim, SimProfileRange *range, uint32_t index);
+
+#endif //CCOMPILER_SIM_H
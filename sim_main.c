@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "profile.h"
+#include "bytes.h"
+
+//Adds the block counts the program left in memory to the profile at path, starting a new one if there is none
+static bool writeProfile(Simulator *sim, const char *path)
+{
+    ProfileData profile = {0};
+    FILE *existing = fopen(path, "r");
+    if(existing)
+    {
+        fclose(existing);
+        if(!profileRead(&profile, path, stdout))
+        {
+            profileFree(&profile);
+            return false;
+        }
+    }
+    ProfileData run = {0};
+    for(uint32_t i = 0; i < sim->profileRangeCount; i++)
+    {
+        SimProfileRange *range = &sim->profileRanges[i];
+        ProfileFunction *function = profileAddFunction(&run, range->name, (int)strlen(range->name), range->checksum,
+                                                       (int)range->counterCount);
+        for(uint32_t c = 0; c < range->counterCount; c++)
+            function->counts[c] = simProfileCount(sim, range, c);
+    }
+    profileMerge(&profile, &run);
+    profileFree(&run);
+    FILE *file = fopen(path, "w");
+    bool result = file && profileWrite(&profile, file);
+    if(file && fclose(file) != 0)
+        result = false;
+    if(!result)
+        printf("Failed to write profile '%s'\n", path);
+    profileFree(&profile);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    const char *imagePath = "a.out";
+    const char *entry = "main";
+    const char *profilePath = NULL;
+    SimConfig config;
+    simConfigDefault(&config);
+    for(int i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "-cost") && i + 1 < argc)
+        {
+            if(!simConfigParseCosts(&config, argv[++i])) return 1;
+        }
+        else if(!strcmp(argv[i], "-max-instructions") && i + 1 < argc)
+        {
+            config.maxInstructions = strtoull(argv[++i], NULL, 10);
+        }
+        else if(!strcmp(argv[i], "-entry") && i + 1 < argc)
+        {
+            entry = argv[++i];
+        }
+        else if(!strcmp(argv[i], "-profile") && i + 1 < argc)
+        {
+            profilePath = argv[++i];
+        }
+        else if(argv[i][0] == '-')
+        {
+            printf("Unknown option '%s'\n", argv[i]);
+            puts("Usage: ccsim [-cost mnemonic=cycles,...] [-max-instructions n] [-entry symbol] [-profile file] "
+                 "[image]");
+            return 1;
+        }
+        else
+        {
+            imagePath = argv[i];
+        }
+    }
+
+    size_t imageSize;
+    unsigned char *image = readFile(imagePath, &imageSize, stdout);
+    if(!image) return 1;
+
+    Simulator sim;
+    bool result = simLoad(&sim, image, imageSize, entry, &config);
+    free(image);
+    if(result)
+        result = simRun(&sim);
+    if(sim.code)
+        simPrintReport(&sim, stdout);
+    //Counts of a run that failed part way are left out rather than mixed into the profile
+    if(result && profilePath)
+    {
+        if(!sim.profileRangeCount)
+        {
+            printf("'%s' was not built with -fprofile-generate\n", imagePath);
+            result = false;
+        }
+        else
+            result = writeProfile(&sim, profilePath);
+    }
+    simDispose(&sim);
+    return result ? 0 : 1;
+}
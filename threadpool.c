@@ -0,0 +1,223 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "threadpool.h"
+
+typedef struct
+{
+    ThreadPoolTask task;
+    void *argument;
+} QueuedTask;
+
+//Ring buffer deque. The owner pushes and pops at the bottom, thieves take from the top.
+typedef struct
+{
+    pthread_mutex_t lock;
+    QueuedTask *tasks;
+    int capacity;
+    int top;
+    int count;
+} TaskDeque;
+
+typedef struct
+{
+    ThreadPool *pool;
+    int index;
+    pthread_t thread;
+    TaskDeque deque;
+} Worker;
+
+struct ThreadPool
+{
+    Worker *workers;
+    int workerCount;
+    int startedCount;
+    atomic_int nextWorker;
+    //Tasks sitting in a deque, changed under the lock of that deque. Idle workers sleep only when it is zero.
+    atomic_int queuedCount;
+    //Tasks submitted but not finished yet
+    atomic_int pendingCount;
+    atomic_bool shutdown;
+    pthread_mutex_t idleLock;
+    pthread_cond_t workAvailable;
+    pthread_cond_t allDone;
+};
+
+static void dequePushBottom(TaskDeque *deque, QueuedTask task, atomic_int *queuedCount)
+{
+    pthread_mutex_lock(&deque->lock);
+    if(deque->count == deque->capacity)
+    {
+        int capacity = deque->capacity * 2;
+        QueuedTask *tasks = malloc(sizeof(QueuedTask) * capacity);
+        for(int i = 0; i < deque->count; i++)
+            tasks[i] = deque->tasks[(deque->top + i) % deque->capacity];
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity = capacity;
+        deque->top = 0;
+    }
+    deque->tasks[(deque->top + deque->count) % deque->capacity] = task;
+    deque->count++;
+    atomic_fetch_add(queuedCount, 1);
+    pthread_mutex_unlock(&deque->lock);
+}
+
+static bool dequePopBottom(TaskDeque *deque, QueuedTask *task, atomic_int *queuedCount)
+{
+    pthread_mutex_lock(&deque->lock);
+    bool found = deque->count > 0;
+    if(found)
+    {
+        deque->count--;
+        *task = deque->tasks[(deque->top + deque->count) % deque->capacity];
+        atomic_fetch_sub(queuedCount, 1);
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+//Without wait, thieves skip a busy deque rather than queue up behind its owner
+static bool dequeStealTop(TaskDeque *deque, QueuedTask *task, atomic_int *queuedCount, bool wait)
+{
+    if(wait)
+        pthread_mutex_lock(&deque->lock);
+    else if(pthread_mutex_trylock(&deque->lock) != 0)
+        return false;
+    bool found = deque->count > 0;
+    if(found)
+    {
+        *task = deque->tasks[deque->top];
+        deque->top = (deque->top + 1) % deque->capacity;
+        deque->count--;
+        atomic_fetch_sub(queuedCount, 1);
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static bool findTask(Worker *worker, QueuedTask *task, bool wait)
+{
+    ThreadPool *pool = worker->pool;
+    if(dequePopBottom(&worker->deque, task, &pool->queuedCount)) return true;
+    for(int i = 1; i < pool->workerCount; i++)
+    {
+        Worker *victim = &pool->workers[(worker->index + i) % pool->workerCount];
+        if(dequeStealTop(&victim->deque, task, &pool->queuedCount, wait)) return true;
+    }
+    return false;
+}
+
+static void *workerMain(void *argument)
+{
+    Worker *worker = argument;
+    ThreadPool *pool = worker->pool;
+    while(true)
+    {
+        QueuedTask task;
+        //A round that skips busy deques, then one that waits for them, so a worker that found nothing to steal
+        //while tasks are queued does not spin on the locks of their owners
+        if(findTask(worker, &task, false) || findTask(worker, &task, true))
+        {
+            task.task(task.argument);
+            if(atomic_fetch_sub(&pool->pendingCount, 1) == 1)
+            {
+                pthread_mutex_lock(&pool->idleLock);
+                pthread_cond_broadcast(&pool->allDone);
+                pthread_mutex_unlock(&pool->idleLock);
+            }
+            continue;
+        }
+        //The count is still above zero only when a task was pushed to a deque after this worker looked at it
+        pthread_mutex_lock(&pool->idleLock);
+        while(atomic_load(&pool->queuedCount) == 0 && !atomic_load(&pool->shutdown))
+            pthread_cond_wait(&pool->workAvailable, &pool->idleLock);
+        pthread_mutex_unlock(&pool->idleLock);
+        if(atomic_load(&pool->shutdown) && atomic_load(&pool->queuedCount) == 0) return NULL;
+    }
+}
+
+ThreadPool *threadPoolCreate(int workerCount)
+{
+    if(workerCount < 1) workerCount = 1;
+    ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+    pool->workers = calloc(workerCount, sizeof(Worker));
+    pool->workerCount = workerCount;
+    atomic_init(&pool->nextWorker, 0);
+    atomic_init(&pool->queuedCount, 0);
+    atomic_init(&pool->pendingCount, 0);
+    atomic_init(&pool->shutdown, false);
+    pthread_mutex_init(&pool->idleLock, NULL);
+    pthread_cond_init(&pool->workAvailable, NULL);
+    pthread_cond_init(&pool->allDone, NULL);
+    for(int i = 0; i < workerCount; i++)
+    {
+        Worker *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        pthread_mutex_init(&worker->deque.lock, NULL);
+        worker->deque.capacity = 16;
+        worker->deque.tasks = malloc(sizeof(QueuedTask) * worker->deque.capacity);
+    }
+    for(int i = 0; i < workerCount; i++)
+    {
+        if(pthread_create(&pool->workers[i].thread, NULL, workerMain, &pool->workers[i]) != 0)
+        {
+            threadPoolDestroy(pool);
+            return NULL;
+        }
+        pool->startedCount++;
+    }
+    return pool;
+}
+
+void threadPoolSubmit(ThreadPool *pool, ThreadPoolTask task, void *argument)
+{
+    int index = atomic_fetch_add(&pool->nextWorker, 1) % pool->workerCount;
+    atomic_fetch_add(&pool->pendingCount, 1);
+    dequePushBottom(&pool->workers[index].deque, (QueuedTask){task, argument}, &pool->queuedCount);
+    //Signalled under the lock so a worker between its last check and pthread_cond_wait cannot miss it
+    pthread_mutex_lock(&pool->idleLock);
+    pthread_cond_signal(&pool->workAvailable);
+    pthread_mutex_unlock(&pool->idleLock);
+}
+
+void threadPoolWait(ThreadPool *pool)
+{
+    pthread_mutex_lock(&pool->idleLock);
+    while(atomic_load(&pool->pendingCount) > 0)
+        pthread_cond_wait(&pool->allDone, &pool->idleLock);
+    pthread_mutex_unlock(&pool->idleLock);
+}
+
+void threadPoolDestroy(ThreadPool *pool)
+{
+    if(!pool) return;
+    pthread_mutex_lock(&pool->idleLock);
+    atomic_store(&pool->shutdown, true);
+    pthread_cond_broadcast(&pool->workAvailable);
+    pthread_mutex_unlock(&pool->idleLock);
+    for(int i = 0; i < pool->startedCount; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+    for(int i = 0; i < pool->workerCount; i++)
+    {
+        pthread_mutex_destroy(&pool->workers[i].deque.lock);
+        free(pool->workers[i].deque.tasks);
+    }
+    pthread_cond_destroy(&pool->allDone);
+    pthread_cond_destroy(&pool->workAvailable);
+    pthread_mutex_destroy(&pool->idleLock);
+    free(pool->workers);
+    free(pool);
+}
+
+int threadPoolDefaultWorkerCount(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    if(count > 0) return (int)count;
+#endif
+    return 1;
+}
@@ -0,0 +1,22 @@
+#ifndef CCOMPILER_THREADPOOL_H
+#define CCOMPILER_THREADPOOL_H
+#include <stdbool.h>
+
+/*
+Fixed size pool of worker threads with one task deque per worker. A worker runs its own tasks newest first and, once
+its deque is empty, steals the oldest task of another worker.
+*/
+typedef void (*ThreadPoolTask)(void *argument);
+typedef struct ThreadPool ThreadPool;
+
+//Returns NULL if the workers could not be started
+extern ThreadPool *threadPoolCreate(int workerCount);
+//Queues the task on the workers in turn
+extern void threadPoolSubmit(ThreadPool *pool, ThreadPoolTask task, void *argument);
+//Blocks until every submitted task has finished
+extern void threadPoolWait(ThreadPool *pool);
+extern void threadPoolDestroy(ThreadPool *pool);
+//Number of online processors, at least 1
+extern int threadPoolDefaultWorkerCount(void);
+
+#endif //CCOMPILER_THREADPOOL_H
@@ -0,0 +1,138 @@
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "timereport.h"
+
+const char *G_PHASE_NAMES[] = {"read", "tokenize", "preprocess", "parse", "optimize", "codegen", "emit"};
+const char *G_PHASE_ITEM_UNITS[] = {"bytes", "tokens", "tokens", "ast nodes", "ir instructions", "instructions",
+                                    "bytes"};
+
+static double clockSeconds(clockid_t clock)
+{
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+void timeReportBegin(TimeReport *report, CompilePhase phase)
+{
+    if(!report) return;
+    report->current = phase;
+    report->allocationStart = G_ALLOCATION_COUNTERS;
+    report->cpuStart = clockSeconds(CLOCK_THREAD_CPUTIME_ID);
+    report->wallStart = clockSeconds(CLOCK_MONOTONIC);
+}
+
+void timeReportEnd(TimeReport *report, unsigned long long items)
+{
+    if(!report) return;
+    double wallEnd = clockSeconds(CLOCK_MONOTONIC);
+    double cpuEnd = clockSeconds(CLOCK_THREAD_CPUTIME_ID);
+    PhaseReport *phase = &report->phases[report->current];
+    phase->wallSeconds += wallEnd - report->wallStart;
+    phase->cpuSeconds += cpuEnd - report->cpuStart;
+    phase->allocations += G_ALLOCATION_COUNTERS.count - report->allocationStart.count;
+    phase->allocatedBytes += G_ALLOCATION_COUNTERS.bytes - report->allocationStart.bytes;
+    phase->items += items;
+}
+
+void timeReportMerge(TimeReport *report, const TimeReport *from)
+{
+    if(!report || !from) return;
+    for(int i = 0; i < PHASE_COUNT; i++)
+    {
+        report->phases[i].wallSeconds += from->phases[i].wallSeconds;
+        report->phases[i].cpuSeconds += from->phases[i].cpuSeconds;
+        report->phases[i].allocations += from->phases[i].allocations;
+        report->phases[i].allocatedBytes += from->phases[i].allocatedBytes;
+        report->phases[i].items += from->phases[i].items;
+    }
+}
+
+long timeReportPeakRss(void)
+{
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    //Linux reports kilobytes
+    return usage.ru_maxrss;
+}
+
+static PhaseReport totalOf(TimeReport *report)
+{
+    PhaseReport total = {0};
+    for(int i = 0; i < PHASE_COUNT; i++)
+    {
+        total.wallSeconds += report->phases[i].wallSeconds;
+        total.cpuSeconds += report->phases[i].cpuSeconds;
+        total.allocations += report->phases[i].allocations;
+        total.allocatedBytes += report->phases[i].allocatedBytes;
+    }
+    return total;
+}
+
+void timeReportPrint(TimeReport *report, const char *unit, FILE *file)
+{
+    PhaseReport total = totalOf(report);
+    fprintf(file, "time report for %s%s\n", unit, report->cached ? " (cached)" : "");
+    fprintf(file, "%-12s %10s %6s %10s %6s %10s %12s %10s\n", "phase", "wall ms", "%", "cpu ms", "%", "allocs",
+            "alloc bytes", "items");
+    for(int i = 0; i <= PHASE_COUNT; i++)
+    {
+        PhaseReport *phase = i < PHASE_COUNT ? &report->phases[i] : &total;
+        fprintf(file, "%-12s %10.3f %5.1f%% %10.3f %5.1f%% %10llu %12llu", i < PHASE_COUNT ? G_PHASE_NAMES[i] : "total",
+                phase->wallSeconds * 1e3, total.wallSeconds > 0 ? phase->wallSeconds * 100 / total.wallSeconds : 0.0,
+                phase->cpuSeconds * 1e3, total.cpuSeconds > 0 ? phase->cpuSeconds * 100 / total.cpuSeconds : 0.0,
+                phase->allocations, phase->allocatedBytes);
+        if(i < PHASE_COUNT)
+            fprintf(file, " %10llu %s\n", phase->items, G_PHASE_ITEM_UNITS[i]);
+        else
+            fprintf(file, "\n");
+    }
+    fprintf(file, "peak rss     %ld KB\n", timeReportPeakRss());
+}
+
+static void writeJsonString(FILE *file, const char *str)
+{
+    fputc('"', file);
+    for(const unsigned char *c = (const unsigned char*)str; *c; c++)
+    {
+        if(*c == '"' || *c == '\\')
+            fprintf(file, "\\%c", *c);
+        else if(*c < 0x20)
+            fprintf(file, "\\u%04x", *c);
+        else
+            fputc(*c, file);
+    }
+    fputc('"', file);
+}
+
+static void writeJsonPhase(FILE *file, PhaseReport *phase)
+{
+    fprintf(file, "{\"wallMs\": %.3f, \"cpuMs\": %.3f, \"allocations\": %llu, \"allocatedBytes\": %llu",
+            phase->wallSeconds * 1e3, phase->cpuSeconds * 1e3, phase->allocations, phase->allocatedBytes);
+}
+
+bool timeReportWriteJson(TimeReport *reports, const char **units, int count, FILE *file)
+{
+    fprintf(file, "{\n  \"version\": 1,\n  \"peakRssKb\": %ld,\n  \"units\": [", timeReportPeakRss());
+    for(int u = 0; u < count; u++)
+    {
+        TimeReport *report = &reports[u];
+        fprintf(file, "%s\n    {\"file\": ", u ? "," : "");
+        writeJsonString(file, units[u]);
+        fprintf(file, ", \"cached\": %s,\n     \"phases\": {", report->cached ? "true" : "false");
+        for(int i = 0; i < PHASE_COUNT; i++)
+        {
+            fprintf(file, "%s\n       \"%s\": ", i ? "," : "", G_PHASE_NAMES[i]);
+            writeJsonPhase(file, &report->phases[i]);
+            fprintf(file, ", \"items\": %llu, \"itemUnit\": \"%s\"}", report->phases[i].items, G_PHASE_ITEM_UNITS[i]);
+        }
+        PhaseReport total = totalOf(report);
+        fprintf(file, "},\n     \"total\": ");
+        writeJsonPhase(file, &total);
+        fprintf(file, "}}");
+    }
+    fprintf(file, "\n  ]\n}\n");
+    return !ferror(file);
+}
@@ -0,0 +1,60 @@
+#ifndef CCOMPILER_TIMEREPORT_H
+#define CCOMPILER_TIMEREPORT_H
+#include <stdio.h>
+#include <stdbool.h>
+#include "alloc.h"
+
+typedef enum
+{
+    PHASE_READ,
+    PHASE_TOKENIZE,
+    PHASE_PREPROCESS,
+    PHASE_PARSE,
+    PHASE_OPTIMIZE,
+    PHASE_CODEGEN,
+    PHASE_EMIT,
+    PHASE_COUNT
+} CompilePhase;
+
+typedef struct
+{
+    double wallSeconds;
+    double cpuSeconds;
+    unsigned long long allocations;
+    unsigned long long allocatedBytes;
+    //What the phase produced, counted in G_PHASE_ITEM_UNITS
+    unsigned long long items;
+} PhaseReport;
+
+/*
+Where the time of one compilation went. A phase may be entered several times, optimize and codegen run once per
+function, and its figures add up. CPU time is that of the calling thread and allocations are counted per thread, so
+reports of jobs running side by side do not mix.
+*/
+typedef struct
+{
+    PhaseReport phases[PHASE_COUNT];
+    //Output came from the compile cache, so the later phases did not run
+    bool cached;
+    CompilePhase current;
+    double wallStart;
+    double cpuStart;
+    AllocationCounters allocationStart;
+} TimeReport;
+
+extern const char *G_PHASE_NAMES[];
+extern const char *G_PHASE_ITEM_UNITS[];
+
+//Both do nothing for a NULL report, so call sites need no checks
+extern void timeReportBegin(TimeReport *report, CompilePhase phase);
+extern void timeReportEnd(TimeReport *report, unsigned long long items);
+//Adds the phases of a report kept by another thread, such as one per function compiled in parallel. Their wall
+//times add up too, so for work done side by side they measure effort rather than elapsed time.
+extern void timeReportMerge(TimeReport *report, const TimeReport *from);
+//Peak resident set size of the whole process in kilobytes
+extern long timeReportPeakRss(void);
+extern void timeReportPrint(TimeReport *report, const char *unit, FILE *file);
+//One JSON document covering every unit of the run
+extern bool timeReportWriteJson(TimeReport *reports, const char **units, int count, FILE *file);
+
+#endif //CCOMPILER_TIMEREPORT_H
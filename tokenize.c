@@ -3,6 +3,8 @@
 #include <string.h>
 #include <ctype.h>
 #include "tokenize.h"
+#include "vec.h"
+#include "alloc.h"
 
 const int G_STORAGE_CLASS_SPECIFIERS_COUNT = 6;
 const char *G_STORAGE_CLASS_SPECIFIERS[] = {
@@ -86,7 +88,7 @@ const char* G_PUNCTUATORS[] = {
         "/",
         "%",
         "<",
-        "<",
+        ">",
         "^",
         "|",
         "?",
@@ -131,33 +133,32 @@ bool isIdentifierCharacter(char c, bool first)
     return false;
 }
 
-void tokenVectorCreate(TokenVector *vector)
+void tokenVectorCreate(TokenVector *vector, Allocator *allocator)
 {
     TokenVector tv = {0};
+    tv.allocator = allocator;
     tv.capacity = 100;
-    tv.tokens = (Token*)malloc(sizeof(Token) * tv.capacity);
+    tv.tokens = (Token*)allocatorAllocate(allocator, sizeof(Token) * tv.capacity);
     *vector = tv;
 }
 
 void tokenVectorDispose(TokenVector *vector)
 {
-    free(vector->tokens);
+    allocatorRelease(vector->allocator, vector->tokens);
 }
 
-static void tokenVectorPush(TokenVector *vector, const Token *token)
+void tokenVectorPush(TokenVector *vector, const Token *token)
 {
-    if(vector->length >= vector->capacity)
-    {
-        Token *newArray = (Token*)malloc(sizeof(Token) * vector->capacity * 2 + sizeof(Token));
-        memcpy(newArray, vector->tokens, sizeof(Token) * vector->capacity);
-        free(vector->tokens);
-        vector->tokens = newArray;
-        vector->capacity = vector->capacity * 2 + 1;
-    }
+    vecReserveFrom(vector->allocator, vector->tokens, vector->capacity, vector->length + 1);
     vector->tokens[vector->length] = *token;
     vector->length++;
 }
 
+void tokenVectorReserve(TokenVector *vector, int capacity)
+{
+    vecReserveFrom(vector->allocator, vector->tokens, vector->capacity, capacity);
+}
+
 //Checks if str (NULL TERMINATED) starts with any one of the strings in strArray.
 //Returns the string that matched if it is found, NULL otherwise.
 static const char *startsWithOneOf(char *str, const char *strArray[], size_t strArrayLength)
@@ -240,6 +241,7 @@ static int charLiteralLength(const char *fileBuffer, int fileBufferOffset, int f
     return length;
 }
 
+//Lexes a preprocessing number, so hexadecimal literals and suffixes stay part of the literal
 static int intLiteralLength(const char *fileBuffer, int fileBufferOffset, int fileBufferLength)
 {
     char c = *(fileBuffer + fileBufferOffset);
@@ -249,7 +251,7 @@ static int intLiteralLength(const char *fileBuffer, int fileBufferOffset, int fi
     while(fileBufferOffset < fileBufferLength)
     {
         c = *(fileBuffer + fileBufferOffset);
-        if(!isdigit(c))
+        if(!isalnum(c) && c != '_')
             return length;
         length++;
         fileBufferOffset++;
@@ -257,6 +259,89 @@ static int intLiteralLength(const char *fileBuffer, int fileBufferOffset, int fi
     return length;
 }
 
+//Skips whitespace and comments, or returns -1 at a newline escape, which only the main loop handles
+static int skipBlank(const char *fileBuffer, int fileBufferOffset, int fileBufferLength)
+{
+    while(fileBufferOffset < fileBufferLength)
+    {
+        const char *c = fileBuffer + fileBufferOffset;
+        char next = fileBufferOffset + 1 < fileBufferLength ? c[1] : 0;
+        if(isspace(*c))
+            fileBufferOffset++;
+        else if(*c == '/' && next == '/')
+        {
+            const char *lineEnd = memchr(c, '\n', fileBufferLength - fileBufferOffset);
+            fileBufferOffset = lineEnd ? (int)(lineEnd - fileBuffer) : fileBufferLength;
+        }
+        else if(*c == '/' && next == '*')
+        {
+            const char *bufferEnd = fileBuffer + fileBufferLength;
+            const char *star = c + 2;
+            while((star = memchr(star, '*', bufferEnd - star)) && !(star + 1 < bufferEnd && star[1] == '/'))
+                star++;
+            if(!star) return -1;
+            fileBufferOffset = (int)(star - fileBuffer) + 2;
+        }
+        else if(*c == '\\')
+            return -1;
+        else
+            break;
+    }
+    return fileBufferOffset;
+}
+
+//Length of the TT_INITIALIZER_LIST starting at the '{' at fileBufferOffset, or 0 if the braces hold anything but
+//integer literals with an optional sign, separated by commas. One scan of the bytes replaces the token per value
+//and per comma that large tables would otherwise cost.
+static int initializerListLength(const char *fileBuffer, int fileBufferOffset, int fileBufferLength)
+{
+    int offset = fileBufferOffset + 1;
+    int valueCount = 0;
+    while(true)
+    {
+        offset = skipBlank(fileBuffer, offset, fileBufferLength);
+        if(offset < 0 || offset >= fileBufferLength) return 0;
+        if(fileBuffer[offset] == '}')
+            return valueCount ? offset + 1 - fileBufferOffset : 0;
+        if(fileBuffer[offset] == '-' || fileBuffer[offset] == '+')
+            offset++;
+        if(offset >= fileBufferLength || !isdigit(fileBuffer[offset])) return 0;
+        while(offset < fileBufferLength && (isalnum(fileBuffer[offset]) || fileBuffer[offset] == '_'))
+            offset++;
+        valueCount++;
+        offset = skipBlank(fileBuffer, offset, fileBufferLength);
+        if(offset < 0 || offset >= fileBufferLength) return 0;
+        if(fileBuffer[offset] == ',')
+            offset++;
+        else if(fileBuffer[offset] != '}')
+            return 0;
+    }
+}
+
+bool initializerListNext(const Token *token, int *offset, long long *value)
+{
+    const char *text = token->tokenStr;
+    int position = *offset ? *offset : 1;
+    while(position < token->tokenStrLength)
+    {
+        position = skipBlank(text, position, token->tokenStrLength);
+        if(position < 0 || text[position] != ',') break;
+        position++;
+    }
+    if(position < 0 || position >= token->tokenStrLength || text[position] == '}') return false;
+    bool negative = text[position] == '-';
+    if(text[position] == '-' || text[position] == '+')
+        position++;
+    *value = strtoll(text + position, NULL, 0);
+    if(negative)
+        *value = -*value;
+    //Suffixes are not part of the value
+    while(position < token->tokenStrLength && (isalnum(text[position]) || text[position] == '_'))
+        position++;
+    *offset = position;
+    return true;
+}
+
 static int identifierLength(const char *fileBuffer, int fileBufferOffset, int fileBufferLength)
 {
     int length = 0;
@@ -281,21 +366,50 @@ static int identifierLength(const char *fileBuffer, int fileBufferOffset, int fi
     return length;
 }
 
-void tokenize(TokenVector *vector, char* fileBuffer, int fileBufferLength)
+bool tokenize(TokenVector *vector, char* fileBuffer, int fileBufferLength, const char *path, FILE *log)
 {
     int fileBufferOffset = 0;
-    int fileLineCount = 1;
+    bool atLineStart = true;
+    //C source averages a token every six bytes or so, which saves most of the regrowth on large files
+    tokenVectorReserve(vector, vector->length + fileBufferLength / 6 + 1);
     while(fileBufferOffset < fileBufferLength)
     {
         char *tokenStrPtr = fileBuffer + fileBufferOffset;
-        if(*tokenStrPtr == '\n') fileLineCount++;
+        char next = fileBufferOffset + 1 < fileBufferLength ? tokenStrPtr[1] : 0;
+        //Lines are only tracked as far as directives need them, numbers come from a LineIndex on demand
         if(isspace(*tokenStrPtr))
         {
+            if(*tokenStrPtr == '\n')
+                atLineStart = true;
             fileBufferOffset++;
             continue;
         }
+        //A backslash before the newline continues the logical line
+        if(*tokenStrPtr == '\\' && (next == '\n' || (next == '\r' && fileBufferOffset + 2 < fileBufferLength &&
+                                                      tokenStrPtr[2] == '\n')))
+        {
+            fileBufferOffset += next == '\n' ? 2 : 3;
+            continue;
+        }
+        if(*tokenStrPtr == '/' && next == '/')
+        {
+            const char *lineEnd = memchr(tokenStrPtr, '\n', fileBufferLength - fileBufferOffset);
+            fileBufferOffset = lineEnd ? (int)(lineEnd - fileBuffer) : fileBufferLength;
+            continue;
+        }
+        //Block comments count as a single space, so they never start a new logical line
+        if(*tokenStrPtr == '/' && next == '*')
+        {
+            const char *bufferEnd = fileBuffer + fileBufferLength;
+            const char *star = tokenStrPtr + 2;
+            while((star = memchr(star, '*', bufferEnd - star)) && !(star + 1 < bufferEnd && star[1] == '/'))
+                star++;
+            fileBufferOffset = star ? (int)(star - fileBuffer) + 2 : fileBufferLength;
+            continue;
+        }
         Token token = {0};
-        token.fileRow = fileLineCount;
+        token.startsLine = atLineStart;
+        atLineStart = false;
         const char *matchedStr = startsWithOneOf(tokenStrPtr, G_STORAGE_CLASS_SPECIFIERS, G_STORAGE_CLASS_SPECIFIERS_COUNT);
         if(matchedStr)
         {
@@ -376,6 +490,22 @@ void tokenize(TokenVector *vector, char* fileBuffer, int fileBufferLength)
             }
         }
 
+        if(*tokenStrPtr == '{' && vector->length && vector->tokens[vector->length - 1].tokenStrLength == 1 &&
+           *vector->tokens[vector->length - 1].tokenStr == '=')
+        {
+            int listLength = initializerListLength(fileBuffer, fileBufferOffset, fileBufferLength);
+            if(listLength)
+            {
+                token.tokenStr = tokenStrPtr;
+                token.tokenStrLength = listLength;
+                token.tokenType = TT_INITIALIZER_LIST;
+
+                fileBufferOffset += listLength;
+                tokenVectorPush(vector, &token);
+                continue;
+            }
+        }
+
         matchedStr = startsWithOneOf(tokenStrPtr, G_PUNCTUATORS, G_PUNCTUATORS_COUNT);
         if(matchedStr)
         {
@@ -393,13 +523,16 @@ void tokenize(TokenVector *vector, char* fileBuffer, int fileBufferLength)
         if(matchedStr)
         {
             int matchedStrLength = (int)strlen(matchedStr);
-            token.tokenStr = tokenStrPtr;
-            token.tokenStrLength = matchedStrLength;
-            token.tokenType = TT_KEYWORD;
+            if(fileBufferOffset + matchedStrLength >= fileBufferLength || !isIdentifierCharacter(*(tokenStrPtr + matchedStrLength), false))
+            {
+                token.tokenStr = tokenStrPtr;
+                token.tokenStrLength = matchedStrLength;
+                token.tokenType = TT_KEYWORD;
 
-            fileBufferOffset += matchedStrLength;
-            tokenVectorPush(vector, &token);
-            continue;
+                fileBufferOffset += matchedStrLength;
+                tokenVectorPush(vector, &token);
+                continue;
+            }
         }
 
         int foundLength = stringLiteralLength(fileBuffer, fileBufferOffset, fileBufferLength);
@@ -450,9 +583,60 @@ void tokenize(TokenVector *vector, char* fileBuffer, int fileBufferLength)
             continue;
         }
 
-        printf("Unable to parse token on line %i\n", fileLineCount);
-        return;
+        if(log)
+        {
+            LineIndex lines;
+            int line;
+            int column;
+            lineIndexBuild(&lines, fileBuffer, fileBufferLength);
+            lineIndexLocate(&lines, fileBufferOffset, &line, &column);
+            lineIndexDispose(&lines);
+            fprintf(log, "%s:%d:%d: Unable to parse token\n", path, line, column);
+        }
+        return false;
+    }
+    return true;
+}
+
+void lineIndexBuild(LineIndex *index, const char *buffer, int length)
+{
+    index->lineStarts = NULL;
+    index->lineCount = 0;
+    index->capacity = 0;
+    vecReserve(index->lineStarts, index->capacity, length / 32 + 1);
+    index->lineStarts[index->lineCount++] = 0;
+    //memchr is vectorized by the C library, which beats testing the buffer a byte at a time
+    const char *end = buffer + length;
+    for(const char *newline = buffer; (newline = memchr(newline, '\n', end - newline)); newline++)
+    {
+        vecReserve(index->lineStarts, index->capacity, index->lineCount + 1);
+        index->lineStarts[index->lineCount++] = (int)(newline - buffer) + 1;
+    }
+}
+
+void lineIndexDispose(LineIndex *index)
+{
+    free(index->lineStarts);
+    index->lineStarts = NULL;
+    index->lineCount = 0;
+    index->capacity = 0;
+}
+
+void lineIndexLocate(const LineIndex *index, int offset, int *line, int *column)
+{
+    //Last line that starts at or before offset
+    int low = 0;
+    int high = index->lineCount - 1;
+    while(low < high)
+    {
+        int middle = (low + high + 1) / 2;
+        if(index->lineStarts[middle] <= offset)
+            low = middle;
+        else
+            high = middle - 1;
     }
+    *line = low + 1;
+    *column = offset - index->lineStarts[low] + 1;
 }
 
 Token *tokenVectorAt(TokenVector *tv, int index)
@@ -1,5 +1,6 @@
 #ifndef CCOMPILER_TOKENIZE_H
 #define CCOMPILER_TOKENIZE_H
+#include <stdio.h>
 #include <stdbool.h>
 
 typedef enum
@@ -15,7 +16,10 @@ typedef enum
     TT_FUNC_SPECIFIER,
     TT_ALIGNMENT_SPECIFIER,
     TT_PUNCTUATOR,
-    TT_KEYWORD
+    TT_KEYWORD,
+    //A whole braced initializer of integer literals after '=', from '{' to '}'. Tables of literals become a single
+    //token instead of one per value and comma, the parser reads the values out of its text.
+    TT_INITIALIZER_LIST
 } TokenType;
 
 typedef struct
@@ -23,22 +27,50 @@ typedef struct
     char *tokenStr;
     int tokenStrLength;
     TokenType tokenType;
-    int fileRow;
+    //First token on its logical line, preprocessing directives start with such a '#'
+    bool startsLine;
 } Token;
 
+//See alloc.h
+typedef struct Allocator Allocator;
+
+//A zero initialized vector is empty and on the heap
 typedef struct
 {
     Token *tokens;
     int length;
     int capacity;
+    Allocator *allocator;
 } TokenVector;
 
-extern void tokenVectorCreate(TokenVector *vector);
+//allocator is NULL for the heap
+extern void tokenVectorCreate(TokenVector *vector, Allocator *allocator);
 extern void tokenVectorDispose(TokenVector *vector);
 extern Token *tokenVectorAt(TokenVector *tv, int index);
+extern void tokenVectorPush(TokenVector *vector, const Token *token);
+//Makes room for capacity tokens in total
+extern void tokenVectorReserve(TokenVector *vector, int capacity);
 
 extern bool isIdentifierCharacter(char c, bool first);
-extern void tokenize(TokenVector *vector, char* fileBuffer, int fileBufferLength);
+//Reads the value of a TT_INITIALIZER_LIST at *offset into its text, 0 for the first one, and advances *offset past
+//it. Returns false once there are no more.
+extern bool initializerListNext(const Token *token, int *offset, long long *value);
+//Tokens carry no line numbers, a LineIndex of the buffer recovers them when a diagnostic needs one. Stops at the
+//first character that starts no token and reports where it is to log, as a location in path, unless log is NULL.
+extern bool tokenize(TokenVector *vector, char* fileBuffer, int fileBufferLength, const char *path, FILE *log);
+
+//Offsets where the lines of a buffer start
+typedef struct
+{
+    int *lineStarts;
+    int lineCount;
+    int capacity;
+} LineIndex;
+
+extern void lineIndexBuild(LineIndex *index, const char *buffer, int length);
+extern void lineIndexDispose(LineIndex *index);
+//Line and column, both counted from 1, of the byte at offset
+extern void lineIndexLocate(const LineIndex *index, int offset, int *line, int *column);
 
 extern const int G_STORAGE_CLASS_SPECIFIERS_COUNT;
 extern const char *G_STORAGE_CLASS_SPECIFIERS[];
@@ -1,42 +1,278 @@
 #ifndef CCOMPILER_VEC_H
 #define CCOMPILER_VEC_H
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
 
+/*
+Containers generated per element type. The Declare macros belong in a header or at the top of a source file, the
+Define macros in exactly one source file, after alloc.h, whose allocator and counted allocation functions they
+expand to.
+*/
+
+#define VEC_MINIMUM_CAPACITY 8
+
+//Defined in alloc.h. NULL allocators are the heap.
+typedef struct Allocator Allocator;
+
+//Makes room for required elements in data, an array from allocator with room for capacity. The capacity at least
+//doubles, so repeated pushes stay amortized constant time, and realloc can often extend the block without copying it.
+#define vecReserveFrom(allocator, data, capacity, required) \
+do \
+{ \
+    if((required) > (capacity)) \
+    { \
+        int vecNewCapacity = (capacity) ? (capacity) * 2 : VEC_MINIMUM_CAPACITY; \
+        if(vecNewCapacity < (required)) vecNewCapacity = (required); \
+        (data) = allocatorReallocate((allocator), (data), sizeof(*(data)) * (size_t)(capacity), \
+                                     sizeof(*(data)) * (size_t)vecNewCapacity); \
+        (capacity) = vecNewCapacity; \
+    } \
+} while(0)
+
+//vecReserveFrom for an array on the heap
+#define vecReserve(data, capacity, required) vecReserveFrom(NULL, data, capacity, required)
+
+//FNV-1a, for hash map keys that are strings or spellings of tokens
+static inline uint32_t vecHashBytes(const char *bytes, int length)
+{
+    uint32_t hash = 2166136261u;
+    for(int i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+//Growable array. A zero initialized list is empty, valid and on the heap.
 #define listDeclare(type, name) \
 typedef struct                  \
 {                               \
     int length;                 \
     int capacity;               \
     type *data;                 \
+    Allocator *allocator;       \
 } name;                         \
 extern void listPush##name( name *list, type value); \
 extern type *listAt##name( name *list, int index); \
-extern name listInit##name( int capacity); \
+extern name listInit##name( Allocator *allocator, int capacity); \
+extern void listReserve##name( name *list, int capacity); \
+extern type listPop##name( name *list); \
+extern void listClear##name( name *list); \
+extern void listFree##name( name *list); \
 
 #define listDefine(type, name) \
 void listPush##name( name *list, type value) \
 { \
-    if(list->length == list->capacity) \
-    { \
-        type *newArray = malloc(sizeof(type) * (list->capacity * 2 + 1)); \
-        memcpy(newArray, list->data, sizeof(type) * list->capacity); \
-        free(list->data); \
-        list->data = newArray; \
-        list->capacity = list->capacity * 2 + 1; \
-    } \
+    vecReserveFrom(list->allocator, list->data, list->capacity, list->length + 1); \
     list->data[list->length] = value; \
     list->length++; \
 }                              \
 type *listAt##name( name *list, int index)    \
 {                              \
-    if(index >= list->length) return NULL;   \
+    if(index < 0 || index >= list->length) return NULL;   \
     return &list->data[index];                               \
 } \
-name listInit##name( int capacity) \
+name listInit##name( Allocator *allocator, int capacity) \
 { \
     name list = {0}; \
-    list.capacity = capacity; \
-    list.data = malloc(sizeof(type) * capacity);  \
+    list.allocator = allocator; \
+    vecReserveFrom(list.allocator, list.data, list.capacity, capacity); \
     return list; \
+} \
+void listReserve##name( name *list, int capacity) \
+{ \
+    vecReserveFrom(list->allocator, list->data, list->capacity, capacity); \
+} \
+/*The list must not be empty*/ \
+type listPop##name( name *list) \
+{ \
+    return list->data[--list->length]; \
+} \
+/*Keeps the array for reuse*/ \
+void listClear##name( name *list) \
+{ \
+    list->length = 0; \
+} \
+void listFree##name( name *list) \
+{ \
+    allocatorRelease(list->allocator, list->data); \
+    list->data = NULL; \
+    list->length = 0; \
+    list->capacity = 0; \
+}
+
+//Growable array whose first inlineCount elements live inside the struct, so short lists never touch allocator.
+//data points into the struct until it spills, so a small list must not be copied or moved once initialized.
+#define smallListDeclare(type, name, inlineCount) \
+typedef struct \
+{ \
+    int length; \
+    int capacity; \
+    type *data; \
+    Allocator *allocator; \
+    type inlineData[inlineCount]; \
+} name; \
+extern void smallListInit##name( name *list, Allocator *allocator); \
+extern void smallListPush##name( name *list, type value); \
+extern type smallListPop##name( name *list); \
+extern void smallListFree##name( name *list); \
+
+#define smallListDefine(type, name) \
+void smallListInit##name( name *list, Allocator *allocator) \
+{ \
+    list->length = 0; \
+    list->capacity = (int)(sizeof(list->inlineData) / sizeof(type)); \
+    list->data = list->inlineData; \
+    list->allocator = allocator; \
+} \
+void smallListPush##name( name *list, type value) \
+{ \
+    if(list->length == list->capacity) \
+    { \
+        int capacity = list->capacity * 2; \
+        bool spilled = list->data != list->inlineData; \
+        type *data = allocatorReallocate(list->allocator, spilled ? list->data : NULL, \
+                                         spilled ? sizeof(type) * (size_t)list->capacity : 0, \
+                                         sizeof(type) * (size_t)capacity); \
+        if(!spilled) \
+            memcpy(data, list->inlineData, sizeof(list->inlineData)); \
+        list->data = data; \
+        list->capacity = capacity; \
+    } \
+    list->data[list->length++] = value; \
+} \
+/*The list must not be empty*/ \
+type smallListPop##name( name *list) \
+{ \
+    return list->data[--list->length]; \
+} \
+void smallListFree##name( name *list) \
+{ \
+    if(list->data != list->inlineData) \
+        allocatorRelease(list->allocator, list->data); \
+    smallListInit##name(list, list->allocator); \
+}
+
+/*
+Hash map with open addressing and linear probing. The table is a power of two in size and at most half full, so
+probe sequences stay short, and entries are stored in the table itself rather than in separately allocated nodes.
+hashFunction(key) returns a uint32_t, equalsFunction(a, b) a bool. Pointers into the map are invalidated by the
+next insertion or removal.
+*/
+#define hashMapDeclare(keyType, valueType, name) \
+typedef struct \
+{ \
+    keyType key; \
+    valueType value; \
+    bool used; \
+} name##Entry; \
+typedef struct \
+{ \
+    name##Entry *entries; \
+    int capacity; \
+    int count; \
+} name; \
+extern void hashMapInit##name( name *map, int capacity); \
+extern void hashMapFree##name( name *map); \
+extern void hashMapClear##name( name *map); \
+extern valueType *hashMapFind##name( name *map, keyType key); \
+extern valueType *hashMapInsert##name( name *map, keyType key, valueType value); \
+extern bool hashMapRemove##name( name *map, keyType key); \
+
+#define hashMapDefine(keyType, valueType, name, hashFunction, equalsFunction) \
+/*Slot holding key, or the empty slot where it would go*/ \
+static int hashMapSlot##name( name##Entry *entries, int capacity, keyType key) \
+{ \
+    int mask = capacity - 1; \
+    int slot = (int)(hashFunction(key) & (uint32_t)mask); \
+    while(entries[slot].used && !equalsFunction(entries[slot].key, key)) \
+        slot = (slot + 1) & mask; \
+    return slot; \
+} \
+/*capacity is rounded up to a power of two*/ \
+void hashMapInit##name( name *map, int capacity) \
+{ \
+    int size = VEC_MINIMUM_CAPACITY; \
+    while(size < capacity * 2) \
+        size *= 2; \
+    map->entries = countedCalloc(size, sizeof(name##Entry)); \
+    map->capacity = size; \
+    map->count = 0; \
+} \
+void hashMapFree##name( name *map) \
+{ \
+    free(map->entries); \
+    map->entries = NULL; \
+    map->capacity = 0; \
+    map->count = 0; \
+} \
+/*Keeps the table for reuse*/ \
+void hashMapClear##name( name *map) \
+{ \
+    if(map->count) \
+        memset(map->entries, 0, sizeof(name##Entry) * map->capacity); \
+    map->count = 0; \
+} \
+valueType *hashMapFind##name( name *map, keyType key) \
+{ \
+    if(!map->count) return NULL; \
+    int slot = hashMapSlot##name(map->entries, map->capacity, key); \
+    return map->entries[slot].used ? &map->entries[slot].value : NULL; \
+} \
+/*Replaces the value if the key is present already*/ \
+valueType *hashMapInsert##name( name *map, keyType key, valueType value) \
+{ \
+    if(!map->entries) \
+        hashMapInit##name(map, 0); \
+    if((map->count + 1) * 2 > map->capacity) \
+    { \
+        int capacity = map->capacity * 2; \
+        name##Entry *entries = countedCalloc(capacity, sizeof(name##Entry)); \
+        for(int i = 0; i < map->capacity; i++) \
+        { \
+            if(map->entries[i].used) \
+                entries[hashMapSlot##name(entries, capacity, map->entries[i].key)] = map->entries[i]; \
+        } \
+        free(map->entries); \
+        map->entries = entries; \
+        map->capacity = capacity; \
+    } \
+    int slot = hashMapSlot##name(map->entries, map->capacity, key); \
+    if(!map->entries[slot].used) \
+    { \
+        map->entries[slot].used = true; \
+        map->entries[slot].key = key; \
+        map->count++; \
+    } \
+    map->entries[slot].value = value; \
+    return &map->entries[slot].value; \
+} \
+/*Shifts the rest of the probe run back instead of leaving a tombstone, so lookups never slow down*/ \
+bool hashMapRemove##name( name *map, keyType key) \
+{ \
+    if(!map->count) return false; \
+    int mask = map->capacity - 1; \
+    int slot = hashMapSlot##name(map->entries, map->capacity, key); \
+    if(!map->entries[slot].used) return false; \
+    int next = slot; \
+    while(true) \
+    { \
+        next = (next + 1) & mask; \
+        if(!map->entries[next].used) break; \
+        int home = (int)(hashFunction(map->entries[next].key) & (uint32_t)mask); \
+        /*The entry may move into the hole only if the hole lies on its probe path*/ \
+        if(((next - home) & mask) >= ((next - slot) & mask)) \
+        { \
+            map->entries[slot] = map->entries[next]; \
+            slot = next; \
+        } \
+    } \
+    map->entries[slot].used = false; \
+    map->count--; \
+    return true; \
 }
+
 #endif //CCOMPILER_VEC_H